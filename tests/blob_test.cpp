@@ -0,0 +1,239 @@
+#include "blob.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// known answers for the primitives, then blobs round tripped and tampered with
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++s_failures; \
+        } \
+    } while (0)
+
+static blob::Key testKey(uint8_t first)
+{
+    blob::Key key;
+    for (int i = 0; i < 32; ++i)
+        key.bytes[i] = (uint8_t)(first + i);
+    return key;
+}
+
+static void testCrc32c()
+{
+    const char* check = "123456789";
+    CHECK(blob::crc32c(check, strlen(check)) == 0xE3069283);
+    CHECK(blob::crc32c(nullptr, 0) == 0);
+
+    // chaining over pieces gives the same as one call, whatever the alignment of the split
+    unsigned char data[1000];
+    for (size_t i = 0; i < sizeof(data); ++i)
+        data[i] = (unsigned char)(i * 31 + 7);
+    const uint32_t whole = blob::crc32c(data, sizeof(data));
+    for (size_t split : { (size_t)1, (size_t)7, (size_t)64, (size_t)999 })
+        CHECK(blob::crc32c(data + split, sizeof(data) - split, blob::crc32c(data, split)) == whole);
+}
+
+// RFC 8439 section 2.8.2
+static void testAead()
+{
+    const blob::Key key = testKey(0x80);
+    const uint8_t nonce[12] = { 0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47 };
+    const uint8_t aad[12] = { 0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7 };
+    const char* plaintext = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, "
+                            "sunscreen would be it.";
+    const uint8_t ciphertext[] = {
+        0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb, 0x7b, 0x86, 0xaf, 0xbc, 0x53, 0xef, 0x7e, 0xc2,
+        0xa4, 0xad, 0xed, 0x51, 0x29, 0x6e, 0x08, 0xfe, 0xa9, 0xe2, 0xb5, 0xa7, 0x36, 0xee, 0x62, 0xd6,
+        0x3d, 0xbe, 0xa4, 0x5e, 0x8c, 0xa9, 0x67, 0x12, 0x82, 0xfa, 0xfb, 0x69, 0xda, 0x92, 0x72, 0x8b,
+        0x1a, 0x71, 0xde, 0x0a, 0x9e, 0x06, 0x0b, 0x29, 0x05, 0xd6, 0xa5, 0xb6, 0x7e, 0xcd, 0x3b, 0x36,
+        0x92, 0xdd, 0xbd, 0x7f, 0x2d, 0x77, 0x8b, 0x8c, 0x98, 0x03, 0xae, 0xe3, 0x28, 0x09, 0x1b, 0x58,
+        0xfa, 0xb3, 0x24, 0xe4, 0xfa, 0xd6, 0x75, 0x94, 0x55, 0x85, 0x80, 0x8b, 0x48, 0x31, 0xd7, 0xbc,
+        0x3f, 0xf4, 0xde, 0xf0, 0x8e, 0x4b, 0x7a, 0x9d, 0xe5, 0x76, 0xd2, 0x65, 0x86, 0xce, 0xc6, 0x4b,
+        0x61, 0x16,
+    };
+    const uint8_t tag[blob::TAG_SIZE] = {
+        0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a, 0x7e, 0x90, 0x2e, 0xcb, 0xd0, 0x60, 0x06, 0x91,
+    };
+    const size_t size = strlen(plaintext);
+    CHECK(size == sizeof(ciphertext));
+
+    uint8_t sealed[sizeof(ciphertext)];
+    uint8_t sealedTag[blob::TAG_SIZE];
+    blob::seal(key, nonce, aad, sizeof(aad), plaintext, size, sealed, sealedTag);
+    CHECK(memcmp(sealed, ciphertext, sizeof(ciphertext)) == 0);
+    CHECK(memcmp(sealedTag, tag, sizeof(tag)) == 0);
+
+    uint8_t opened[sizeof(ciphertext)];
+    CHECK(blob::open(key, nonce, aad, sizeof(aad), ciphertext, sizeof(ciphertext), tag, opened));
+    CHECK(memcmp(opened, plaintext, size) == 0);
+
+    // in place works the same
+    memcpy(opened, plaintext, size);
+    blob::seal(key, nonce, aad, sizeof(aad), opened, size, opened, sealedTag);
+    CHECK(memcmp(opened, ciphertext, sizeof(ciphertext)) == 0);
+
+    // any change to the ciphertext, associated data or tag is refused, and nothing is written
+    uint8_t damaged[sizeof(ciphertext)];
+    memcpy(damaged, ciphertext, sizeof(ciphertext));
+    damaged[40] ^= 1;
+    memset(opened, 0, sizeof(opened));
+    CHECK(!blob::open(key, nonce, aad, sizeof(aad), damaged, sizeof(damaged), tag, opened));
+    CHECK(opened[0] == 0);
+
+    uint8_t damagedAad[sizeof(aad)];
+    memcpy(damagedAad, aad, sizeof(aad));
+    damagedAad[0] ^= 0x80;
+    CHECK(!blob::open(key, nonce, damagedAad, sizeof(damagedAad), ciphertext, sizeof(ciphertext), tag, opened));
+
+    uint8_t damagedTag[blob::TAG_SIZE];
+    memcpy(damagedTag, tag, sizeof(tag));
+    damagedTag[15] ^= 1;
+    CHECK(!blob::open(key, nonce, aad, sizeof(aad), ciphertext, sizeof(ciphertext), damagedTag, opened));
+}
+
+static bool roundTrips(const std::vector<unsigned char>& data, const blob::Options& options, size_t* encodedSize = nullptr)
+{
+    std::vector<unsigned char> encoded = blob::encode(data.data(), data.size(), options);
+    if (encodedSize)
+        *encodedSize = encoded.size();
+
+    std::vector<unsigned char> decoded;
+    const char* reason = nullptr;
+    if (!blob::decode(encoded.data(), encoded.size(), decoded, options.key, &reason))
+    {
+        fprintf(stderr, "decode failed: %s\n", reason);
+        return false;
+    }
+    return decoded == data;
+}
+
+static void testRoundTrip()
+{
+    const blob::Key key = testKey(1);
+
+    blob::Options compressed;
+    blob::Options stored;
+    stored.compress = false;
+    blob::Options sealed;
+    sealed.key = &key;
+    blob::Options smallBlocks;
+    smallBlocks.blockSize = 256;
+
+    // empty input still makes a valid blob, which decodes back to nothing
+    const std::vector<unsigned char> empty;
+    CHECK(roundTrips(empty, compressed));
+    CHECK(roundTrips(empty, stored));
+    CHECK(roundTrips(empty, sealed));
+
+    const std::vector<unsigned char> tiny = { 42 };
+    CHECK(roundTrips(tiny, compressed));
+    CHECK(roundTrips(tiny, sealed));
+
+    // repetitive data compresses, noise is stored raw block by block, and both come back exact
+    std::vector<unsigned char> text;
+    const char* line = "layout(set = 1, binding = 0) readonly buffer MaterialBuffer { vec4 tint; } materials[];\n";
+    while (text.size() < 200000)
+        text.insert(text.end(), line, line + strlen(line));
+
+    std::vector<unsigned char> noise(100000);
+    uint32_t state = 0x12345678;
+    for (auto& it : noise)
+    {
+        state = state * 1664525 + 1013904223;
+        it = (unsigned char)(state >> 24);
+    }
+
+    size_t compressedSize = 0;
+    CHECK(roundTrips(text, compressed, &compressedSize));
+    CHECK(compressedSize < text.size() / 4);
+    CHECK(roundTrips(text, smallBlocks));
+    CHECK(roundTrips(text, sealed));
+    CHECK(roundTrips(noise, compressed, &compressedSize));
+    CHECK(compressedSize < noise.size() + noise.size() / 1000 + sizeof(blob::Header) + 64);
+    CHECK(roundTrips(noise, stored));
+
+    // a mix, so blocks alternate between compressed and raw
+    std::vector<unsigned char> mixed;
+    for (int i = 0; i < 4; ++i)
+    {
+        mixed.insert(mixed.end(), text.begin(), text.begin() + 70000);
+        mixed.insert(mixed.end(), noise.begin(), noise.begin() + 70000);
+    }
+    CHECK(roundTrips(mixed, compressed));
+    CHECK(roundTrips(mixed, sealed));
+}
+
+static void testTampering()
+{
+    const blob::Key key = testKey(1);
+    const blob::Key otherKey = testKey(2);
+
+    std::vector<unsigned char> data(5000);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = (unsigned char)(i % 97);
+
+    blob::Options options;
+    options.key = &key;
+    const std::vector<unsigned char> encoded = blob::encode(data.data(), data.size(), options);
+
+    std::vector<unsigned char> out;
+    const char* reason = nullptr;
+    CHECK(blob::decode(encoded.data(), encoded.size(), out, &key, &reason));
+
+    CHECK(!blob::decode(encoded.data(), encoded.size(), out, nullptr, &reason));
+    CHECK(out.empty());
+    CHECK(!blob::decode(encoded.data(), encoded.size(), out, &otherKey, &reason));
+    CHECK(out.empty());
+
+    // a flipped bit is caught by the checksum
+    std::vector<unsigned char> flipped = encoded;
+    flipped[sizeof(blob::Header) + 10] ^= 4;
+    CHECK(!blob::decode(flipped.data(), flipped.size(), out, &key, &reason));
+    CHECK(out.empty());
+
+    // and with the checksum fixed up to match, by the tag
+    blob::Header header;
+    memcpy(&header, flipped.data(), sizeof(header));
+    header.checksum = blob::crc32c(flipped.data() + sizeof(header), flipped.size() - sizeof(header));
+    memcpy(flipped.data(), &header, sizeof(header));
+    reason = nullptr;
+    CHECK(!blob::decode(flipped.data(), flipped.size(), out, &key, &reason));
+    CHECK(reason && strcmp(reason, "authentication failed") == 0);
+    CHECK(out.empty());
+
+    // the header is authenticated too
+    std::vector<unsigned char> resized = encoded;
+    memcpy(&header, resized.data(), sizeof(header));
+    header.blockSize *= 2;
+    memcpy(resized.data(), &header, sizeof(header));
+    CHECK(!blob::decode(resized.data(), resized.size(), out, &key, &reason));
+
+    CHECK(!blob::decode(encoded.data(), encoded.size() - 1, out, &key, &reason));
+    CHECK(!blob::decode(encoded.data(), sizeof(blob::Header) - 1, out, &key, &reason));
+
+    // unsealed blobs have only the checksum, which still catches damage
+    const std::vector<unsigned char> plain = blob::encode(data.data(), data.size());
+    std::vector<unsigned char> damaged = plain;
+    damaged.back() ^= 1;
+    CHECK(!blob::decode(damaged.data(), damaged.size(), out, nullptr, &reason));
+    CHECK(out.empty());
+}
+
+int main()
+{
+    testCrc32c();
+    testAead();
+    testRoundTrip();
+    testTampering();
+
+    if (s_failures)
+        fprintf(stderr, "blob_test: %d checks failed\n", s_failures);
+    else
+        printf("blob_test: all checks passed\n");
+    return s_failures ? 1 : 0;
+}
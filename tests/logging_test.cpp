@@ -0,0 +1,146 @@
+#include "logging.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+// writes binary logs through the real logger, then checks what decodeBinary makes of them and of damaged copies
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++s_failures; \
+        } \
+    } while (0)
+
+static const char* s_logPath = "logging_test.bin";
+static const char* s_damagedPath = "logging_test_damaged.bin";
+
+static bool contains(const std::string& text, const char* s)
+{
+    return text.find(s) != std::string::npos;
+}
+
+static std::vector<unsigned char> readFile(const char* path)
+{
+    std::vector<unsigned char> data;
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return data;
+
+    int c;
+    while ((c = fgetc(file)) != EOF)
+        data.push_back((unsigned char)c);
+    fclose(file);
+    return data;
+}
+
+static void writeFile(const char* path, const unsigned char* data, size_t size)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return;
+    fwrite(data, 1, size, file);
+    fclose(file);
+}
+
+static void writeLog()
+{
+    LogConfig config;
+    config.console = false;
+    config.binaryPath = s_logPath;
+    logging::init(config);
+    logging::setLevel(LogSeverity::eDebug);
+
+    const char* name = "pipeline";
+    LOG_INFO(LogCategory::eDevice, "%s", "first");
+    LOG_WARNING(LogCategory::ePipeline, "%s compiled in %.2f ms, %u left, %d%%", name, 1.5, 3u, -7);
+    LOG_ERROR(LogCategory::eMemory, "%5s|%-5s|%x", "ab", "cd", 255u);
+
+    // a second thread's records are flushed after the first's, the decoder puts them back in order
+    std::thread other([] { LOG_DEBUG(LogCategory::eFrame, "frame %llu", 42ull); });
+    other.join();
+    LOG_INFO(LogCategory::eGeneral, "%s", "last");
+
+    logging::shutdown();
+}
+
+static void testRoundTrip()
+{
+    std::string text;
+    const char* reason = nullptr;
+    CHECK(logging::decodeBinary(s_logPath, text, &reason));
+    CHECK(reason == nullptr);
+
+    CHECK(contains(text, " I device     [0] first\n"));
+    CHECK(contains(text, " W pipeline   [0] pipeline compiled in 1.50 ms, 3 left, -7%\n"));
+    CHECK(contains(text, " E memory     [0]    ab|cd   |ff\n"));
+    CHECK(contains(text, " D frame      [1] frame 42\n"));
+
+    // timestamp order, not flush order
+    CHECK(text.find("first") < text.find("frame 42"));
+    CHECK(text.find("frame 42") < text.find("last"));
+}
+
+static void testDamage()
+{
+    const std::vector<unsigned char> data = readFile(s_logPath);
+    CHECK(data.size() > sizeof(logging::BINARY_MAGIC) + sizeof(logging::BinaryRecord));
+
+    std::string text;
+    const char* reason = nullptr;
+    CHECK(!logging::decodeBinary("logging_test_missing.bin", text, &reason));
+    CHECK(reason != nullptr);
+
+    // not a log at all
+    std::vector<unsigned char> damaged = data;
+    damaged[0] ^= 1;
+    writeFile(s_damagedPath, damaged.data(), damaged.size());
+    text.clear();
+    CHECK(!logging::decodeBinary(s_damagedPath, text, &reason));
+    CHECK(text.empty());
+
+    // cut off mid record, everything before it still decodes
+    std::string whole;
+    CHECK(logging::decodeBinary(s_logPath, whole, &reason));
+    writeFile(s_damagedPath, data.data(), data.size() - 3);
+    text.clear();
+    CHECK(!logging::decodeBinary(s_damagedPath, text, &reason));
+    CHECK(contains(text, "first"));
+    CHECK(std::count(text.begin(), text.end(), '\n') == std::count(whole.begin(), whole.end(), '\n') - 1);
+
+    // an argument claiming more bytes than its record holds is reported missing, never read past
+    logging::BinaryRecord record;
+    memcpy(&record, data.data() + sizeof(logging::BINARY_MAGIC), sizeof(record));
+    damaged = data;
+    const size_t lengthAt = sizeof(logging::BINARY_MAGIC) + sizeof(record) + record.formatLength + 1;
+    const uint32_t hugeLength = 0x7fffffff;
+    memcpy(damaged.data() + lengthAt, &hugeLength, sizeof(hugeLength));
+    writeFile(s_damagedPath, damaged.data(), damaged.size());
+    text.clear();
+    CHECK(logging::decodeBinary(s_damagedPath, text, &reason));
+    CHECK(contains(text, "[0] <missing>\n"));
+    CHECK(contains(text, "last"));
+}
+
+int main()
+{
+    writeLog();
+    testRoundTrip();
+    testDamage();
+
+    remove(s_logPath);
+    remove(s_damagedPath);
+
+    if (s_failures)
+        fprintf(stderr, "logging_test: %d checks failed\n", s_failures);
+    else
+        printf("logging_test: all checks passed\n");
+    return s_failures ? 1 : 0;
+}
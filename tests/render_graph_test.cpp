@@ -0,0 +1,301 @@
+#include "render_graph.h"
+
+#include <stdio.h>
+
+// builds graphs with no device behind them and checks what compile() and assignMemory() made of them
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++s_failures; \
+        } \
+    } while (0)
+
+static const RenderGraph::RecordFn s_noRecord = [](vk::CommandBuffer) {};
+
+static const GraphAccess s_colorWrite(vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::AccessFlagBits::eColorAttachmentWrite,
+    vk::ImageLayout::eColorAttachmentOptimal);
+static const GraphAccess s_sampled(vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eShaderRead,
+    vk::ImageLayout::eShaderReadOnlyOptimal);
+static const GraphAccess s_computeWrite(vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite);
+static const GraphAccess s_computeRead(vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead);
+static const GraphAccess s_indirectRead(vk::PipelineStageFlagBits::eDrawIndirect, vk::AccessFlagBits::eIndirectCommandRead);
+static const GraphAccess s_present(vk::PipelineStageFlagBits::eBottomOfPipe, vk::AccessFlags(), vk::ImageLayout::ePresentSrcKHR);
+
+static GraphImageDesc colorTarget()
+{
+    GraphImageDesc desc;
+    desc.format = vk::Format::eR8G8B8A8Unorm;
+    desc.extent.width = 64;
+    desc.extent.height = 64;
+    desc.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled;
+    return desc;
+}
+
+static GraphBufferDesc storageBuffer()
+{
+    GraphBufferDesc desc;
+    desc.size = 1024;
+    desc.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer;
+    return desc;
+}
+
+static vk::MemoryRequirements requirements(vk::DeviceSize size)
+{
+    vk::MemoryRequirements req;
+    req.size = size;
+    req.alignment = 256;
+    req.memoryTypeBits = 1;
+    return req;
+}
+
+static bool sharesMemory(const RenderGraph& graph, uint32_t a, uint32_t b, vk::DeviceSize sizeA, vk::DeviceSize sizeB)
+{
+    return graph.getHeap(a) == graph.getHeap(b) &&
+           graph.getHeapOffset(a) < graph.getHeapOffset(b) + sizeB && graph.getHeapOffset(b) < graph.getHeapOffset(a) + sizeA;
+}
+
+static void testCulling()
+{
+    RenderGraph graph;
+    uint32_t backbuffer = graph.importImage("backbuffer", vk::Image(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+    uint32_t albedo = graph.createImage("albedo", colorTarget());
+    uint32_t debug = graph.createImage("debug", colorTarget());
+    uint32_t first = graph.createBuffer("first", storageBuffer());
+    uint32_t second = graph.createBuffer("second", storageBuffer());
+    uint32_t readback = graph.createBuffer("readback", storageBuffer());
+    graph.exportResource(backbuffer, s_present);
+
+    graph.addPass("gbuffer", s_noRecord).write(albedo, s_colorWrite);
+    graph.addPass("debug", s_noRecord).write(debug, s_colorWrite);
+    // a chain leading nowhere goes as a whole, not just its last pass
+    graph.addPass("deadFirst", s_noRecord).write(first, s_computeWrite);
+    graph.addPass("deadSecond", s_noRecord).read(first, s_computeRead).write(second, s_computeWrite);
+    graph.addPass("readback", s_noRecord).write(readback, s_computeWrite).sideEffects();
+    graph.addPass("lighting", s_noRecord).read(albedo, s_sampled).write(backbuffer, s_colorWrite);
+    graph.compile();
+
+    CHECK(!graph.isCulled(0));
+    CHECK(graph.isCulled(1));
+    CHECK(graph.isCulled(2));
+    CHECK(graph.isCulled(3));
+    CHECK(!graph.isCulled(4));
+    CHECK(!graph.isCulled(5));
+    CHECK(graph.getStats().culledPasses == 3);
+
+    // resources only culled passes touch are never live, so get no memory
+    CHECK(graph.isLive(albedo));
+    CHECK(!graph.isLive(debug));
+    CHECK(!graph.isLive(first));
+    CHECK(!graph.isLive(second));
+    CHECK(graph.isLive(readback));
+}
+
+static void testImageBarriers()
+{
+    RenderGraph graph;
+    uint32_t backbuffer = graph.importImage("backbuffer", vk::Image(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+    uint32_t albedo = graph.createImage("albedo", colorTarget());
+    graph.exportResource(backbuffer, s_present);
+
+    graph.addPass("gbuffer", s_noRecord).write(albedo, s_colorWrite);
+    graph.addPass("lighting", s_noRecord).read(albedo, s_sampled).write(backbuffer, s_colorWrite);
+    graph.compile();
+
+    // the first use discards whatever was there, nothing to wait for
+    const GraphBarrierBatch& gbuffer = graph.getBarriers(0);
+    CHECK(gbuffer.images.size() == 1);
+    CHECK(gbuffer.images[0].resource == albedo);
+    CHECK(gbuffer.images[0].oldLayout == vk::ImageLayout::eUndefined);
+    CHECK(gbuffer.images[0].newLayout == vk::ImageLayout::eColorAttachmentOptimal);
+    CHECK(!gbuffer.images[0].srcAccess);
+    CHECK(!gbuffer.srcStages);
+
+    // the consumer waits on the producer's attachment writes and gets the image in its layout
+    const GraphBarrierBatch& lighting = graph.getBarriers(1);
+    const GraphImageBarrier* albedoBarrier = nullptr;
+    for (const auto& it : lighting.images)
+    {
+        if (it.resource == albedo)
+            albedoBarrier = &it;
+    }
+    CHECK(albedoBarrier != nullptr);
+    if (albedoBarrier)
+    {
+        CHECK(albedoBarrier->oldLayout == vk::ImageLayout::eColorAttachmentOptimal);
+        CHECK(albedoBarrier->newLayout == vk::ImageLayout::eShaderReadOnlyOptimal);
+        CHECK(albedoBarrier->srcAccess == vk::AccessFlags(vk::AccessFlagBits::eColorAttachmentWrite));
+        CHECK(albedoBarrier->dstAccess == vk::AccessFlags(vk::AccessFlagBits::eShaderRead));
+    }
+    CHECK(!!(lighting.srcStages & vk::PipelineStageFlagBits::eColorAttachmentOutput));
+    CHECK(!!(lighting.dstStages & vk::PipelineStageFlagBits::eFragmentShader));
+
+    // and after the graph the backbuffer goes to whoever it was exported to
+    const GraphBarrierBatch& finalBarriers = graph.getFinalBarriers();
+    CHECK(finalBarriers.images.size() == 1);
+    CHECK(finalBarriers.images[0].resource == backbuffer);
+    CHECK(finalBarriers.images[0].oldLayout == vk::ImageLayout::eColorAttachmentOptimal);
+    CHECK(finalBarriers.images[0].newLayout == vk::ImageLayout::ePresentSrcKHR);
+    CHECK(finalBarriers.images[0].srcAccess == vk::AccessFlags(vk::AccessFlagBits::eColorAttachmentWrite));
+}
+
+static void testBufferBarriers()
+{
+    RenderGraph graph;
+    uint32_t commands = graph.importBuffer("commands", vk::Buffer());
+    graph.exportResource(commands, s_indirectRead);
+
+    graph.addPass("cull", s_noRecord).write(commands, s_computeWrite);
+    // the draws' own targets aren't in the graph, without side effects they'd be culled
+    graph.addPass("draw", s_noRecord).read(commands, s_indirectRead).sideEffects();
+    graph.addPass("drawAgain", s_noRecord).read(commands, s_indirectRead).sideEffects();
+    graph.addPass("recull", s_noRecord).write(commands, s_computeWrite);
+    graph.compile();
+
+    // imported with no prior use, so nothing to wait on
+    CHECK(graph.getBarriers(0).empty());
+
+    // read after write: a global memory barrier, buffers have no layouts to transition
+    const GraphBarrierBatch& draw = graph.getBarriers(1);
+    CHECK(draw.images.empty());
+    CHECK(draw.srcStages == vk::PipelineStageFlags(vk::PipelineStageFlagBits::eComputeShader));
+    CHECK(draw.srcAccess == vk::AccessFlags(vk::AccessFlagBits::eShaderWrite));
+    CHECK(draw.dstStages == vk::PipelineStageFlags(vk::PipelineStageFlagBits::eDrawIndirect));
+    CHECK(draw.dstAccess == vk::AccessFlags(vk::AccessFlagBits::eIndirectCommandRead));
+
+    // the write is already visible to that stage, a second reader needs nothing
+    CHECK(graph.getBarriers(2).empty());
+
+    // write after read waits for the readers as well as the earlier write
+    const GraphBarrierBatch& recull = graph.getBarriers(3);
+    CHECK(!!(recull.srcStages & vk::PipelineStageFlagBits::eDrawIndirect));
+    CHECK(!!(recull.srcStages & vk::PipelineStageFlagBits::eComputeShader));
+    CHECK(!!(recull.dstStages & vk::PipelineStageFlagBits::eComputeShader));
+
+    // the export waits on the last write too
+    const GraphBarrierBatch& finalBarriers = graph.getFinalBarriers();
+    CHECK(finalBarriers.srcStages == vk::PipelineStageFlags(vk::PipelineStageFlagBits::eComputeShader));
+    CHECK(finalBarriers.dstAccess == vk::AccessFlags(vk::AccessFlagBits::eIndirectCommandRead));
+
+    CHECK(graph.getStats().barriers == 3);
+    CHECK(graph.getStats().imageBarriers == 0);
+}
+
+static void testAliasing()
+{
+    RenderGraph graph;
+    uint32_t output = graph.importBuffer("output", vk::Buffer());
+    uint32_t a = graph.createBuffer("a", storageBuffer());
+    uint32_t b = graph.createBuffer("b", storageBuffer());
+    uint32_t c = graph.createBuffer("c", storageBuffer());
+    uint32_t image = graph.createImage("image", colorTarget());
+    graph.exportResource(output, s_computeRead);
+
+    // a lives over passes 0-1, b 1-2, c 2-3, the image 3-4; only neighbours overlap
+    graph.addPass("p0", s_noRecord).write(a, s_computeWrite);
+    graph.addPass("p1", s_noRecord).read(a, s_computeRead).write(b, s_computeWrite);
+    graph.addPass("p2", s_noRecord).read(b, s_computeRead).write(c, s_computeWrite);
+    graph.addPass("p3", s_noRecord).read(c, s_computeRead).write(image, s_colorWrite);
+    graph.addPass("p4", s_noRecord).read(image, s_sampled).write(output, s_computeWrite);
+    graph.compile();
+
+    const vk::DeviceSize bufferSize = 1024;
+    const vk::DeviceSize imageSize = 4096;
+    graph.setMemoryRequirements(a, requirements(bufferSize));
+    graph.setMemoryRequirements(b, requirements(bufferSize));
+    graph.setMemoryRequirements(c, requirements(bufferSize));
+    graph.setMemoryRequirements(image, requirements(imageSize));
+    graph.assignMemory();
+
+    CHECK(!sharesMemory(graph, a, b, bufferSize, bufferSize));
+    CHECK(!sharesMemory(graph, b, c, bufferSize, bufferSize));
+    CHECK(sharesMemory(graph, a, c, bufferSize, bufferSize));
+
+    // buffers and images are kept in heaps of their own
+    CHECK(graph.getHeaps().size() == 2);
+    CHECK(graph.getHeap(image) != graph.getHeap(a));
+    CHECK(graph.getHeaps()[graph.getHeap(a)].type == GraphResourceType::eBuffer);
+    CHECK(graph.getHeaps()[graph.getHeap(image)].type == GraphResourceType::eImage);
+
+    CHECK(graph.getStats().transientBytes == 3 * bufferSize + imageSize);
+    CHECK(graph.getStats().heapBytes == 2 * bufferSize + imageSize);
+
+    // c takes over a's memory, so its first use waits for a's last
+    const GraphBarrierBatch& p2 = graph.getBarriers(2);
+    CHECK(!!(p2.srcStages & vk::PipelineStageFlagBits::eComputeShader));
+    CHECK(!!(p2.srcAccess & vk::AccessFlagBits::eShaderWrite));
+}
+
+static void testOverlappingLifetimes()
+{
+    // a wider graph where every pass keeps a few resources alive, sizes differing so the placement
+    // has gaps to fill
+    RenderGraph graph;
+    uint32_t output = graph.importBuffer("output", vk::Buffer());
+    graph.exportResource(output, s_computeRead);
+
+    const uint32_t count = 12;
+    uint32_t resources[count];
+    vk::DeviceSize sizes[count];
+    char names[count][16];
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        snprintf(names[i], sizeof(names[i]), "t%u", i);
+        resources[i] = graph.createBuffer(names[i], storageBuffer());
+        sizes[i] = 256 * (1 + (i * 7) % 5);
+    }
+
+    // resource i is written by pass i and read by pass i + 1 + i % 3
+    for (uint32_t p = 0; p < count + 3; ++p)
+    {
+        graph.addPass("pass", s_noRecord);
+        if (p < count)
+            graph.write(resources[p], s_computeWrite);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (p == i + 1 + i % 3)
+                graph.read(resources[i], s_computeRead);
+        }
+        graph.write(output, s_computeWrite);
+    }
+    graph.compile();
+
+    for (uint32_t i = 0; i < count; ++i)
+        graph.setMemoryRequirements(resources[i], requirements(sizes[i]));
+    graph.assignMemory();
+
+    bool aliased = false;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        for (uint32_t j = i + 1; j < count; ++j)
+        {
+            const uint32_t a = resources[i];
+            const uint32_t b = resources[j];
+            const bool overlapping = graph.getFirstPass(a) <= graph.getLastPass(b) && graph.getFirstPass(b) <= graph.getLastPass(a);
+            const bool shared = sharesMemory(graph, a, b, sizes[i], sizes[j]);
+            if (overlapping)
+                CHECK(!shared);
+            aliased |= shared;
+        }
+    }
+    CHECK(aliased);
+    CHECK(graph.getStats().heapBytes < graph.getStats().transientBytes);
+}
+
+int main()
+{
+    testCulling();
+    testImageBarriers();
+    testBufferBarriers();
+    testAliasing();
+    testOverlappingLifetimes();
+
+    if (s_failures)
+        fprintf(stderr, "render_graph_test: %d checks failed\n", s_failures);
+    else
+        printf("render_graph_test: all checks passed\n");
+    return s_failures ? 1 : 0;
+}
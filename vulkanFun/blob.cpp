@@ -0,0 +1,768 @@
+#include "blob.h"
+
+#include <string.h>
+#include <algorithm>
+#include <random>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define BLOB_CRC_SSE42
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define BLOB_CRC_ARM
+#include <arm_acle.h>
+#endif
+
+static_assert(sizeof(blob::Header) == 48, "blob::Header layout is part of the file format");
+
+static const uint32_t RAW_BLOCK = 0x80000000u;  // block stored as is, it didn't compress
+
+static uint32_t load32(const unsigned char* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void store32(unsigned char* p, uint32_t v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static void store64(unsigned char* p, uint64_t v)
+{
+    store32(p, (uint32_t)v);
+    store32(p + 4, (uint32_t)(v >> 32));
+}
+
+// crc32c
+
+static const uint32_t CRC32C_POLY = 0x82F63B78;   // reflected
+
+struct Crc32cTables {
+    uint32_t                      t[8][256];
+
+    Crc32cTables()
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; ++k)
+                crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+            t[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            for (int k = 1; k < 8; ++k)
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+        }
+    }
+};
+
+static uint32_t crc32cTables(uint32_t crc, const unsigned char* p, size_t size)
+{
+    static const Crc32cTables tables;
+    const auto& t = tables.t;
+
+    while (size >= 8)
+    {
+        uint32_t lo = load32(p) ^ crc;
+        uint32_t hi = load32(p + 4);
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while (size--)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+
+    return crc;
+}
+
+#ifdef BLOB_CRC_SSE42
+#ifndef _MSC_VER
+__attribute__((target("sse4.2")))
+#endif
+static uint32_t crc32cHardware(uint32_t crc, const unsigned char* p, size_t size)
+{
+    uint64_t crc64 = crc;
+
+    // a cache line per iteration
+    while (size >= 64)
+    {
+        uint64_t words[8];
+        memcpy(words, p, sizeof(words));
+        for (int i = 0; i < 8; ++i)
+            crc64 = _mm_crc32_u64(crc64, words[i]);
+        p += 64;
+        size -= 64;
+    }
+    while (size >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        size -= 8;
+    }
+
+    crc = (uint32_t)crc64;
+    while (size--)
+        crc = _mm_crc32_u8(crc, *p++);
+
+    return crc;
+}
+
+static bool hasHardwareCrc()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#elif defined(BLOB_CRC_ARM)
+static uint32_t crc32cHardware(uint32_t crc, const unsigned char* p, size_t size)
+{
+    while (size >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc = __crc32cd(crc, word);
+        p += 8;
+        size -= 8;
+    }
+    while (size--)
+        crc = __crc32cb(crc, *p++);
+
+    return crc;
+}
+
+static bool hasHardwareCrc()
+{
+    return true;
+}
+#endif
+
+uint32_t blob::crc32c(const void* data, size_t size, uint32_t crc)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    crc = ~crc;
+
+#if defined(BLOB_CRC_SSE42) || defined(BLOB_CRC_ARM)
+    static const bool hardware = hasHardwareCrc();
+    if (hardware)
+        return ~crc32cHardware(crc, p, size);
+#endif
+
+    return ~crc32cTables(crc, p, size);
+}
+
+// LZ4 block format: token (literal count, match length - 4), literals, 16 bit offset, with 255 runs
+// extending either count. The last 5 bytes are always literals and no match starts in the last 12
+
+static const size_t MIN_MATCH = 4;
+static const size_t LAST_LITERALS = 5;
+static const size_t MATCH_SEARCH_LIMIT = 12;
+static const uint32_t HASH_BITS = 12;
+
+static size_t lzCompress(const unsigned char* src, size_t size, unsigned char* dst, size_t capacity)
+{
+    uint32_t table[1 << HASH_BITS];
+    memset(table, 0xff, sizeof(table));
+
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+    const size_t searchEnd = size > MATCH_SEARCH_LIMIT ? size - MATCH_SEARCH_LIMIT : 0;
+    const size_t matchEnd = size > LAST_LITERALS ? size - LAST_LITERALS : 0;
+
+    // literals from anchor, then a match unless matchLength is 0. False once it'd overrun capacity
+    auto emit = [&](size_t literals, size_t offset, size_t matchLength) {
+        size_t worstCase = 1 + literals / 255 + 1 + literals + 2 + matchLength / 255 + 1;
+        if (op + worstCase > capacity)
+            return false;
+
+        unsigned char* token = dst + op++;
+        *token = (unsigned char)(std::min<size_t>(literals, 15) << 4);
+        if (literals >= 15)
+        {
+            size_t rest = literals - 15;
+            for (; rest >= 255; rest -= 255)
+                dst[op++] = 255;
+            dst[op++] = (unsigned char)rest;
+        }
+
+        memcpy(dst + op, src + anchor, literals);
+        op += literals;
+
+        if (matchLength == 0)
+            return true;
+
+        dst[op++] = (unsigned char)offset;
+        dst[op++] = (unsigned char)(offset >> 8);
+
+        size_t length = matchLength - MIN_MATCH;
+        *token |= (unsigned char)std::min<size_t>(length, 15);
+        if (length >= 15)
+        {
+            size_t rest = length - 15;
+            for (; rest >= 255; rest -= 255)
+                dst[op++] = 255;
+            dst[op++] = (unsigned char)rest;
+        }
+        return true;
+    };
+
+    while (ip < searchEnd)
+    {
+        uint32_t sequence = load32(src + ip);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+        uint32_t candidate = table[hash];
+        table[hash] = (uint32_t)ip;
+
+        if (candidate == ~0u || ip - candidate > 0xffff || load32(src + candidate) != sequence)
+        {
+            ++ip;
+            continue;
+        }
+
+        size_t length = MIN_MATCH;
+        while (ip + length < matchEnd && src[candidate + length] == src[ip + length])
+            ++length;
+
+        if (!emit(ip - anchor, ip - candidate, length))
+            return 0;
+
+        ip += length;
+        anchor = ip;
+    }
+
+    if (!emit(size - anchor, 0, 0))
+        return 0;
+
+    return op;
+}
+
+// false unless src decodes to exactly dstSize bytes without reading or writing out of bounds
+static bool lzDecompress(const unsigned char* src, size_t srcSize, unsigned char* dst, size_t dstSize)
+{
+    size_t ip = 0;
+    size_t op = 0;
+
+    auto readLength = [&](size_t& length) {
+        unsigned char b;
+        do
+        {
+            if (ip >= srcSize)
+                return false;
+            b = src[ip++];
+            length += b;
+        } while (b == 255);
+        return true;
+    };
+
+    while (ip < srcSize)
+    {
+        unsigned char token = src[ip++];
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(literals))
+            return false;
+        if (literals > srcSize - ip || literals > dstSize - op)
+            return false;
+
+        memcpy(dst + op, src + ip, literals);
+        ip += literals;
+        op += literals;
+
+        // the last sequence has no match
+        if (ip == srcSize)
+            break;
+
+        if (srcSize - ip < 2)
+            return false;
+        size_t offset = (size_t)src[ip] | ((size_t)src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op)
+            return false;
+
+        size_t length = token & 15;
+        if (length == 15 && !readLength(length))
+            return false;
+        length += MIN_MATCH;
+        if (length > dstSize - op)
+            return false;
+
+        // matches may overlap what they're producing, a run of one byte repeats it
+        const unsigned char* match = dst + op - offset;
+        if (offset >= length)
+        {
+            memcpy(dst + op, match, length);
+        }
+        else
+        {
+            for (size_t i = 0; i < length; ++i)
+                dst[op + i] = match[i];
+        }
+        op += length;
+    }
+
+    return op == dstSize;
+}
+
+// chacha20-poly1305, RFC 8439
+
+static uint32_t rotl(uint32_t v, int n)
+{
+    return (v << n) | (v >> (32 - n));
+}
+
+#define CHACHA_QUARTER(a, b, c, d) \
+    a += b; d ^= a; d = rotl(d, 16); \
+    c += d; b ^= c; b = rotl(b, 12); \
+    a += b; d ^= a; d = rotl(d, 8); \
+    c += d; b ^= c; b = rotl(b, 7);
+
+static void chachaBlock(const uint32_t key[8], uint32_t counter, const uint32_t nonce[3], unsigned char out[64])
+{
+    uint32_t state[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+        key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+        counter, nonce[0], nonce[1], nonce[2]
+    };
+
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+
+    for (int i = 0; i < 10; ++i)
+    {
+        CHACHA_QUARTER(x[0], x[4], x[8], x[12]);
+        CHACHA_QUARTER(x[1], x[5], x[9], x[13]);
+        CHACHA_QUARTER(x[2], x[6], x[10], x[14]);
+        CHACHA_QUARTER(x[3], x[7], x[11], x[15]);
+        CHACHA_QUARTER(x[0], x[5], x[10], x[15]);
+        CHACHA_QUARTER(x[1], x[6], x[11], x[12]);
+        CHACHA_QUARTER(x[2], x[7], x[8], x[13]);
+        CHACHA_QUARTER(x[3], x[4], x[9], x[14]);
+    }
+
+    for (int i = 0; i < 16; ++i)
+        store32(out + i * 4, x[i] + state[i]);
+}
+
+struct ChaCha20 {
+    uint32_t                      key[8];
+    uint32_t                      nonce[3];
+
+    ChaCha20(const blob::Key& k, const uint8_t n[12])
+    {
+        for (int i = 0; i < 8; ++i)
+            key[i] = load32(k.bytes + i * 4);
+        for (int i = 0; i < 3; ++i)
+            nonce[i] = load32(n + i * 4);
+    }
+
+    // a 64 byte keystream block per line, block 0 is kept for the poly1305 key
+    void apply(const unsigned char* src, unsigned char* dst, size_t size) const
+    {
+        unsigned char stream[64];
+        for (size_t pos = 0, block = 1; pos < size; pos += 64, ++block)
+        {
+            chachaBlock(key, (uint32_t)block, nonce, stream);
+
+            size_t count = std::min<size_t>(64, size - pos);
+            for (size_t i = 0; i < count; ++i)
+                dst[pos + i] = src[pos + i] ^ stream[i];
+        }
+    }
+
+    void polyKey(unsigned char out[32]) const
+    {
+        unsigned char stream[64];
+        chachaBlock(key, 0, nonce, stream);
+        memcpy(out, stream, 32);
+    }
+};
+
+// 26 bit limbs, so every product fits in 64 bits
+struct Poly1305 {
+    uint32_t                      r[5];
+    uint32_t                      h[5] = {};
+    uint32_t                      pad[4];
+    unsigned char                 buffer[16];
+    size_t                        buffered = 0;
+
+    explicit Poly1305(const unsigned char key[32])
+    {
+        r[0] = load32(key + 0) & 0x3ffffff;
+        r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+        r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+        r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+        r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+
+        for (int i = 0; i < 4; ++i)
+            pad[i] = load32(key + 16 + i * 4);
+    }
+
+    void blocks(const unsigned char* m, size_t size, uint32_t hibit)
+    {
+        const uint32_t r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3], r4 = r[4];
+        const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+        uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+
+        for (; size >= 16; m += 16, size -= 16)
+        {
+            h0 += load32(m + 0) & 0x3ffffff;
+            h1 += (load32(m + 3) >> 2) & 0x3ffffff;
+            h2 += (load32(m + 6) >> 4) & 0x3ffffff;
+            h3 += (load32(m + 9) >> 6) & 0x3ffffff;
+            h4 += (load32(m + 12) >> 8) | hibit;
+
+            uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+            uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+            uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+            uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+            uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+            uint32_t c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+            d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+            d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+            d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+            d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+            h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+            h1 += c;
+        }
+
+        h[0] = h0; h[1] = h1; h[2] = h2; h[3] = h3; h[4] = h4;
+    }
+
+    void update(const unsigned char* m, size_t size)
+    {
+        if (buffered)
+        {
+            size_t count = std::min(size, 16 - buffered);
+            memcpy(buffer + buffered, m, count);
+            buffered += count;
+            m += count;
+            size -= count;
+            if (buffered < 16)
+                return;
+            blocks(buffer, 16, 1 << 24);
+            buffered = 0;
+        }
+
+        size_t whole = size & ~(size_t)15;
+        blocks(m, whole, 1 << 24);
+
+        memcpy(buffer, m + whole, size - whole);
+        buffered = size - whole;
+    }
+
+    // zeros up to the next 16 bytes, as the AEAD construction pads each part
+    void pad16()
+    {
+        if (!buffered)
+            return;
+        memset(buffer + buffered, 0, 16 - buffered);
+        blocks(buffer, 16, 1 << 24);
+        buffered = 0;
+    }
+
+    void finish(unsigned char tag[16])
+    {
+        if (buffered)
+        {
+            buffer[buffered] = 1;
+            memset(buffer + buffered + 1, 0, 16 - buffered - 1);
+            blocks(buffer, 16, 0);
+            buffered = 0;
+        }
+
+        uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+
+        uint32_t c = h1 >> 26; h1 &= 0x3ffffff;
+        h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+        h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+        h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+
+        // h - p, kept only when it didn't borrow
+        uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+        uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+        uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+        uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+        uint32_t g4 = h4 + c - (1u << 26);
+
+        uint32_t mask = (g4 >> 31) - 1;
+        h0 = (h0 & ~mask) | (g0 & mask);
+        h1 = (h1 & ~mask) | (g1 & mask);
+        h2 = (h2 & ~mask) | (g2 & mask);
+        h3 = (h3 & ~mask) | (g3 & mask);
+        h4 = (h4 & ~mask) | (g4 & mask);
+
+        uint32_t w0 = h0 | (h1 << 26);
+        uint32_t w1 = (h1 >> 6) | (h2 << 20);
+        uint32_t w2 = (h2 >> 12) | (h3 << 14);
+        uint32_t w3 = (h3 >> 18) | (h4 << 8);
+
+        uint64_t f = (uint64_t)w0 + pad[0];              store32(tag + 0, (uint32_t)f);
+        f = (uint64_t)w1 + pad[1] + (f >> 32);           store32(tag + 4, (uint32_t)f);
+        f = (uint64_t)w2 + pad[2] + (f >> 32);           store32(tag + 8, (uint32_t)f);
+        f = (uint64_t)w3 + pad[3] + (f >> 32);           store32(tag + 12, (uint32_t)f);
+    }
+};
+
+static void computeTag(const ChaCha20& cipher, const unsigned char* aad, size_t aadSize,
+                       const unsigned char* ciphertext, size_t size, unsigned char tag[16])
+{
+    unsigned char polyKey[32];
+    cipher.polyKey(polyKey);
+
+    Poly1305 mac(polyKey);
+    mac.update(aad, aadSize);
+    mac.pad16();
+    mac.update(ciphertext, size);
+    mac.pad16();
+
+    unsigned char lengths[16];
+    store64(lengths, aadSize);
+    store64(lengths + 8, size);
+    mac.update(lengths, sizeof(lengths));
+    mac.finish(tag);
+}
+
+void blob::seal(const Key& key, const uint8_t nonce[12], const void* aad, size_t aadSize,
+                const void* src, size_t size, void* dst, uint8_t tag[TAG_SIZE])
+{
+    ChaCha20 cipher(key, nonce);
+    cipher.apply((const unsigned char*)src, (unsigned char*)dst, size);
+    computeTag(cipher, (const unsigned char*)aad, aadSize, (const unsigned char*)dst, size, tag);
+}
+
+bool blob::open(const Key& key, const uint8_t nonce[12], const void* aad, size_t aadSize,
+                const void* src, size_t size, const uint8_t tag[TAG_SIZE], void* dst)
+{
+    ChaCha20 cipher(key, nonce);
+
+    unsigned char expected[TAG_SIZE];
+    computeTag(cipher, (const unsigned char*)aad, aadSize, (const unsigned char*)src, size, expected);
+
+    // constant time, so the comparison leaks nothing about how close a forgery came
+    unsigned char diff = 0;
+    for (uint32_t i = 0; i < TAG_SIZE; ++i)
+        diff |= expected[i] ^ tag[i];
+    if (diff)
+        return false;
+
+    cipher.apply((const unsigned char*)src, (unsigned char*)dst, size);
+    return true;
+}
+
+// the header is authenticated too, minus the checksum which is only known afterwards
+static void headerAad(const blob::Header& header, unsigned char aad[sizeof(blob::Header)])
+{
+    blob::Header copy = header;
+    copy.checksum = 0;
+    memcpy(aad, &copy, sizeof(copy));
+}
+
+std::vector<unsigned char> blob::encode(const void* data, size_t size, const Options& options)
+{
+    const unsigned char* src = (const unsigned char*)data;
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.rawSize = size;
+    header.blockSize = std::max(options.blockSize, 256u);
+
+    std::vector<unsigned char> out(sizeof(Header));
+
+    if (options.compress)
+    {
+        header.flags |= FLAG_COMPRESSED;
+
+        for (size_t pos = 0; pos < size; pos += header.blockSize)
+        {
+            size_t count = std::min<size_t>(header.blockSize, size - pos);
+            size_t start = out.size();
+            out.resize(start + 4 + count);
+
+            // anything that doesn't come out smaller is stored as it is
+            size_t packed = lzCompress(src + pos, count, out.data() + start + 4, count - 1);
+            if (packed)
+            {
+                store32(out.data() + start, (uint32_t)packed);
+                out.resize(start + 4 + packed);
+            }
+            else
+            {
+                store32(out.data() + start, (uint32_t)count | RAW_BLOCK);
+                memcpy(out.data() + start + 4, src + pos, count);
+            }
+        }
+    }
+    else if (size)
+    {
+        // resize and copy rather than insert, which GCC's -Warray-bounds misreads at -O2
+        out.resize(sizeof(Header) + size);
+        memcpy(out.data() + sizeof(Header), src, size);
+    }
+
+    if (options.key)
+    {
+        header.flags |= FLAG_ENCRYPTED;
+
+        std::random_device random;
+        for (int i = 0; i < 3; ++i)
+            store32(header.nonce + i * 4, random());
+
+        size_t payloadSize = out.size() - sizeof(Header);
+        header.storedSize = payloadSize + TAG_SIZE;
+
+        unsigned char aad[sizeof(Header)];
+        headerAad(header, aad);
+
+        out.resize(out.size() + TAG_SIZE);
+        seal(*options.key, header.nonce, aad, sizeof(aad), out.data() + sizeof(Header), payloadSize, out.data() + sizeof(Header),
+             out.data() + sizeof(Header) + payloadSize);
+    }
+    else
+    {
+        header.storedSize = out.size() - sizeof(Header);
+    }
+
+    header.checksum = crc32c(out.data() + sizeof(Header), (size_t)header.storedSize);
+    memcpy(out.data(), &header, sizeof(header));
+    return out;
+}
+
+bool blob::decode(const void* data, size_t size, std::vector<unsigned char>& out, const Key* key, const char** reason)
+{
+    const char* unused;
+    if (!reason)
+        reason = &unused;
+
+    const unsigned char* src = (const unsigned char*)data;
+    out.clear();
+
+    Header header;
+    if (size < sizeof(header))
+    {
+        *reason = "truncated header";
+        return false;
+    }
+    memcpy(&header, src, sizeof(header));
+
+    const bool compressed = (header.flags & FLAG_COMPRESSED) != 0;
+    const bool encrypted = (header.flags & FLAG_ENCRYPTED) != 0;
+    const uint64_t payloadSize = header.storedSize - (encrypted ? TAG_SIZE : 0);
+
+    if (header.magic != MAGIC || header.version != VERSION)
+    {
+        *reason = "not a blob";
+        return false;
+    }
+    if (header.storedSize != size - sizeof(header) || header.storedSize < (encrypted ? TAG_SIZE : 0))
+    {
+        *reason = "truncated data";
+        return false;
+    }
+    // bounds what a damaged header can make us allocate, LZ4 can't expand a block more than 255 times
+    if ((!compressed && header.rawSize != payloadSize) || (compressed && header.rawSize / 256 > payloadSize) || header.blockSize == 0)
+    {
+        *reason = "inconsistent sizes";
+        return false;
+    }
+    if (header.checksum != crc32c(src + sizeof(header), (size_t)header.storedSize))
+    {
+        *reason = "checksum mismatch";
+        return false;
+    }
+
+    const unsigned char* payload = src + sizeof(header);
+    std::vector<unsigned char> decrypted;
+
+    if (encrypted)
+    {
+        if (!key)
+        {
+            *reason = "sealed, no key";
+            return false;
+        }
+
+        unsigned char aad[sizeof(Header)];
+        headerAad(header, aad);
+
+        decrypted.resize((size_t)payloadSize);
+        if (!open(*key, header.nonce, aad, sizeof(aad), payload, (size_t)payloadSize, payload + payloadSize, decrypted.data()))
+        {
+            *reason = "authentication failed";
+            return false;
+        }
+        payload = decrypted.data();
+    }
+
+    if (!compressed)
+    {
+        out.assign(payload, payload + payloadSize);
+        return true;
+    }
+
+    out.resize((size_t)header.rawSize);
+
+    size_t ip = 0;
+    for (size_t op = 0; op < out.size(); )
+    {
+        size_t expected = std::min<size_t>(header.blockSize, out.size() - op);
+
+        if (payloadSize - ip < 4)
+        {
+            *reason = "truncated block";
+            out.clear();
+            return false;
+        }
+        uint32_t word = load32(payload + ip);
+        size_t stored = word & ~RAW_BLOCK;
+        ip += 4;
+
+        bool ok = stored <= payloadSize - ip;
+        if (ok && (word & RAW_BLOCK))
+        {
+            ok = stored == expected;
+            if (ok)
+                memcpy(out.data() + op, payload + ip, stored);
+        }
+        else if (ok)
+        {
+            ok = lzDecompress(payload + ip, stored, out.data() + op, expected);
+        }
+
+        if (!ok)
+        {
+            *reason = "corrupt block";
+            out.clear();
+            return false;
+        }
+
+        ip += stored;
+        op += expected;
+    }
+
+    if (ip != payloadSize)
+    {
+        *reason = "trailing data";
+        out.clear();
+        return false;
+    }
+
+    return true;
+}
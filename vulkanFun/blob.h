@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Container for the files the app writes for itself, the pipeline and reflection caches. The payload is
+// LZ4 style compressed in independent blocks, covered by a CRC32C, and can be sealed with
+// ChaCha20-Poly1305 so it can't be read or altered without the key. Encoding and decoding make one pass
+// over each block, a 64 byte line at a time
+namespace blob
+{
+    static const uint32_t         MAGIC = 0x4C424B56;       // "VKBL"
+    static const uint16_t         VERSION = 1;
+    static const uint32_t         DEFAULT_BLOCK_SIZE = 64 * 1024;
+    static const uint32_t         TAG_SIZE = 16;
+
+    static const uint16_t         FLAG_COMPRESSED = 1 << 0;
+    static const uint16_t         FLAG_ENCRYPTED = 1 << 1;
+
+    struct Header {
+        uint32_t                  magic;
+        uint16_t                  version;
+        uint16_t                  flags;
+        uint64_t                  rawSize;          // size once decoded
+        uint64_t                  storedSize;       // everything after the header, tag included
+        uint32_t                  blockSize;
+        uint32_t                  checksum;         // CRC32C of everything after the header
+        uint8_t                   nonce[12];
+        uint32_t                  reserved;
+    };
+
+    struct Key {
+        uint8_t                   bytes[32];
+    };
+
+    struct Options {
+        bool                      compress = true;
+        const Key*                key = nullptr;    // sealed when set
+        uint32_t                  blockSize = DEFAULT_BLOCK_SIZE;
+    };
+
+    std::vector<unsigned char>    encode(const void* data, size_t size, const Options& options = Options());
+
+    // false, with reason saying why, when data isn't a blob, is damaged, or is sealed with a key it wasn't given
+    bool                          decode(const void* data, size_t size, std::vector<unsigned char>& out,
+                                         const Key* key = nullptr, const char** reason = nullptr);
+
+    // ChaCha20-Poly1305 as in RFC 8439, what sealed blobs use with their header as the associated data.
+    // src and dst may be the same; open() writes nothing and returns false when the tag doesn't match
+    void                          seal(const Key& key, const uint8_t nonce[12], const void* aad, size_t aadSize,
+                                       const void* src, size_t size, void* dst, uint8_t tag[TAG_SIZE]);
+    bool                          open(const Key& key, const uint8_t nonce[12], const void* aad, size_t aadSize,
+                                       const void* src, size_t size, const uint8_t tag[TAG_SIZE], void* dst);
+
+    // SSE4.2 or ARMv8 CRC instructions when the CPU has them, slicing-by-8 tables otherwise
+    uint32_t                      crc32c(const void* data, size_t size, uint32_t crc = 0);
+}
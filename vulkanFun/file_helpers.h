@@ -1,7 +1,22 @@
 #pragma once
 
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
 #include <vector>
 #include <fstream>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 namespace file_helpers
 {
@@ -21,6 +36,166 @@ namespace file_helpers
         return buff;
     };
 
+    // read-only view of a whole file, pages come straight from the page cache without being copied.
+    // The data is page aligned, so SPIR-V can be read as words in place. A mapping follows the file, and
+    // reading past its end after something truncates it faults, so files that may be rewritten while
+    // in use are better read() into a private copy
+    class MappedFile
+    {
+    public:
+        // how the file will be read, passed on to madvise
+        enum class Hint { eNormal, eSequential, eRandom, eWillNeed };
+
+        MappedFile() = default;
+        ~MappedFile() { close(); }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        MappedFile(MappedFile&& other) noexcept
+            : m_data(other.m_data), m_size(other.m_size), m_copy(other.m_copy)
+        {
+            other.m_data = nullptr;
+            other.m_size = 0;
+        }
+
+        MappedFile& operator=(MappedFile&& other) noexcept
+        {
+            if (this != &other)
+            {
+                close();
+                m_data = other.m_data;
+                m_size = other.m_size;
+                m_copy = other.m_copy;
+                other.m_data = nullptr;
+                other.m_size = 0;
+            }
+            return *this;
+        }
+
+        // false for missing and empty files, which leave it empty
+        bool open(const std::string& fName, Hint hint = Hint::eSequential)
+        {
+            close();
+
+#ifdef _WIN32
+            HANDLE file = CreateFileA(fName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                                      OPEN_EXISTING, hint == Hint::eRandom ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+                return false;
+
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+            {
+                CloseHandle(file);
+                return false;
+            }
+
+            // the view keeps the mapping alive, neither handle is needed once it exists
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            CloseHandle(file);
+            if (!mapping)
+                return false;
+
+            void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+            if (!data)
+                return false;
+
+            m_data = (const unsigned char*)data;
+            m_size = (size_t)size.QuadPart;
+#else
+            int fd = ::open(fName.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size == 0)
+            {
+                ::close(fd);
+                return false;
+            }
+
+            void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (data == MAP_FAILED)
+                return false;
+
+            static const int advice[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED };
+            madvise(data, (size_t)st.st_size, advice[(int)hint]);
+
+            m_data = (const unsigned char*)data;
+            m_size = (size_t)st.st_size;
+#endif
+            return true;
+        }
+
+        // same interface, but the contents are copied into word aligned memory of its own
+        bool read(const std::string& fName)
+        {
+            close();
+
+            FILE* file = fopen(fName.c_str(), "rb");
+            if (!file)
+                return false;
+
+            fseek(file, 0, SEEK_END);
+            long size = ftell(file);
+            fseek(file, 0, SEEK_SET);
+
+            uint32_t* words = size > 0 ? new uint32_t[((size_t)size + 3) / 4] : nullptr;
+            bool ok = words && fread(words, 1, (size_t)size, file) == (size_t)size;
+            fclose(file);
+
+            if (!ok)
+            {
+                delete[] words;
+                return false;
+            }
+
+            m_data = (const unsigned char*)words;
+            m_size = (size_t)size;
+            m_copy = true;
+            return true;
+        }
+
+        void close()
+        {
+            if (!m_data)
+                return;
+
+            if (m_copy)
+                delete[] (const uint32_t*)m_data;
+            else
+#ifdef _WIN32
+                UnmapViewOfFile(m_data);
+#else
+                munmap((void*)m_data, m_size);
+#endif
+            m_data = nullptr;
+            m_size = 0;
+            m_copy = false;
+        }
+
+        const unsigned char*      data() const { return m_data; }
+        // mappings are page aligned and read() allocates words, so the data can be read as 32 bit words in place
+        const uint32_t*           words() const { return (const uint32_t*)m_data; }
+        size_t                    size() const { return m_size; }
+        bool                      empty() const { return m_size == 0; }
+
+    private:
+        const unsigned char*      m_data = nullptr;
+        size_t                    m_size = 0;
+        bool                      m_copy = false;   // read() rather than mapped
+    };
+
+    inline MappedFile mapFile(const std::string& fName, MappedFile::Hint hint = MappedFile::Hint::eSequential)
+    {
+        MappedFile file;
+        file.open(fName, hint);
+        return file;
+    }
+
     static void writeFile(const std::string& fName, const std::vector<unsigned char>& data)
     {
         std::ofstream file(fName, std::ios::binary);
@@ -31,22 +206,46 @@ namespace file_helpers
 
         file.close();
     }
-    
-    template<typename T>
-    void encrypt(std::vector<T>& data)
+
+    // writes a temp file next to fName then renames it over, a crash mid-write leaves the old file intact
+    inline bool writeFileAtomic(const std::string& fName, const void* data, size_t size)
     {
-        static const std::string encryption_key = "sAfd@;sa34BY6fd:R4";
-        const size_t keySize = encryption_key.size();
+        std::string tempPath = fName + ".tmp";
 
-        for (size_t i = 0; i < data.size(); ++i)
+        FILE* file = fopen(tempPath.c_str(), "wb");
+        if (!file)
+            return false;
+
+        bool written = fwrite(data, 1, size, file) == size;
+        written = fflush(file) == 0 && written;
+#ifndef _WIN32
+        // make sure the contents are on disk before the rename makes them visible
+        written = fsync(fileno(file)) == 0 && written;
+#endif
+        fclose(file);
+
+        if (!written)
         {
-            data[i] ^= encryption_key[i % keySize];
+            remove(tempPath.c_str());
+            return false;
         }
+
+#ifdef _WIN32
+        return MoveFileExA(tempPath.c_str(), fName.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        return rename(tempPath.c_str(), fName.c_str()) == 0;
+#endif
     }
 
-    template<typename T>
-    void decrypt(std::vector<T>& data)
+    // FNV-1a, for content keys rather than anything adversarial
+    inline uint64_t hash64(const void* data, size_t size, uint64_t h = 14695981039346656037ull)
     {
-        encrypt<T>(data); // reversible
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < size; ++i)
+        {
+            h ^= bytes[i];
+            h *= 1099511628211ull;
+        }
+        return h;
     }
 }
\ No newline at end of file
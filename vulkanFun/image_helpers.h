@@ -0,0 +1,116 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <fstream>
+#include <stdint.h>
+
+namespace image_helpers
+{
+    // rgb is width * height * 3 bytes, top row first
+    static bool writePPM(const std::string& fName, uint32_t width, uint32_t height, const std::vector<unsigned char>& rgb)
+    {
+        std::ofstream file(fName, std::ios::binary);
+        if (!file.is_open())
+            return false;
+
+        std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+        file.write(header.data(), header.size());
+        file.write((const char*)rgb.data(), rgb.size());
+
+        return file.good();
+    }
+
+    static uint32_t crc32(uint32_t crc, const unsigned char* data, size_t size)
+    {
+        static uint32_t table[256] = {};
+        if (table[1] == 0)
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k)
+                    c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                table[i] = c;
+            }
+        }
+
+        crc = ~crc;
+        for (size_t i = 0; i < size; ++i)
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    // PNG with stored (uncompressed) deflate blocks, no zlib needed and any decoder reads it
+    static bool writePNG(const std::string& fName, uint32_t width, uint32_t height, const std::vector<unsigned char>& rgb)
+    {
+        auto put32 = [](std::vector<unsigned char>& out, uint32_t v) {
+            out.push_back((unsigned char)(v >> 24));
+            out.push_back((unsigned char)(v >> 16));
+            out.push_back((unsigned char)(v >> 8));
+            out.push_back((unsigned char)v);
+        };
+
+        auto putChunk = [&put32](std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data) {
+            put32(out, (uint32_t)data.size());
+            size_t start = out.size();
+            out.insert(out.end(), type, type + 4);
+            out.insert(out.end(), data.begin(), data.end());
+            put32(out, crc32(0, out.data() + start, out.size() - start));
+        };
+
+        // every scanline starts with filter type 0
+        const size_t stride = (size_t)width * 3;
+        std::vector<unsigned char> raw;
+        raw.reserve((stride + 1) * height);
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            raw.push_back(0);
+            raw.insert(raw.end(), rgb.begin() + y * stride, rgb.begin() + (y + 1) * stride);
+        }
+
+        std::vector<unsigned char> idat = { 0x78, 0x01 };
+        uint32_t adlerA = 1, adlerB = 0;
+        size_t pos = 0;
+        do
+        {
+            size_t len = std::min(raw.size() - pos, (size_t)65535);
+            idat.push_back(pos + len == raw.size() ? 1 : 0);
+            idat.push_back((unsigned char)len);
+            idat.push_back((unsigned char)(len >> 8));
+            idat.push_back((unsigned char)~len);
+            idat.push_back((unsigned char)(~len >> 8));
+            idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + len);
+
+            for (size_t i = pos; i < pos + len; ++i)
+            {
+                adlerA = (adlerA + raw[i]) % 65521;
+                adlerB = (adlerB + adlerA) % 65521;
+            }
+            pos += len;
+        } while (pos < raw.size());
+        put32(idat, (adlerB << 16) | adlerA);
+
+        std::vector<unsigned char> ihdr;
+        put32(ihdr, width);
+        put32(ihdr, height);
+        ihdr.push_back(8);  // bit depth
+        ihdr.push_back(2);  // truecolour
+        ihdr.push_back(0);
+        ihdr.push_back(0);
+        ihdr.push_back(0);
+
+        std::vector<unsigned char> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        putChunk(png, "IHDR", ihdr);
+        putChunk(png, "IDAT", idat);
+        putChunk(png, "IEND", std::vector<unsigned char>());
+
+        std::ofstream file(fName, std::ios::binary);
+        if (!file.is_open())
+            return false;
+
+        file.write((const char*)png.data(), png.size());
+        return file.good();
+    }
+}
@@ -0,0 +1,459 @@
+#include "logging.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+
+namespace logging
+{
+    std::atomic<uint8_t> g_levels[(size_t)LogCategory::eCount] = {
+        { LOG_COMPILE_LEVEL }, { LOG_COMPILE_LEVEL }, { LOG_COMPILE_LEVEL },
+        { LOG_COMPILE_LEVEL }, { LOG_COMPILE_LEVEL }, { LOG_COMPILE_LEVEL }
+    };
+
+    static_assert((size_t)LogCategory::eCount == 6, "g_levels needs an initialiser per category");
+
+    static const char* s_categoryNames[] = { "general", "validation", "device", "memory", "pipeline", "frame" };
+    static const char s_severityChars[] = { 'D', 'I', 'W', 'E' };
+
+    struct Logger {
+        std::mutex                ringsMutex;
+        std::vector<std::unique_ptr<Ring>> rings;  // never freed before shutdown, the flusher holds raw pointers
+
+        LogConfig                 config;
+        FILE*                     binaryFile = nullptr;
+        std::thread               flusher;
+        std::atomic<bool>         running{ false };
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        ~Logger() { shutdown(); }
+    };
+
+    static Logger& logger()
+    {
+        static Logger s_logger;
+        return s_logger;
+    }
+
+    static size_t align8(size_t v) { return (v + 7) & ~(size_t)7; }
+
+    void Ring::copyIn(size_t pos, const void* src, size_t size)
+    {
+        size_t offset = pos & (CAPACITY - 1);
+        size_t first = std::min(size, CAPACITY - offset);
+        memcpy(m_data + offset, src, first);
+        memcpy(m_data, (const unsigned char*)src + first, size - first);
+    }
+
+    void Ring::copyOut(size_t pos, void* dst, size_t size) const
+    {
+        size_t offset = pos & (CAPACITY - 1);
+        size_t first = std::min(size, CAPACITY - offset);
+        memcpy(dst, m_data + offset, first);
+        memcpy((unsigned char*)dst + first, m_data, size - first);
+    }
+
+    bool Ring::write(const RecordHeader& header, const unsigned char* args, size_t argBytes)
+    {
+        size_t size = align8(sizeof(RecordHeader) + argBytes);
+
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        if (CAPACITY - (head - tail) < size)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        RecordHeader h = header;
+        h.size = (uint32_t)size;
+        copyIn(head, &h, sizeof(h));
+        copyIn(head + sizeof(h), args, argBytes);
+
+        // publishes the record to the flusher
+        m_head.store(head + size, std::memory_order_release);
+        return true;
+    }
+
+    size_t Ring::read(unsigned char* dst, size_t maxBytes)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_acquire);
+
+        size_t bytes = 0;
+        while (tail + bytes < head)
+        {
+            RecordHeader h;
+            copyOut(tail + bytes, &h, sizeof(h));
+            if (bytes + h.size > maxBytes)
+                break;
+
+            copyOut(tail + bytes, dst + bytes, h.size);
+            bytes += h.size;
+        }
+
+        // hands the space back to the producer
+        m_tail.store(tail + bytes, std::memory_order_release);
+        return bytes;
+    }
+
+    Ring& threadRing()
+    {
+        thread_local Ring* ring = nullptr;
+        if (!ring)
+        {
+            Logger& l = logger();
+            std::lock_guard<std::mutex> lock(l.ringsMutex);
+
+            l.rings.push_back(std::unique_ptr<Ring>(new Ring()));
+            ring = l.rings.back().get();
+            ring->threadIx = (uint32_t)l.rings.size() - 1;
+        }
+        return *ring;
+    }
+
+    uint64_t timestampNs()
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - logger().start).count();
+    }
+
+    void setLevel(LogCategory category, LogSeverity minSeverity)
+    {
+        g_levels[(size_t)category].store((uint8_t)minSeverity, std::memory_order_relaxed);
+    }
+
+    void setLevel(LogSeverity minSeverity)
+    {
+        for (auto& it : g_levels)
+            it.store((uint8_t)minSeverity, std::memory_order_relaxed);
+    }
+
+    // printf with the arguments decoded from a record, one conversion at a time. Arguments running past
+    // argBytes, as in a damaged binary log, are treated as missing
+    static void formatMessage(std::string& out, const char* format, const unsigned char* args, size_t argBytes, uint32_t argCount)
+    {
+        const unsigned char* argsEnd = args + argBytes;
+        uint32_t argIx = 0;
+
+        auto nextArg = [&](ArgType& type, uint64_t& bits, const char*& str) -> bool {
+            if (argIx >= argCount || argsEnd - args < 1)
+                return false;
+
+            type = (ArgType)args[0];
+            if (type == ArgType::eString)
+            {
+                uint32_t len;
+                if ((size_t)(argsEnd - args) < 1 + sizeof(len))
+                    return false;
+                memcpy(&len, args + 1, sizeof(len));
+                if ((size_t)(argsEnd - args) < 1 + sizeof(len) + (size_t)len + 1 || args[1 + sizeof(len) + len] != 0)
+                    return false;
+                str = (const char*)(args + 1 + sizeof(len));
+                args += 1 + sizeof(len) + len + 1;
+            }
+            else
+            {
+                if ((size_t)(argsEnd - args) < 1 + sizeof(bits))
+                    return false;
+                memcpy(&bits, args + 1, sizeof(bits));
+                args += 1 + sizeof(bits);
+            }
+            ++argIx;
+            return true;
+        };
+
+        char buff[512];
+        const char* p = format;
+        while (*p)
+        {
+            if (*p != '%')
+            {
+                out += *p++;
+                continue;
+            }
+
+            if (p[1] == '%')
+            {
+                out += '%';
+                p += 2;
+                continue;
+            }
+
+            // rebuild the spec with the length modifier the decoded type needs
+            std::string spec = "%";
+            ++p;
+            while (*p && strchr("-+ #0", *p))
+                spec += *p++;
+            while (*p && ((*p >= '0' && *p <= '9') || *p == '.' || *p == '*'))
+            {
+                if (*p == '*')
+                {
+                    ArgType type; uint64_t bits = 0; const char* str = nullptr;
+                    spec += nextArg(type, bits, str) ? std::to_string((int)(int64_t)bits) : "0";
+                    ++p;
+                }
+                else
+                {
+                    spec += *p++;
+                }
+            }
+            while (*p && strchr("hljztLqI64", *p))
+                ++p;
+
+            char conversion = *p ? *p++ : 's';
+
+            ArgType type; uint64_t bits = 0; const char* str = nullptr;
+            if (!nextArg(type, bits, str))
+            {
+                out += "<missing>";
+                continue;
+            }
+
+            int written = 0;
+            switch (conversion)
+            {
+            case 'd': case 'i':
+                written = snprintf(buff, sizeof(buff), (spec + "lld").c_str(), (long long)(int64_t)bits);
+                break;
+            case 'u': case 'o': case 'x': case 'X':
+                written = snprintf(buff, sizeof(buff), (spec + "ll" + conversion).c_str(), (unsigned long long)bits);
+                break;
+            case 'c':
+                written = snprintf(buff, sizeof(buff), (spec + "c").c_str(), (int)(int64_t)bits);
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            {
+                double d;
+                if (type == ArgType::eDouble)
+                    memcpy(&d, &bits, sizeof(d));
+                else
+                    d = type == ArgType::eInt ? (double)(int64_t)bits : (double)bits;
+                written = snprintf(buff, sizeof(buff), (spec + conversion).c_str(), d);
+                break;
+            }
+            case 'p':
+                written = snprintf(buff, sizeof(buff), "%p", (void*)(uintptr_t)bits);
+                break;
+            case 's':
+            default:
+                if (type == ArgType::eString)
+                {
+                    // strings can outgrow the scratch buffer, only pay for snprintf when a width is given
+                    if (spec.size() == 1)
+                    {
+                        out += str;
+                        continue;
+                    }
+                    written = snprintf(buff, sizeof(buff), (spec + "s").c_str(), str);
+                }
+                else
+                {
+                    written = snprintf(buff, sizeof(buff), "%llu", (unsigned long long)bits);
+                }
+                break;
+            }
+
+            if (written > 0)
+                out.append(buff, std::min((size_t)written, sizeof(buff) - 1));
+        }
+    }
+
+    static void appendPrefix(std::string& text, uint64_t timestampNs, uint8_t severity, uint8_t category)
+    {
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "%10.3f %c %-10s ", timestampNs / 1.0e6,
+            s_severityChars[severity & 3], s_categoryNames[category % (size_t)LogCategory::eCount]);
+        text += prefix;
+    }
+
+    static void drain(std::string& text, std::vector<unsigned char>& scratch)
+    {
+        Logger& l = logger();
+
+        std::vector<Ring*> rings;
+        {
+            std::lock_guard<std::mutex> lock(l.ringsMutex);
+            for (auto& it : l.rings)
+                rings.push_back(it.get());
+        }
+
+        for (Ring* ring : rings)
+        {
+            uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped && l.config.console)
+                text += "[log] dropped " + std::to_string(dropped) + " records from thread " + std::to_string(ring->threadIx) + "\n";
+
+            size_t bytes;
+            while ((bytes = ring->read(scratch.data(), scratch.size())) > 0)
+            {
+                size_t pos = 0;
+                while (pos < bytes)
+                {
+                    RecordHeader h;
+                    memcpy(&h, scratch.data() + pos, sizeof(h));
+                    const unsigned char* args = scratch.data() + pos + sizeof(h);
+
+                    if (l.config.console)
+                    {
+                        appendPrefix(text, h.timestampNs, h.severity, h.category);
+                        formatMessage(text, h.format, args, h.size - sizeof(h), h.argCount);
+                        text += '\n';
+                    }
+
+                    if (l.binaryFile)
+                    {
+                        // zeroed first so padding and reserved bytes never carry stale stack memory into the file
+                        BinaryRecord record;
+                        memset(&record, 0, sizeof(record));
+                        record.formatLength = (uint32_t)strlen(h.format);
+                        record.size = (uint32_t)(sizeof(record) + record.formatLength + h.size - sizeof(h));
+                        record.severity = h.severity;
+                        record.category = h.category;
+                        record.argCount = h.argCount;
+                        record.timestampNs = h.timestampNs;
+                        record.threadIx = ring->threadIx;
+
+                        fwrite(&record, sizeof(record), 1, l.binaryFile);
+                        fwrite(h.format, 1, record.formatLength, l.binaryFile);
+                        fwrite(args, 1, h.size - sizeof(h), l.binaryFile);
+                    }
+
+                    pos += h.size;
+                }
+            }
+        }
+
+        if (!text.empty())
+        {
+            fwrite(text.data(), 1, text.size(), stdout);
+            fflush(stdout);
+            text.clear();
+        }
+        if (l.binaryFile)
+            fflush(l.binaryFile);
+    }
+
+    static void flusherLoop()
+    {
+        Logger& l = logger();
+
+        std::string text;
+        std::vector<unsigned char> scratch(Ring::CAPACITY);
+
+        while (l.running.load(std::memory_order_acquire))
+        {
+            drain(text, scratch);
+            std::this_thread::sleep_for(std::chrono::milliseconds(l.config.flushIntervalMs));
+        }
+
+        drain(text, scratch);
+    }
+
+    void init(const LogConfig& config)
+    {
+        Logger& l = logger();
+        if (l.running)
+            return;
+
+        l.config = config;
+
+        if (config.binaryPath)
+        {
+            l.binaryFile = fopen(config.binaryPath, "wb");
+            if (l.binaryFile)
+                fwrite(BINARY_MAGIC, 1, sizeof(BINARY_MAGIC), l.binaryFile);
+        }
+
+        l.running = true;
+        l.flusher = std::thread(flusherLoop);
+    }
+
+    bool decodeBinary(const char* path, std::string& text, const char** reason)
+    {
+        FILE* file = fopen(path, "rb");
+        if (!file)
+        {
+            *reason = "can't open the file";
+            return false;
+        }
+
+        std::vector<unsigned char> data;
+        unsigned char buff[64 * 1024];
+        size_t read;
+        while ((read = fread(buff, 1, sizeof(buff), file)) > 0)
+            data.insert(data.end(), buff, buff + read);
+        fclose(file);
+
+        if (data.size() < sizeof(BINARY_MAGIC) || memcmp(data.data(), BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0)
+        {
+            *reason = "not a binary log";
+            return false;
+        }
+
+        // a record cut short, by a crash mid-write say, ends the log
+        *reason = nullptr;
+        std::vector<std::pair<uint64_t, size_t>> records;   // timestamp and offset
+        size_t pos = sizeof(BINARY_MAGIC);
+        while (pos < data.size())
+        {
+            BinaryRecord record;
+            if (data.size() - pos < sizeof(record))
+            {
+                *reason = "truncated record";
+                break;
+            }
+
+            memcpy(&record, data.data() + pos, sizeof(record));
+            if (record.size < sizeof(record) + (size_t)record.formatLength || record.size > data.size() - pos)
+            {
+                *reason = "truncated record";
+                break;
+            }
+
+            records.push_back(std::make_pair(record.timestampNs, pos));
+            pos += record.size;
+        }
+
+        // each flush writes one thread's records after another's, so threads only interleave once sorted
+        std::stable_sort(records.begin(), records.end(), [](const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b) {
+            return a.first < b.first;
+        });
+
+        for (auto& it : records)
+        {
+            BinaryRecord record;
+            memcpy(&record, data.data() + it.second, sizeof(record));
+
+            const unsigned char* formatStart = data.data() + it.second + sizeof(record);
+            const std::string format((const char*)formatStart, record.formatLength);
+            const unsigned char* args = formatStart + record.formatLength;
+
+            appendPrefix(text, record.timestampNs, record.severity, record.category);
+            text += "[" + std::to_string(record.threadIx) + "] ";
+            formatMessage(text, format.c_str(), args, record.size - sizeof(record) - record.formatLength, record.argCount);
+            text += '\n';
+        }
+
+        return *reason == nullptr;
+    }
+
+    void shutdown()
+    {
+        Logger& l = logger();
+        if (!l.running.exchange(false))
+            return;
+
+        l.flusher.join();
+
+        if (l.binaryFile)
+        {
+            fclose(l.binaryFile);
+            l.binaryFile = nullptr;
+        }
+    }
+}
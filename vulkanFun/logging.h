@@ -0,0 +1,233 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <type_traits>
+
+// Severities below LOG_COMPILE_LEVEL compile to nothing, the rest are filtered per category at runtime
+#define LOG_LEVEL_DEBUG   0
+#define LOG_LEVEL_INFO    1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR   3
+
+#ifndef LOG_COMPILE_LEVEL
+#ifdef NDEBUG
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+enum class LogSeverity : uint8_t {
+    eDebug = LOG_LEVEL_DEBUG,
+    eInfo = LOG_LEVEL_INFO,
+    eWarning = LOG_LEVEL_WARNING,
+    eError = LOG_LEVEL_ERROR
+};
+
+enum class LogCategory : uint8_t {
+    eGeneral,
+    eValidation,
+    eDevice,
+    eMemory,
+    ePipeline,
+    eFrame,
+    eCount
+};
+
+struct LogConfig {
+    bool                          console = true;
+    const char*                   binaryPath = nullptr;   // raw records, formatted offline by decodeBinary
+    uint32_t                      flushIntervalMs = 2;
+};
+
+// Logging without locks or formatting on the calling thread. Each thread appends records to a ring of
+// its own: the format string pointer plus the arguments encoded by type, strings copied. A background
+// thread drains the rings and formats the text, so a log call costs a few stores and a full ring drops
+// the record rather than blocking. Format strings must be literals, they're read long after the call
+namespace logging
+{
+    enum class ArgType : uint8_t {
+        eInt,
+        eUInt,
+        eDouble,
+        eString,
+        ePointer
+    };
+
+    struct RecordHeader {
+        uint32_t                  size;           // header + arguments, padded to 8
+        uint8_t                   severity;
+        uint8_t                   category;
+        uint8_t                   argCount;
+        uint8_t                   reserved;
+        uint64_t                  timestampNs;
+        const char*               format;
+    };
+
+    // a binary log is BINARY_MAGIC then one of these per record, each followed by its format string,
+    // unterminated, and the arguments as encodeArg wrote them
+    inline constexpr char         BINARY_MAGIC[8] = { 'V', 'K', 'L', 'O', 'G', '0', '0', '1' };
+
+    struct BinaryRecord {
+        uint32_t                  size;           // this header, the format string and the arguments
+        uint8_t                   severity;
+        uint8_t                   category;
+        uint8_t                   argCount;
+        uint8_t                   reserved;
+        uint64_t                  timestampNs;
+        uint32_t                  threadIx;
+        uint32_t                  formatLength;
+    };
+
+    // single producer (the owning thread), single consumer (the flusher)
+    class Ring
+    {
+    public:
+        static constexpr size_t   CAPACITY = 256 * 1024;
+
+        bool                      write(const RecordHeader& header, const unsigned char* args, size_t argBytes);
+        size_t                    read(unsigned char* dst, size_t maxBytes); // whole records only
+
+        uint32_t                  threadIx = 0;
+        std::atomic<uint64_t>     dropped{ 0 };
+
+    private:
+        void                      copyIn(size_t pos, const void* src, size_t size);
+        void                      copyOut(size_t pos, void* dst, size_t size) const;
+
+        std::atomic<size_t>       m_head{ 0 };
+        std::atomic<size_t>       m_tail{ 0 };
+        unsigned char             m_data[CAPACITY];
+    };
+
+    void                          init(const LogConfig& config = LogConfig());
+    void                          shutdown();   // drains everything still queued
+
+    void                          setLevel(LogCategory category, LogSeverity minSeverity);
+    void                          setLevel(LogSeverity minSeverity); // every category
+
+    // a binary log as text, one line per record like the console's plus the thread, in timestamp order.
+    // False with the reason if the file is missing, not a log, or damaged; text then holds the records
+    // before the damage
+    bool                          decodeBinary(const char* path, std::string& text, const char** reason);
+
+    extern std::atomic<uint8_t>   g_levels[(size_t)LogCategory::eCount];
+
+    inline bool                   isEnabled(LogCategory category, LogSeverity severity)
+    {
+        return (uint8_t)severity >= g_levels[(size_t)category].load(std::memory_order_relaxed);
+    }
+
+    Ring&                         threadRing();
+    uint64_t                      timestampNs();
+
+    // argument encoding, one type tag byte then the value
+    template<typename T>
+    inline size_t                 argBytes(const T& v)
+    {
+        typedef typename std::decay<T>::type D;
+        if constexpr (std::is_same<D, const char*>::value || std::is_same<D, char*>::value)
+        {
+            const char* s = v;
+            return 1 + sizeof(uint32_t) + (s ? strlen(s) : 6) + 1;
+        }
+        else
+            return 1 + sizeof(uint64_t);
+    }
+
+    template<typename T>
+    inline unsigned char*         encodeArg(unsigned char* dst, const T& v)
+    {
+        typedef typename std::decay<T>::type D;
+        if constexpr (std::is_same<D, const char*>::value || std::is_same<D, char*>::value)
+        {
+            const char* s = v;
+            if (!s)
+                s = "(null)";
+            uint32_t len = (uint32_t)strlen(s);
+            *dst++ = (unsigned char)ArgType::eString;
+            memcpy(dst, &len, sizeof(len));
+            memcpy(dst + sizeof(len), s, len + 1);
+            return dst + sizeof(len) + len + 1;
+        }
+        else
+        {
+            ArgType type;
+            uint64_t bits;
+            if constexpr (std::is_floating_point<D>::value)
+            {
+                double d = (double)v;
+                type = ArgType::eDouble;
+                memcpy(&bits, &d, sizeof(bits));
+            }
+            else if constexpr (std::is_pointer<D>::value)
+            {
+                type = ArgType::ePointer;
+                bits = (uint64_t)(uintptr_t)v;
+            }
+            else if constexpr (std::is_enum<D>::value)
+            {
+                type = ArgType::eInt;
+                bits = (uint64_t)(int64_t)v;
+            }
+            else if constexpr (std::is_signed<D>::value)
+            {
+                type = ArgType::eInt;
+                bits = (uint64_t)(int64_t)v;
+            }
+            else
+            {
+                type = ArgType::eUInt;
+                bits = (uint64_t)v;
+            }
+            *dst++ = (unsigned char)type;
+            memcpy(dst, &bits, sizeof(bits));
+            return dst + sizeof(bits);
+        }
+    }
+
+    template<typename... Args>
+    inline void                   write(LogSeverity severity, LogCategory category, const char* format, const Args&... args)
+    {
+        static_assert(sizeof...(Args) < 256, "too many log arguments");
+
+        size_t argSize = 0;
+        ((argSize += argBytes(args)), ...);
+
+        // small messages encode on the stack, long ones are rare enough to pay for the heap
+        unsigned char stackArgs[512];
+        unsigned char* encoded = argSize <= sizeof(stackArgs) ? stackArgs : new unsigned char[argSize];
+
+        unsigned char* dst = encoded;
+        ((dst = encodeArg(dst, args)), ...);
+        (void)dst;
+
+        RecordHeader header;
+        header.size = 0;
+        header.severity = (uint8_t)severity;
+        header.category = (uint8_t)category;
+        header.argCount = (uint8_t)sizeof...(Args);
+        header.reserved = 0;
+        header.timestampNs = timestampNs();
+        header.format = format;
+
+        threadRing().write(header, encoded, argSize);
+
+        if (encoded != stackArgs)
+            delete[] encoded;
+    }
+}
+
+#define LOG_WRITE(level, severity, category, fmt, ...) \
+    do { \
+        if (level >= LOG_COMPILE_LEVEL && logging::isEnabled(category, severity)) \
+            logging::write(severity, category, "" fmt, ##__VA_ARGS__); \
+    } while (0)
+
+#define LOG_DEBUG(category, fmt, ...)   LOG_WRITE(LOG_LEVEL_DEBUG, LogSeverity::eDebug, category, fmt, ##__VA_ARGS__)
+#define LOG_INFO(category, fmt, ...)    LOG_WRITE(LOG_LEVEL_INFO, LogSeverity::eInfo, category, fmt, ##__VA_ARGS__)
+#define LOG_WARNING(category, fmt, ...) LOG_WRITE(LOG_LEVEL_WARNING, LogSeverity::eWarning, category, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(category, fmt, ...)   LOG_WRITE(LOG_LEVEL_ERROR, LogSeverity::eError, category, fmt, ##__VA_ARGS__)
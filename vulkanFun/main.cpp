@@ -1,6 +1,10 @@
 #include "trace.h"
 #include <GLFW/glfw3.h>
 #include "vk_renderer.h"
+#include "mesh.h"
+#include <string.h>
+#include <stdlib.h>
+#include <chrono>
 
 #pragma comment(linker, "/SUBSYSTEM:windows /ENTRY:mainCRTStartup")
 
@@ -30,10 +34,135 @@ static void printVideoModes()
     TRACE("current video mode: %d %d @%dhz", currentVideoMode->width, currentVideoMode->height, currentVideoMode->refreshRate);
 }
 
-int main()
+int main(int argc, char** argv)
 {
     const unsigned WIDTH = 640;
     const unsigned HEIGHT = 480;
+
+    // --log-binary file writes raw log records alongside the console output
+    // --decode-log file prints a --log-binary file as text then exits, no GPU needed
+    // --bench-record [draws] times command buffer recording across thread counts then exits
+    // --bench-mesh [triangles] reports the mesh optimizer's ACMR/ATVR on a generated mesh then exits, no GPU needed
+    // --headless [frames] renders offscreen with no window, --output file.ppm|png saves the last frame
+    // --trace file.json captures CPU/GPU scopes for chrome://tracing
+    // --msaa [samples] renders multisampled, 4x by default, clamped to what the device supports
+    // --async-compute moves the cull to a compute-only queue family when the device has one
+    bool benchRecord = false;
+    uint32_t benchDraws = 100000;
+    bool benchMesh = false;
+    uint32_t benchTriangles = 100000;
+    bool headless = false;
+    uint32_t headlessFrames = 300;
+    const char* outputFile = nullptr;
+    const char* traceFile = nullptr;
+    uint32_t msaaSamples = 1;
+    bool asyncCompute = false;
+    LogConfig logConfig;
+    const char* decodeLog = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--bench-record") == 0)
+        {
+            benchRecord = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                benchDraws = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--bench-mesh") == 0)
+        {
+            benchMesh = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                benchTriangles = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--headless") == 0)
+        {
+            headless = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                headlessFrames = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--msaa") == 0)
+        {
+            msaaSamples = 4;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                msaaSamples = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--async-compute") == 0)
+        {
+            asyncCompute = true;
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            outputFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            traceFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--log-binary") == 0 && i + 1 < argc)
+        {
+            logConfig.binaryPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--decode-log") == 0 && i + 1 < argc)
+        {
+            decodeLog = argv[++i];
+        }
+    }
+
+    // before the logger starts, so nothing it prints lands in the middle of the decoded records
+    if (decodeLog)
+    {
+        std::string text;
+        const char* reason = nullptr;
+        bool decoded = logging::decodeBinary(decodeLog, text, &reason);
+        fwrite(text.data(), 1, text.size(), stdout);
+        if (!decoded)
+            fprintf(stderr, "%s: %s\n", decodeLog, reason);
+        return decoded ? 0 : 1;
+    }
+
+    logging::init(logConfig);
+
+    if (benchMesh)
+    {
+        mesh::benchmark(benchTriangles);
+        logging::shutdown();
+        return 0;
+    }
+
+    if (headless)
+    {
+        r.setAsyncCompute(asyncCompute);
+        r.init(nullptr, WIDTH, HEIGHT, DEFAULT_FRAMES_IN_FLIGHT, msaaSamples);
+        r.getProfiler().setCapture(traceFile != nullptr);
+
+        // the benchmark leaves the current frame's buffers recorded but never submitted, so it runs alone
+        if (benchRecord)
+        {
+            r.benchmarkRecording(benchDraws);
+            r.shutdown();
+            logging::shutdown();
+            return 0;
+        }
+
+        // no vsync or presentation, so this is raw submit throughput
+        auto start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < headlessFrames; ++i)
+        {
+            r.updateFrame();
+            r.drawFrame();
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        TRACE("headless: %u frames in %.2f ms, %.3f ms per frame", headlessFrames, ms, headlessFrames ? ms / headlessFrames : 0.0);
+
+        if (outputFile)
+            r.readbackImage(outputFile);
+        if (traceFile)
+            r.getProfiler().writeChromeTrace(traceFile);
+
+        r.shutdown();
+        logging::shutdown();
+        return 0;
+    }
     
     glfwInit();
 
@@ -45,18 +174,27 @@ int main()
     glfwSetWindowSizeCallback(window, onWindowResized);
 
     VKRenderer::printDecorations();
-    r.init(window, WIDTH, HEIGHT);
+    r.setAsyncCompute(asyncCompute);
+    r.init(window, WIDTH, HEIGHT, DEFAULT_FRAMES_IN_FLIGHT, msaaSamples);
+    r.getProfiler().setCapture(traceFile != nullptr);
+
+    if (benchRecord)
+        r.benchmarkRecording(benchDraws);
 
-    while (!glfwWindowShouldClose(window))
+    while (!benchRecord && !glfwWindowShouldClose(window))
     {
         glfwPollEvents();
         r.updateFrame();
         r.drawFrame();
     }
 
+    if (traceFile)
+        r.getProfiler().writeChromeTrace(traceFile);
+
     glfwDestroyWindow(window);
 
     r.shutdown();
+    logging::shutdown();
 
     return 0;
 }
@@ -0,0 +1,718 @@
+#include "mesh.h"
+#include "trace.h"
+#include "blob.h"
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+static_assert(sizeof(mesh::FileHeader) == 128, "mesh::FileHeader layout is part of the file format");
+
+static const uint32_t NO_VERTEX = ~0u;
+
+static size_t alignSection(size_t size)
+{
+    return (size + mesh::SECTION_ALIGNMENT - 1) & ~(size_t)(mesh::SECTION_ALIGNMENT - 1);
+}
+
+// the FIFO holds vertex v while fewer than cacheSize others have been added after it, so a timestamp per
+// vertex is all the simulation needs. Moving time on by more than the cache size empties it
+struct FifoCache {
+    std::vector<uint32_t>         added;
+    uint32_t                      time;
+    uint32_t                      size;
+
+    FifoCache(size_t vertexCount, uint32_t cacheSize) : added(vertexCount, 0), time(cacheSize + 1), size(cacheSize) {}
+
+    bool contains(uint32_t v) const { return time - added[v] <= size; }
+    void flush() { time += size + 1; }
+
+    // true on a miss
+    bool touch(uint32_t v)
+    {
+        if (contains(v))
+            return false;
+        added[v] = time++;
+        return true;
+    }
+};
+
+static uint32_t hashVertex(const void* const* streams, const uint32_t* strides, uint32_t streamCount, size_t v)
+{
+    uint32_t h = 2166136261u;
+    for (uint32_t s = 0; s < streamCount; ++s)
+    {
+        const unsigned char* bytes = (const unsigned char*)streams[s] + v * strides[s];
+        for (uint32_t i = 0; i < strides[s]; i += 4)
+        {
+            uint32_t word;
+            memcpy(&word, bytes + i, sizeof(word));
+            h = (h ^ word) * 16777619u;
+        }
+    }
+
+    // FNV alone leaves the low bits, which pick the slot, poorly mixed
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
+
+static bool sameVertex(const void* const* streams, const uint32_t* strides, uint32_t streamCount, size_t a, size_t b)
+{
+    for (uint32_t s = 0; s < streamCount; ++s)
+    {
+        const unsigned char* data = (const unsigned char*)streams[s];
+        if (memcmp(data + a * strides[s], data + b * strides[s], strides[s]) != 0)
+            return false;
+    }
+    return true;
+}
+
+size_t mesh::generateVertexRemap(uint32_t* remap, const void* const* streams, const uint32_t* strides,
+                                 uint32_t streamCount, size_t vertexCount)
+{
+    // open addressing, at most half full
+    size_t tableSize = 16;
+    while (tableSize < vertexCount * 2)
+        tableSize *= 2;
+
+    std::vector<uint32_t> table(tableSize, NO_VERTEX);
+    const size_t mask = tableSize - 1;
+
+    size_t unique = 0;
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        size_t slot = hashVertex(streams, strides, streamCount, v) & mask;
+        while (table[slot] != NO_VERTEX && !sameVertex(streams, strides, streamCount, table[slot], v))
+            slot = (slot + 1) & mask;
+
+        if (table[slot] == NO_VERTEX)
+        {
+            table[slot] = (uint32_t)v;
+            remap[v] = (uint32_t)unique++;
+        }
+        else
+        {
+            remap[v] = remap[table[slot]];
+        }
+    }
+    return unique;
+}
+
+void mesh::optimizeVertexCache(uint32_t* dst, const uint32_t* indices, size_t indexCount, size_t vertexCount,
+                               uint32_t cacheSize, std::vector<uint32_t>* clusters)
+{
+    const size_t triangleCount = indexCount / 3;
+
+    // triangles using each vertex, and how many of them are still to be emitted
+    std::vector<uint32_t> live(vertexCount, 0);
+    for (size_t i = 0; i < triangleCount * 3; ++i)
+        ++live[indices[i]];
+
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v)
+        offsets[v + 1] = offsets[v] + live[v];
+
+    std::vector<uint32_t> adjacency(triangleCount * 3);
+    {
+        std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < triangleCount * 3; ++i)
+            adjacency[cursor[indices[i]]++] = (uint32_t)(i / 3);
+    }
+
+    FifoCache cache(vertexCount, cacheSize);
+    std::vector<char> emitted(triangleCount, 0);
+    std::vector<uint32_t> deadEnds;
+    std::vector<uint32_t> candidates;
+    size_t scan = 0;
+    size_t written = 0;
+
+    if (clusters)
+        clusters->clear();
+
+    // recently emitted vertices first, then the lowest numbered one that's still live
+    auto skipDeadEnd = [&]() -> uint32_t {
+        while (!deadEnds.empty())
+        {
+            uint32_t v = deadEnds.back();
+            deadEnds.pop_back();
+            if (live[v] > 0)
+                return v;
+        }
+        for (; scan < vertexCount; ++scan)
+        {
+            if (live[scan] > 0)
+                return (uint32_t)scan;
+        }
+        return NO_VERTEX;
+    };
+
+    uint32_t fan = skipDeadEnd();
+    if (clusters && fan != NO_VERTEX)
+        clusters->push_back(0);
+
+    while (fan != NO_VERTEX)
+    {
+        // emit every remaining triangle around the fan vertex
+        candidates.clear();
+        for (uint32_t a = offsets[fan]; a < offsets[fan + 1]; ++a)
+        {
+            uint32_t t = adjacency[a];
+            if (emitted[t])
+                continue;
+
+            for (uint32_t k = 0; k < 3; ++k)
+            {
+                uint32_t v = indices[t * 3 + k];
+                dst[written++] = v;
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                cache.touch(v);
+            }
+            emitted[t] = 1;
+        }
+
+        // next is the oldest neighbour whose fan would still fit in the cache, else any live neighbour
+        uint32_t next = NO_VERTEX;
+        int64_t best = -1;
+        for (uint32_t v : candidates)
+        {
+            if (live[v] == 0)
+                continue;
+
+            int64_t age = cache.time - cache.added[v];
+            int64_t priority = age + 2 * (int64_t)live[v] <= cacheSize ? age : 0;
+            if (priority > best)
+            {
+                best = priority;
+                next = v;
+            }
+        }
+
+        // a dead end, the order is free to jump here, which is where clusters start
+        if (next == NO_VERTEX)
+        {
+            next = skipDeadEnd();
+            if (clusters && next != NO_VERTEX)
+                clusters->push_back((uint32_t)(written / 3));
+        }
+
+        fan = next;
+    }
+}
+
+void mesh::optimizeOverdraw(uint32_t* dst, const uint32_t* indices, size_t indexCount,
+                            const float* positions, uint32_t positionStride, size_t vertexCount,
+                            const std::vector<uint32_t>& clusters, uint32_t cacheSize, float threshold)
+{
+    const uint32_t triangleCount = (uint32_t)(indexCount / 3);
+    if (triangleCount == 0)
+        return;
+
+    // split where a run of a cluster is already cheap enough on a cold cache
+    std::vector<uint32_t> runs;
+    FifoCache cache(vertexCount, cacheSize);
+
+    auto triangleMisses = [&](uint32_t t) {
+        return (uint32_t)cache.touch(indices[t * 3 + 0]) + cache.touch(indices[t * 3 + 1]) + cache.touch(indices[t * 3 + 2]);
+    };
+
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        const uint32_t start = clusters[c];
+        const uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+
+        cache.flush();
+        uint32_t clusterMisses = 0;
+        for (uint32_t t = start; t < end; ++t)
+            clusterMisses += triangleMisses(t);
+
+        const float limit = threshold * (float)clusterMisses / (float)(end - start);
+
+        cache.flush();
+        runs.push_back(start);
+        uint32_t runStart = start;
+        uint32_t runMisses = 0;
+        for (uint32_t t = start; t + 1 < end; ++t)
+        {
+            runMisses += triangleMisses(t);
+            if ((float)runMisses <= limit * (float)(t + 1 - runStart))
+            {
+                runs.push_back(t + 1);
+                runStart = t + 1;
+                runMisses = 0;
+                cache.flush();
+            }
+        }
+    }
+
+    // area weighted centroid and normal of every run, and of the whole mesh
+    struct Run {
+        uint32_t                  start;
+        uint32_t                  end;
+        float                     sortKey;
+    };
+    std::vector<Run> sorted(runs.size());
+    std::vector<float> centroids(runs.size() * 3, 0.0f);
+    std::vector<float> normals(runs.size() * 3, 0.0f);
+    float meshCentroid[3] = {};
+    float meshArea = 0.0f;
+
+    for (size_t r = 0; r < runs.size(); ++r)
+    {
+        sorted[r].start = runs[r];
+        sorted[r].end = r + 1 < runs.size() ? runs[r + 1] : triangleCount;
+
+        float area = 0.0f;
+        for (uint32_t t = sorted[r].start; t < sorted[r].end; ++t)
+        {
+            const float* p0 = positions + (size_t)indices[t * 3 + 0] * positionStride;
+            const float* p1 = positions + (size_t)indices[t * 3 + 1] * positionStride;
+            const float* p2 = positions + (size_t)indices[t * 3 + 2] * positionStride;
+
+            float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+            float a = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+            for (int k = 0; k < 3; ++k)
+            {
+                centroids[r * 3 + k] += (p0[k] + p1[k] + p2[k]) * a;
+                normals[r * 3 + k] += n[k];
+            }
+            area += a;
+        }
+
+        for (int k = 0; k < 3; ++k)
+            meshCentroid[k] += centroids[r * 3 + k];
+        meshArea += area;
+
+        if (area > 0.0f)
+        {
+            for (int k = 0; k < 3; ++k)
+                centroids[r * 3 + k] /= area * 3.0f;
+        }
+    }
+
+    if (meshArea > 0.0f)
+    {
+        for (int k = 0; k < 3; ++k)
+            meshCentroid[k] /= meshArea * 3.0f;
+    }
+
+    // runs on the outside facing away from the middle tend to hide the rest, so they go first
+    for (size_t r = 0; r < runs.size(); ++r)
+    {
+        const float* n = &normals[r * 3];
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        float key = 0.0f;
+        for (int k = 0; k < 3; ++k)
+            key += (centroids[r * 3 + k] - meshCentroid[k]) * n[k];
+        sorted[r].sortKey = length > 0.0f ? key / length : 0.0f;
+    }
+
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Run& a, const Run& b) { return a.sortKey > b.sortKey; });
+
+    size_t written = 0;
+    for (const Run& run : sorted)
+    {
+        memcpy(dst + written, indices + run.start * 3, (run.end - run.start) * 3 * sizeof(uint32_t));
+        written += (run.end - run.start) * 3;
+    }
+}
+
+size_t mesh::optimizeVertexFetch(uint32_t* remap, const uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+    std::fill(remap, remap + vertexCount, NO_VERTEX);
+
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        if (remap[indices[i]] == NO_VERTEX)
+            remap[indices[i]] = next++;
+    }
+    return next;
+}
+
+mesh::CacheStats mesh::simulateVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+    FifoCache cache(vertexCount, cacheSize);
+
+    uint32_t misses = 0;
+    for (size_t i = 0; i < indexCount; ++i)
+        misses += cache.touch(indices[i]);
+
+    CacheStats stats;
+    stats.acmr = indexCount >= 3 ? (float)misses / (float)(indexCount / 3) : 0.0f;
+    stats.atvr = vertexCount ? (float)misses / (float)vertexCount : 0.0f;
+    return stats;
+}
+
+uint64_t mesh::layoutHash(const VertexAttributeInfo* info, uint32_t attributeCount)
+{
+    return file_helpers::hash64(info, attributeCount * sizeof(VertexAttributeInfo));
+}
+
+uint64_t mesh::hashSource(const VertexAttributeInfo* info, uint32_t attributeCount,
+                          const VertexAttributeSource* sources, size_t vertexCount,
+                          const uint32_t* indices, size_t indexCount)
+{
+    uint64_t hash = file_helpers::hash64(indices, indices ? indexCount * sizeof(uint32_t) : 0);
+    for (uint32_t a = 0; a < attributeCount; ++a)
+    {
+        for (size_t v = 0; v < vertexCount; ++v)
+            hash = file_helpers::hash64(sources[a].data + v * sources[a].stride, info[a].components * sizeof(float), hash);
+    }
+    return hash;
+}
+
+void mesh::build(const VertexAttributeInfo* info, uint32_t attributeCount, const uint32_t* strides,
+                 const VertexAttributeSource* sources, size_t vertexCount,
+                 const uint32_t* indices, size_t indexCount,
+                 Mesh& out, const BuildOptions& options, BuildStats* stats)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    uint32_t streamCount = 0;
+    for (uint32_t a = 0; a < attributeCount; ++a)
+        streamCount = std::max(streamCount, info[a].stream + 1);
+
+    std::vector<uint32_t> input;
+    if (!indices)
+    {
+        input.resize(vertexCount);
+        for (size_t v = 0; v < vertexCount; ++v)
+            input[v] = (uint32_t)v;
+        indices = input.data();
+        indexCount = vertexCount;
+    }
+
+    if (indexCount % 3 != 0)
+        TRACE("Mesh has %u indices, the last partial triangle is dropped", (uint32_t)indexCount);
+    indexCount -= indexCount % 3;
+
+    out = Mesh();
+    out.layoutHash = layoutHash(info, attributeCount);
+    out.streamCount = streamCount;
+
+    out.sourceHash = hashSource(info, attributeCount, sources, vertexCount, indices, indexCount);
+
+    // vertices are merged once packed, so ones only quantization tells apart become one
+    std::vector<unsigned char> packed[MAX_VERTEX_STREAMS];
+    void* packedStreams[MAX_VERTEX_STREAMS] = {};
+    for (uint32_t s = 0; s < streamCount; ++s)
+    {
+        packed[s].resize(vertexCount * strides[s]);
+        packedStreams[s] = packed[s].data();
+        out.streamStrides[s] = strides[s];
+    }
+    vertex_encode::encode(info, attributeCount, strides, sources, vertexCount, packedStreams);
+
+    std::vector<uint32_t> remap(vertexCount);
+    const size_t uniqueCount = generateVertexRemap(remap.data(), packedStreams, strides, streamCount, vertexCount);
+
+    // one source vertex for each merged one, and its position for the overdraw sort
+    std::vector<uint32_t> representative(uniqueCount);
+    std::vector<float> positions(uniqueCount * 3, 0.0f);
+    const VertexAttributeSource& position = sources[options.positionAttribute];
+    const uint32_t positionComponents = std::min(info[options.positionAttribute].components, 3u);
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        representative[remap[v]] = (uint32_t)v;
+        for (uint32_t k = 0; k < positionComponents; ++k)
+            positions[remap[v] * 3 + k] = position.data[v * position.stride + k];
+    }
+
+    // triangles that collapsed to a line or a point draw nothing
+    std::vector<uint32_t> merged;
+    merged.reserve(indexCount);
+    for (size_t i = 0; i < indexCount; i += 3)
+    {
+        uint32_t a = remap[indices[i + 0]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+        if (a != b && b != c && c != a)
+        {
+            merged.push_back(a);
+            merged.push_back(b);
+            merged.push_back(c);
+        }
+    }
+
+    std::vector<uint32_t> cacheOrder(merged.size());
+    std::vector<uint32_t> clusters;
+    optimizeVertexCache(cacheOrder.data(), merged.data(), merged.size(), uniqueCount, options.cacheSize, &clusters);
+
+    std::vector<uint32_t> ordered(merged.size());
+    optimizeOverdraw(ordered.data(), cacheOrder.data(), cacheOrder.size(), positions.data(), 3, uniqueCount,
+                     clusters, options.cacheSize, options.overdrawThreshold);
+
+    std::vector<uint32_t> fetchRemap(uniqueCount);
+    const size_t finalCount = optimizeVertexFetch(fetchRemap.data(), ordered.data(), ordered.size(), uniqueCount);
+
+    out.vertexCount = (uint32_t)finalCount;
+    out.indices.resize(ordered.size());
+    for (size_t i = 0; i < ordered.size(); ++i)
+        out.indices[i] = fetchRemap[ordered[i]];
+
+    for (uint32_t s = 0; s < streamCount; ++s)
+        out.streams[s].resize(finalCount * strides[s]);
+
+    bool first = true;
+    for (size_t u = 0; u < uniqueCount; ++u)
+    {
+        const uint32_t to = fetchRemap[u];
+        if (to == NO_VERTEX)
+            continue;
+
+        for (uint32_t s = 0; s < streamCount; ++s)
+            memcpy(out.streams[s].data() + (size_t)to * strides[s], packed[s].data() + (size_t)representative[u] * strides[s], strides[s]);
+
+        for (int k = 0; k < 3; ++k)
+        {
+            const float p = positions[u * 3 + k];
+            out.boundsMin[k] = first ? p : std::min(out.boundsMin[k], p);
+            out.boundsMax[k] = first ? p : std::max(out.boundsMax[k], p);
+        }
+        first = false;
+    }
+
+    if (stats)
+    {
+        stats->inputVertices = (uint32_t)vertexCount;
+        stats->uniqueVertices = (uint32_t)finalCount;
+        stats->triangles = (uint32_t)(out.indices.size() / 3);
+        stats->clusters = (uint32_t)clusters.size();
+        stats->input = simulateVertexCache(indices, indexCount, vertexCount, options.cacheSize);
+        stats->merged = simulateVertexCache(merged.data(), merged.size(), uniqueCount, options.cacheSize);
+        stats->cacheOrder = simulateVertexCache(cacheOrder.data(), cacheOrder.size(), uniqueCount, options.cacheSize);
+        stats->optimized = simulateVertexCache(out.indices.data(), out.indices.size(), finalCount, options.cacheSize);
+        stats->ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+}
+
+std::vector<unsigned char> mesh::serialize(const Mesh& mesh)
+{
+    const uint32_t indexSize = mesh.indexSize();
+
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = FILE_MAGIC;
+    header.version = FILE_VERSION;
+    header.indexSize = (uint16_t)indexSize;
+    header.layoutHash = mesh.layoutHash;
+    header.sourceHash = mesh.sourceHash;
+    header.vertexCount = mesh.vertexCount;
+    header.indexCount = (uint32_t)mesh.indices.size();
+    header.streamCount = mesh.streamCount;
+    memcpy(header.boundsMin, mesh.boundsMin, sizeof(header.boundsMin));
+    memcpy(header.boundsMax, mesh.boundsMax, sizeof(header.boundsMax));
+
+    // every section starts aligned, so the mapping can be used in place
+    size_t offset = alignSection(sizeof(header));
+    for (uint32_t s = 0; s < mesh.streamCount; ++s)
+    {
+        header.streamOffsets[s] = offset;
+        header.streamStrides[s] = mesh.streamStrides[s];
+        offset += alignSection(mesh.streams[s].size());
+    }
+    header.indexOffset = offset;
+    offset += alignSection(mesh.indices.size() * indexSize);
+    header.fileSize = offset;
+
+    std::vector<unsigned char> contents(offset, 0);
+    for (uint32_t s = 0; s < mesh.streamCount; ++s)
+    {
+        if (!mesh.streams[s].empty())
+            memcpy(contents.data() + header.streamOffsets[s], mesh.streams[s].data(), mesh.streams[s].size());
+    }
+
+    unsigned char* indexData = contents.data() + header.indexOffset;
+    if (indexSize == 2)
+    {
+        for (size_t i = 0; i < mesh.indices.size(); ++i)
+        {
+            uint16_t index = (uint16_t)mesh.indices[i];
+            memcpy(indexData + i * 2, &index, sizeof(index));
+        }
+    }
+    else if (!mesh.indices.empty())
+    {
+        memcpy(indexData, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+    }
+
+    header.checksum = blob::crc32c(contents.data() + sizeof(header), contents.size() - sizeof(header));
+    memcpy(contents.data(), &header, sizeof(header));
+    return contents;
+}
+
+bool mesh::writeFile(const std::string& path, const Mesh& mesh)
+{
+    std::vector<unsigned char> contents = serialize(mesh);
+    if (!file_helpers::writeFileAtomic(path, contents.data(), contents.size()))
+    {
+        LOG_WARNING(LogCategory::eGeneral, "Failed to write mesh %s", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool mesh::validate(const void* data, size_t size, uint64_t layoutHash, uint64_t sourceHash, const char** reason)
+{
+    const char* unused = nullptr;
+    if (!reason)
+        reason = &unused;
+
+    FileHeader header;
+    if (size >= sizeof(header))
+        memcpy(&header, data, sizeof(header));
+    else
+        memset(&header, 0, sizeof(header));
+
+    bool sectionsFit = header.streamCount <= MAX_VERTEX_STREAMS &&
+                       header.indexOffset + (uint64_t)header.indexCount * header.indexSize <= size;
+    for (uint32_t s = 0; sectionsFit && s < header.streamCount; ++s)
+        sectionsFit = header.streamOffsets[s] + (uint64_t)header.vertexCount * header.streamStrides[s] <= size;
+
+    if (size < sizeof(header) || header.magic != FILE_MAGIC)
+        *reason = "not a mesh file";
+    else if (header.version != FILE_VERSION)
+        *reason = "older version";
+    else if (header.layoutHash != layoutHash)
+        *reason = "built for another vertex layout";
+    else if (sourceHash != 0 && header.sourceHash != sourceHash)
+        *reason = "built from other data";
+    else if (header.fileSize != size || (header.indexSize != 2 && header.indexSize != 4) || !sectionsFit)
+        *reason = "truncated or damaged";
+    else if (blob::crc32c((const unsigned char*)data + sizeof(header), size - sizeof(header)) != header.checksum)
+        *reason = "checksum mismatch";
+    else
+        return true;
+
+    return false;
+}
+
+bool mesh::MeshFile::open(const std::string& path, uint64_t layoutHash, uint64_t sourceHash, const char** reason)
+{
+    close();
+    if (!m_file.open(path, file_helpers::MappedFile::Hint::eSequential))
+    {
+        if (reason)
+            *reason = "missing or empty";
+        return false;
+    }
+
+    if (validate(m_file.data(), m_file.size(), layoutHash, sourceHash, reason))
+        return true;
+
+    close();
+    return false;
+}
+
+bool mesh::MeshFile::load(std::vector<unsigned char> contents, uint64_t layoutHash, uint64_t sourceHash, const char** reason)
+{
+    close();
+    if (!validate(contents.data(), contents.size(), layoutHash, sourceHash, reason))
+        return false;
+
+    m_contents = std::move(contents);
+    return true;
+}
+
+void mesh::MeshFile::close()
+{
+    m_file.close();
+    m_contents.clear();
+}
+
+namespace
+{
+    struct BenchVertex {
+        float                     position[3];
+        float                     normal[3];
+    };
+
+    // positions stay full precision, normals are octahedral in a second stream
+    typedef VertexFormat<
+        VertexAttribute<0, VertexEncoding::eFloat32, 3>,
+        VertexAttribute<1, VertexEncoding::eOctahedral16, 3, 1>> BenchFormat;
+
+    // a torus as exporters tend to write one: every triangle with its own vertices, in no useful order
+    std::vector<BenchVertex> makeTorus(uint32_t triangleCount)
+    {
+        const uint32_t minor = 48;
+        const uint32_t major = std::max(3u, triangleCount / (minor * 2));
+        const float pi = 3.14159265358979f;
+
+        auto vertexAt = [&](uint32_t i, uint32_t j) {
+            float u = (float)(i % major) / (float)major * 2.0f * pi;
+            float v = (float)(j % minor) / (float)minor * 2.0f * pi;
+            BenchVertex vertex;
+            vertex.normal[0] = cosf(u) * cosf(v);
+            vertex.normal[1] = sinf(u) * cosf(v);
+            vertex.normal[2] = sinf(v);
+            vertex.position[0] = cosf(u) * (1.0f + 0.3f * cosf(v));
+            vertex.position[1] = sinf(u) * (1.0f + 0.3f * cosf(v));
+            vertex.position[2] = 0.3f * sinf(v);
+            return vertex;
+        };
+
+        std::vector<uint32_t> order(major * minor * 2);
+        for (uint32_t t = 0; t < (uint32_t)order.size(); ++t)
+            order[t] = t;
+        std::shuffle(order.begin(), order.end(), std::mt19937(1234));
+
+        std::vector<BenchVertex> vertices;
+        vertices.reserve(order.size() * 3);
+        for (uint32_t t : order)
+        {
+            uint32_t quad = t / 2, i = quad / minor, j = quad % minor;
+            if (t & 1)
+            {
+                vertices.push_back(vertexAt(i, j));
+                vertices.push_back(vertexAt(i + 1, j + 1));
+                vertices.push_back(vertexAt(i, j + 1));
+            }
+            else
+            {
+                vertices.push_back(vertexAt(i, j));
+                vertices.push_back(vertexAt(i + 1, j));
+                vertices.push_back(vertexAt(i + 1, j + 1));
+            }
+        }
+        return vertices;
+    }
+}
+
+void mesh::benchmark(uint32_t triangleCount)
+{
+    std::vector<BenchVertex> vertices = makeTorus(triangleCount);
+
+    const VertexAttributeSource sources[] = {
+        { vertices[0].position, sizeof(BenchVertex) / sizeof(float) },
+        { vertices[0].normal, sizeof(BenchVertex) / sizeof(float) },
+    };
+
+    TRACE("mesh benchmark: %u triangles, %u vertices as given", (uint32_t)vertices.size() / 3, (uint32_t)vertices.size());
+
+    // each pass is optimized for the cache size it's measured on
+    const uint32_t cacheSizes[] = { 8, 16, 32 };
+    for (uint32_t cacheSize : cacheSizes)
+    {
+        BuildOptions options;
+        options.cacheSize = cacheSize;
+
+        Mesh built;
+        BuildStats stats;
+        build<BenchFormat>(sources, vertices.size(), nullptr, 0, built, options, &stats);
+
+        TRACE("cache %2u: %u unique vertices, %u clusters, %u bit indices, built in %.2f ms",
+              cacheSize, stats.uniqueVertices, stats.clusters, built.indexSize() * 8, stats.ms);
+        TRACE("  input        ACMR %.3f  ATVR %.3f", stats.input.acmr, stats.input.atvr);
+        TRACE("  merged       ACMR %.3f  ATVR %.3f", stats.merged.acmr, stats.merged.atvr);
+        TRACE("  cache order  ACMR %.3f  ATVR %.3f", stats.cacheOrder.acmr, stats.cacheOrder.atvr);
+        TRACE("  + overdraw   ACMR %.3f  ATVR %.3f", stats.optimized.acmr, stats.optimized.atvr);
+    }
+}
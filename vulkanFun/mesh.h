@@ -0,0 +1,178 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "vertex_format.h"
+#include "file_helpers.h"
+
+// Offline mesh processing and the binary format it writes. build() takes float vertex data and a triangle
+// list, packs the vertices into a VertexFormat, merges identical vertices, then reorders triangles for the
+// post-transform cache (Tipsify), clusters of them for overdraw and the vertices for fetch locality.
+// Files are laid out so a mapping can be handed to the staging uploads as is
+namespace mesh
+{
+    static const uint32_t         FILE_MAGIC = 0x534D4B56;  // "VKMS"
+    static const uint16_t         FILE_VERSION = 1;
+    static const uint32_t         SECTION_ALIGNMENT = 16;
+    static const uint32_t         DEFAULT_CACHE_SIZE = 16;  // FIFO entries the optimizer and simulator assume
+
+    struct FileHeader {
+        uint32_t                  magic;
+        uint16_t                  version;
+        uint16_t                  indexSize;        // 2 or 4 bytes
+        uint64_t                  layoutHash;       // of the VertexFormat's attribute info
+        uint64_t                  sourceHash;       // of what it was built from, 0 when unknown
+        uint32_t                  vertexCount;
+        uint32_t                  indexCount;
+        uint32_t                  streamCount;
+        uint32_t                  checksum;         // CRC32C of everything after the header
+        uint64_t                  streamOffsets[MAX_VERTEX_STREAMS];    // from the start of the file
+        uint32_t                  streamStrides[MAX_VERTEX_STREAMS];
+        uint64_t                  indexOffset;
+        uint64_t                  fileSize;
+        float                     boundsMin[3];
+        float                     boundsMax[3];
+    };
+
+    // post-transform cache behaviour of an index order, on a FIFO of the given size.
+    // acmr is transforms per triangle (0.5 at best, 3 at worst), atvr per vertex (1 at best)
+    struct CacheStats {
+        float                     acmr = 0.0f;
+        float                     atvr = 0.0f;
+    };
+
+    struct BuildOptions {
+        uint32_t                  cacheSize = DEFAULT_CACHE_SIZE;
+        float                     overdrawThreshold = 1.05f;    // ACMR an overdraw cluster may cost, relative to its cache order
+        uint32_t                  positionAttribute = 0;        // source used for bounds and the overdraw sort
+    };
+
+    struct BuildStats {
+        uint32_t                  inputVertices = 0;
+        uint32_t                  uniqueVertices = 0;
+        uint32_t                  triangles = 0;
+        uint32_t                  clusters = 0;
+        CacheStats                input;            // as given
+        CacheStats                merged;           // identical vertices merged, order unchanged
+        CacheStats                cacheOrder;       // Tipsify order alone
+        CacheStats                optimized;        // and the overdraw and fetch reordering
+        double                    ms = 0.0;
+    };
+
+    // what build() produces, written out as is by writeFile
+    struct Mesh {
+        uint64_t                  layoutHash = 0;
+        uint64_t                  sourceHash = 0;
+        uint32_t                  vertexCount = 0;
+        uint32_t                  streamCount = 0;
+        uint32_t                  streamStrides[MAX_VERTEX_STREAMS] = {};
+        std::vector<unsigned char> streams[MAX_VERTEX_STREAMS];
+        std::vector<uint32_t>     indices;
+        float                     boundsMin[3] = {};
+        float                     boundsMax[3] = {};
+
+        // 16 bit whenever every index fits, 0xffff is left out so primitive restart never trips on it
+        uint32_t                  indexSize() const { return vertexCount < 0xffff ? 2 : 4; }
+    };
+
+    uint64_t                      layoutHash(const VertexAttributeInfo* info, uint32_t attributeCount);
+
+    // of the float data and indices, so a file can be checked against its source without building it
+    uint64_t                      hashSource(const VertexAttributeInfo* info, uint32_t attributeCount,
+                                             const VertexAttributeSource* sources, size_t vertexCount,
+                                             const uint32_t* indices, size_t indexCount);
+
+    // indices may be null for an unindexed triangle list. sources are in attribute order, as for vertex_encode
+    void                          build(const VertexAttributeInfo* info, uint32_t attributeCount, const uint32_t* strides,
+                                        const VertexAttributeSource* sources, size_t vertexCount,
+                                        const uint32_t* indices, size_t indexCount,
+                                        Mesh& out, const BuildOptions& options = BuildOptions(), BuildStats* stats = nullptr);
+
+    template<typename Format>
+    void build(const VertexAttributeSource* sources, size_t vertexCount, const uint32_t* indices, size_t indexCount,
+               Mesh& out, const BuildOptions& options = BuildOptions(), BuildStats* stats = nullptr)
+    {
+        uint32_t strides[Format::STREAM_COUNT];
+        for (uint32_t i = 0; i < Format::STREAM_COUNT; ++i)
+            strides[i] = Format::stride(i);
+        build(Format::info.data(), Format::ATTRIBUTE_COUNT, strides, sources, vertexCount, indices, indexCount, out, options, stats);
+    }
+
+    template<typename Format>
+    uint64_t layoutHash()
+    {
+        return layoutHash(Format::info.data(), Format::ATTRIBUTE_COUNT);
+    }
+
+    template<typename Format>
+    uint64_t hashSource(const VertexAttributeSource* sources, size_t vertexCount, const uint32_t* indices, size_t indexCount)
+    {
+        return hashSource(Format::info.data(), Format::ATTRIBUTE_COUNT, sources, vertexCount, indices, indexCount);
+    }
+
+    // the file's contents, and the same written out via a temp file and rename
+    std::vector<unsigned char>    serialize(const Mesh& mesh);
+    bool                          writeFile(const std::string& path, const Mesh& mesh);
+
+    // false, with reason saying why, when data isn't a mesh file, is damaged, for another vertex layout,
+    // or built from other data than sourceHash (unless that's 0)
+    bool                          validate(const void* data, size_t size, uint64_t layoutHash, uint64_t sourceHash = 0,
+                                           const char** reason = nullptr);
+
+    // A mesh file mapped read-only. Vertex streams and indices point into the mapping, ready to be copied
+    // straight into staging memory
+    class MeshFile
+    {
+    public:
+        // fails as validate() does, and for missing files
+        bool                      open(const std::string& path, uint64_t layoutHash, uint64_t sourceHash = 0,
+                                       const char** reason = nullptr);
+
+        // serialize()d contents held in memory, for when a freshly built mesh couldn't be written out
+        bool                      load(std::vector<unsigned char> contents, uint64_t layoutHash, uint64_t sourceHash = 0,
+                                       const char** reason = nullptr);
+        void                      close();
+
+        const FileHeader&         getHeader() const { return *(const FileHeader*)getData(); }
+        const void*               getStream(uint32_t stream) const { return getData() + getHeader().streamOffsets[stream]; }
+        size_t                    getStreamSize(uint32_t stream) const { return (size_t)getHeader().vertexCount * getHeader().streamStrides[stream]; }
+        const void*               getIndices() const { return getData() + getHeader().indexOffset; }
+        size_t                    getIndicesSize() const { return (size_t)getHeader().indexCount * getHeader().indexSize; }
+
+    private:
+        const unsigned char*      getData() const { return m_contents.empty() ? m_file.data() : m_contents.data(); }
+
+        file_helpers::MappedFile  m_file;
+        std::vector<unsigned char> m_contents;
+    };
+
+    // the individual steps build() runs, usable on their own
+
+    // remap[i] is where vertex i ends up once identical ones are merged, returns how many are left.
+    // Vertices are compared a word at a time across all streams, every stride must be a multiple of 4
+    size_t                        generateVertexRemap(uint32_t* remap, const void* const* streams, const uint32_t* strides,
+                                                      uint32_t streamCount, size_t vertexCount);
+
+    // Tipsify (Sander, Nehab, Barczak 2007). clusters, if given, gets the first triangle of every run
+    // that starts at a dead end, where the order is free to change without hurting the cache
+    void                          optimizeVertexCache(uint32_t* dst, const uint32_t* indices, size_t indexCount, size_t vertexCount,
+                                                      uint32_t cacheSize, std::vector<uint32_t>* clusters = nullptr);
+
+    // splits the clusters further wherever that costs less than threshold in ACMR, then sorts them so
+    // those facing out from the middle of the mesh are drawn first. positions are xyz floats
+    void                          optimizeOverdraw(uint32_t* dst, const uint32_t* indices, size_t indexCount,
+                                                   const float* positions, uint32_t positionStride, size_t vertexCount,
+                                                   const std::vector<uint32_t>& clusters, uint32_t cacheSize, float threshold);
+
+    // remap for vertices in the order the indices first use them, unused ones are dropped. Returns the count kept
+    size_t                        optimizeVertexFetch(uint32_t* remap, const uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+    CacheStats                    simulateVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize);
+
+    // builds a generated mesh with shuffled, unshared triangles and prints every step's effect on
+    // ACMR/ATVR for a range of cache sizes. CPU only
+    void                          benchmark(uint32_t triangleCount);
+}
@@ -0,0 +1,426 @@
+#include "render_graph.h"
+
+#include <algorithm>
+#include <assert.h>
+
+// access bits that write memory, anything else only reads it
+static const vk::AccessFlags WRITE_ACCESS = vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eColorAttachmentWrite |
+    vk::AccessFlagBits::eDepthStencilAttachmentWrite | vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eHostWrite |
+    vk::AccessFlagBits::eMemoryWrite;
+
+static vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+void RenderGraph::reset()
+{
+    m_resources.clear();
+    m_passes.clear();
+    m_finalBarriers = GraphBarrierBatch();
+    m_heaps.clear();
+    m_stats = RenderGraphStats();
+}
+
+uint32_t RenderGraph::importBuffer(const char* name, vk::Buffer buffer, const GraphAccess& state)
+{
+    Resource resource;
+    resource.name = name;
+    resource.type = GraphResourceType::eBuffer;
+    resource.transient = false;
+    resource.buffer = buffer;
+    resource.initial = state;
+    m_resources.push_back(resource);
+    return (uint32_t)m_resources.size() - 1;
+}
+
+uint32_t RenderGraph::importImage(const char* name, vk::Image image, const vk::ImageSubresourceRange& range, const GraphAccess& state)
+{
+    Resource resource;
+    resource.name = name;
+    resource.type = GraphResourceType::eImage;
+    resource.transient = false;
+    resource.image = image;
+    resource.range = range;
+    resource.initial = state;
+    m_resources.push_back(resource);
+    return (uint32_t)m_resources.size() - 1;
+}
+
+uint32_t RenderGraph::createBuffer(const char* name, const GraphBufferDesc& desc)
+{
+    Resource resource;
+    resource.name = name;
+    resource.type = GraphResourceType::eBuffer;
+    resource.transient = true;
+    resource.bufferDesc = desc;
+    m_resources.push_back(resource);
+    return (uint32_t)m_resources.size() - 1;
+}
+
+uint32_t RenderGraph::createImage(const char* name, const GraphImageDesc& desc)
+{
+    Resource resource;
+    resource.name = name;
+    resource.type = GraphResourceType::eImage;
+    resource.transient = true;
+    resource.imageDesc = desc;
+    resource.range = vk::ImageSubresourceRange(desc.aspect, 0, desc.mipLevels, 0, 1);
+    m_resources.push_back(resource);
+    return (uint32_t)m_resources.size() - 1;
+}
+
+void RenderGraph::exportResource(uint32_t resource, const GraphAccess& next)
+{
+    m_resources[resource].exported = true;
+    m_resources[resource].next = next;
+}
+
+RenderGraph& RenderGraph::addPass(const char* name, RecordFn record)
+{
+    Pass pass;
+    pass.name = name;
+    pass.record = std::move(record);
+    m_passes.push_back(std::move(pass));
+    return *this;
+}
+
+RenderGraph::Use& RenderGraph::use(uint32_t resource, const GraphAccess& access)
+{
+    std::vector<Use>& uses = m_passes.back().uses;
+    auto it = std::find_if(uses.begin(), uses.end(), [resource](const Use& u) { return u.resource == resource; });
+    if (it == uses.end())
+    {
+        Use u;
+        u.resource = resource;
+        u.reads = false;
+        u.writes = false;
+        uses.push_back(u);
+        it = uses.end() - 1;
+    }
+
+    // one pass sees one layout, a read and a write of the same image have to agree on it
+    assert(it->access.layout == vk::ImageLayout::eUndefined || access.layout == vk::ImageLayout::eUndefined || it->access.layout == access.layout);
+    it->access.stages |= access.stages;
+    it->access.access |= access.access;
+    if (access.layout != vk::ImageLayout::eUndefined)
+        it->access.layout = access.layout;
+    if (access.finalLayout != vk::ImageLayout::eUndefined)
+        it->access.finalLayout = access.finalLayout;
+    return *it;
+}
+
+RenderGraph& RenderGraph::read(uint32_t resource, const GraphAccess& access)
+{
+    use(resource, access).reads = true;
+    return *this;
+}
+
+RenderGraph& RenderGraph::write(uint32_t resource, const GraphAccess& access)
+{
+    // read-modify-write, atomics say, also depends on what was there before
+    Use& u = use(resource, access);
+    u.writes = true;
+    if (access.access & ~WRITE_ACCESS)
+        u.reads = true;
+    return *this;
+}
+
+RenderGraph& RenderGraph::sideEffects()
+{
+    m_passes.back().sideEffects = true;
+    return *this;
+}
+
+void RenderGraph::cullPasses()
+{
+    // walking back from the outputs, a pass survives when something still needed is written by it,
+    // and whatever it reads is then needed by the passes before it
+    std::vector<bool> needed(m_resources.size(), false);
+    for (size_t r = 0; r < m_resources.size(); ++r)
+        needed[r] = m_resources[r].exported;
+
+    for (size_t p = m_passes.size(); p-- > 0;)
+    {
+        Pass& pass = m_passes[p];
+        pass.culled = !pass.sideEffects;
+        for (const auto& it : pass.uses)
+        {
+            if (it.writes && needed[it.resource])
+                pass.culled = false;
+        }
+
+        if (pass.culled)
+            continue;
+
+        for (const auto& it : pass.uses)
+        {
+            if (it.reads)
+                needed[it.resource] = true;
+        }
+    }
+}
+
+void RenderGraph::synchronise(const Resource& resource, State& state, const GraphAccess& access, bool writes,
+                              GraphBarrierBatch& batch, uint32_t resourceIx) const
+{
+    const vk::AccessFlags reads = access.access & ~WRITE_ACCESS;
+    const bool transition = resource.type == GraphResourceType::eImage && access.layout != vk::ImageLayout::eUndefined &&
+        access.layout != state.layout;
+
+    if (transition)
+    {
+        // a layout transition reads and writes the whole image, so it waits on every use before it
+        GraphImageBarrier barrier;
+        barrier.resource = resourceIx;
+        barrier.srcAccess = state.writeAccess;
+        barrier.dstAccess = access.access;
+        barrier.oldLayout = state.layout;
+        barrier.newLayout = access.layout;
+        batch.images.push_back(barrier);
+
+        batch.srcStages |= state.writeStages | state.readStages;
+        batch.dstStages |= access.stages;
+    }
+    else
+    {
+        // read after write, unless an earlier barrier already made the write visible here. Write
+        // after write always waits, a use touching no memory, like presenting, has nothing to wait for
+        if (state.writeStages && (writes || (reads && ((access.stages & ~state.visibleStages) || (reads & ~state.visibleAccess)))))
+        {
+            batch.srcStages |= state.writeStages;
+            batch.srcAccess |= state.writeAccess;
+            batch.dstStages |= access.stages;
+            batch.dstAccess |= access.access;
+            state.visibleStages |= access.stages;
+            state.visibleAccess |= reads;
+        }
+
+        // write after read only has to wait for the reads, there's nothing of theirs to make visible
+        if (writes && state.readStages)
+        {
+            batch.srcStages |= state.readStages;
+            batch.dstStages |= access.stages;
+        }
+    }
+
+    if (writes)
+    {
+        state.writeStages = access.stages;
+        state.writeAccess = access.access & WRITE_ACCESS;
+        state.readStages = vk::PipelineStageFlags();
+        state.visibleStages = vk::PipelineStageFlags();
+        state.visibleAccess = vk::AccessFlags();
+    }
+    else if (transition)
+    {
+        // later readers chain through this pass's stages, which only ran once the transition was done
+        state.writeStages = access.stages;
+        state.readStages = access.stages;
+        state.visibleStages = access.stages;
+        state.visibleAccess = reads;
+    }
+    else
+    {
+        state.readStages |= access.stages;
+    }
+
+    if (access.finalLayout != vk::ImageLayout::eUndefined)
+        state.layout = access.finalLayout;
+    else if (access.layout != vk::ImageLayout::eUndefined)
+        state.layout = access.layout;
+}
+
+void RenderGraph::compile()
+{
+    cullPasses();
+
+    m_finalBarriers = GraphBarrierBatch();
+    m_heaps.clear();
+    m_stats = RenderGraphStats();
+
+    std::vector<State> states(m_resources.size());
+    for (size_t r = 0; r < m_resources.size(); ++r)
+    {
+        Resource& resource = m_resources[r];
+        resource.firstPass = INVALID;
+        resource.lastPass = INVALID;
+        resource.firstStages = vk::PipelineStageFlags();
+        resource.firstAccess = vk::AccessFlags();
+        resource.usedStages = vk::PipelineStageFlags();
+        resource.writes = vk::AccessFlags();
+        resource.heap = INVALID;
+        resource.heapOffset = 0;
+
+        // transient resources start each graph with nothing in them
+        State& state = states[r];
+        state.layout = resource.initial.layout;
+        if (resource.initial.access & WRITE_ACCESS)
+        {
+            state.writeStages = resource.initial.stages;
+            state.writeAccess = resource.initial.access & WRITE_ACCESS;
+        }
+        else
+        {
+            state.readStages = resource.initial.stages;
+        }
+    }
+
+    for (uint32_t p = 0; p < (uint32_t)m_passes.size(); ++p)
+    {
+        Pass& pass = m_passes[p];
+        pass.barriers = GraphBarrierBatch();
+        if (pass.culled)
+            continue;
+
+        for (const auto& it : pass.uses)
+        {
+            Resource& resource = m_resources[it.resource];
+            if (resource.transient)
+            {
+                if (resource.firstPass == INVALID)
+                {
+                    resource.firstPass = p;
+                    resource.firstStages = it.access.stages;
+                    resource.firstAccess = it.access.access;
+                }
+                resource.lastPass = p;
+                resource.usedStages |= it.access.stages;
+                resource.writes |= it.access.access & WRITE_ACCESS;
+            }
+
+            synchronise(resource, states[it.resource], it.access, it.writes, pass.barriers, it.resource);
+        }
+    }
+
+    for (uint32_t r = 0; r < (uint32_t)m_resources.size(); ++r)
+    {
+        const Resource& resource = m_resources[r];
+        if (resource.exported)
+            synchronise(resource, states[r], resource.next, (bool)(resource.next.access & WRITE_ACCESS), m_finalBarriers, r);
+    }
+
+    updateStats();
+}
+
+void RenderGraph::setMemoryRequirements(uint32_t resource, const vk::MemoryRequirements& requirements)
+{
+    m_resources[resource].requirements = requirements;
+}
+
+void RenderGraph::assignMemory()
+{
+    m_heaps.clear();
+
+    // biggest first, smaller resources then fill the gaps around them
+    std::vector<uint32_t> order;
+    for (uint32_t r = 0; r < (uint32_t)m_resources.size(); ++r)
+    {
+        if (m_resources[r].transient && isLive(r))
+            order.push_back(r);
+    }
+    std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return m_resources[a].requirements.size > m_resources[b].requirements.size;
+    });
+
+    std::vector<std::vector<uint32_t>> placed;
+    for (auto r : order)
+    {
+        Resource& resource = m_resources[r];
+        const vk::MemoryRequirements& req = resource.requirements;
+
+        for (uint32_t h = 0; h <= (uint32_t)m_heaps.size() && resource.heap == INVALID; ++h)
+        {
+            if (h == (uint32_t)m_heaps.size())
+            {
+                GraphHeap heap;
+                heap.type = resource.type;
+                m_heaps.push_back(heap);
+                placed.push_back(std::vector<uint32_t>());
+            }
+
+            GraphHeap& heap = m_heaps[h];
+            if (heap.type != resource.type || !(heap.memoryTypeBits & req.memoryTypeBits))
+                continue;
+
+            // only resources alive at the same time are in the way, lowest gap between them that fits
+            std::vector<uint32_t> clashes;
+            for (auto other : placed[h])
+            {
+                const Resource& o = m_resources[other];
+                if (o.firstPass <= resource.lastPass && resource.firstPass <= o.lastPass)
+                    clashes.push_back(other);
+            }
+            std::sort(clashes.begin(), clashes.end(), [this](uint32_t a, uint32_t b) {
+                return m_resources[a].heapOffset < m_resources[b].heapOffset;
+            });
+
+            vk::DeviceSize offset = 0;
+            for (auto other : clashes)
+            {
+                const Resource& o = m_resources[other];
+                if (alignUp(offset, req.alignment) + req.size <= o.heapOffset)
+                    break;
+                offset = std::max(offset, o.heapOffset + o.requirements.size);
+            }
+            offset = alignUp(offset, req.alignment);
+
+            resource.heap = h;
+            resource.heapOffset = offset;
+            heap.size = std::max(heap.size, offset + req.size);
+            heap.alignment = std::max(heap.alignment, req.alignment);
+            heap.memoryTypeBits &= req.memoryTypeBits;
+            placed[h].push_back(r);
+        }
+    }
+
+    // memory handed over from resources that are done with it, the new one's first use waits for them
+    for (auto r : order)
+    {
+        const Resource& resource = m_resources[r];
+        GraphBarrierBatch& batch = m_passes[resource.firstPass].barriers;
+
+        for (auto other : placed[resource.heap])
+        {
+            const Resource& o = m_resources[other];
+            const bool overlaps = o.heapOffset < resource.heapOffset + resource.requirements.size &&
+                resource.heapOffset < o.heapOffset + o.requirements.size;
+            if (other == r || !overlaps || o.lastPass >= resource.firstPass)
+                continue;
+
+            batch.srcStages |= o.usedStages;
+            batch.srcAccess |= o.writes;
+            batch.dstStages |= resource.firstStages;
+            batch.dstAccess |= resource.firstAccess;
+        }
+    }
+
+    updateStats();
+}
+
+void RenderGraph::updateStats()
+{
+    m_stats = RenderGraphStats();
+    m_stats.passes = (uint32_t)m_passes.size();
+
+    for (const auto& it : m_passes)
+    {
+        if (it.culled)
+            ++m_stats.culledPasses;
+        if (!it.barriers.empty())
+            ++m_stats.barriers;
+        m_stats.imageBarriers += (uint32_t)it.barriers.images.size();
+    }
+
+    if (!m_finalBarriers.empty())
+        ++m_stats.barriers;
+    m_stats.imageBarriers += (uint32_t)m_finalBarriers.images.size();
+
+    for (uint32_t r = 0; r < (uint32_t)m_resources.size(); ++r)
+    {
+        if (m_resources[r].transient && isLive(r))
+            m_stats.transientBytes += m_resources[r].requirements.size;
+    }
+    for (const auto& it : m_heaps)
+        m_stats.heapBytes += it.size;
+}
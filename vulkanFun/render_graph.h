@@ -0,0 +1,212 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <string>
+#include <functional>
+
+// how a pass uses a resource. For images layout is what the pass needs it in, eUndefined when the
+// pass doesn't care about its contents or transitions it itself, like a render pass attachment, and
+// finalLayout what it's left in when that differs
+struct GraphAccess {
+    vk::PipelineStageFlags        stages;
+    vk::AccessFlags               access;
+    vk::ImageLayout               layout = vk::ImageLayout::eUndefined;
+    vk::ImageLayout               finalLayout = vk::ImageLayout::eUndefined;
+
+    GraphAccess() = default;
+    GraphAccess(vk::PipelineStageFlags stages, vk::AccessFlags access, vk::ImageLayout layout = vk::ImageLayout::eUndefined,
+                vk::ImageLayout finalLayout = vk::ImageLayout::eUndefined)
+        : stages(stages), access(access), layout(layout), finalLayout(finalLayout) {}
+};
+
+enum class GraphResourceType : uint8_t {
+    eBuffer,
+    eImage
+};
+
+// transient resources are created by whoever executes the graph, usage has to cover every access
+struct GraphBufferDesc {
+    vk::DeviceSize                size = 0;
+    vk::BufferUsageFlags          usage;
+};
+
+struct GraphImageDesc {
+    vk::Format                    format = vk::Format::eUndefined;
+    vk::Extent2D                  extent;
+    uint32_t                      mipLevels = 1;
+    vk::SampleCountFlagBits       samples = vk::SampleCountFlagBits::e1;
+    vk::ImageUsageFlags           usage;
+    vk::ImageAspectFlags          aspect = vk::ImageAspectFlagBits::eColor;
+};
+
+struct GraphImageBarrier {
+    uint32_t                      resource;
+    vk::AccessFlags               srcAccess;
+    vk::AccessFlags               dstAccess;
+    vk::ImageLayout               oldLayout;
+    vk::ImageLayout               newLayout;
+};
+
+// everything one pass waits on, recorded as a single vkCmdPipelineBarrier. Buffers and images
+// keeping their layout share the global memory barrier, only transitions get image barriers
+struct GraphBarrierBatch {
+    vk::PipelineStageFlags        srcStages;
+    vk::PipelineStageFlags        dstStages;
+    vk::AccessFlags               srcAccess;
+    vk::AccessFlags               dstAccess;
+    std::vector<GraphImageBarrier> images;
+
+    bool                          empty() const { return !dstStages; }
+};
+
+// a range of memory transient resources are placed in, once per resource type as buffers and
+// optimally tiled images may not share memory without minding bufferImageGranularity
+struct GraphHeap {
+    GraphResourceType             type;
+    vk::DeviceSize                size = 0;
+    vk::DeviceSize                alignment = 1;
+    uint32_t                      memoryTypeBits = ~0u;
+};
+
+struct RenderGraphStats {
+    uint32_t                      passes = 0;
+    uint32_t                      culledPasses = 0;
+    uint32_t                      barriers = 0;         // non-empty batches, each one vkCmdPipelineBarrier
+    uint32_t                      imageBarriers = 0;    // layout transitions among them
+    vk::DeviceSize                transientBytes = 0;   // what transient resources would take unaliased
+    vk::DeviceSize                heapBytes = 0;        // what they take aliased
+};
+
+// Frame graph: passes declare which buffers and images they read and write, in execution order.
+// compile() drops passes nothing exported depends on, then works out the barriers and layout
+// transitions each remaining pass needs, merging them into one batch per pass. assignMemory()
+// places transient resources whose lifetimes don't overlap in the same memory and adds the
+// barriers handing it over. Everything here is CPU side bookkeeping, it never touches a device, so
+// graphs can be built and checked without one. VKRenderGraph creates the resources and records it
+class RenderGraph
+{
+public:
+    static constexpr uint32_t     INVALID = ~0u;
+
+    using RecordFn = std::function<void(vk::CommandBuffer)>;
+
+    void                          reset();
+
+    // state is how it was last used before the graph, nothing to wait on when left empty
+    uint32_t                      importBuffer(const char* name, vk::Buffer buffer, const GraphAccess& state = GraphAccess());
+    uint32_t                      importImage(const char* name, vk::Image image, const vk::ImageSubresourceRange& range,
+                                              const GraphAccess& state = GraphAccess());
+
+    // transient, only live between the first and last pass using them, contents start undefined
+    uint32_t                      createBuffer(const char* name, const GraphBufferDesc& desc);
+    uint32_t                      createImage(const char* name, const GraphImageDesc& desc);
+
+    // what uses the resource after the graph, it's transitioned and made visible to that. Exported
+    // resources are the graph's outputs, passes that don't lead to one are culled
+    void                          exportResource(uint32_t resource, const GraphAccess& next);
+
+    // the accesses that follow describe it, a pass both reading and writing a resource calls both
+    RenderGraph&                  addPass(const char* name, RecordFn record);
+    RenderGraph&                  read(uint32_t resource, const GraphAccess& access);
+    RenderGraph&                  write(uint32_t resource, const GraphAccess& access);
+    RenderGraph&                  sideEffects();    // never culled, e.g. writes the host reads back
+
+    void                          compile();
+
+    // transient resources need their memory requirements set after compile() and before this
+    void                          setMemoryRequirements(uint32_t resource, const vk::MemoryRequirements& requirements);
+    void                          assignMemory();
+
+    uint32_t                      getPassCount() const { return (uint32_t)m_passes.size(); }
+    const std::string&            getPassName(uint32_t pass) const { return m_passes[pass].name; }
+    bool                          isCulled(uint32_t pass) const { return m_passes[pass].culled; }
+    const RecordFn&               getRecord(uint32_t pass) const { return m_passes[pass].record; }
+    const GraphBarrierBatch&      getBarriers(uint32_t pass) const { return m_passes[pass].barriers; }
+    const GraphBarrierBatch&      getFinalBarriers() const { return m_finalBarriers; }
+
+    uint32_t                      getResourceCount() const { return (uint32_t)m_resources.size(); }
+    const std::string&            getResourceName(uint32_t resource) const { return m_resources[resource].name; }
+    GraphResourceType             getResourceType(uint32_t resource) const { return m_resources[resource].type; }
+    bool                          isTransient(uint32_t resource) const { return m_resources[resource].transient; }
+    // transient and used by a pass that survived culling, between these two
+    bool                          isLive(uint32_t resource) const { return m_resources[resource].firstPass != INVALID; }
+    uint32_t                      getFirstPass(uint32_t resource) const { return m_resources[resource].firstPass; }
+    uint32_t                      getLastPass(uint32_t resource) const { return m_resources[resource].lastPass; }
+    vk::Buffer                    getImportedBuffer(uint32_t resource) const { return m_resources[resource].buffer; }
+    vk::Image                     getImportedImage(uint32_t resource) const { return m_resources[resource].image; }
+    const GraphBufferDesc&        getBufferDesc(uint32_t resource) const { return m_resources[resource].bufferDesc; }
+    const GraphImageDesc&         getImageDesc(uint32_t resource) const { return m_resources[resource].imageDesc; }
+    const vk::ImageSubresourceRange& getRange(uint32_t resource) const { return m_resources[resource].range; }
+
+    // where assignMemory() put it, an index into getHeaps() and an offset into that heap
+    uint32_t                      getHeap(uint32_t resource) const { return m_resources[resource].heap; }
+    vk::DeviceSize                getHeapOffset(uint32_t resource) const { return m_resources[resource].heapOffset; }
+    const std::vector<GraphHeap>& getHeaps() const { return m_heaps; }
+
+    const RenderGraphStats&       getStats() const { return m_stats; }
+
+private:
+    struct Resource {
+        std::string               name;
+        GraphResourceType         type;
+        bool                      transient;
+        vk::Buffer                buffer;           // imported only
+        vk::Image                 image;
+        vk::ImageSubresourceRange range;
+        GraphBufferDesc           bufferDesc;       // transient only
+        GraphImageDesc            imageDesc;
+        GraphAccess               initial;
+        bool                      exported = false;
+        GraphAccess               next;
+
+        // filled in by compile() and assignMemory()
+        uint32_t                  firstPass = INVALID;
+        uint32_t                  lastPass = INVALID;
+        vk::PipelineStageFlags    firstStages;      // what the first pass using it does
+        vk::AccessFlags           firstAccess;
+        vk::PipelineStageFlags    usedStages;       // every use, what memory taken over from it waits for
+        vk::AccessFlags           writes;
+        vk::MemoryRequirements    requirements;
+        uint32_t                  heap = INVALID;
+        vk::DeviceSize            heapOffset = 0;
+    };
+
+    struct Use {
+        uint32_t                  resource;
+        GraphAccess               access;
+        bool                      reads;
+        bool                      writes;
+    };
+
+    struct Pass {
+        std::string               name;
+        RecordFn                  record;
+        std::vector<Use>          uses;
+        bool                      sideEffects = false;
+        bool                      culled = false;
+        GraphBarrierBatch         barriers;         // recorded before the pass
+    };
+
+    // synchronisation state of one resource as the passes are walked
+    struct State {
+        vk::ImageLayout           layout = vk::ImageLayout::eUndefined;
+        vk::PipelineStageFlags    writeStages;      // the last write, not yet waited on by everything after it
+        vk::AccessFlags           writeAccess;
+        vk::PipelineStageFlags    readStages;       // reads since that write, a later write waits for them
+        vk::PipelineStageFlags    visibleStages;    // where the last write has been made visible
+        vk::AccessFlags           visibleAccess;
+    };
+
+    Use&                          use(uint32_t resource, const GraphAccess& access);
+    void                          cullPasses();
+    void                          updateStats();
+    void                          synchronise(const Resource& resource, State& state, const GraphAccess& access, bool writes,
+                                              GraphBarrierBatch& batch, uint32_t resourceIx) const;
+
+    std::vector<Resource>         m_resources;
+    std::vector<Pass>             m_passes;
+    GraphBarrierBatch             m_finalBarriers;
+    std::vector<GraphHeap>        m_heaps;
+    RenderGraphStats              m_stats;
+};
@@ -0,0 +1,44 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+// material lookup through the bindless heap (set 1), BINDLESS_FALLBACK builds the variant for
+// devices without descriptor indexing, where each set holds just the draw's resources at element 0
+
+#ifdef BINDLESS_FALLBACK
+#define HEAP_SIZE 1
+#define HEAP_INDEX(i) 0
+#else
+#define HEAP_SIZE
+#define HEAP_INDEX(i) nonuniformEXT(i)
+#endif
+
+layout(set = 1, binding = 0) readonly buffer MaterialBuffer {
+	vec4 tint;
+} materials[HEAP_SIZE];
+
+layout(set = 1, binding = 1) uniform texture2D textures[HEAP_SIZE];
+layout(set = 1, binding = 2) uniform sampler samplers[HEAP_SIZE];
+
+layout(push_constant) uniform BindlessIndices {
+	uint bufferIx;
+	uint imageIx;
+	uint samplerIx;
+	uint reserved;
+} indices;
+
+layout(location = 0) in vec3 fragColor;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+	vec4 colour = vec4(fragColor, 1.0);
+
+	if (indices.bufferIx != 0xffffffffu)
+		colour *= materials[HEAP_INDEX(indices.bufferIx)].tint;
+
+	if (indices.imageIx != 0xffffffffu && indices.samplerIx != 0xffffffffu)
+		colour *= texture(sampler2D(textures[HEAP_INDEX(indices.imageIx)], samplers[HEAP_INDEX(indices.samplerIx)]), gl_FragCoord.xy / 512.0);
+
+	outColor = colour;
+}
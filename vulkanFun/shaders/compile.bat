@@ -1,3 +1,8 @@
 glslangValidator -V shader.vert
 glslangValidator -V shader.frag
+glslangValidator -V bindless.frag -o bindless_frag.spv
+glslangValidator -V -DBINDLESS_FALLBACK bindless.frag -o bindless_fallback_frag.spv
+glslangValidator -V instanced.vert -o instanced_vert.spv
+glslangValidator -V cull.comp -o cull_comp.spv
+glslangValidator -V depth_pyramid.comp -o depth_pyramid_comp.spv
 pause
\ No newline at end of file
@@ -0,0 +1,30 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// shader.vert with the model matrix per instance instead of in the uniforms
+
+layout(binding = 0) uniform UniformBufferObject {
+	mat4 model;
+	mat4 view;
+	mat4 proj;
+} ubo;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+// rows of an affine transform, see SceneInstance
+layout(location = 2) in vec4 inModelRow0;
+layout(location = 3) in vec4 inModelRow1;
+layout(location = 4) in vec4 inModelRow2;
+
+layout(location = 0) out vec3 fragColor;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+void main() {
+	mat4 model = transpose(mat4(inModelRow0, inModelRow1, inModelRow2, vec4(0.0, 0.0, 0.0, 1.0)));
+    gl_Position = ubo.proj * ubo.view * model * vec4(inPosition, 0.0, 1.0);
+	fragColor = inColor;
+}
@@ -0,0 +1,67 @@
+#include "thread_pool.h"
+
+void ThreadPool::init(uint32_t threadCount)
+{
+    if (threadCount == 0)
+    {
+        uint32_t hwThreads = std::thread::hardware_concurrency();
+        threadCount = hwThreads > 1 ? hwThreads - 1 : 1;
+    }
+
+    m_stop = false;
+    for (uint32_t i = 0; i < threadCount; ++i)
+        m_threads.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+void ThreadPool::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (auto& it : m_threads)
+        it.join();
+    m_threads.clear();
+}
+
+void ThreadPool::workerLoop()
+{
+    for (;;)
+    {
+        std::function<void()> job;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]() { return m_stop || !m_jobs.empty(); });
+
+            // drain what's queued before stopping so no future is left unsatisfied
+            if (m_jobs.empty())
+                return;
+
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        job();
+    }
+}
+
+void ThreadPool::parallelFor(uint32_t count, const std::function<void(uint32_t)>& fn)
+{
+    if (count == 0)
+        return;
+
+    std::vector<std::future<void>> pending;
+    pending.reserve(count - 1);
+
+    for (uint32_t i = 1; i < count; ++i)
+        pending.push_back(submit([&fn, i]() { fn(i); }));
+
+    // the caller takes a share rather than sitting idle
+    fn(0);
+
+    for (auto& it : pending)
+        it.wait();
+}
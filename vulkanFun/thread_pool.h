@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+// Fixed set of worker threads pulling jobs from a shared queue
+class ThreadPool
+{
+public:
+    // threadCount of 0 picks one worker per hardware thread, less the caller's
+    void                          init(uint32_t threadCount = 0);
+    void                          shutdown();
+
+    uint32_t                      getThreadCount() const { return (uint32_t)m_threads.size(); }
+
+    template<typename F>
+    auto                          submit(F&& f) -> std::future<decltype(f())>
+    {
+        typedef decltype(f()) R;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        auto result = task->get_future();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back([task]() { (*task)(); });
+        }
+        m_wake.notify_one();
+
+        return result;
+    }
+
+    // runs fn(0..count-1) across the workers and the calling thread, returns once all are done.
+    // Must not be called from inside a job, the caller would wait on itself
+    void                          parallelFor(uint32_t count, const std::function<void(uint32_t)>& fn);
+
+private:
+    void                          workerLoop();
+
+    std::vector<std::thread>      m_threads;
+    std::deque<std::function<void()>> m_jobs;
+    std::mutex                    m_mutex;
+    std::condition_variable       m_wake;
+    bool                          m_stop = false;
+};
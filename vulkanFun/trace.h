@@ -3,16 +3,14 @@
 #include <stdio.h>
 #define NOMINMAX
 
+#include "logging.h"
+
 #define TRACE_ENABLED
 
 #if defined TRACE_ENABLED
 
-#define TRACE(v, ...) \
-		{ \
-			char __buffv__[1024]; \
-			sprintf(__buffv__, "[TRACE] " v "\n", __VA_ARGS__); \
-			printf(__buffv__); \
-		}
+// kept for existing call sites, new code should log with a category through LOG_*
+#define TRACE(v, ...) LOG_INFO(LogCategory::eGeneral, v, __VA_ARGS__)
 #else
 
 #define TRACE(v, ...)
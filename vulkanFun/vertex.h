@@ -2,38 +2,21 @@
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
-#include <vulkan/vulkan.hpp>
 #include <vector>
 
+#include "vertex_format.h"
+
+// source data, built into meshes/quad.mesh on first run
 struct Vertex {
     glm::vec2 pos;
     glm::vec3 color;
-
-    static vk::VertexInputBindingDescription getBindingDesc() {
-        vk::VertexInputBindingDescription desc;
-        desc.binding = 0;
-        desc.stride = sizeof(Vertex);
-        desc.inputRate = vk::VertexInputRate::eVertex;
-        return desc;
-    };
-
-    static std::array<vk::VertexInputAttributeDescription, 2> getAttributeDesc() {
-        std::array<vk::VertexInputAttributeDescription, 2> desc;
-        
-        desc[0].binding = 0;
-        desc[0].location = 0;
-        desc[0].format = vk::Format::eR32G32Sfloat;
-        desc[0].offset = offsetof(Vertex, pos);
-
-        desc[1].binding = 0;
-        desc[1].location = 1;
-        desc[1].format = vk::Format::eR32G32B32Sfloat;
-        desc[1].offset = offsetof(Vertex, color);
-
-        return desc;
-    };
 };
 
+// what the GPU reads, 8 bytes a vertex rather than 20. Locations match shader.vert's inputs
+typedef VertexFormat<
+    VertexAttribute<0, VertexEncoding::eHalf, 2>,
+    VertexAttribute<1, VertexEncoding::eUnorm8, 3>> QuadVertexFormat;
+
 const std::vector<Vertex> vertices = {
     { { -0.5f, -0.5f },{ 1.0f, 0.0f, 0.0f } },
     { { 0.5f, -0.5f },{ 0.0f, 1.0f, 0.0f } },
@@ -0,0 +1,259 @@
+#include "vertex_format.h"
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define VERTEX_ENCODE_SSE
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
+// NaN goes to lo, as _mm_max_ps does
+static float clampf(float x, float lo, float hi)
+{
+    return x > lo ? (x < hi ? x : hi) : lo;
+}
+
+// round to nearest even, keeps infinities, NaNs and denormals
+static uint16_t halfFromFloat(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t exponent = (x >> 23) & 0xff;
+    uint32_t mantissa = x & 0x7fffff;
+
+    if (exponent == 0xff)
+        return (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+
+    int e = (int)exponent - 127 + 15;
+    if (e >= 31)
+        return (uint16_t)(sign | 0x7c00);
+
+    if (e <= 0)
+    {
+        if (e < -10)
+            return (uint16_t)sign;
+
+        mantissa |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - e);
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            ++half;
+        return (uint16_t)(sign | half);
+    }
+
+    // a carry out of the mantissa correctly bumps the exponent, up to infinity
+    uint32_t half = sign | ((uint32_t)e << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        ++half;
+    return (uint16_t)half;
+}
+
+#ifdef VERTEX_ENCODE_SSE
+#ifndef _MSC_VER
+__attribute__((target("f16c")))
+#endif
+static size_t toHalfF16C(const float* src, uint16_t* dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i lo = _mm_cvtps_ph(_mm_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        __m128i hi = _mm_cvtps_ph(_mm_loadu_ps(src + i + 4), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi64(lo, hi));
+    }
+    return i;
+}
+
+static bool hasF16C()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 29)) != 0;
+#else
+    return __builtin_cpu_supports("f16c");
+#endif
+}
+
+static __m128i roundClamped(const float* src, __m128 lo, __m128 hi, __m128 scale)
+{
+    return _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src), lo), hi), scale));
+}
+#endif
+
+void vertex_encode::toHalf(const float* src, uint16_t* dst, size_t count)
+{
+    size_t i = 0;
+#ifdef VERTEX_ENCODE_SSE
+    static const bool f16c = hasF16C();
+    if (f16c)
+        i = toHalfF16C(src, dst, count);
+#endif
+    for (; i < count; ++i)
+        dst[i] = halfFromFloat(src[i]);
+}
+
+void vertex_encode::toSnorm16(const float* src, int16_t* dst, size_t count)
+{
+    size_t i = 0;
+#ifdef VERTEX_ENCODE_SSE
+    const __m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f), scale = _mm_set1_ps(32767.0f);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i a = roundClamped(src + i, lo, hi, scale);
+        __m128i b = roundClamped(src + i + 4, lo, hi, scale);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(a, b));
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] = (int16_t)lrintf(clampf(src[i], -1.0f, 1.0f) * 32767.0f);
+}
+
+void vertex_encode::toUnorm16(const float* src, uint16_t* dst, size_t count)
+{
+    size_t i = 0;
+#ifdef VERTEX_ENCODE_SSE
+    // SSE2 only packs signed, so pack around 32768 and flip the top bit back
+    const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(1.0f), scale = _mm_set1_ps(65535.0f);
+    const __m128i bias = _mm_set1_epi32(32768);
+    const __m128i flip = _mm_set1_epi16((short)0x8000);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i a = _mm_sub_epi32(roundClamped(src + i, lo, hi, scale), bias);
+        __m128i b = _mm_sub_epi32(roundClamped(src + i + 4, lo, hi, scale), bias);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(_mm_packs_epi32(a, b), flip));
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] = (uint16_t)lrintf(clampf(src[i], 0.0f, 1.0f) * 65535.0f);
+}
+
+void vertex_encode::toSnorm8(const float* src, int8_t* dst, size_t count)
+{
+    size_t i = 0;
+#ifdef VERTEX_ENCODE_SSE
+    const __m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f), scale = _mm_set1_ps(127.0f);
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i a = _mm_packs_epi32(roundClamped(src + i, lo, hi, scale), roundClamped(src + i + 4, lo, hi, scale));
+        __m128i b = _mm_packs_epi32(roundClamped(src + i + 8, lo, hi, scale), roundClamped(src + i + 12, lo, hi, scale));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi16(a, b));
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] = (int8_t)lrintf(clampf(src[i], -1.0f, 1.0f) * 127.0f);
+}
+
+void vertex_encode::toUnorm8(const float* src, uint8_t* dst, size_t count)
+{
+    size_t i = 0;
+#ifdef VERTEX_ENCODE_SSE
+    const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(1.0f), scale = _mm_set1_ps(255.0f);
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i a = _mm_packs_epi32(roundClamped(src + i, lo, hi, scale), roundClamped(src + i + 4, lo, hi, scale));
+        __m128i b = _mm_packs_epi32(roundClamped(src + i + 8, lo, hi, scale), roundClamped(src + i + 12, lo, hi, scale));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(a, b));
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] = (uint8_t)lrintf(clampf(src[i], 0.0f, 1.0f) * 255.0f);
+}
+
+void vertex_encode::toOctahedral(const float* src, uint32_t srcStride, float* dst, size_t count)
+{
+    for (size_t i = 0; i < count; ++i, src += srcStride)
+    {
+        float x = src[0], y = src[1], z = src[2];
+
+        // project onto the octahedron, a zero vector comes out as +z
+        float l1 = fabsf(x) + fabsf(y) + fabsf(z);
+        float u = l1 > 0.0f ? x / l1 : 0.0f;
+        float v = l1 > 0.0f ? y / l1 : 0.0f;
+
+        // and fold the lower half over the diagonals
+        if (z < 0.0f)
+        {
+            float fu = (1.0f - fabsf(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+            float fv = (1.0f - fabsf(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+            u = fu;
+            v = fv;
+        }
+
+        dst[i * 2 + 0] = u;
+        dst[i * 2 + 1] = v;
+    }
+}
+
+void vertex_encode::encode(const VertexAttributeInfo* info, uint32_t attributeCount, const uint32_t* strides,
+                           const VertexAttributeSource* sources, size_t vertexCount, void* const* streams)
+{
+    // attributes go a batch at a time through a contiguous scratch run, where the kernels can use SIMD,
+    // then get scattered to their place in the stream
+    static const size_t BATCH = 256;
+    float floats[BATCH * 4];
+    uint32_t packed[BATCH * 4];
+
+    uint32_t streamCount = 0;
+    for (uint32_t a = 0; a < attributeCount; ++a)
+        streamCount = std::max(streamCount, info[a].stream + 1);
+
+    // padding between attributes is zero rather than whatever the buffer held
+    for (uint32_t s = 0; s < streamCount; ++s)
+        memset(streams[s], 0, vertexCount * strides[s]);
+
+    for (uint32_t a = 0; a < attributeCount; ++a)
+    {
+        const VertexAttributeInfo& attribute = info[a];
+        const VertexAttributeSource& source = sources[a];
+        const uint32_t stored = vertexStoredComponents(attribute.encoding, attribute.components);
+        const uint32_t stride = strides[attribute.stream];
+        unsigned char* out = (unsigned char*)streams[attribute.stream] + attribute.offset;
+
+        for (size_t first = 0; first < vertexCount; first += BATCH)
+        {
+            const size_t count = std::min(BATCH, vertexCount - first);
+            const float* src = source.data + first * source.stride;
+            const size_t total = count * stored;
+
+            if (attribute.encoding == VertexEncoding::eOctahedral16 || attribute.encoding == VertexEncoding::eOctahedral8)
+            {
+                toOctahedral(src, source.stride, floats, count);
+            }
+            else
+            {
+                for (size_t v = 0; v < count; ++v)
+                {
+                    for (uint32_t c = 0; c < stored; ++c)
+                        floats[v * stored + c] = c < attribute.components ? src[v * source.stride + c] : 1.0f;
+                }
+            }
+
+            switch (attribute.encoding)
+            {
+            case VertexEncoding::eFloat32: memcpy(packed, floats, total * sizeof(float)); break;
+            case VertexEncoding::eHalf: toHalf(floats, (uint16_t*)packed, total); break;
+            case VertexEncoding::eSnorm16:
+            case VertexEncoding::eOctahedral16: toSnorm16(floats, (int16_t*)packed, total); break;
+            case VertexEncoding::eUnorm16: toUnorm16(floats, (uint16_t*)packed, total); break;
+            case VertexEncoding::eSnorm8:
+            case VertexEncoding::eOctahedral8: toSnorm8(floats, (int8_t*)packed, total); break;
+            case VertexEncoding::eUnorm8: toUnorm8(floats, (uint8_t*)packed, total); break;
+            }
+
+            const unsigned char* bytes = (const unsigned char*)packed;
+            for (size_t v = 0; v < count; ++v)
+                memcpy(out + (first + v) * stride, bytes + v * attribute.size, attribute.size);
+        }
+    }
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+
+static const uint32_t MAX_VERTEX_STREAMS = 4;
+
+// how an attribute is stored. 8 and 16 bit encodings of 3 components are padded to 4, 3 component
+// formats of those sizes are rarely supported for vertex input; the padding is written as 1
+enum class VertexEncoding : uint32_t {
+    eFloat32,
+    eHalf,
+    eSnorm16,
+    eUnorm16,
+    eSnorm8,
+    eUnorm8,
+    eOctahedral16,  // unit vector folded onto 2 snorm16, see octahedral decode below
+    eOctahedral8,   // same in 2 snorm8
+};
+
+// octahedral vectors are unfolded in the shader:
+//   vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+//   float t = max(-n.z, 0.0);
+//   n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+//   n = normalize(n);
+
+constexpr uint32_t vertexComponentBytes(VertexEncoding encoding)
+{
+    switch (encoding)
+    {
+    case VertexEncoding::eFloat32: return 4;
+    case VertexEncoding::eHalf:
+    case VertexEncoding::eSnorm16:
+    case VertexEncoding::eUnorm16:
+    case VertexEncoding::eOctahedral16: return 2;
+    default: return 1;
+    }
+}
+
+// components actually stored for components in the source
+constexpr uint32_t vertexStoredComponents(VertexEncoding encoding, uint32_t components)
+{
+    return encoding == VertexEncoding::eOctahedral16 || encoding == VertexEncoding::eOctahedral8 ? 2 :
+           encoding != VertexEncoding::eFloat32 && components == 3 ? 4 : components;
+}
+
+// VK_FORMAT_UNDEFINED for combinations that don't exist, octahedral only encodes 3 component vectors
+constexpr VkFormat vertexFormat(VertexEncoding encoding, uint32_t components)
+{
+    if (components < 1 || components > 4)
+        return VK_FORMAT_UNDEFINED;
+
+    const uint32_t stored = vertexStoredComponents(encoding, components);
+    switch (encoding)
+    {
+    case VertexEncoding::eFloat32:
+    {
+        const VkFormat formats[] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+        return formats[stored - 1];
+    }
+    case VertexEncoding::eHalf:
+    {
+        const VkFormat formats[] = { VK_FORMAT_R16_SFLOAT, VK_FORMAT_R16G16_SFLOAT, VK_FORMAT_UNDEFINED, VK_FORMAT_R16G16B16A16_SFLOAT };
+        return formats[stored - 1];
+    }
+    case VertexEncoding::eSnorm16:
+    {
+        const VkFormat formats[] = { VK_FORMAT_R16_SNORM, VK_FORMAT_R16G16_SNORM, VK_FORMAT_UNDEFINED, VK_FORMAT_R16G16B16A16_SNORM };
+        return formats[stored - 1];
+    }
+    case VertexEncoding::eUnorm16:
+    {
+        const VkFormat formats[] = { VK_FORMAT_R16_UNORM, VK_FORMAT_R16G16_UNORM, VK_FORMAT_UNDEFINED, VK_FORMAT_R16G16B16A16_UNORM };
+        return formats[stored - 1];
+    }
+    case VertexEncoding::eSnorm8:
+    {
+        const VkFormat formats[] = { VK_FORMAT_R8_SNORM, VK_FORMAT_R8G8_SNORM, VK_FORMAT_UNDEFINED, VK_FORMAT_R8G8B8A8_SNORM };
+        return formats[stored - 1];
+    }
+    case VertexEncoding::eUnorm8:
+    {
+        const VkFormat formats[] = { VK_FORMAT_R8_UNORM, VK_FORMAT_R8G8_UNORM, VK_FORMAT_UNDEFINED, VK_FORMAT_R8G8B8A8_UNORM };
+        return formats[stored - 1];
+    }
+    case VertexEncoding::eOctahedral16:
+        return components == 3 ? VK_FORMAT_R16G16_SNORM : VK_FORMAT_UNDEFINED;
+    case VertexEncoding::eOctahedral8:
+        return components == 3 ? VK_FORMAT_R8G8_SNORM : VK_FORMAT_UNDEFINED;
+    }
+    return VK_FORMAT_UNDEFINED;
+}
+
+// one attribute of a VertexFormat, Components is what the source data and the shader have
+template<uint32_t Location, VertexEncoding Encoding, uint32_t Components, uint32_t Stream = 0>
+struct VertexAttribute {
+    static constexpr uint32_t     location = Location;
+    static constexpr VertexEncoding encoding = Encoding;
+    static constexpr uint32_t     components = Components;
+    static constexpr uint32_t     stream = Stream;
+    static constexpr VkFormat     format = vertexFormat(Encoding, Components);
+    static constexpr uint32_t     size = vertexStoredComponents(Encoding, Components) * vertexComponentBytes(Encoding);
+
+    static_assert(format != VK_FORMAT_UNDEFINED, "no vertex format for this encoding and component count");
+    static_assert(Stream < MAX_VERTEX_STREAMS, "too many vertex streams");
+};
+
+// everything the encoder needs to know about one attribute
+struct VertexAttributeInfo {
+    uint32_t                      location;
+    uint32_t                      stream;
+    uint32_t                      offset;           // within the stream's vertex
+    VertexEncoding                encoding;
+    uint32_t                      components;
+    VkFormat                      format;
+    uint32_t                      size;
+};
+
+// builds what VertexFormat holds, free functions as a class's own members can't be called in its body
+namespace vertex_format_detail
+{
+    template<typename... Attributes>
+    constexpr std::array<VertexAttributeInfo, sizeof...(Attributes)> makeInfo()
+    {
+        const uint32_t locations[] = { Attributes::location... };
+        const uint32_t streams[] = { Attributes::stream... };
+        const VertexEncoding encodings[] = { Attributes::encoding... };
+        const uint32_t components[] = { Attributes::components... };
+        const VkFormat formats[] = { Attributes::format... };
+        const uint32_t sizes[] = { Attributes::size... };
+
+        std::array<VertexAttributeInfo, sizeof...(Attributes)> info = {};
+        uint32_t offsets[MAX_VERTEX_STREAMS] = {};
+        for (uint32_t i = 0; i < sizeof...(Attributes); ++i)
+        {
+            info[i].location = locations[i];
+            info[i].stream = streams[i];
+            info[i].offset = offsets[streams[i]];
+            info[i].encoding = encodings[i];
+            info[i].components = components[i];
+            info[i].format = formats[i];
+            info[i].size = sizes[i];
+            offsets[streams[i]] += sizes[i];
+        }
+        return info;
+    }
+
+    template<size_t N>
+    constexpr uint32_t streamCount(const std::array<VertexAttributeInfo, N>& info)
+    {
+        uint32_t count = 0;
+        for (size_t i = 0; i < N; ++i)
+            count = info[i].stream + 1 > count ? info[i].stream + 1 : count;
+        return count;
+    }
+
+    template<size_t N>
+    constexpr uint32_t stride(const std::array<VertexAttributeInfo, N>& info, uint32_t stream)
+    {
+        uint32_t end = 0;
+        for (size_t i = 0; i < N; ++i)
+        {
+            if (info[i].stream == stream)
+                end = info[i].offset + info[i].size;
+        }
+        return (end + 3) & ~3u;
+    }
+
+    template<size_t N>
+    constexpr std::array<VkVertexInputAttributeDescription, N> makeAttributes(const std::array<VertexAttributeInfo, N>& info)
+    {
+        std::array<VkVertexInputAttributeDescription, N> attributes = {};
+        for (size_t i = 0; i < N; ++i)
+        {
+            attributes[i].location = info[i].location;
+            attributes[i].binding = info[i].stream;
+            attributes[i].format = info[i].format;
+            attributes[i].offset = info[i].offset;
+        }
+        return attributes;
+    }
+
+    template<uint32_t StreamCount, size_t N>
+    constexpr std::array<VkVertexInputBindingDescription, StreamCount> makeBindings(const std::array<VertexAttributeInfo, N>& info)
+    {
+        std::array<VkVertexInputBindingDescription, StreamCount> bindings = {};
+        for (uint32_t i = 0; i < StreamCount; ++i)
+        {
+            bindings[i].binding = i;
+            bindings[i].stride = stride(info, i);
+            bindings[i].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        }
+        return bindings;
+    }
+}
+
+// A vertex layout described by its attributes, with the Vulkan vertex input descriptions built at compile
+// time. Attributes sharing a stream are interleaved in declaration order and each stream is a binding of
+// its own, so positions can be split from everything else for depth only passes. Strides are 4 byte aligned
+template<typename... Attributes>
+struct VertexFormat {
+    static_assert(sizeof...(Attributes) > 0, "a vertex format needs at least one attribute");
+
+    static constexpr uint32_t     ATTRIBUTE_COUNT = sizeof...(Attributes);
+
+    static constexpr std::array<VertexAttributeInfo, ATTRIBUTE_COUNT> info = vertex_format_detail::makeInfo<Attributes...>();
+
+    static constexpr uint32_t     STREAM_COUNT = vertex_format_detail::streamCount(info);
+
+    static constexpr std::array<VkVertexInputAttributeDescription, ATTRIBUTE_COUNT> attributes = vertex_format_detail::makeAttributes(info);
+    static constexpr std::array<VkVertexInputBindingDescription, STREAM_COUNT> bindings = vertex_format_detail::makeBindings<STREAM_COUNT>(info);
+
+    static constexpr uint32_t stride(uint32_t stream) { return vertex_format_detail::stride(info, stream); }
+};
+
+// float source for one attribute: components floats per vertex, stride floats apart
+struct VertexAttributeSource {
+    const float*                  data;
+    uint32_t                      stride;
+};
+
+namespace vertex_encode
+{
+    // packs vertexCount vertices of float data into the format's streams, sources in attribute order.
+    // streams[i] must hold vertexCount * stride(i) bytes
+    void                          encode(const VertexAttributeInfo* info, uint32_t attributeCount, const uint32_t* strides,
+                                         const VertexAttributeSource* sources, size_t vertexCount, void* const* streams);
+
+    template<typename Format>
+    void encode(const VertexAttributeSource* sources, size_t vertexCount, void* const* streams)
+    {
+        uint32_t strides[Format::STREAM_COUNT];
+        for (uint32_t i = 0; i < Format::STREAM_COUNT; ++i)
+            strides[i] = Format::stride(i);
+        encode(Format::info.data(), Format::ATTRIBUTE_COUNT, strides, sources, vertexCount, streams);
+    }
+
+    // the SIMD kernels the encoder is built from, count is in components
+    void                          toHalf(const float* src, uint16_t* dst, size_t count);
+    void                          toSnorm16(const float* src, int16_t* dst, size_t count);
+    void                          toUnorm16(const float* src, uint16_t* dst, size_t count);
+    void                          toSnorm8(const float* src, int8_t* dst, size_t count);
+    void                          toUnorm8(const float* src, uint8_t* dst, size_t count);
+
+    // count xyz vectors to count xy pairs in [-1, 1], ready for toSnorm16/toSnorm8
+    void                          toOctahedral(const float* src, uint32_t srcStride, float* dst, size_t count);
+}
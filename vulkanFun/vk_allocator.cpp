@@ -0,0 +1,366 @@
+#include "vk_allocator.h"
+#include "trace.h"
+#include <algorithm>
+
+static uint32_t floorLog2(vk::DeviceSize v)
+{
+    uint32_t r = 0;
+    while (v >>= 1)
+        ++r;
+    return r;
+}
+
+static uint32_t ceilLog2(vk::DeviceSize v)
+{
+    uint32_t r = floorLog2(v);
+    return (v > (1ull << r)) ? r + 1 : r;
+}
+
+void VKAllocator::init(vk::PhysicalDevice physDevice, vk::Device dev, vk::DeviceSize preferredBlockSize)
+{
+    m_dev = dev;
+    m_memoryProps = physDevice.getMemoryProperties();
+    m_maxAllocationCount = physDevice.getProperties().limits.maxMemoryAllocationCount;
+    m_deviceAllocationCount = 0;
+    m_dedicatedBytes = 0;
+    m_dedicatedCount = 0;
+    m_sharedFamilies.clear();
+
+    // blocks are powers of two, and no more than an eighth of their heap so small heaps aren't swallowed whole
+    for (uint32_t i = 0; i < m_memoryProps.memoryTypeCount; ++i)
+    {
+        vk::DeviceSize heapSize = m_memoryProps.memoryHeaps[m_memoryProps.memoryTypes[i].heapIndex].size;
+        vk::DeviceSize blockSize = std::min(preferredBlockSize, std::max(heapSize / 8, (vk::DeviceSize)1 << MIN_ORDER));
+        m_blockSize[i] = (vk::DeviceSize)1 << std::max(floorLog2(blockSize), MIN_ORDER);
+    }
+
+    m_pools.resize(m_memoryProps.memoryTypeCount * 2);
+    for (uint32_t i = 0; i < (uint32_t)m_pools.size(); ++i)
+    {
+        m_pools[i].memoryTypeIndex = i / 2;
+        m_pools[i].kind = (VKResourceKind)(i % 2);
+    }
+}
+
+void VKAllocator::shutdown()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto& pool : m_pools)
+    {
+        for (auto& block : pool.blocks)
+        {
+            if (block->allocationCount)
+                TRACE("allocator: %u allocations leaked in memory type %u", block->allocationCount, pool.memoryTypeIndex);
+            destroyBlock(block.get());
+        }
+        pool.blocks.clear();
+    }
+
+    if (m_dedicatedCount)
+        TRACE("allocator: %u dedicated allocations leaked", m_dedicatedCount);
+}
+
+uint32_t VKAllocator::findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred) const
+{
+    // first pass looks for everything we'd like, second settles for what we need
+    const vk::MemoryPropertyFlags passes[] = { required | preferred, required };
+
+    for (auto properties : passes)
+    {
+        for (uint32_t i = 0; i < m_memoryProps.memoryTypeCount; ++i)
+        {
+            const auto& p = m_memoryProps.memoryTypes[i];
+
+            if (typeFilter & (1 << i) &&
+                (p.propertyFlags & properties) == properties)
+            {
+                return i;
+            }
+        }
+    }
+
+    return 0;
+}
+
+vk::DeviceMemory VKAllocator::allocateDeviceMemory(vk::DeviceSize size, uint32_t memoryTypeIndex, void** mapped)
+{
+    if (m_deviceAllocationCount + 1 >= m_maxAllocationCount)
+        TRACE("allocator: approaching maxMemoryAllocationCount (%u of %u)", m_deviceAllocationCount + 1, m_maxAllocationCount);
+
+    vk::MemoryAllocateInfo allocInfo;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+    vk::DeviceMemory memory = m_dev.allocateMemory(allocInfo);
+    ++m_deviceAllocationCount;
+
+    // host visible memory stays mapped for its whole lifetime
+    *mapped = nullptr;
+    if (m_memoryProps.memoryTypes[memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+        *mapped = m_dev.mapMemory(memory, 0, VK_WHOLE_SIZE);
+
+    return memory;
+}
+
+VKMemoryBlock* VKAllocator::createBlock(Pool& pool)
+{
+    std::unique_ptr<VKMemoryBlock> block(new VKMemoryBlock());
+    block->size = m_blockSize[pool.memoryTypeIndex];
+    block->maxOrder = floorLog2(block->size);
+    block->poolIx = (uint32_t)(&pool - m_pools.data());
+    block->memory = allocateDeviceMemory(block->size, pool.memoryTypeIndex, &block->mapped);
+
+    block->freeLists.resize(block->maxOrder - MIN_ORDER + 1);
+    block->freeLists.back().insert(0);
+
+    pool.blocks.push_back(std::move(block));
+    return pool.blocks.back().get();
+}
+
+void VKAllocator::destroyBlock(VKMemoryBlock* block)
+{
+    if (block->mapped)
+        m_dev.unmapMemory(block->memory);
+    m_dev.freeMemory(block->memory);
+    --m_deviceAllocationCount;
+}
+
+VKAllocation VKAllocator::allocate(const vk::MemoryRequirements& memReq, vk::MemoryPropertyFlags properties, VKResourceKind kind, vk::MemoryPropertyFlags preferred)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    VKAllocation alloc;
+    alloc.memoryTypeIndex = findMemoryType(memReq.memoryTypeBits, properties, preferred);
+    alloc.size = memReq.size;
+
+    const uint32_t order = std::max(ceilLog2(std::max(memReq.size, memReq.alignment)), MIN_ORDER);
+
+    // big resources aren't worth pooling, and would waste most of a block to buddy rounding. Lazily
+    // allocated memory is only committed per allocation, a shared block would commit it for everyone
+    const bool lazy = (bool)(m_memoryProps.memoryTypes[alloc.memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eLazilyAllocated);
+    if (lazy || order >= floorLog2(m_blockSize[alloc.memoryTypeIndex]))
+    {
+        alloc.memory = allocateDeviceMemory(memReq.size, alloc.memoryTypeIndex, &alloc.mapped);
+        m_dedicatedBytes += memReq.size;
+        ++m_dedicatedCount;
+        return alloc;
+    }
+
+    Pool& pool = m_pools[alloc.memoryTypeIndex * 2 + (uint32_t)kind];
+
+    VKMemoryBlock* block = nullptr;
+    uint32_t foundOrder = 0;
+    for (auto& it : pool.blocks)
+    {
+        for (uint32_t o = order; o <= it->maxOrder; ++o)
+        {
+            if (!it->freeLists[o - MIN_ORDER].empty())
+            {
+                block = it.get();
+                foundOrder = o;
+                break;
+            }
+        }
+        if (block)
+            break;
+    }
+
+    if (!block)
+    {
+        block = createBlock(pool);
+        foundOrder = block->maxOrder;
+    }
+
+    // take the lowest free range, then split it until it's the size we want
+    auto& freeList = block->freeLists[foundOrder - MIN_ORDER];
+    vk::DeviceSize offset = *freeList.begin();
+    freeList.erase(freeList.begin());
+
+    for (uint32_t o = foundOrder; o > order; --o)
+        block->freeLists[o - 1 - MIN_ORDER].insert(offset + (1ull << (o - 1)));
+
+    block->usedBytes += 1ull << order;
+    block->requestedBytes += memReq.size;
+    ++block->allocationCount;
+
+    alloc.memory = block->memory;
+    alloc.offset = offset;
+    alloc.mapped = block->mapped ? (char*)block->mapped + offset : nullptr;
+    alloc.block = block;
+    alloc.order = order;
+    return alloc;
+}
+
+void VKAllocator::free(VKAllocation& alloc)
+{
+    if (!alloc.memory)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!alloc.block)
+    {
+        if (alloc.mapped)
+            m_dev.unmapMemory(alloc.memory);
+        m_dev.freeMemory(alloc.memory);
+        --m_deviceAllocationCount;
+        m_dedicatedBytes -= alloc.size;
+        --m_dedicatedCount;
+        alloc = VKAllocation();
+        return;
+    }
+
+    VKMemoryBlock* block = alloc.block;
+    block->usedBytes -= 1ull << alloc.order;
+    block->requestedBytes -= alloc.size;
+    --block->allocationCount;
+
+    // merge with our buddy for as long as it's free too
+    vk::DeviceSize offset = alloc.offset;
+    uint32_t o = alloc.order;
+    while (o < block->maxOrder)
+    {
+        auto& freeList = block->freeLists[o - MIN_ORDER];
+        auto buddy = freeList.find(offset ^ (1ull << o));
+        if (buddy == freeList.end())
+            break;
+
+        offset = std::min(offset, *buddy);
+        freeList.erase(buddy);
+        ++o;
+    }
+    block->freeLists[o - MIN_ORDER].insert(offset);
+
+    // hand empty blocks back to the driver, but keep one around per pool to avoid thrashing
+    Pool& pool = m_pools[block->poolIx];
+    if (block->allocationCount == 0 && pool.blocks.size() > 1)
+    {
+        auto it = std::find_if(pool.blocks.begin(), pool.blocks.end(), [block](const std::unique_ptr<VKMemoryBlock>& b) {
+            return b.get() == block;
+        });
+
+        destroyBlock(block);
+        pool.blocks.erase(it);
+    }
+
+    alloc = VKAllocation();
+}
+
+VKAllocation VKAllocator::createBuffer(const vk::BufferCreateInfo& bufferInfo, vk::MemoryPropertyFlags properties, vk::Buffer& buff, vk::MemoryPropertyFlags preferred)
+{
+    buff = m_dev.createBuffer(bufferInfo);
+
+    vk::MemoryRequirements memReq = m_dev.getBufferMemoryRequirements(buff);
+    VKAllocation alloc = allocate(memReq, properties, VKResourceKind::eLinear, preferred);
+
+    m_dev.bindBufferMemory(buff, alloc.memory, alloc.offset);
+    return alloc;
+}
+
+void VKAllocator::destroyBuffer(vk::Buffer& buff, VKAllocation& alloc)
+{
+    m_dev.destroyBuffer(buff);
+    buff = vk::Buffer();
+    free(alloc);
+}
+
+VKAllocation VKAllocator::createImage(const vk::ImageCreateInfo& imageInfo, vk::MemoryPropertyFlags properties, vk::Image& image, vk::MemoryPropertyFlags preferred)
+{
+    image = m_dev.createImage(imageInfo);
+
+    vk::MemoryRequirements memReq = m_dev.getImageMemoryRequirements(image);
+    VKAllocation alloc = allocate(memReq, properties,
+        imageInfo.tiling == vk::ImageTiling::eOptimal ? VKResourceKind::eOptimal : VKResourceKind::eLinear, preferred);
+
+    m_dev.bindImageMemory(image, alloc.memory, alloc.offset);
+    return alloc;
+}
+
+void VKAllocator::destroyImage(vk::Image& image, VKAllocation& alloc)
+{
+    m_dev.destroyImage(image);
+    image = vk::Image();
+    free(alloc);
+}
+
+void VKAllocator::share(vk::BufferCreateInfo& bufferInfo) const
+{
+    bufferInfo.sharingMode = m_sharedFamilies.size() > 1 ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive;
+    bufferInfo.queueFamilyIndexCount = m_sharedFamilies.size() > 1 ? (uint32_t)m_sharedFamilies.size() : 0;
+    bufferInfo.pQueueFamilyIndices = m_sharedFamilies.data();
+}
+
+void VKAllocator::share(vk::ImageCreateInfo& imageInfo) const
+{
+    imageInfo.sharingMode = m_sharedFamilies.size() > 1 ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive;
+    imageInfo.queueFamilyIndexCount = m_sharedFamilies.size() > 1 ? (uint32_t)m_sharedFamilies.size() : 0;
+    imageInfo.pQueueFamilyIndices = m_sharedFamilies.data();
+}
+
+void VKAllocator::accumulateStats(const Pool& pool, VKAllocatorStats& stats) const
+{
+    for (auto& block : pool.blocks)
+    {
+        stats.blockBytes += block->size;
+        stats.usedBytes += block->usedBytes;
+        stats.requestedBytes += block->requestedBytes;
+        stats.freeBytes += block->size - block->usedBytes;
+        stats.allocationCount += block->allocationCount;
+        ++stats.blockCount;
+
+        for (uint32_t o = block->maxOrder; o >= MIN_ORDER; --o)
+        {
+            if (!block->freeLists[o - MIN_ORDER].empty())
+            {
+                stats.largestFreeRange = std::max(stats.largestFreeRange, (vk::DeviceSize)1 << o);
+                break;
+            }
+        }
+    }
+}
+
+VKAllocatorStats VKAllocator::getStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    VKAllocatorStats stats;
+    for (auto& pool : m_pools)
+        accumulateStats(pool, stats);
+
+    stats.blockBytes += m_dedicatedBytes;
+    stats.usedBytes += m_dedicatedBytes;
+    stats.requestedBytes += m_dedicatedBytes;
+    stats.dedicatedCount = m_dedicatedCount;
+    stats.allocationCount += m_dedicatedCount;
+    return stats;
+}
+
+VKAllocatorStats VKAllocator::getStats(uint32_t memoryTypeIndex) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    VKAllocatorStats stats;
+    accumulateStats(m_pools[memoryTypeIndex * 2 + 0], stats);
+    accumulateStats(m_pools[memoryTypeIndex * 2 + 1], stats);
+    return stats;
+}
+
+void VKAllocator::printStats() const
+{
+    for (uint32_t i = 0; i < m_memoryProps.memoryTypeCount; ++i)
+    {
+        auto stats = getStats(i);
+        if (stats.blockCount == 0)
+            continue;
+
+        TRACE("allocator: type %u (%s): %u blocks, %llu KB used of %llu KB, %u allocations, frag ext %.2f int %.2f",
+            i, vk::to_string(m_memoryProps.memoryTypes[i].propertyFlags).c_str(),
+            stats.blockCount, (unsigned long long)stats.usedBytes / 1024, (unsigned long long)stats.blockBytes / 1024, stats.allocationCount,
+            stats.externalFragmentation(), stats.internalFragmentation());
+    }
+
+    auto total = getStats();
+    TRACE("allocator: %llu KB in %u blocks + %u dedicated, %u device allocations of %u max",
+        (unsigned long long)total.blockBytes / 1024, total.blockCount, total.dedicatedCount, m_deviceAllocationCount, m_maxAllocationCount);
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <set>
+
+// one vkAllocateMemory, carved up by a buddy allocator. Free lists are indexed by order - MIN_ORDER,
+// a block of order n sits at an offset that is a multiple of 2^n so any alignment up to it is free
+struct VKMemoryBlock {
+    vk::DeviceMemory              memory;
+    vk::DeviceSize                size = 0;
+    void*                         mapped = nullptr;
+    uint32_t                      maxOrder = 0;
+    uint32_t                      poolIx = 0;
+    std::vector<std::set<vk::DeviceSize>> freeLists;
+
+    vk::DeviceSize                usedBytes = 0;
+    vk::DeviceSize                requestedBytes = 0;
+    uint32_t                      allocationCount = 0;
+};
+
+// resources that may not share a block, keeps linear and optimal resources apart so
+// bufferImageGranularity never has to be considered inside a block
+enum class VKResourceKind {
+    eLinear,
+    eOptimal
+};
+
+// a sub-allocated range of device memory
+struct VKAllocation {
+    vk::DeviceMemory              memory;
+    vk::DeviceSize                offset = 0;
+    vk::DeviceSize                size = 0;
+    void*                         mapped = nullptr; // non-null when the owning block is host visible
+    uint32_t                      memoryTypeIndex = 0;
+
+    VKMemoryBlock*                block = nullptr; // null for dedicated allocations
+    uint32_t                      order = 0;
+};
+
+struct VKAllocatorStats {
+    vk::DeviceSize                blockBytes = 0;       // bytes allocated from the driver
+    vk::DeviceSize                usedBytes = 0;        // bytes handed out, including buddy rounding
+    vk::DeviceSize                requestedBytes = 0;   // bytes actually asked for
+    vk::DeviceSize                freeBytes = 0;
+    vk::DeviceSize                largestFreeRange = 0;
+    uint32_t                      blockCount = 0;
+    uint32_t                      dedicatedCount = 0;
+    uint32_t                      allocationCount = 0;
+
+    // 0 when all free space is one contiguous range, tending to 1 as it splinters
+    float                         externalFragmentation() const { return freeBytes ? 1.0f - (float)largestFreeRange / (float)freeBytes : 0.0f; }
+    // fraction of handed out bytes lost to power of two rounding
+    float                         internalFragmentation() const { return usedBytes ? 1.0f - (float)requestedBytes / (float)usedBytes : 0.0f; }
+};
+
+// Pools device memory into large blocks per memory type and sub-allocates them with a buddy allocator.
+// Allocations larger than half a block get their own vkAllocateMemory.
+class VKAllocator
+{
+public:
+    static constexpr vk::DeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+    static constexpr uint32_t     MIN_ORDER = 8; // 256 byte minimum sub-allocation
+
+    void                          init(vk::PhysicalDevice physDevice, vk::Device dev, vk::DeviceSize preferredBlockSize = DEFAULT_BLOCK_SIZE);
+    void                          shutdown();
+
+    uint32_t                      findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred = vk::MemoryPropertyFlags()) const;
+    const vk::PhysicalDeviceMemoryProperties& getMemoryProperties() const { return m_memoryProps; }
+
+    // preferred flags are used when a matching memory type exists, e.g. device local for host written data on UMA/ReBAR
+    VKAllocation                  allocate(const vk::MemoryRequirements& memReq, vk::MemoryPropertyFlags properties, VKResourceKind kind, vk::MemoryPropertyFlags preferred = vk::MemoryPropertyFlags());
+    void                          free(VKAllocation& alloc);
+
+    VKAllocation                  createBuffer(const vk::BufferCreateInfo& bufferInfo, vk::MemoryPropertyFlags properties, vk::Buffer& buff, vk::MemoryPropertyFlags preferred = vk::MemoryPropertyFlags());
+    void                          destroyBuffer(vk::Buffer& buff, VKAllocation& alloc);
+
+    // eLazilyAllocated preferred for transient attachments, on tilers they then may never be backed by memory
+    VKAllocation                  createImage(const vk::ImageCreateInfo& imageInfo, vk::MemoryPropertyFlags properties, vk::Image& image, vk::MemoryPropertyFlags preferred = vk::MemoryPropertyFlags());
+    void                          destroyImage(vk::Image& image, VKAllocation& alloc);
+
+    // resources used from more than one queue family, e.g. by async compute and graphics, are given
+    // concurrent sharing across these by share(). With fewer than two families it leaves them exclusive
+    void                          setSharedQueueFamilies(const std::vector<uint32_t>& families) { m_sharedFamilies = families; }
+    void                          share(vk::BufferCreateInfo& bufferInfo) const;
+    void                          share(vk::ImageCreateInfo& imageInfo) const;
+
+    VKAllocatorStats              getStats() const;
+    VKAllocatorStats              getStats(uint32_t memoryTypeIndex) const;
+    void                          printStats() const;
+
+private:
+    struct Pool {
+        uint32_t                  memoryTypeIndex;
+        VKResourceKind            kind;
+        std::vector<std::unique_ptr<VKMemoryBlock>> blocks;
+    };
+
+    VKMemoryBlock*                createBlock(Pool& pool);
+    void                          destroyBlock(VKMemoryBlock* block);
+    vk::DeviceMemory              allocateDeviceMemory(vk::DeviceSize size, uint32_t memoryTypeIndex, void** mapped);
+    void                          accumulateStats(const Pool& pool, VKAllocatorStats& stats) const;
+
+    vk::Device                    m_dev;
+    vk::PhysicalDeviceMemoryProperties m_memoryProps;
+    vk::DeviceSize                m_blockSize[VK_MAX_MEMORY_TYPES];
+    uint32_t                      m_maxAllocationCount;
+    uint32_t                      m_deviceAllocationCount;
+
+    // indexed by memoryTypeIndex * 2 + kind
+    std::vector<Pool>             m_pools;
+
+    vk::DeviceSize                m_dedicatedBytes;
+    uint32_t                      m_dedicatedCount;
+
+    std::vector<uint32_t>         m_sharedFamilies;
+
+    mutable std::mutex            m_mutex;
+};
+
+// Bump allocator over a fixed range, for transient data that is released all at once
+class VKLinearAllocator
+{
+public:
+    static constexpr vk::DeviceSize INVALID_OFFSET = ~0ull;
+
+    void                          init(vk::DeviceSize capacity) { m_capacity = capacity; m_head = 0; }
+    void                          reset() { m_head = 0; }
+
+    vk::DeviceSize                allocate(vk::DeviceSize size, vk::DeviceSize alignment)
+    {
+        vk::DeviceSize offset = alignment > 1 ? (m_head + alignment - 1) & ~(alignment - 1) : m_head;
+        if (offset + size > m_capacity)
+            return INVALID_OFFSET;
+
+        m_head = offset + size;
+        return offset;
+    }
+
+    vk::DeviceSize                used() const { return m_head; }
+    vk::DeviceSize                capacity() const { return m_capacity; }
+
+private:
+    vk::DeviceSize                m_capacity = 0;
+    vk::DeviceSize                m_head = 0;
+};
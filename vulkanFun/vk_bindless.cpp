@@ -0,0 +1,383 @@
+#include "vk_bindless.h"
+#include "logging.h"
+
+#include <string.h>
+#include <algorithm>
+
+static const vk::DescriptorType s_descriptorTypes[] = {
+    vk::DescriptorType::eStorageBuffer,
+    vk::DescriptorType::eSampledImage,
+    vk::DescriptorType::eSampler
+};
+
+static const uint32_t s_maxCounts[] = {
+    VKBindlessHeap::MAX_BUFFERS,
+    VKBindlessHeap::MAX_IMAGES,
+    VKBindlessHeap::MAX_SAMPLERS
+};
+
+static_assert(sizeof(s_descriptorTypes) / sizeof(s_descriptorTypes[0]) == (size_t)BindlessKind::eCount, "a descriptor type per kind");
+
+const void* VKBindlessHeap::prepareDevice(vk::Instance inst, bool hasProperties2, vk::PhysicalDevice physDevice, std::vector<const char*>& deviceExtensions)
+{
+    m_bindless = false;
+    for (size_t i = 0; i < (size_t)BindlessKind::eCount; ++i)
+        m_tables[i].capacity = s_maxCounts[i];
+
+#ifdef VK_EXT_descriptor_indexing
+    auto allPhysDeviceExtensions = physDevice.enumerateDeviceExtensionProperties();
+    auto hasExtension = [&](const char* name) {
+        return std::find_if(allPhysDeviceExtensions.begin(), allPhysDeviceExtensions.end(), [name](const vk::ExtensionProperties& e) {
+            return strcmp(e.extensionName, name) == 0;
+        }) != allPhysDeviceExtensions.end();
+    };
+
+    // the features and limits are only reachable through the properties2 queries
+    auto getFeatures2 = hasProperties2 ? (PFN_vkGetPhysicalDeviceFeatures2KHR)inst.getProcAddr("vkGetPhysicalDeviceFeatures2KHR") : nullptr;
+    auto getProperties2 = hasProperties2 ? (PFN_vkGetPhysicalDeviceProperties2KHR)inst.getProcAddr("vkGetPhysicalDeviceProperties2KHR") : nullptr;
+
+    if (!getFeatures2 || !getProperties2 ||
+        !hasExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) || !hasExtension(VK_KHR_MAINTENANCE3_EXTENSION_NAME))
+    {
+        LOG_INFO(LogCategory::eDevice, "Descriptor indexing unavailable, using per-frame descriptor sets");
+        return nullptr;
+    }
+
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT supported = {};
+    supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+    VkPhysicalDeviceFeatures2KHR features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+    features2.pNext = &supported;
+    getFeatures2(VkPhysicalDevice(physDevice), &features2);
+
+    if (!supported.runtimeDescriptorArray ||
+        !supported.descriptorBindingPartiallyBound ||
+        !supported.descriptorBindingUpdateUnusedWhilePending ||
+        !supported.descriptorBindingStorageBufferUpdateAfterBind ||
+        !supported.descriptorBindingSampledImageUpdateAfterBind ||
+        !supported.shaderStorageBufferArrayNonUniformIndexing ||
+        !supported.shaderSampledImageArrayNonUniformIndexing)
+    {
+        LOG_INFO(LogCategory::eDevice, "Descriptor indexing lacks update after bind, using per-frame descriptor sets");
+        return nullptr;
+    }
+
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT limits = {};
+    limits.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+
+    VkPhysicalDeviceProperties2KHR properties2 = {};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+    properties2.pNext = &limits;
+    getProperties2(VkPhysicalDevice(physDevice), &properties2);
+
+    // every binding is visible to both stages, so the per-stage limits are the tighter ones
+    Table& buffers = m_tables[(size_t)BindlessKind::eBuffer];
+    Table& images = m_tables[(size_t)BindlessKind::eImage];
+    Table& samplers = m_tables[(size_t)BindlessKind::eSampler];
+
+    buffers.capacity = std::min({ buffers.capacity, limits.maxDescriptorSetUpdateAfterBindStorageBuffers, limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers });
+    images.capacity = std::min({ images.capacity, limits.maxDescriptorSetUpdateAfterBindSampledImages, limits.maxPerStageDescriptorUpdateAfterBindSampledImages });
+    samplers.capacity = std::min({ samplers.capacity, limits.maxDescriptorSetUpdateAfterBindSamplers, limits.maxPerStageDescriptorUpdateAfterBindSamplers });
+
+    // and all three share one per-stage resource budget
+    uint32_t budget = limits.maxPerStageUpdateAfterBindResources;
+    samplers.capacity = std::min(samplers.capacity, budget / 4);
+    images.capacity = std::min(images.capacity, (budget - samplers.capacity) / 2);
+    buffers.capacity = std::min(buffers.capacity, budget - samplers.capacity - images.capacity);
+
+    m_enabledFeatures = {};
+    m_enabledFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    m_enabledFeatures.runtimeDescriptorArray = VK_TRUE;
+    m_enabledFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+    m_enabledFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    m_enabledFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+    m_enabledFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    m_enabledFeatures.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+    m_enabledFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+
+    deviceExtensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+    deviceExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+
+    LOG_INFO(LogCategory::eDevice, "Bindless heap: %u buffers, %u images, %u samplers",
+        buffers.capacity, images.capacity, samplers.capacity);
+
+    m_bindless = true;
+    return &m_enabledFeatures;
+#else
+    (void)inst; (void)hasProperties2; (void)physDevice; (void)deviceExtensions;
+    LOG_INFO(LogCategory::eDevice, "Built without descriptor indexing, using per-frame descriptor sets");
+    return nullptr;
+#endif
+}
+
+void VKBindlessHeap::init(vk::Device dev, uint32_t framesInFlight, VKDescriptorAllocator& fallbackSets)
+{
+    m_dev = dev;
+    m_framesInFlight = framesInFlight;
+    m_frameNumber = 0;
+    m_fallbackSets = &fallbackSets;
+    m_defaults = BindlessIndices();
+
+    for (auto& it : m_tables)
+    {
+        it.slots.clear();
+        it.freeList.clear();
+    }
+
+    vk::DescriptorSetLayoutBinding bindings[(size_t)BindlessKind::eCount];
+    for (uint32_t i = 0; i < (uint32_t)BindlessKind::eCount; ++i)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = s_descriptorTypes[i];
+        bindings[i].descriptorCount = m_bindless ? m_tables[i].capacity : 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+    }
+
+    vk::DescriptorSetLayoutCreateInfo layoutInfo;
+    layoutInfo.bindingCount = (uint32_t)BindlessKind::eCount;
+    layoutInfo.pBindings = bindings;
+
+#ifdef VK_EXT_descriptor_indexing
+    // slots can be written while the set is bound in command buffers still pending, and unused ones
+    // may hold nothing at all
+    VkDescriptorBindingFlagsEXT bindingFlags[(size_t)BindlessKind::eCount];
+    for (auto& it : bindingFlags)
+    {
+        it = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+             VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT |
+             VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+    }
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    bindingFlagsInfo.bindingCount = (uint32_t)BindlessKind::eCount;
+    bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+    if (m_bindless)
+    {
+        layoutInfo.flags = vk::DescriptorSetLayoutCreateFlags(VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT);
+        layoutInfo.pNext = &bindingFlagsInfo;
+    }
+#endif
+
+    m_layout = m_dev.createDescriptorSetLayout(layoutInfo);
+
+    if (m_bindless)
+    {
+#ifdef VK_EXT_descriptor_indexing
+        vk::DescriptorPoolSize poolSizes[(size_t)BindlessKind::eCount];
+        for (uint32_t i = 0; i < (uint32_t)BindlessKind::eCount; ++i)
+        {
+            poolSizes[i].type = s_descriptorTypes[i];
+            poolSizes[i].descriptorCount = m_tables[i].capacity;
+        }
+
+        vk::DescriptorPoolCreateInfo poolInfo;
+        poolInfo.flags = vk::DescriptorPoolCreateFlags(VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT);
+        poolInfo.maxSets = 1;
+        poolInfo.poolSizeCount = (uint32_t)BindlessKind::eCount;
+        poolInfo.pPoolSizes = poolSizes;
+        m_pool = m_dev.createDescriptorPool(poolInfo);
+
+        vk::DescriptorSetAllocateInfo allocInfo;
+        allocInfo.descriptorPool = m_pool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &m_layout;
+        m_set = m_dev.allocateDescriptorSets(allocInfo)[0];
+#endif
+    }
+}
+
+void VKBindlessHeap::shutdown()
+{
+    if (m_pool)
+        m_dev.destroyDescriptorPool(m_pool);
+    m_pool = vk::DescriptorPool();
+    m_set = vk::DescriptorSet();
+
+    if (m_layout)
+        m_dev.destroyDescriptorSetLayout(m_layout);
+    m_layout = vk::DescriptorSetLayout();
+
+    for (auto& it : m_tables)
+    {
+        it.slots.clear();
+        it.freeList.clear();
+    }
+    m_pendingReleases.clear();
+    m_defaults = BindlessIndices();
+}
+
+uint32_t VKBindlessHeap::allocateHandle(BindlessKind kind)
+{
+    Table& table = m_tables[(size_t)kind];
+
+    if (!table.freeList.empty())
+    {
+        uint32_t handle = table.freeList.back();
+        table.freeList.pop_back();
+        return handle;
+    }
+
+    if (table.slots.size() >= table.capacity)
+    {
+        LOG_ERROR(LogCategory::eMemory, "Bindless heap full, %u slots of kind %u in use", table.capacity, (uint32_t)kind);
+        return BindlessIndices::INVALID;
+    }
+
+    table.slots.push_back(Slot());
+    return (uint32_t)table.slots.size() - 1;
+}
+
+void VKBindlessHeap::writeSlot(vk::DescriptorSet set, BindlessKind kind, uint32_t arrayElement, const Slot& slot)
+{
+    vk::WriteDescriptorSet write;
+    write.dstSet = set;
+    write.dstBinding = (uint32_t)kind;
+    write.dstArrayElement = arrayElement;
+    write.descriptorCount = 1;
+    write.descriptorType = s_descriptorTypes[(size_t)kind];
+
+    if (kind == BindlessKind::eBuffer)
+        write.pBufferInfo = &slot.bufferInfo;
+    else
+        write.pImageInfo = &slot.imageInfo;
+
+    m_dev.updateDescriptorSets(write, nullptr);
+}
+
+uint32_t VKBindlessHeap::registerBuffer(vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    uint32_t handle = allocateHandle(BindlessKind::eBuffer);
+    if (handle == BindlessIndices::INVALID)
+        return handle;
+
+    Slot& slot = m_tables[(size_t)BindlessKind::eBuffer].slots[handle];
+    slot.bufferInfo = vk::DescriptorBufferInfo(buffer, offset, range);
+
+    // fallback sets are written when a frame first uses them
+    if (m_bindless)
+        writeSlot(m_set, BindlessKind::eBuffer, handle, slot);
+    return handle;
+}
+
+uint32_t VKBindlessHeap::registerImage(vk::ImageView view, vk::ImageLayout layout)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    uint32_t handle = allocateHandle(BindlessKind::eImage);
+    if (handle == BindlessIndices::INVALID)
+        return handle;
+
+    Slot& slot = m_tables[(size_t)BindlessKind::eImage].slots[handle];
+    slot.imageInfo = vk::DescriptorImageInfo(vk::Sampler(), view, layout);
+
+    if (m_bindless)
+        writeSlot(m_set, BindlessKind::eImage, handle, slot);
+    return handle;
+}
+
+uint32_t VKBindlessHeap::registerSampler(vk::Sampler sampler)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    uint32_t handle = allocateHandle(BindlessKind::eSampler);
+    if (handle == BindlessIndices::INVALID)
+        return handle;
+
+    Slot& slot = m_tables[(size_t)BindlessKind::eSampler].slots[handle];
+    slot.imageInfo = vk::DescriptorImageInfo(sampler, vk::ImageView(), vk::ImageLayout::eUndefined);
+
+    if (m_bindless)
+        writeSlot(m_set, BindlessKind::eSampler, handle, slot);
+    return handle;
+}
+
+void VKBindlessHeap::release(BindlessKind kind, uint32_t handle)
+{
+    if (handle == BindlessIndices::INVALID)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    PendingRelease pending;
+    pending.kind = kind;
+    pending.handle = handle;
+    pending.frameNumber = m_frameNumber;
+    m_pendingReleases.push_back(pending);
+}
+
+void VKBindlessHeap::beginFrame(uint64_t frameNumber)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_frameNumber = frameNumber;
+
+    // the frame recorded when a handle was released used this same slot, its fence has now signalled.
+    // The descriptor is left as it was, partially bound slots that no draw reads needn't be valid
+    while (!m_pendingReleases.empty() && frameNumber >= m_pendingReleases.front().frameNumber + m_framesInFlight)
+    {
+        const PendingRelease& pending = m_pendingReleases.front();
+        m_tables[(size_t)pending.kind].freeList.push_back(pending.handle);
+        m_pendingReleases.pop_front();
+    }
+}
+
+vk::DescriptorSet VKBindlessHeap::getSet(const BindlessIndices& indices)
+{
+    if (m_bindless)
+        return m_set;
+
+    // unset bindings take the defaults' resources, the zeroed push constants never point at them
+    BindlessIndices resolved;
+    resolved.buffer = indices.buffer != BindlessIndices::INVALID ? indices.buffer : m_defaults.buffer;
+    resolved.image = indices.image != BindlessIndices::INVALID ? indices.image : m_defaults.image;
+    resolved.sampler = indices.sampler != BindlessIndices::INVALID ? indices.sampler : m_defaults.sampler;
+
+    if (!resolved.isSet())
+        return vk::DescriptorSet();
+
+    // the allocator's cache hands back the same set for the same resources within a frame
+    DescriptorSetContents contents;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        const Table& buffers = m_tables[(size_t)BindlessKind::eBuffer];
+        const Table& images = m_tables[(size_t)BindlessKind::eImage];
+        const Table& samplers = m_tables[(size_t)BindlessKind::eSampler];
+
+        if (resolved.buffer < buffers.slots.size())
+        {
+            const vk::DescriptorBufferInfo& info = buffers.slots[resolved.buffer].bufferInfo;
+            contents.buffer((uint32_t)BindlessKind::eBuffer, vk::DescriptorType::eStorageBuffer, info.buffer, info.offset, info.range);
+        }
+        if (resolved.image < images.slots.size())
+        {
+            const vk::DescriptorImageInfo& info = images.slots[resolved.image].imageInfo;
+            contents.image((uint32_t)BindlessKind::eImage, vk::DescriptorType::eSampledImage, vk::Sampler(), info.imageView, info.imageLayout);
+        }
+        if (resolved.sampler < samplers.slots.size())
+        {
+            const vk::DescriptorImageInfo& info = samplers.slots[resolved.sampler].imageInfo;
+            contents.image((uint32_t)BindlessKind::eSampler, vk::DescriptorType::eSampler, info.sampler, vk::ImageView(), vk::ImageLayout::eUndefined);
+        }
+    }
+
+    return m_fallbackSets->get(m_layout, contents);
+}
+
+BindlessIndices VKBindlessHeap::getPushIndices(const BindlessIndices& indices) const
+{
+    if (m_bindless)
+        return indices;
+
+    // each fallback set holds just the draw's resources, at element 0
+    BindlessIndices push;
+    push.buffer = indices.buffer != BindlessIndices::INVALID ? 0 : BindlessIndices::INVALID;
+    push.image = indices.image != BindlessIndices::INVALID ? 0 : BindlessIndices::INVALID;
+    push.sampler = indices.sampler != BindlessIndices::INVALID ? 0 : BindlessIndices::INVALID;
+    return push;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <deque>
+#include <mutex>
+
+#include "vk_descriptor_allocator.h"
+
+enum class BindlessKind : uint32_t {
+    eBuffer,    // storage buffer, binding 0
+    eImage,     // sampled image, binding 1
+    eSampler,   // sampler, binding 2
+    eCount
+};
+
+// what a draw indexes, pushed as constants so switching material never rebinds a set
+struct BindlessIndices {
+    static constexpr uint32_t     INVALID = ~0u;
+
+    uint32_t                      buffer = INVALID;
+    uint32_t                      image = INVALID;
+    uint32_t                      sampler = INVALID;
+    uint32_t                      reserved = 0;
+
+    bool                          isSet() const { return buffer != INVALID || image != INVALID || sampler != INVALID; }
+    bool                          operator==(const BindlessIndices& o) const { return buffer == o.buffer && image == o.image && sampler == o.sampler; }
+    bool                          operator!=(const BindlessIndices& o) const { return !(*this == o); }
+};
+
+// Bindless resource heap. With VK_EXT_descriptor_indexing it is one update-after-bind set of large,
+// partially bound arrays of buffers, images and samplers, bound once per command buffer; draws pick their
+// resources through BindlessIndices push constants. Without it, each distinct BindlessIndices gets a small
+// set per frame from a VKDescriptorAllocator, with the resources at element 0 and zeroed push constants,
+// so shaders compiled with BINDLESS_FALLBACK index the same way
+class VKBindlessHeap
+{
+public:
+    static constexpr uint32_t     MAX_BUFFERS = 16384;
+    static constexpr uint32_t     MAX_IMAGES = 16384;
+    static constexpr uint32_t     MAX_SAMPLERS = 256;
+
+    // before device creation: enables the extension and its features if present. hasProperties2 says the
+    // instance has VK_KHR_get_physical_device_properties2, which the queries need. The returned chain
+    // must go into DeviceCreateInfo::pNext and stays valid as long as this object
+    const void*                   prepareDevice(vk::Instance inst, bool hasProperties2, vk::PhysicalDevice physDevice,
+                                                std::vector<const char*>& deviceExtensions);
+
+    // fallbackSets is only used without descriptor indexing, and must be reset by the owner each frame
+    void                          init(vk::Device dev, uint32_t framesInFlight, VKDescriptorAllocator& fallbackSets);
+    void                          shutdown();
+
+    bool                          isBindless() const { return m_bindless; }
+    vk::DescriptorSetLayout       getLayout() const { return m_layout; }
+
+    uint32_t                      registerBuffer(vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range);
+    uint32_t                      registerImage(vk::ImageView view, vk::ImageLayout layout);
+    uint32_t                      registerSampler(vk::Sampler sampler);
+
+    // the slot is recycled once every frame that might still read it has retired
+    void                          release(BindlessKind kind, uint32_t handle);
+
+    // once the frame slot's fence has signalled
+    void                          beginFrame(uint64_t frameNumber);
+
+    // fallback only: what a set holds in the bindings its indices leave unset, shaders declare all three so
+    // each needs something valid even when the push constants say not to read it
+    void                          setFallbackDefaults(const BindlessIndices& defaults) { m_defaults = defaults; }
+
+    // bindless: the heap set, the same for every draw. Fallback: a set for these indices this frame, null
+    // when neither they nor the defaults name anything. Safe to call from recording threads
+    vk::DescriptorSet             getSet(const BindlessIndices& indices);
+
+    // what to push for a draw, indices as they are with bindless, zeros for the fallback sets
+    BindlessIndices               getPushIndices(const BindlessIndices& indices) const;
+
+private:
+    struct Slot {
+        vk::DescriptorBufferInfo  bufferInfo;
+        vk::DescriptorImageInfo   imageInfo;
+    };
+
+    struct Table {
+        std::vector<Slot>         slots;
+        std::vector<uint32_t>     freeList;
+        uint32_t                  capacity = 0;
+    };
+
+    struct PendingRelease {
+        BindlessKind              kind;
+        uint32_t                  handle;
+        uint64_t                  frameNumber;
+    };
+
+    uint32_t                      allocateHandle(BindlessKind kind);
+    void                          writeSlot(vk::DescriptorSet set, BindlessKind kind, uint32_t arrayElement, const Slot& slot);
+
+    vk::Device                    m_dev;
+    bool                          m_bindless = false;
+    uint32_t                      m_framesInFlight = 0;
+
+    vk::DescriptorSetLayout       m_layout;
+    vk::DescriptorPool            m_pool;       // bindless only
+    vk::DescriptorSet             m_set;        // ditto
+
+    Table                         m_tables[(size_t)BindlessKind::eCount];
+    std::deque<PendingRelease>    m_pendingReleases;
+    uint64_t                      m_frameNumber = 0;
+
+    VKDescriptorAllocator*        m_fallbackSets = nullptr;
+    BindlessIndices               m_defaults;
+
+    std::mutex                    m_mutex;
+
+#ifdef VK_EXT_descriptor_indexing
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT m_enabledFeatures;  // chained into device creation
+#endif
+};
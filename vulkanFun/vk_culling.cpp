@@ -0,0 +1,347 @@
+#include "vk_culling.h"
+#include "logging.h"
+
+#include <string.h>
+#include <algorithm>
+
+static_assert(sizeof(glm::mat4) * 2 + sizeof(glm::vec4) * 6 + 32 == 256, "CullParams must match cull.comp");
+
+void VKCullingPass::init(vk::Device dev, VKAllocator& allocator, VKLayoutCache& layouts, VKPipelineLibrary& pipelines,
+                         VKDescriptorAllocator& descriptors, VKUniformRing& uniforms, uint32_t framesInFlight,
+                         uint32_t pyramidLatency)
+{
+    m_dev = dev;
+    m_allocator = &allocator;
+    m_layouts = &layouts;
+    m_pipelines = &pipelines;
+    m_descriptors = &descriptors;
+    m_uniforms = &uniforms;
+    m_currentFrame = 0;
+    m_stats = CullingStats();
+
+    vk::SamplerCreateInfo samplerInfo;
+    samplerInfo.magFilter = vk::Filter::eNearest;
+    samplerInfo.minFilter = vk::Filter::eNearest;
+    samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    m_sampler = m_dev.createSampler(samplerInfo);
+
+    vk::BufferCreateInfo bufferInfo;
+    bufferInfo.size = sizeof(CullingStats);
+    bufferInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer;
+    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+
+    m_statsBuffers.resize(framesInFlight);
+    m_statsAllocs.resize(framesInFlight);
+    for (uint32_t i = 0; i < framesInFlight; ++i)
+    {
+        m_statsAllocs[i] = m_allocator->createBuffer(bufferInfo,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, m_statsBuffers[i]);
+        memset(m_statsAllocs[i].mapped, 0, sizeof(CullingStats));
+    }
+
+    m_pyramids.resize(std::max(pyramidLatency, 1u));
+    m_pyramidIx = 0;
+    createPyramids(vk::Extent2D(1, 1));
+}
+
+void VKCullingPass::shutdown()
+{
+    retirePyramids();
+    for (auto& it : m_retiredPyramids)
+        destroyPyramid(it);
+    m_retiredPyramids.clear();
+
+    for (size_t i = 0; i < m_statsBuffers.size(); ++i)
+        m_allocator->destroyBuffer(m_statsBuffers[i], m_statsAllocs[i]);
+    m_statsBuffers.clear();
+    m_statsAllocs.clear();
+
+    m_dev.destroySampler(m_sampler);
+}
+
+void VKCullingPass::createPipelines(vk::ShaderModule cullShader, const ShaderReflection& cullReflection,
+                                    vk::ShaderModule pyramidShader, const ShaderReflection& pyramidReflection)
+{
+    m_cullPipeline = vk::Pipeline();
+    m_pyramidPipeline = vk::Pipeline();
+    if (!cullShader)
+        return;
+
+    // the parameters come out of the uniform ring, bound at this frame's offset
+    PipelineLayoutOverrides overrides;
+    overrides.dynamicBuffers.push_back({ 0, 0 });
+
+    std::vector<vk::DescriptorSetLayout> setLayouts;
+    m_cullLayout = m_layouts->getPipelineLayout({ &cullReflection }, overrides, &setLayouts);
+    m_cullSetLayout = setLayouts[0];
+    m_cullPipeline = m_pipelines->getBlocking(PipelineKey::computeKey(cullShader, m_cullLayout));
+
+    if (pyramidShader)
+    {
+        m_pyramidLayout = m_layouts->getPipelineLayout({ &pyramidReflection }, PipelineLayoutOverrides(), &setLayouts);
+        m_pyramidSetLayout = setLayouts[0];
+        m_pyramidPipeline = m_pipelines->getBlocking(PipelineKey::computeKey(pyramidShader, m_pyramidLayout));
+    }
+
+    LOG_INFO(LogCategory::eDevice, "GPU culling: frustum%s", m_pyramidPipeline ? " and occlusion" : " only");
+}
+
+void VKCullingPass::setDepthSource(vk::ImageView depthView, vk::Extent2D extent)
+{
+    m_depthView = depthView;
+    m_depthExtent = extent;
+
+    // the largest power of two that fits, so every level below it halves exactly
+    vk::Extent2D pyramidExtent(1, 1);
+    if (depthView && m_pyramidPipeline)
+    {
+        while (pyramidExtent.width * 2 <= extent.width)
+            pyramidExtent.width *= 2;
+        while (pyramidExtent.height * 2 <= extent.height)
+            pyramidExtent.height *= 2;
+    }
+
+    retirePyramids();
+    createPyramids(pyramidExtent);
+}
+
+void VKCullingPass::createPyramids(vk::Extent2D extent)
+{
+    uint32_t mipCount = 1;
+    while ((std::max(extent.width, extent.height) >> mipCount) > 0)
+        ++mipCount;
+
+    vk::ImageCreateInfo imageInfo;
+    imageInfo.imageType = vk::ImageType::e2D;
+    imageInfo.format = vk::Format::eR32Sfloat;
+    imageInfo.extent = vk::Extent3D(extent.width, extent.height, 1);
+    imageInfo.mipLevels = mipCount;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = vk::SampleCountFlagBits::e1;
+    imageInfo.tiling = vk::ImageTiling::eOptimal;
+    imageInfo.usage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    // built on the graphics queue and read by a cull that may run on async compute
+    m_allocator->share(imageInfo);
+    imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+    for (auto& pyramid : m_pyramids)
+    {
+        pyramid.alloc = m_allocator->createImage(imageInfo, vk::MemoryPropertyFlagBits::eDeviceLocal, pyramid.image);
+
+        vk::ImageViewCreateInfo viewInfo;
+        viewInfo.image = pyramid.image;
+        viewInfo.viewType = vk::ImageViewType::e2D;
+        viewInfo.format = imageInfo.format;
+        viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, mipCount, 0, 1);
+        pyramid.view = m_dev.createImageView(viewInfo);
+
+        for (uint32_t mip = 0; mip < mipCount; ++mip)
+        {
+            viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, mip, 1, 0, 1);
+            pyramid.mips.push_back(m_dev.createImageView(viewInfo));
+        }
+
+        pyramid.fresh = true;
+        pyramid.valid = false;
+    }
+
+    m_pyramidExtent = extent;
+}
+
+void VKCullingPass::retirePyramids()
+{
+    for (auto& pyramid : m_pyramids)
+    {
+        RetiredPyramid retired;
+        retired.image = pyramid.image;
+        retired.alloc = pyramid.alloc;
+        retired.views.swap(pyramid.mips);
+        retired.views.push_back(pyramid.view);
+        retired.framesLeft = (uint32_t)m_statsBuffers.size();
+        m_retiredPyramids.push_back(retired);
+
+        pyramid = Pyramid();
+    }
+}
+
+void VKCullingPass::destroyPyramid(RetiredPyramid& pyramid)
+{
+    for (auto it : pyramid.views)
+        m_dev.destroyImageView(it);
+    m_allocator->destroyImage(pyramid.image, pyramid.alloc);
+}
+
+void VKCullingPass::preparePyramid(vk::CommandBuffer cmd, Pyramid& pyramid)
+{
+    if (!pyramid.fresh)
+        return;
+
+    // everything stays in eGeneral from here on, cleared to the far plane so nothing is occluded by it
+    vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, (uint32_t)pyramid.mips.size(), 0, 1);
+
+    vk::ImageMemoryBarrier barrier;
+    barrier.oldLayout = vk::ImageLayout::eUndefined;
+    barrier.newLayout = vk::ImageLayout::eGeneral;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = pyramid.image;
+    barrier.subresourceRange = range;
+    barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(), nullptr, nullptr, barrier);
+
+    vk::ClearColorValue farPlane;
+    farPlane.float32[0] = 1.0f;
+    cmd.clearColorImage(pyramid.image, vk::ImageLayout::eGeneral, farPlane, range);
+
+    barrier.oldLayout = vk::ImageLayout::eGeneral;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader,
+        vk::DependencyFlags(), nullptr, nullptr, barrier);
+
+    pyramid.fresh = false;
+}
+
+void VKCullingPass::beginFrame(uint32_t frameIx)
+{
+    m_currentFrame = frameIx;
+    memcpy(&m_stats, m_statsAllocs[frameIx].mapped, sizeof(CullingStats));
+    m_pyramidIx = (m_pyramidIx + 1) % (uint32_t)m_pyramids.size();
+
+    auto it = m_retiredPyramids.begin();
+    while (it != m_retiredPyramids.end())
+    {
+        if (--it->framesLeft > 0)
+        {
+            ++it;
+            continue;
+        }
+
+        destroyPyramid(*it);
+        it = m_retiredPyramids.erase(it);
+    }
+}
+
+void VKCullingPass::recordCull(vk::CommandBuffer cmd, const SceneBuffers& scene, const glm::mat4& view, const glm::mat4& proj)
+{
+    if (!m_cullPipeline || scene.instanceCount == 0)
+        return;
+
+    Pyramid& pyramid = m_pyramids[m_pyramidIx];
+    preparePyramid(cmd, pyramid);
+
+    CullParams params;
+    memset(&params, 0, sizeof(params));
+    params.view = view;
+    params.proj = proj;
+
+    // Gribb/Hartmann, rows of the view projection matrix added to and taken from the w row
+    glm::mat4 viewProj = proj * view;
+    glm::vec4 rows[4];
+    for (int r = 0; r < 4; ++r)
+        rows[r] = glm::vec4(viewProj[0][r], viewProj[1][r], viewProj[2][r], viewProj[3][r]);
+
+    for (int p = 0; p < 6; ++p)
+    {
+        glm::vec4 plane = (p & 1) ? rows[3] - rows[p / 2] : rows[3] + rows[p / 2];
+        params.frustum[p] = plane / glm::length(glm::vec3(plane));
+    }
+
+    // a standard perspective matrix has its near distance in the z and w terms
+    params.pyramidSize = glm::vec2((float)m_pyramidExtent.width, (float)m_pyramidExtent.height);
+    params.znear = proj[3][2] / (proj[2][2] - 1.0f);
+    params.occlusion = pyramid.valid ? 1 : 0;
+    params.instanceCount = scene.instanceCount;
+    params.commandCount = scene.commandCount;
+
+    uint32_t paramsOffset = m_uniforms->push(params);
+    if (paramsOffset == VKUniformRing::INVALID_OFFSET)
+        return;
+
+    // the slot's fence has signalled, so its counters are free to be zeroed from here
+    memset(m_statsAllocs[m_currentFrame].mapped, 0, sizeof(CullingStats));
+
+    DescriptorSetContents contents;
+    contents.buffer(0, vk::DescriptorType::eUniformBufferDynamic, m_uniforms->getBuffer(), 0, sizeof(CullParams))
+            .buffer(1, vk::DescriptorType::eStorageBuffer, scene.instances, 0, VK_WHOLE_SIZE)
+            .buffer(2, vk::DescriptorType::eStorageBuffer, scene.culledInstances, 0, VK_WHOLE_SIZE)
+            .buffer(3, vk::DescriptorType::eStorageBuffer, scene.commands, 0, VK_WHOLE_SIZE)
+            .buffer(4, vk::DescriptorType::eStorageBuffer, scene.bounds, 0, VK_WHOLE_SIZE)
+            .buffer(5, vk::DescriptorType::eStorageBuffer, m_statsBuffers[m_currentFrame], 0, sizeof(CullingStats))
+            .image(6, vk::DescriptorType::eCombinedImageSampler, m_sampler, pyramid.view, vk::ImageLayout::eGeneral);
+    vk::DescriptorSet set = m_descriptors->get(m_cullSetLayout, contents);
+    if (!set)
+        return;
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, m_cullPipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_cullLayout, 0, set, paramsOffset);
+    cmd.dispatch((scene.instanceCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+    // the counters are read on the host once the fence signals, which only covers device writes made available to it
+    vk::BufferMemoryBarrier statsBarrier;
+    statsBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    statsBarrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+    statsBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    statsBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    statsBarrier.buffer = m_statsBuffers[m_currentFrame];
+    statsBarrier.offset = 0;
+    statsBarrier.size = sizeof(CullingStats);
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost,
+        vk::DependencyFlags(), nullptr, statsBarrier, nullptr);
+}
+
+void VKCullingPass::recordPyramid(vk::CommandBuffer cmd)
+{
+    if (!m_pyramidPipeline || !m_depthView)
+        return;
+
+    Pyramid& pyramid = m_pyramids[m_pyramidIx];
+    preparePyramid(cmd, pyramid);
+
+    // each level reduces the one above it, the first reduces the depth image itself. A level without
+    // a set would leave the pyramid half built, so nothing is recorded unless every level has one
+    std::vector<vk::DescriptorSet> sets(pyramid.mips.size());
+    for (uint32_t mip = 0; mip < (uint32_t)pyramid.mips.size(); ++mip)
+    {
+        DescriptorSetContents contents;
+        if (mip == 0)
+            contents.image(0, vk::DescriptorType::eCombinedImageSampler, m_sampler, m_depthView, vk::ImageLayout::eShaderReadOnlyOptimal);
+        else
+            contents.image(0, vk::DescriptorType::eCombinedImageSampler, m_sampler, pyramid.mips[mip - 1], vk::ImageLayout::eGeneral);
+        contents.image(1, vk::DescriptorType::eStorageImage, vk::Sampler(), pyramid.mips[mip], vk::ImageLayout::eGeneral);
+
+        sets[mip] = m_descriptors->get(m_pyramidSetLayout, contents);
+        if (!sets[mip])
+            return;
+    }
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, m_pyramidPipeline);
+
+    for (uint32_t mip = 0; mip < (uint32_t)pyramid.mips.size(); ++mip)
+    {
+        const uint32_t width = std::max(m_pyramidExtent.width >> mip, 1u);
+        const uint32_t height = std::max(m_pyramidExtent.height >> mip, 1u);
+
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_pyramidLayout, 0, sets[mip], nullptr);
+        cmd.dispatch((width + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, (height + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, 1);
+
+        vk::ImageMemoryBarrier mipBarrier;
+        mipBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+        mipBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+        mipBarrier.oldLayout = vk::ImageLayout::eGeneral;
+        mipBarrier.newLayout = vk::ImageLayout::eGeneral;
+        mipBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        mipBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        mipBarrier.image = pyramid.image;
+        mipBarrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, mip, 1, 0, 1);
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+            vk::DependencyFlags(), nullptr, nullptr, mipBarrier);
+    }
+
+    pyramid.valid = true;
+}
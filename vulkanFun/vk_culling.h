@@ -0,0 +1,140 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "vk_allocator.h"
+#include "vk_layout_cache.h"
+#include "vk_pipeline_library.h"
+#include "vk_descriptor_allocator.h"
+#include "vk_uniform_ring.h"
+#include "vk_indirect_scene.h"
+
+struct CullingStats {
+    uint32_t                      tested = 0;
+    uint32_t                      visible = 0;
+};
+
+// GPU frustum and occlusion culling for a VKIndirectScene. One thread per instance tests its mesh's
+// bounding sphere against the frustum planes and a hierarchical Z pyramid, and survivors are appended to
+// their command's run in the culled instance buffer, bumping its instanceCount. The pyramid is built from
+// an earlier frame's depth, the previous one unless told otherwise, and tested with the current matrices,
+// so objects revealed by fast camera motion may show up that many frames late. Until a depth source is
+// given only the frustum test runs
+class VKCullingPass
+{
+public:
+    static constexpr uint32_t     CULL_GROUP_SIZE = 64;     // local_size_x of cull.comp
+    static constexpr uint32_t     PYRAMID_GROUP_SIZE = 8;   // local_size_x and _y of depth_pyramid.comp
+
+    // pyramidLatency is how many frames back the pyramid a cull reads was built, one pyramid is kept for
+    // each. With 1 the cull waits for all of the previous frame's graphics work, with 2 a cull on another
+    // queue only waits for the frame before that and overlaps the previous one
+    void                          init(vk::Device dev, VKAllocator& allocator, VKLayoutCache& layouts, VKPipelineLibrary& pipelines,
+                                       VKDescriptorAllocator& descriptors, VKUniformRing& uniforms, uint32_t framesInFlight,
+                                       uint32_t pyramidLatency = 1);
+    void                          shutdown();
+
+    // null modules leave culling unavailable, a null pyramid module just disables occlusion
+    void                          createPipelines(vk::ShaderModule cullShader, const ShaderReflection& cullReflection,
+                                                  vk::ShaderModule pyramidShader, const ShaderReflection& pyramidReflection);
+    bool                          isAvailable() const { return (bool)m_cullPipeline; }
+
+    // the depth image the pyramid is built from, resized with it. The view must be sampleable and in
+    // eShaderReadOnlyOptimal when recordPyramid runs, and the render pass writing it next has to wait for
+    // compute shader reads. A null view turns occlusion off. The old pyramids are kept until frames that
+    // may still use them have retired
+    void                          setDepthSource(vk::ImageView depthView, vk::Extent2D extent);
+
+    // reads back what the slot's last frame culled, once its fence has signalled, frees old pyramids and
+    // moves on to the pyramid this frame's cull reads and its pyramid pass rebuilds
+    void                          beginFrame(uint32_t frameIx);
+
+    // outside a render pass, after VKIndirectScene::build, on a graphics or compute queue. Writes the
+    // culled instances and the commands' instance counts from the compute stage, the caller makes the
+    // draws wait for them
+    void                          recordCull(vk::CommandBuffer cmd, const SceneBuffers& scene, const glm::mat4& view, const glm::mat4& proj);
+
+    // after the render pass that wrote the depth source, which the caller makes this wait for, as
+    // well as the cull's reads of the pyramid. Only records anything with a depth source
+    void                          recordPyramid(vk::CommandBuffer cmd);
+    bool                          hasDepthSource() const { return m_pyramidPipeline && m_depthView; }
+
+    // this frame's, read by the cull and then rebuilt by recordPyramid, both from the compute stage, in
+    // eGeneral. It was last written getPyramidLatency() frames ago
+    vk::Image                     getPyramid() const { return m_pyramids[m_pyramidIx].image; }
+    uint32_t                      getPyramidMipCount() const { return (uint32_t)m_pyramids[m_pyramidIx].mips.size(); }
+    uint32_t                      getPyramidLatency() const { return (uint32_t)m_pyramids.size(); }
+    uint32_t                      getPyramidIndex() const { return m_pyramidIx; }
+
+    const CullingStats&           getStats() const { return m_stats; }
+
+private:
+    // std140, matches CullParams in cull.comp
+    struct CullParams {
+        glm::mat4                 view;
+        glm::mat4                 proj;
+        glm::vec4                 frustum[6];       // world space planes, xyz normal pointing in
+        glm::vec2                 pyramidSize;
+        float                     znear;
+        uint32_t                  occlusion;
+        uint32_t                  instanceCount;
+        uint32_t                  commandCount;
+        uint32_t                  pad[2];
+    };
+
+    // max depth of each texel's footprint, a 1x1 far plane placeholder until there's a depth source
+    struct Pyramid {
+        vk::Image                 image;
+        VKAllocation              alloc;
+        vk::ImageView             view;             // every mip, for the cull
+        std::vector<vk::ImageView> mips;            // one per mip, for building it
+        bool                      fresh = true;     // not yet in eGeneral
+        bool                      valid = false;    // holds a depth pyramid rather than the placeholder
+    };
+
+    struct RetiredPyramid {
+        vk::Image                 image;
+        VKAllocation              alloc;
+        std::vector<vk::ImageView> views;
+        uint32_t                  framesLeft;       // beginFrame calls until every slot has cycled
+    };
+
+    void                          createPyramids(vk::Extent2D extent);
+    void                          retirePyramids();
+    void                          destroyPyramid(RetiredPyramid& pyramid);
+    void                          preparePyramid(vk::CommandBuffer cmd, Pyramid& pyramid);
+
+    vk::Device                    m_dev;
+    VKAllocator*                  m_allocator;
+    VKLayoutCache*                m_layouts;
+    VKPipelineLibrary*            m_pipelines;
+    VKDescriptorAllocator*        m_descriptors;
+    VKUniformRing*                m_uniforms;
+
+    vk::Pipeline                  m_cullPipeline;   // both owned by m_pipelines
+    vk::Pipeline                  m_pyramidPipeline;
+    vk::PipelineLayout            m_cullLayout;     // both owned by m_layouts
+    vk::PipelineLayout            m_pyramidLayout;
+    vk::DescriptorSetLayout       m_cullSetLayout;
+    vk::DescriptorSetLayout       m_pyramidSetLayout;
+
+    vk::Sampler                   m_sampler;        // nearest, for the depth source and the pyramid
+    vk::ImageView                 m_depthView;
+    vk::Extent2D                  m_depthExtent;
+
+    // one per frame of latency, used in turn so a frame reads the one built that many frames ago
+    std::vector<Pyramid>          m_pyramids;
+    uint32_t                      m_pyramidIx;
+    vk::Extent2D                  m_pyramidExtent;
+    std::vector<RetiredPyramid>   m_retiredPyramids;
+
+    // tested and visible counters per frame slot, host visible
+    std::vector<vk::Buffer>       m_statsBuffers;
+    std::vector<VKAllocation>     m_statsAllocs;
+    uint32_t                      m_currentFrame;
+    CullingStats                  m_stats;
+};
@@ -0,0 +1,284 @@
+#include "vk_descriptor_allocator.h"
+#include "trace.h"
+
+#include <string.h>
+#include <algorithm>
+
+template<typename T>
+static uint64_t handleBits(T handle)
+{
+    return (uint64_t)handle;
+}
+
+DescriptorSetContents& DescriptorSetContents::buffer(uint32_t binding, vk::DescriptorType type, vk::Buffer buffer,
+                                                     vk::DeviceSize offset, vk::DeviceSize range, uint32_t arrayElement)
+{
+    DescriptorEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.binding = binding;
+    entry.arrayElement = arrayElement;
+    entry.type = (uint32_t)type;
+    entry.object = handleBits((VkBuffer)buffer);
+    entry.offset = (uint64_t)offset;
+    entry.range = (uint64_t)range;
+    m_entries.push_back(entry);
+    return *this;
+}
+
+DescriptorSetContents& DescriptorSetContents::image(uint32_t binding, vk::DescriptorType type, vk::Sampler sampler,
+                                                    vk::ImageView view, vk::ImageLayout layout, uint32_t arrayElement)
+{
+    DescriptorEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.binding = binding;
+    entry.arrayElement = arrayElement;
+    entry.type = (uint32_t)type;
+    entry.imageLayout = (uint32_t)layout;
+    entry.object = handleBits((VkSampler)sampler);
+    entry.view = handleBits((VkImageView)view);
+    m_entries.push_back(entry);
+    return *this;
+}
+
+uint64_t DescriptorSetContents::hash(vk::DescriptorSetLayout layout) const
+{
+    // FNV-1a over the layout then every entry
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&h](const void* data, size_t size) {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < size; ++i)
+        {
+            h ^= bytes[i];
+            h *= 1099511628211ull;
+        }
+    };
+
+    uint64_t layoutBits = handleBits((VkDescriptorSetLayout)layout);
+    mix(&layoutBits, sizeof(layoutBits));
+    if (!m_entries.empty())
+        mix(m_entries.data(), m_entries.size() * sizeof(DescriptorEntry));
+    return h;
+}
+
+void DescriptorSetContents::write(vk::Device dev, vk::DescriptorSet set) const
+{
+    std::vector<vk::WriteDescriptorSet> writes(m_entries.size());
+    std::vector<vk::DescriptorBufferInfo> bufferInfos(m_entries.size());
+    std::vector<vk::DescriptorImageInfo> imageInfos(m_entries.size());
+
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        const DescriptorEntry& entry = m_entries[i];
+        vk::DescriptorType type = (vk::DescriptorType)entry.type;
+
+        writes[i].dstSet = set;
+        writes[i].dstBinding = entry.binding;
+        writes[i].dstArrayElement = entry.arrayElement;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = type;
+
+        switch (type)
+        {
+        case vk::DescriptorType::eUniformBuffer:
+        case vk::DescriptorType::eUniformBufferDynamic:
+        case vk::DescriptorType::eStorageBuffer:
+        case vk::DescriptorType::eStorageBufferDynamic:
+            bufferInfos[i].buffer = vk::Buffer((VkBuffer)entry.object);
+            bufferInfos[i].offset = (vk::DeviceSize)entry.offset;
+            bufferInfos[i].range = (vk::DeviceSize)entry.range;
+            writes[i].pBufferInfo = &bufferInfos[i];
+            break;
+        default:
+            imageInfos[i].sampler = vk::Sampler((VkSampler)entry.object);
+            imageInfos[i].imageView = vk::ImageView((VkImageView)entry.view);
+            imageInfos[i].imageLayout = (vk::ImageLayout)entry.imageLayout;
+            writes[i].pImageInfo = &imageInfos[i];
+            break;
+        }
+    }
+
+    if (!writes.empty())
+        dev.updateDescriptorSets(writes, nullptr);
+}
+
+void VKDescriptorAllocator::init(vk::Device dev, uint32_t framesInFlight, const std::vector<DescriptorPoolRatio>* ratios)
+{
+    m_dev = dev;
+    m_nextPoolSets = INITIAL_SETS_PER_POOL;
+    m_currentFrame = 0;
+    m_frames.clear();
+    m_frames.resize(framesInFlight);
+    m_stats = DescriptorAllocatorStats();
+
+    if (ratios)
+    {
+        m_ratios = *ratios;
+    }
+    else
+    {
+        m_ratios = {
+            { vk::DescriptorType::eUniformBuffer, 1.0f },
+            { vk::DescriptorType::eUniformBufferDynamic, 1.0f },
+            { vk::DescriptorType::eStorageBuffer, 2.0f },
+            { vk::DescriptorType::eSampledImage, 2.0f },
+            { vk::DescriptorType::eStorageImage, 1.0f },
+            { vk::DescriptorType::eSampler, 1.0f },
+            { vk::DescriptorType::eCombinedImageSampler, 2.0f },
+        };
+    }
+}
+
+void VKDescriptorAllocator::shutdown()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto it : m_allPools)
+        m_dev.destroyDescriptorPool(it);
+
+    m_allPools.clear();
+    m_freePools.clear();
+    m_frames.clear();
+}
+
+void VKDescriptorAllocator::beginFrame(uint32_t frameIx)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_currentFrame = frameIx;
+    FrameDescriptors& frame = m_frames[frameIx];
+
+    // one reset returns every set the frame allocated
+    for (auto it : frame.usedPools)
+    {
+        m_dev.resetDescriptorPool(it);
+        m_freePools.push_back(it);
+    }
+
+    m_stats.poolsInUse -= (uint32_t)frame.usedPools.size();
+    frame.usedPools.clear();
+    frame.cache.clear();
+    frame.setsAllocated = 0;
+}
+
+vk::DescriptorPool VKDescriptorAllocator::acquirePool()
+{
+    if (!m_freePools.empty())
+    {
+        vk::DescriptorPool pool = m_freePools.back();
+        m_freePools.pop_back();
+        return pool;
+    }
+
+    std::vector<vk::DescriptorPoolSize> poolSizes;
+    for (auto& it : m_ratios)
+        poolSizes.push_back(vk::DescriptorPoolSize(it.type, std::max(1u, (uint32_t)(it.perSet * m_nextPoolSets))));
+
+    vk::DescriptorPoolCreateInfo poolInfo;
+    poolInfo.maxSets = m_nextPoolSets;
+    poolInfo.poolSizeCount = (uint32_t)poolSizes.size();
+    poolInfo.pPoolSizes = poolSizes.data();
+
+    vk::DescriptorPool pool = m_dev.createDescriptorPool(poolInfo);
+    m_allPools.push_back(pool);
+    ++m_stats.poolsCreated;
+
+    // a frame that needed another pool will likely need it again, so the next one is bigger
+    m_nextPoolSets = std::min(m_nextPoolSets * 2, MAX_SETS_PER_POOL);
+    return pool;
+}
+
+vk::DescriptorSet VKDescriptorAllocator::allocateLocked(vk::DescriptorSetLayout layout)
+{
+    FrameDescriptors& frame = m_frames[m_currentFrame];
+
+    VkDescriptorSetLayout vkLayout = layout;
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &vkLayout;
+
+    // the C entry point reports pool exhaustion as a result rather than an exception
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        if (attempt > 0 || frame.usedPools.empty())
+        {
+            frame.usedPools.push_back(acquirePool());
+            ++m_stats.poolsInUse;
+        }
+
+        allocInfo.descriptorPool = frame.usedPools.back();
+
+        VkDescriptorSet set = VK_NULL_HANDLE;
+        VkResult res = vkAllocateDescriptorSets(VkDevice(m_dev), &allocInfo, &set);
+        if (res == VK_SUCCESS)
+        {
+            ++m_stats.allocated;
+            ++frame.setsAllocated;
+            m_stats.maxSetsInFrame = std::max(m_stats.maxSetsInFrame, frame.setsAllocated);
+            return vk::DescriptorSet(set);
+        }
+
+        if (res != VK_ERROR_OUT_OF_POOL_MEMORY_KHR && res != VK_ERROR_FRAGMENTED_POOL)
+            break;
+    }
+
+    // even a fresh pool can't hold it, the layout needs more of a type than the ratios give
+    LOG_ERROR(LogCategory::eMemory, "Descriptor allocation failed for layout %p", (void*)(VkDescriptorSetLayout)layout);
+    return vk::DescriptorSet();
+}
+
+vk::DescriptorSet VKDescriptorAllocator::allocate(vk::DescriptorSetLayout layout)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return allocateLocked(layout);
+}
+
+vk::DescriptorSet VKDescriptorAllocator::get(vk::DescriptorSetLayout layout, const DescriptorSetContents& contents)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    FrameDescriptors& frame = m_frames[m_currentFrame];
+    uint64_t h = contents.hash(layout);
+
+    auto it = frame.cache.find(h);
+    if (it != frame.cache.end() && it->second.layout == layout &&
+        it->second.entries.size() == contents.getEntries().size() &&
+        (contents.empty() || memcmp(it->second.entries.data(), contents.getEntries().data(), contents.getEntries().size() * sizeof(DescriptorEntry)) == 0))
+    {
+        ++m_stats.cacheHits;
+        return it->second.set;
+    }
+
+    vk::DescriptorSet set = allocateLocked(layout);
+    if (!set)
+        return set;
+
+    contents.write(m_dev, set);
+
+    // a hash collision just leaves the first set cached
+    if (it == frame.cache.end())
+    {
+        CachedSet cached;
+        cached.layout = layout;
+        cached.entries = contents.getEntries();
+        cached.set = set;
+        frame.cache.emplace(h, std::move(cached));
+    }
+    return set;
+}
+
+DescriptorAllocatorStats VKDescriptorAllocator::getStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void VKDescriptorAllocator::printStats() const
+{
+    DescriptorAllocatorStats stats = getStats();
+
+    TRACE("%s", "Descriptor allocator:");
+    TRACE("> %llu sets allocated, %llu cache hits, at most %u sets in a frame",
+        (unsigned long long)stats.allocated, (unsigned long long)stats.cacheHits, stats.maxSetsInFrame);
+    TRACE("> %u pools created, %u in use", stats.poolsCreated, stats.poolsInUse);
+}
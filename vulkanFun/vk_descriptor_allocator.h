@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+// share of a pool's descriptors of one type, per set the pool is sized for
+struct DescriptorPoolRatio {
+    vk::DescriptorType            type;
+    float                         perSet;
+};
+
+// one descriptor of a set's contents, handles stored as integers so contents hash and compare as bytes
+struct DescriptorEntry {
+    uint32_t                      binding;
+    uint32_t                      arrayElement;
+    uint32_t                      type;
+    uint32_t                      imageLayout;
+    uint64_t                      object;           // buffer, or sampler
+    uint64_t                      view;
+    uint64_t                      offset;
+    uint64_t                      range;
+};
+
+// what a set should hold, built up then handed to VKDescriptorAllocator::get()
+class DescriptorSetContents
+{
+public:
+    DescriptorSetContents&        buffer(uint32_t binding, vk::DescriptorType type, vk::Buffer buffer,
+                                         vk::DeviceSize offset, vk::DeviceSize range, uint32_t arrayElement = 0);
+    DescriptorSetContents&        image(uint32_t binding, vk::DescriptorType type, vk::Sampler sampler,
+                                        vk::ImageView view, vk::ImageLayout layout, uint32_t arrayElement = 0);
+
+    uint64_t                      hash(vk::DescriptorSetLayout layout) const;
+    void                          write(vk::Device dev, vk::DescriptorSet set) const;
+
+    const std::vector<DescriptorEntry>& getEntries() const { return m_entries; }
+    bool                          empty() const { return m_entries.empty(); }
+    void                          clear() { m_entries.clear(); }
+
+private:
+    std::vector<DescriptorEntry>  m_entries;
+};
+
+struct DescriptorAllocatorStats {
+    uint64_t                      allocated = 0;
+    uint64_t                      cacheHits = 0;
+    uint32_t                      poolsCreated = 0;
+    uint32_t                      poolsInUse = 0;
+    uint32_t                      maxSetsInFrame = 0;
+};
+
+// Transient descriptor sets, valid for the frame they are allocated in. Each frame in flight keeps a list
+// of pools, allocating from the newest and moving on to another when it runs out, so sets are never freed
+// one by one: the frame's pools are reset wholesale once its fence has signalled, and go back to a free
+// list shared by every frame. New pools grow geometrically up to MAX_SETS_PER_POOL. get() also caches
+// sets by layout and contents, so asking for identical contents again in a frame costs a hash lookup.
+// Safe to use from recording threads
+class VKDescriptorAllocator
+{
+public:
+    static constexpr uint32_t     INITIAL_SETS_PER_POOL = 64;
+    static constexpr uint32_t     MAX_SETS_PER_POOL = 4096;
+
+    // null ratios use a mix of buffers, images and samplers
+    void                          init(vk::Device dev, uint32_t framesInFlight,
+                                       const std::vector<DescriptorPoolRatio>* ratios = nullptr);
+    void                          shutdown();
+
+    // once the frame slot's fence has signalled, every set it allocated last time round becomes invalid
+    void                          beginFrame(uint32_t frameIx);
+
+    // a set with undefined contents for this frame
+    vk::DescriptorSet             allocate(vk::DescriptorSetLayout layout);
+
+    // a set for this frame holding contents, shared with earlier identical requests in the frame
+    vk::DescriptorSet             get(vk::DescriptorSetLayout layout, const DescriptorSetContents& contents);
+
+    DescriptorAllocatorStats      getStats() const;
+    void                          printStats() const;
+
+private:
+    struct CachedSet {
+        vk::DescriptorSetLayout   layout;
+        std::vector<DescriptorEntry> entries;
+        vk::DescriptorSet         set;
+    };
+
+    struct FrameDescriptors {
+        std::vector<vk::DescriptorPool> usedPools;  // the back one is allocated from
+        std::unordered_map<uint64_t, CachedSet> cache;
+        uint32_t                  setsAllocated = 0;
+    };
+
+    vk::DescriptorSet             allocateLocked(vk::DescriptorSetLayout layout);
+    vk::DescriptorPool            acquirePool();
+
+    vk::Device                    m_dev;
+    std::vector<DescriptorPoolRatio> m_ratios;
+    uint32_t                      m_nextPoolSets;
+
+    std::vector<FrameDescriptors> m_frames;
+    uint32_t                      m_currentFrame;
+    std::vector<vk::DescriptorPool> m_freePools;    // reset, ready for any frame
+    std::vector<vk::DescriptorPool> m_allPools;
+
+    mutable std::mutex            m_mutex;
+    DescriptorAllocatorStats      m_stats;
+};
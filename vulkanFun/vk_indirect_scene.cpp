@@ -0,0 +1,380 @@
+#include "vk_indirect_scene.h"
+#include "logging.h"
+
+#include <string.h>
+#include <algorithm>
+
+static const vk::DeviceSize COMMAND_STRIDE = sizeof(VkDrawIndexedIndirectCommand);
+
+SceneInstance SceneInstance::fromMatrix(const glm::mat4& m)
+{
+    // glm is column major, the rows are what the shader needs
+    SceneInstance instance;
+    for (int r = 0; r < 3; ++r)
+        instance.rows[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+    return instance;
+}
+
+void VKIndirectScene::prepareDevice(vk::PhysicalDevice physDevice, std::vector<const char*>& deviceExtensions)
+{
+    m_extensionEnabled = false;
+
+#ifdef VK_KHR_draw_indirect_count
+    auto allPhysDeviceExtensions = physDevice.enumerateDeviceExtensionProperties();
+    auto found = std::find_if(allPhysDeviceExtensions.begin(), allPhysDeviceExtensions.end(), [](const vk::ExtensionProperties& e) {
+        return strcmp(e.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0;
+    });
+
+    if (found != allPhysDeviceExtensions.end())
+    {
+        deviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        m_extensionEnabled = true;
+    }
+#else
+    (void)physDevice;
+    (void)deviceExtensions;
+#endif
+}
+
+void VKIndirectScene::init(vk::PhysicalDevice physDevice, vk::Device dev, VKAllocator& allocator, uint32_t framesInFlight)
+{
+    m_dev = dev;
+    m_allocator = &allocator;
+    m_currentFrame = 0;
+
+    // the device enables every feature it has, these only say which ones that was
+    vk::PhysicalDeviceFeatures features = physDevice.getFeatures();
+    m_multiDrawIndirect = features.multiDrawIndirect == VK_TRUE;
+    m_indirectFirstInstance = features.drawIndirectFirstInstance == VK_TRUE;
+    m_maxDrawIndirectCount = m_multiDrawIndirect ? physDevice.getProperties().limits.maxDrawIndirectCount : 1;
+
+    m_drawIndirectCount = m_extensionEnabled ? m_dev.getProcAddr("vkCmdDrawIndexedIndirectCountKHR") : nullptr;
+
+    LOG_INFO(LogCategory::eDevice, "Indirect scene: draw indirect count %s, multi-draw indirect %s, first instance %s",
+        m_drawIndirectCount ? "yes" : "no", m_multiDrawIndirect ? "yes" : "no", m_indirectFirstInstance ? "yes" : "no");
+
+    m_frames.resize(framesInFlight);
+    for (auto& frame : m_frames)
+        reserve(frame, INITIAL_INSTANCES, 256);
+}
+
+void VKIndirectScene::shutdown()
+{
+    for (auto& frame : m_frames)
+    {
+        m_allocator->destroyBuffer(frame.instances, frame.instancesAlloc);
+        m_allocator->destroyBuffer(frame.culledInstances, frame.culledInstancesAlloc);
+        m_allocator->destroyBuffer(frame.commands, frame.commandsAlloc);
+        m_allocator->destroyBuffer(frame.bounds, frame.boundsAlloc);
+    }
+    m_frames.clear();
+    m_meshes.clear();
+    m_order.clear();
+}
+
+void VKIndirectScene::getInstanceInput(uint32_t firstLocation,
+                                       std::vector<vk::VertexInputBindingDescription>& bindings,
+                                       std::vector<vk::VertexInputAttributeDescription>& attributes)
+{
+    bindings.push_back(vk::VertexInputBindingDescription(INSTANCE_BINDING, sizeof(SceneInstance), vk::VertexInputRate::eInstance));
+    for (uint32_t r = 0; r < 3; ++r)
+    {
+        attributes.push_back(vk::VertexInputAttributeDescription(firstLocation + r, INSTANCE_BINDING,
+            vk::Format::eR32G32B32A32Sfloat, r * (uint32_t)sizeof(glm::vec4)));
+    }
+}
+
+uint32_t VKIndirectScene::registerMesh(const SceneMesh& mesh)
+{
+    Mesh entry;
+    entry.desc = mesh;
+    m_meshes.push_back(entry);
+    m_orderDirty = true;
+    return (uint32_t)m_meshes.size() - 1;
+}
+
+void VKIndirectScene::beginFrame(uint32_t frameIx)
+{
+    m_currentFrame = frameIx;
+
+    // capacity is kept, a steady scene stops allocating after its first frame
+    for (auto& it : m_meshes)
+        it.instances.clear();
+    m_commands.clear();
+    m_batches.clear();
+    m_stats = SceneStats();
+}
+
+void VKIndirectScene::addInstances(uint32_t meshId, const SceneInstance* instances, size_t count)
+{
+    std::vector<SceneInstance>& dst = m_meshes[meshId].instances;
+    dst.insert(dst.end(), instances, instances + count);
+}
+
+bool VKIndirectScene::sameState(const SceneMesh& a, const SceneMesh& b)
+{
+    return a.pipeline == b.pipeline && a.material == b.material &&
+           a.vertexBuffer == b.vertexBuffer && a.vertexStreamCount == b.vertexStreamCount &&
+           memcmp(a.vertexStreamOffsets, b.vertexStreamOffsets, sizeof(a.vertexStreamOffsets)) == 0 &&
+           a.indexBuffer == b.indexBuffer && a.indexType == b.indexType;
+}
+
+bool VKIndirectScene::stateLess(const SceneMesh& a, const SceneMesh& b)
+{
+    if (a.pipeline != b.pipeline) return a.pipeline < b.pipeline;
+    if (a.material.buffer != b.material.buffer) return a.material.buffer < b.material.buffer;
+    if (a.material.image != b.material.image) return a.material.image < b.material.image;
+    if (a.material.sampler != b.material.sampler) return a.material.sampler < b.material.sampler;
+    if (a.vertexBuffer != b.vertexBuffer) return a.vertexBuffer < b.vertexBuffer;
+    if (a.indexBuffer != b.indexBuffer) return a.indexBuffer < b.indexBuffer;
+    if (a.indexType != b.indexType) return a.indexType < b.indexType;
+    if (a.vertexStreamCount != b.vertexStreamCount) return a.vertexStreamCount < b.vertexStreamCount;
+    return memcmp(a.vertexStreamOffsets, b.vertexStreamOffsets, sizeof(a.vertexStreamOffsets)) < 0;
+}
+
+SceneBuffers VKIndirectScene::getBuffers() const
+{
+    const FrameBuffers& frame = m_frames[m_currentFrame];
+
+    SceneBuffers buffers;
+    buffers.instances = frame.instances;
+    buffers.culledInstances = frame.culledInstances;
+    buffers.commands = frame.commands;
+    buffers.bounds = frame.bounds;
+    buffers.instanceCount = m_stats.instances;
+    buffers.commandCount = m_stats.commands;
+    return buffers;
+}
+
+vk::DeviceSize VKIndirectScene::getCountOffset(const FrameBuffers& frame) const
+{
+    return frame.commandCapacity * COMMAND_STRIDE;
+}
+
+void VKIndirectScene::reserve(FrameBuffers& frame, uint32_t instanceCount, uint32_t commandCount)
+{
+    // the frame slot's last submission has retired, so its buffers can simply be replaced
+    if (instanceCount > frame.instanceCapacity)
+    {
+        m_allocator->destroyBuffer(frame.instances, frame.instancesAlloc);
+        m_allocator->destroyBuffer(frame.culledInstances, frame.culledInstancesAlloc);
+        frame.instanceCapacity = std::max(instanceCount, frame.instanceCapacity * 2);
+
+        vk::BufferCreateInfo bufferInfo;
+        bufferInfo.size = (vk::DeviceSize)frame.instanceCapacity * sizeof(SceneInstance);
+        bufferInfo.usage = vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer;
+        m_allocator->share(bufferInfo);
+
+        // written once and read once a frame, device local too where the heap allows it
+        frame.instancesAlloc = m_allocator->createBuffer(bufferInfo,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, frame.instances,
+            vk::MemoryPropertyFlagBits::eDeviceLocal);
+    }
+
+    // only ever written by the culling pass
+    if (m_gpuCulling && !frame.culledInstances)
+    {
+        vk::BufferCreateInfo bufferInfo;
+        bufferInfo.size = (vk::DeviceSize)frame.instanceCapacity * sizeof(SceneInstance);
+        bufferInfo.usage = vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer;
+        m_allocator->share(bufferInfo);
+
+        frame.culledInstancesAlloc = m_allocator->createBuffer(bufferInfo, vk::MemoryPropertyFlagBits::eDeviceLocal, frame.culledInstances);
+    }
+
+    // every mesh may be its own batch, so there's a count slot per command
+    if (commandCount > frame.commandCapacity)
+    {
+        m_allocator->destroyBuffer(frame.commands, frame.commandsAlloc);
+        frame.commandCapacity = std::max(commandCount, frame.commandCapacity * 2);
+
+        vk::BufferCreateInfo bufferInfo;
+        bufferInfo.size = frame.commandCapacity * (COMMAND_STRIDE + sizeof(uint32_t));
+        bufferInfo.usage = vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eStorageBuffer;
+        m_allocator->share(bufferInfo);
+
+        frame.commandsAlloc = m_allocator->createBuffer(bufferInfo,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, frame.commands,
+            vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+        m_allocator->destroyBuffer(frame.bounds, frame.boundsAlloc);
+        bufferInfo.size = frame.commandCapacity * sizeof(glm::vec4);
+        bufferInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer;
+
+        frame.boundsAlloc = m_allocator->createBuffer(bufferInfo,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, frame.bounds,
+            vk::MemoryPropertyFlagBits::eDeviceLocal);
+    }
+}
+
+void VKIndirectScene::build()
+{
+    if (m_orderDirty)
+    {
+        m_order.resize(m_meshes.size());
+        for (uint32_t i = 0; i < (uint32_t)m_order.size(); ++i)
+            m_order[i] = i;
+
+        std::stable_sort(m_order.begin(), m_order.end(), [this](uint32_t a, uint32_t b) {
+            return stateLess(m_meshes[a].desc, m_meshes[b].desc);
+        });
+        m_orderDirty = false;
+    }
+
+    uint32_t instanceCount = 0;
+    uint32_t commandCount = 0;
+    for (auto& it : m_meshes)
+    {
+        instanceCount += (uint32_t)it.instances.size();
+        commandCount += it.instances.empty() ? 0 : 1;
+    }
+
+    FrameBuffers& frame = m_frames[m_currentFrame];
+    reserve(frame, instanceCount, commandCount);
+
+    // each mesh's instances are one contiguous run, which its command points at through firstInstance
+    SceneInstance* instances = (SceneInstance*)frame.instancesAlloc.mapped;
+    glm::vec4* bounds = (glm::vec4*)frame.boundsAlloc.mapped;
+    m_commands.clear();
+    m_batches.clear();
+
+    uint32_t firstInstance = 0;
+    for (uint32_t meshId : m_order)
+    {
+        const Mesh& mesh = m_meshes[meshId];
+        if (mesh.instances.empty())
+            continue;
+
+        memcpy(instances + firstInstance, mesh.instances.data(), mesh.instances.size() * sizeof(SceneInstance));
+
+        VkDrawIndexedIndirectCommand command;
+        command.indexCount = mesh.desc.indexCount;
+        command.instanceCount = m_gpuCulling ? 0 : (uint32_t)mesh.instances.size();
+        command.firstIndex = mesh.desc.firstIndex;
+        command.vertexOffset = mesh.desc.vertexOffset;
+        command.firstInstance = firstInstance;
+
+        if (m_batches.empty() || !sameState(m_meshes[m_batches.back().meshId].desc, mesh.desc) ||
+            m_batches.back().commandCount == m_maxDrawIndirectCount)
+        {
+            Batch batch;
+            batch.meshId = meshId;
+            batch.firstCommand = (uint32_t)m_commands.size();
+            batch.commandCount = 0;
+            m_batches.push_back(batch);
+        }
+
+        ++m_batches.back().commandCount;
+        bounds[m_commands.size()] = mesh.desc.boundingSphere;
+        m_commands.push_back(command);
+        firstInstance += (uint32_t)mesh.instances.size();
+    }
+
+    unsigned char* commands = (unsigned char*)frame.commandsAlloc.mapped;
+    if (!m_commands.empty())
+        memcpy(commands, m_commands.data(), m_commands.size() * COMMAND_STRIDE);
+
+    uint32_t* counts = (uint32_t*)(commands + getCountOffset(frame));
+    for (size_t b = 0; b < m_batches.size(); ++b)
+        counts[b] = m_batches[b].commandCount;
+
+    m_stats.instances = instanceCount;
+    m_stats.commands = (uint32_t)m_commands.size();
+    m_stats.batches = (uint32_t)m_batches.size();
+    m_stats.drawCalls = 0;
+}
+
+void VKIndirectScene::record(vk::CommandBuffer cmd, vk::Pipeline defaultPipeline, vk::PipelineLayout layout,
+                             vk::DescriptorSet descriptorSet, uint32_t uniformOffset, VKBindlessHeap& bindless)
+{
+    if (m_batches.empty())
+        return;
+
+    const FrameBuffers& frame = m_frames[m_currentFrame];
+#ifdef VK_KHR_draw_indirect_count
+    const vk::DeviceSize countOffset = getCountOffset(frame);
+#endif
+
+    // every batch reads its instances from the same buffer, firstInstance picks the run
+    const vk::DeviceSize instanceOffset = 0;
+    cmd.bindVertexBuffers(INSTANCE_BINDING, m_gpuCulling ? frame.culledInstances : frame.instances, instanceOffset);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, 0, descriptorSet, uniformOffset);
+
+    vk::Pipeline boundPipeline;
+    vk::DescriptorSet boundMaterialSet;
+    BindlessIndices boundMaterial;
+    bool materialPushed = false;
+
+    for (size_t b = 0; b < m_batches.size(); ++b)
+    {
+        const Batch& batch = m_batches[b];
+        const SceneMesh& mesh = m_meshes[batch.meshId].desc;
+
+        vk::Pipeline pipeline = mesh.pipeline ? mesh.pipeline : defaultPipeline;
+        if (pipeline != boundPipeline)
+        {
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+            boundPipeline = pipeline;
+        }
+
+        // meshes without a material still push, invalid indices tell the shader to skip the lookups
+        vk::DescriptorSet materialSet = bindless.getSet(mesh.material);
+        if (materialSet && materialSet != boundMaterialSet)
+        {
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, 1, materialSet, nullptr);
+            boundMaterialSet = materialSet;
+        }
+
+        BindlessIndices push = bindless.getPushIndices(mesh.material);
+        if (!materialPushed || push != boundMaterial)
+        {
+            cmd.pushConstants(layout, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+                0, sizeof(push), &push);
+            boundMaterial = push;
+            materialPushed = true;
+        }
+
+        vk::Buffer buffers[MAX_VERTEX_STREAMS];
+        for (uint32_t s = 0; s < mesh.vertexStreamCount; ++s)
+            buffers[s] = mesh.vertexBuffer;
+
+        cmd.bindVertexBuffers(0, vk::ArrayProxy<const vk::Buffer>(mesh.vertexStreamCount, buffers),
+            vk::ArrayProxy<const vk::DeviceSize>(mesh.vertexStreamCount, mesh.vertexStreamOffsets));
+        cmd.bindIndexBuffer(mesh.indexBuffer, 0, mesh.indexType);
+
+        const vk::DeviceSize commandOffset = batch.firstCommand * COMMAND_STRIDE;
+
+        // every command has its own firstInstance, which indirect draws only honour with the feature
+#ifdef VK_KHR_draw_indirect_count
+        if (m_drawIndirectCount && m_indirectFirstInstance)
+        {
+            ((PFN_vkCmdDrawIndexedIndirectCountKHR)m_drawIndirectCount)(VkCommandBuffer(cmd),
+                VkBuffer(frame.commands), commandOffset, VkBuffer(frame.commands), countOffset + b * sizeof(uint32_t),
+                batch.commandCount, (uint32_t)COMMAND_STRIDE);
+            ++m_stats.drawCalls;
+        }
+        else
+#endif
+        if (m_multiDrawIndirect && m_indirectFirstInstance)
+        {
+            cmd.drawIndexedIndirect(frame.commands, commandOffset, batch.commandCount, (uint32_t)COMMAND_STRIDE);
+            ++m_stats.drawCalls;
+        }
+        else if (m_indirectFirstInstance)
+        {
+            for (uint32_t c = 0; c < batch.commandCount; ++c)
+                cmd.drawIndexedIndirect(frame.commands, commandOffset + c * COMMAND_STRIDE, 1, (uint32_t)COMMAND_STRIDE);
+            m_stats.drawCalls += batch.commandCount;
+        }
+        else
+        {
+            // direct draws may always set firstInstance
+            for (uint32_t c = 0; c < batch.commandCount; ++c)
+            {
+                const VkDrawIndexedIndirectCommand& command = m_commands[batch.firstCommand + c];
+                cmd.drawIndexed(command.indexCount, command.instanceCount, command.firstIndex, command.vertexOffset, command.firstInstance);
+            }
+            m_stats.drawCalls += batch.commandCount;
+        }
+    }
+}
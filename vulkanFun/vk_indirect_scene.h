@@ -0,0 +1,154 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "vk_allocator.h"
+#include "vk_bindless.h"
+#include "vertex_format.h"
+
+// a mesh and the material it's drawn with, registered once and instanced any number of times a frame.
+// Meshes sharing everything but their index range, e.g. ones suballocated from the same buffers, end up
+// in one multi-draw
+struct SceneMesh {
+    vk::Pipeline                  pipeline;         // null uses the pipeline given to record()
+    vk::Buffer                    vertexBuffer;
+    uint32_t                      vertexStreamCount = 1;
+    vk::DeviceSize                vertexStreamOffsets[MAX_VERTEX_STREAMS] = {};
+    vk::Buffer                    indexBuffer;
+    vk::IndexType                 indexType = vk::IndexType::eUint16;
+    uint32_t                      indexCount = 0;
+    uint32_t                      firstIndex = 0;
+    int32_t                       vertexOffset = 0;
+    BindlessIndices               material;
+    glm::vec4                     boundingSphere = glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);  // local center and radius, negative is never culled
+};
+
+// per instance vertex input, the rows of an affine model matrix. The shader rebuilds it with
+// transpose(mat4(row0, row1, row2, vec4(0, 0, 0, 1)))
+struct SceneInstance {
+    glm::vec4                     rows[3];
+
+    static SceneInstance          fromMatrix(const glm::mat4& m);
+};
+
+struct SceneStats {
+    uint32_t                      instances = 0;
+    uint32_t                      commands = 0;     // one per mesh with instances
+    uint32_t                      batches = 0;      // runs of commands drawn with the same state
+    uint32_t                      drawCalls = 0;    // what record() issued, indirect or not
+};
+
+// what a GPU pass needs to cull the current frame, see VKIndirectScene::setGpuCulling
+struct SceneBuffers {
+    vk::Buffer                    instances;        // every instance, in runs per command
+    vk::Buffer                    culledInstances;  // survivors, compacted within the same runs
+    vk::Buffer                    commands;
+    vk::Buffer                    bounds;           // SceneMesh::boundingSphere per command
+    uint32_t                      instanceCount;
+    uint32_t                      commandCount;
+};
+
+// Instanced, indirect submission for large object counts. Instances are grouped by mesh as they're
+// added, build() copies each mesh's run into this frame's instance buffer and writes one
+// VkDrawIndexedIndirectCommand per mesh, and record() issues a drawIndexedIndirectCount per batch of
+// meshes sharing state. Counts live in a GPU-visible buffer so a culling pass can compact commands
+// without the CPU. Without draw indirect count it falls back to multi-draw indirect, then to one
+// indirect draw per mesh, and to direct instanced draws if indirect draws can't set firstInstance
+class VKIndirectScene
+{
+public:
+    static constexpr uint32_t     INSTANCE_BINDING = MAX_VERTEX_STREAMS;   // after any mesh stream
+    static constexpr uint32_t     INITIAL_INSTANCES = 16384;
+
+    // before device creation, enables VK_KHR_draw_indirect_count when present
+    void                          prepareDevice(vk::PhysicalDevice physDevice, std::vector<const char*>& deviceExtensions);
+    void                          init(vk::PhysicalDevice physDevice, vk::Device dev, VKAllocator& allocator, uint32_t framesInFlight);
+    void                          shutdown();
+
+    // the instance binding and its three attributes from firstLocation on, for a pipeline's vertex layout
+    static void                   getInstanceInput(uint32_t firstLocation,
+                                                   std::vector<vk::VertexInputBindingDescription>& bindings,
+                                                   std::vector<vk::VertexInputAttributeDescription>& attributes);
+
+    uint32_t                      registerMesh(const SceneMesh& mesh);
+
+    // drops last frame's instances, only call once the frame slot's fence has signalled
+    void                          beginFrame(uint32_t frameIx);
+
+    void                          addInstance(uint32_t meshId, const SceneInstance& instance) { m_meshes[meshId].instances.push_back(instance); }
+    void                          addInstances(uint32_t meshId, const SceneInstance* instances, size_t count);
+
+    // writes the frame's instances, commands and counts. Once a frame, after every instance is in
+    void                          build();
+
+    // set 0 is bound with uniformOffset, as DrawItems do
+    void                          record(vk::CommandBuffer cmd, vk::Pipeline defaultPipeline, vk::PipelineLayout layout,
+                                         vk::DescriptorSet descriptorSet, uint32_t uniformOffset, VKBindlessHeap& bindless);
+
+    // With GPU culling build() writes every command with no instances and record() draws from the culled
+    // instance buffer, so a pass must fill both from getBuffers() between the two, every frame. Needs
+    // indirect draws that can set firstInstance, without them it stays off
+    void                          setGpuCulling(bool enabled) { m_gpuCulling = enabled && m_indirectFirstInstance; }
+    bool                          isGpuCulling() const { return m_gpuCulling; }
+    SceneBuffers                  getBuffers() const;
+
+    bool                          hasDrawIndirectCount() const { return m_drawIndirectCount != nullptr; }
+    const SceneStats&             getStats() const { return m_stats; }
+
+private:
+    struct Mesh {
+        SceneMesh                 desc;
+        std::vector<SceneInstance> instances;
+    };
+
+    struct Batch {
+        uint32_t                  meshId;           // the state every command in it shares
+        uint32_t                  firstCommand;
+        uint32_t                  commandCount;
+    };
+
+    // per frame in flight, grown when a frame needs more than it holds
+    struct FrameBuffers {
+        vk::Buffer                instances;
+        VKAllocation              instancesAlloc;
+        vk::Buffer                culledInstances;  // only with GPU culling
+        VKAllocation              culledInstancesAlloc;
+        uint32_t                  instanceCapacity = 0;
+
+        vk::Buffer                commands;         // commands, then one count per batch
+        VKAllocation              commandsAlloc;
+        vk::Buffer                bounds;
+        VKAllocation              boundsAlloc;
+        uint32_t                  commandCapacity = 0;
+    };
+
+    static bool                   sameState(const SceneMesh& a, const SceneMesh& b);
+    static bool                   stateLess(const SceneMesh& a, const SceneMesh& b);
+    void                          reserve(FrameBuffers& frame, uint32_t instanceCount, uint32_t commandCount);
+    vk::DeviceSize                getCountOffset(const FrameBuffers& frame) const;
+
+    vk::Device                    m_dev;
+    VKAllocator*                  m_allocator;
+
+    bool                          m_extensionEnabled = false;
+    PFN_vkVoidFunction            m_drawIndirectCount = nullptr;    // vkCmdDrawIndexedIndirectCountKHR
+    bool                          m_multiDrawIndirect;
+    bool                          m_indirectFirstInstance = false;
+    bool                          m_gpuCulling = false;
+    uint32_t                      m_maxDrawIndirectCount;
+
+    std::vector<Mesh>             m_meshes;
+    std::vector<uint32_t>         m_order;          // mesh ids sorted so equal state is adjacent
+    bool                          m_orderDirty = false;
+
+    uint32_t                      m_currentFrame;
+    std::vector<FrameBuffers>     m_frames;
+
+    std::vector<VkDrawIndexedIndirectCommand> m_commands;
+    std::vector<Batch>            m_batches;
+    SceneStats                    m_stats;
+};
@@ -0,0 +1,238 @@
+#include "vk_layout_cache.h"
+#include "trace.h"
+
+#include <algorithm>
+
+template<typename T>
+static uint64_t handleBits(T handle)
+{
+    return (uint64_t)handle;
+}
+
+void VKLayoutCache::init(vk::Device dev)
+{
+    m_dev = dev;
+}
+
+void VKLayoutCache::shutdown()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto& it : m_pipelineLayouts)
+        m_dev.destroyPipelineLayout(it.second);
+    m_pipelineLayouts.clear();
+
+    for (auto& it : m_setLayouts)
+        m_dev.destroyDescriptorSetLayout(it.second);
+    m_setLayouts.clear();
+}
+
+vk::DescriptorSetLayout VKLayoutCache::getSetLayout(const std::vector<vk::DescriptorSetLayoutBinding>& bindings)
+{
+    // immutable samplers aren't part of the key, and so aren't supported
+    std::vector<vk::DescriptorSetLayoutBinding> sorted = bindings;
+    std::sort(sorted.begin(), sorted.end(), [](const vk::DescriptorSetLayoutBinding& a, const vk::DescriptorSetLayoutBinding& b) {
+        return a.binding < b.binding;
+    });
+
+    std::vector<uint64_t> key;
+    for (auto& it : sorted)
+    {
+        key.push_back(it.binding);
+        key.push_back((uint64_t)it.descriptorType);
+        key.push_back(it.descriptorCount);
+        key.push_back((uint64_t)(VkShaderStageFlags)it.stageFlags);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto found = m_setLayouts.find(key);
+    if (found != m_setLayouts.end())
+        return found->second;
+
+    vk::DescriptorSetLayoutCreateInfo layoutInfo;
+    layoutInfo.bindingCount = (uint32_t)sorted.size();
+    layoutInfo.pBindings = sorted.data();
+
+    vk::DescriptorSetLayout layout = m_dev.createDescriptorSetLayout(layoutInfo);
+    m_setLayouts.emplace(key, layout);
+    return layout;
+}
+
+vk::PipelineLayout VKLayoutCache::getPipelineLayout(const std::vector<vk::DescriptorSetLayout>& setLayouts,
+                                                    const std::vector<vk::PushConstantRange>& pushConstants)
+{
+    std::vector<uint64_t> key;
+    key.push_back(setLayouts.size());
+    for (auto& it : setLayouts)
+        key.push_back(handleBits((VkDescriptorSetLayout)it));
+    for (auto& it : pushConstants)
+    {
+        key.push_back((uint64_t)(VkShaderStageFlags)it.stageFlags);
+        key.push_back(it.offset);
+        key.push_back(it.size);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto found = m_pipelineLayouts.find(key);
+    if (found != m_pipelineLayouts.end())
+        return found->second;
+
+    vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
+    pipelineLayoutInfo.setLayoutCount = (uint32_t)setLayouts.size();
+    pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+    pipelineLayoutInfo.pushConstantRangeCount = (uint32_t)pushConstants.size();
+    pipelineLayoutInfo.pPushConstantRanges = pushConstants.data();
+
+    vk::PipelineLayout layout = m_dev.createPipelineLayout(pipelineLayoutInfo);
+    m_pipelineLayouts.emplace(key, layout);
+    return layout;
+}
+
+vk::PipelineLayout VKLayoutCache::getPipelineLayout(const std::vector<const ShaderReflection*>& stages,
+                                                    const PipelineLayoutOverrides& overrides,
+                                                    std::vector<vk::DescriptorSetLayout>* setLayoutsOut)
+{
+    // bindings of every stage by set, one declared in several stages becomes visible to all of them
+    std::map<uint32_t, std::map<uint32_t, vk::DescriptorSetLayoutBinding>> sets;
+    uint32_t pushFirst = ~0u;
+    uint32_t pushLast = 0;
+    vk::ShaderStageFlags pushStages;
+
+    for (const ShaderReflection* stage : stages)
+    {
+        for (auto& it : stage->bindings)
+        {
+            vk::DescriptorSetLayoutBinding& binding = sets[it.set][it.binding];
+            if (binding.stageFlags && binding.descriptorType != (vk::DescriptorType)it.descriptorType)
+                LOG_WARNING(LogCategory::ePipeline, "Set %u binding %u is declared with different types across stages", it.set, it.binding);
+
+            binding.binding = it.binding;
+            binding.descriptorType = (vk::DescriptorType)it.descriptorType;
+            binding.stageFlags |= vk::ShaderStageFlags((VkShaderStageFlags)it.stages);
+
+            // runtime sized arrays belong in an external set, the layout can't know how big to make them
+            binding.descriptorCount = std::max(binding.descriptorCount, std::max(it.count, 1u));
+        }
+
+        if (stage->pushConstantSize)
+        {
+            pushFirst = std::min(pushFirst, stage->pushConstantOffset);
+            pushLast = std::max(pushLast, stage->pushConstantOffset + stage->pushConstantSize);
+            pushStages |= vk::ShaderStageFlags(stage->stage);
+        }
+    }
+
+    for (auto& it : overrides.pushConstants)
+    {
+        pushFirst = std::min(pushFirst, it.offset);
+        pushLast = std::max(pushLast, it.offset + it.size);
+        pushStages |= it.stageFlags;
+    }
+
+    for (auto& it : overrides.dynamicBuffers)
+    {
+        auto set = sets.find(it.set);
+        if (set == sets.end() || set->second.find(it.binding) == set->second.end())
+            continue;
+
+        vk::DescriptorSetLayoutBinding& binding = set->second[it.binding];
+        if (binding.descriptorType == vk::DescriptorType::eUniformBuffer)
+            binding.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+        else if (binding.descriptorType == vk::DescriptorType::eStorageBuffer)
+            binding.descriptorType = vk::DescriptorType::eStorageBufferDynamic;
+    }
+
+    uint32_t setCount = sets.empty() ? 0 : sets.rbegin()->first + 1;
+    for (auto& it : overrides.externalSets)
+        setCount = std::max(setCount, it.set + 1);
+
+    // sets no stage uses still need a layout, an empty one
+    std::vector<vk::DescriptorSetLayout> setLayouts(setCount);
+    for (uint32_t i = 0; i < setCount; ++i)
+    {
+        auto external = std::find_if(overrides.externalSets.begin(), overrides.externalSets.end(), [i](const PipelineLayoutOverrides::ExternalSet& e) {
+            return e.set == i;
+        });
+
+        if (external != overrides.externalSets.end())
+        {
+            setLayouts[i] = external->layout;
+            continue;
+        }
+
+        std::vector<vk::DescriptorSetLayoutBinding> bindings;
+        auto set = sets.find(i);
+        if (set != sets.end())
+        {
+            for (auto& it : set->second)
+                bindings.push_back(it.second);
+        }
+        setLayouts[i] = getSetLayout(bindings);
+    }
+
+    std::vector<vk::PushConstantRange> pushConstants;
+    if (pushLast > 0)
+        pushConstants.push_back(vk::PushConstantRange(pushStages, pushFirst, pushLast - pushFirst));
+
+    if (setLayoutsOut)
+        *setLayoutsOut = setLayouts;
+
+    return getPipelineLayout(setLayouts, pushConstants);
+}
+
+void VKLayoutCache::getVertexInput(const ShaderReflection& vertexStage,
+                                   std::vector<vk::VertexInputBindingDescription>& bindings,
+                                   std::vector<vk::VertexInputAttributeDescription>& attributes)
+{
+    bindings.clear();
+    attributes.clear();
+
+    uint32_t offset = 0;
+    for (auto& it : vertexStage.vertexInputs)
+    {
+        vk::VertexInputAttributeDescription attribute;
+        attribute.location = it.location;
+        attribute.binding = 0;
+        attribute.format = (vk::Format)it.format;
+        attribute.offset = offset;
+        attributes.push_back(attribute);
+
+        offset += it.size;
+    }
+
+    if (!attributes.empty())
+        bindings.push_back(vk::VertexInputBindingDescription(0, offset, vk::VertexInputRate::eVertex));
+}
+
+bool VKLayoutCache::coversVertexInput(const ShaderReflection& vertexStage,
+                                      const std::vector<vk::VertexInputAttributeDescription>& attributes)
+{
+    bool covered = true;
+    for (auto& it : vertexStage.vertexInputs)
+    {
+        auto found = std::find_if(attributes.begin(), attributes.end(), [&it](const vk::VertexInputAttributeDescription& a) {
+            return a.location == it.location;
+        });
+
+        if (found == attributes.end())
+        {
+            TRACE("Vertex input location %u has no attribute", it.location);
+            covered = false;
+        }
+    }
+    return covered;
+}
+
+uint32_t VKLayoutCache::getSetLayoutCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (uint32_t)m_setLayouts.size();
+}
+
+uint32_t VKLayoutCache::getPipelineLayoutCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (uint32_t)m_pipelineLayouts.size();
+}
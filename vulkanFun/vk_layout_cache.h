@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <map>
+#include <mutex>
+
+#include "vk_shader_reflection.h"
+
+// what reflection can't see, applied when a pipeline layout is generated
+struct PipelineLayoutOverrides {
+    struct Binding {
+        uint32_t                  set;
+        uint32_t                  binding;
+    };
+
+    struct ExternalSet {
+        uint32_t                  set;
+        vk::DescriptorSetLayout   layout;
+    };
+
+    std::vector<Binding>          dynamicBuffers;   // uniform/storage buffers bound with a dynamic offset
+    std::vector<ExternalSet>      externalSets;     // sets whose layout is owned elsewhere, e.g. the bindless heap
+    std::vector<vk::PushConstantRange> pushConstants; // merged with the reflected ranges
+};
+
+// Descriptor set and pipeline layouts generated from shader reflection and shared by content: two
+// pipelines whose shaders declare the same interface get the same VkPipelineLayout, so descriptor sets
+// stay compatible between them. Owns everything it returns
+class VKLayoutCache
+{
+public:
+    void                          init(vk::Device dev);
+    void                          shutdown();
+
+    vk::DescriptorSetLayout       getSetLayout(const std::vector<vk::DescriptorSetLayoutBinding>& bindings);
+    vk::PipelineLayout            getPipelineLayout(const std::vector<vk::DescriptorSetLayout>& setLayouts,
+                                                    const std::vector<vk::PushConstantRange>& pushConstants);
+
+    // bindings and push constants of every stage merged, set layouts by set number in setLayoutsOut.
+    // Push constants become one range visible to every stage that declared any
+    vk::PipelineLayout            getPipelineLayout(const std::vector<const ShaderReflection*>& stages,
+                                                    const PipelineLayoutOverrides& overrides = PipelineLayoutOverrides(),
+                                                    std::vector<vk::DescriptorSetLayout>* setLayoutsOut = nullptr);
+
+    // one interleaved binding 0, attributes packed in location order
+    static void                   getVertexInput(const ShaderReflection& vertexStage,
+                                                 std::vector<vk::VertexInputBindingDescription>& bindings,
+                                                 std::vector<vk::VertexInputAttributeDescription>& attributes);
+
+    // true when every input the vertex stage declares has an attribute at its location, for layouts
+    // written on the CPU side such as a VertexFormat
+    static bool                   coversVertexInput(const ShaderReflection& vertexStage,
+                                                    const std::vector<vk::VertexInputAttributeDescription>& attributes);
+
+    uint32_t                      getSetLayoutCount() const;
+    uint32_t                      getPipelineLayoutCount() const;
+
+private:
+    vk::Device                    m_dev;
+
+    // keyed by the raw words of the description, so equal contents always find the same layout
+    std::map<std::vector<uint64_t>, vk::DescriptorSetLayout> m_setLayouts;
+    std::map<std::vector<uint64_t>, vk::PipelineLayout> m_pipelineLayouts;
+    mutable std::mutex            m_mutex;
+};
@@ -0,0 +1,188 @@
+#include "vk_pipeline_cache.h"
+#include "trace.h"
+#include "file_helpers.h"
+#include "blob.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static_assert(sizeof(PipelineCacheFileHeader) == 48, "PipelineCacheFileHeader layout is part of the file format");
+
+void VKPipelineCache::init(vk::PhysicalDevice physDevice, vk::Device dev, const std::string& path)
+{
+    m_dev = dev;
+    m_deviceProps = physDevice.getProperties();
+    m_path = path;
+
+    m_generation = 0;
+    m_flushedGeneration = 0;
+    m_lastFlush = std::chrono::steady_clock::now();
+
+    load();
+
+    vk::PipelineCacheCreateInfo cacheCreateInfo;
+    if (m_initialSize)
+    {
+        cacheCreateInfo.initialDataSize = m_initialSize;
+        cacheCreateInfo.pInitialData = (const void*)m_initialData;
+    }
+
+    m_mainCache = m_dev.createPipelineCache(cacheCreateInfo);
+}
+
+void VKPipelineCache::shutdown()
+{
+    if (m_backgroundFlush.valid())
+        m_backgroundFlush.get();
+
+    if (m_generation != m_flushedGeneration)
+        flush();
+
+    for (auto& it : m_threadCaches)
+        m_dev.destroyPipelineCache(it.second);
+    m_threadCaches.clear();
+
+    m_dev.destroyPipelineCache(m_mainCache);
+    m_initialFile.clear();
+    m_initialData = nullptr;
+    m_initialSize = 0;
+}
+
+vk::PipelineCache VKPipelineCache::getThreadCache()
+{
+    std::lock_guard<std::mutex> lock(m_threadCacheMutex);
+
+    auto it = m_threadCaches.find(std::this_thread::get_id());
+    if (it != m_threadCaches.end())
+        return it->second;
+
+    vk::PipelineCacheCreateInfo cacheCreateInfo;
+    if (m_initialSize)
+    {
+        cacheCreateInfo.initialDataSize = m_initialSize;
+        cacheCreateInfo.pInitialData = (const void*)m_initialData;
+    }
+
+    vk::PipelineCache cache = m_dev.createPipelineCache(cacheCreateInfo);
+    m_threadCaches[std::this_thread::get_id()] = cache;
+
+    return cache;
+}
+
+void VKPipelineCache::update(double flushInterval)
+{
+    if (m_generation == m_flushedGeneration)
+        return;
+
+    // previous flush still writing, try again next frame
+    if (m_backgroundFlush.valid())
+    {
+        if (m_backgroundFlush.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return;
+        m_backgroundFlush.get();
+    }
+
+    double sinceLastFlush = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_lastFlush).count();
+    if (sinceLastFlush < flushInterval)
+        return;
+
+    m_lastFlush = std::chrono::steady_clock::now();
+    m_backgroundFlush = std::async(std::launch::async, [this]() { return flush(); });
+}
+
+bool VKPipelineCache::flush()
+{
+    std::lock_guard<std::mutex> flushLock(m_flushMutex);
+
+    // anything compiled after this point is picked up by the next flush
+    uint32_t generation = m_generation;
+
+    std::vector<vk::PipelineCache> threadCaches;
+    {
+        std::lock_guard<std::mutex> lock(m_threadCacheMutex);
+        for (auto& it : m_threadCaches)
+            threadCaches.push_back(it.second);
+    }
+
+    // source caches are only read, so compiles can carry on using them while this runs
+    if (threadCaches.empty() == false)
+        m_dev.mergePipelineCaches(m_mainCache, threadCaches);
+
+    auto driverData = m_dev.getPipelineCacheData(m_mainCache);
+
+    PipelineCacheFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = FILE_MAGIC;
+    header.version = FILE_VERSION;
+    header.vendorID = m_deviceProps.vendorID;
+    header.deviceID = m_deviceProps.deviceID;
+    header.driverVersion = m_deviceProps.driverVersion;
+    memcpy(header.pipelineCacheUUID, m_deviceProps.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = driverData.size();
+
+    std::vector<unsigned char> contents(sizeof(header) + driverData.size());
+    memcpy(contents.data(), &header, sizeof(header));
+    if (driverData.empty() == false)
+        memcpy(contents.data() + sizeof(header), driverData.data(), driverData.size());
+
+    auto fileData = blob::encode(contents.data(), contents.size());
+
+    if (!file_helpers::writeFileAtomic(m_path, fileData.data(), fileData.size()))
+    {
+        LOG_ERROR(LogCategory::ePipeline, "Failed to write pipeline cache %s", m_path.c_str());
+        return false;
+    }
+
+    m_flushedGeneration = generation;
+    return true;
+}
+
+bool VKPipelineCache::load()
+{
+    m_initialData = nullptr;
+    m_initialSize = 0;
+
+    // decompressed straight out of the mapping, which is only held while this runs
+    file_helpers::MappedFile file;
+    if (!file.open(m_path, file_helpers::MappedFile::Hint::eSequential))
+        return false;
+
+    const char* reason = nullptr;
+    std::vector<unsigned char> fileData;
+    if (!blob::decode(file.data(), file.size(), fileData, nullptr, &reason))
+    {
+        LOG_WARNING(LogCategory::ePipeline, "Discarding pipeline cache %s: %s", m_path.c_str(), reason);
+        return false;
+    }
+
+    PipelineCacheFileHeader header;
+    if (fileData.size() < sizeof(header))
+    {
+        LOG_WARNING(LogCategory::ePipeline, "Discarding pipeline cache %s: truncated header", m_path.c_str());
+        return false;
+    }
+    memcpy(&header, fileData.data(), sizeof(header));
+
+    if (header.magic != FILE_MAGIC || header.version != FILE_VERSION)
+        reason = "unknown format";
+    else if (header.vendorID != m_deviceProps.vendorID || header.deviceID != m_deviceProps.deviceID)
+        reason = "different device";
+    else if (header.driverVersion != m_deviceProps.driverVersion)
+        reason = "driver updated";
+    else if (memcmp(header.pipelineCacheUUID, m_deviceProps.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+        reason = "pipeline cache UUID changed";
+    else if (header.dataSize != fileData.size() - sizeof(header))
+        reason = "truncated data";
+
+    if (reason)
+    {
+        LOG_WARNING(LogCategory::ePipeline, "Discarding pipeline cache %s: %s", m_path.c_str(), reason);
+        return false;
+    }
+
+    TRACE("Loaded pipeline cache %s, %llu bytes", m_path.c_str(), (unsigned long long)header.dataSize);
+    m_initialFile = std::move(fileData);
+    m_initialData = m_initialFile.data() + sizeof(header);
+    m_initialSize = (size_t)header.dataSize;
+    return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <future>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+// Wrapper around the driver's cache blob, stored compressed and checksummed in a blob container. Anything
+// that doesn't match the current device and driver exactly, or fails the checksum, is thrown away rather
+// than handed to the driver
+struct PipelineCacheFileHeader {
+    uint32_t                      magic;
+    uint32_t                      version;
+    uint32_t                      vendorID;
+    uint32_t                      deviceID;
+    uint32_t                      driverVersion;
+    uint32_t                      reserved;
+    uint8_t                       pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t                      dataSize;
+};
+
+// Persistent pipeline cache. Every compiling thread gets a VkPipelineCache of its own, so they never
+// contend on one; flushes merge them into the main cache and write it out via a temp file and rename,
+// so a crash mid-write leaves the previous file intact
+class VKPipelineCache
+{
+public:
+    static constexpr uint32_t     FILE_MAGIC = 0x43504B56; // "VKPC"
+    static constexpr uint32_t     FILE_VERSION = 2;
+    static constexpr double       DEFAULT_FLUSH_INTERVAL = 10.0; // seconds
+
+    void                          init(vk::PhysicalDevice physDevice, vk::Device dev, const std::string& path);
+    void                          shutdown();
+
+    // cache for the calling thread, created on first use and seeded with what was loaded from disk
+    vk::PipelineCache             getThreadCache();
+
+    // called after anything was added to a thread cache
+    void                          markDirty() { ++m_generation; }
+
+    // once a frame; when there's something new and flushInterval has passed a flush starts in the background
+    void                          update(double flushInterval = DEFAULT_FLUSH_INTERVAL);
+
+    // merges the thread caches and writes the file, returns false if the write failed
+    bool                          flush();
+
+private:
+    bool                          load();           // decodes and validates the file, fills the m_initial* members
+
+    vk::Device                    m_dev;
+    vk::PhysicalDeviceProperties  m_deviceProps;
+    std::string                   m_path;
+
+    vk::PipelineCache             m_mainCache;
+    std::vector<unsigned char>    m_initialFile;    // decoded file, seeds the thread caches
+    const unsigned char*          m_initialData;    // driver blob within m_initialFile, after our header
+    size_t                        m_initialSize;
+
+    std::unordered_map<std::thread::id, vk::PipelineCache> m_threadCaches;
+    std::mutex                    m_threadCacheMutex;
+
+    std::mutex                    m_flushMutex;     // one flush at a time, also guards m_mainCache
+    std::future<bool>             m_backgroundFlush;
+    std::atomic<uint32_t>         m_generation;
+    std::atomic<uint32_t>         m_flushedGeneration;
+    std::chrono::steady_clock::time_point m_lastFlush;
+};
@@ -0,0 +1,390 @@
+#include "vk_pipeline_library.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+
+static_assert(sizeof(PipelineKey) == 4 * sizeof(vk::PipelineLayout) + 24, "PipelineKey must not contain padding");
+
+PipelineKey::PipelineKey()
+{
+    memset((void*)this, 0, sizeof(*this));
+
+    topology = (uint8_t)vk::PrimitiveTopology::eTriangleList;
+    polygonMode = (uint8_t)vk::PolygonMode::eFill;
+    cullMode = (uint8_t)vk::CullModeFlagBits::eBack;
+    frontFace = (uint8_t)vk::FrontFace::eCounterClockwise;
+    blendMode = (uint8_t)BlendMode::eOpaque;
+    depthCompare = (uint8_t)vk::CompareOp::eLess;
+    samples = (uint8_t)vk::SampleCountFlagBits::e1;
+}
+
+PipelineKey PipelineKey::computeKey(vk::ShaderModule shader, vk::PipelineLayout layout)
+{
+    PipelineKey key;
+    key.vertShader = shader;
+    key.layout = layout;
+    key.compute = 1;
+    return key;
+}
+
+bool PipelineKey::operator==(const PipelineKey& o) const
+{
+    return memcmp(this, &o, sizeof(*this)) == 0;
+}
+
+size_t PipelineKey::hash() const
+{
+    // FNV-1a, keys are small and hashed once per lookup
+    const uint8_t* bytes = (const uint8_t*)this;
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < sizeof(*this); ++i)
+    {
+        h ^= bytes[i];
+        h *= 1099511628211ull;
+    }
+    return (size_t)h;
+}
+
+void VKPipelineLibrary::init(vk::Device dev, VKPipelineCache& pipelineCache, uint32_t compileThreads)
+{
+    m_dev = dev;
+    m_pipelineCache = &pipelineCache;
+
+    m_hits = 0;
+    m_pendingHits = 0;
+    m_misses = 0;
+    m_compileStats = PipelineLibraryStats();
+
+    // a pool of its own, so slow compiles never queue in front of the render thread's recording jobs
+    m_compileThreads.init(compileThreads);
+}
+
+void VKPipelineLibrary::shutdown()
+{
+    // outstanding compiles are drained before the workers exit
+    m_compileThreads.shutdown();
+
+    for (auto& it : m_pipelines)
+    {
+        vk::Pipeline pipeline = it.second.get();
+        if (pipeline)
+            m_dev.destroyPipeline(pipeline);
+    }
+    m_pipelines.clear();
+    m_vertexLayouts.clear();
+}
+
+uint32_t VKPipelineLibrary::registerVertexLayout(const std::vector<vk::VertexInputBindingDescription>& bindings,
+                                                 const std::vector<vk::VertexInputAttributeDescription>& attributes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (uint32_t i = 0; i < m_vertexLayouts.size(); ++i)
+    {
+        const VertexLayout& layout = m_vertexLayouts[i];
+        if (layout.bindings.size() == bindings.size() && layout.attributes.size() == attributes.size() &&
+            std::equal(bindings.begin(), bindings.end(), layout.bindings.begin()) &&
+            std::equal(attributes.begin(), attributes.end(), layout.attributes.begin()))
+        {
+            return i;
+        }
+    }
+
+    VertexLayout layout;
+    layout.bindings = bindings;
+    layout.attributes = attributes;
+    m_vertexLayouts.push_back(layout);
+
+    return (uint32_t)m_vertexLayouts.size() - 1;
+}
+
+vk::Pipeline VKPipelineLibrary::get(const PipelineKey& key, vk::Pipeline placeholder)
+{
+    std::shared_future<vk::Pipeline> pipeline = request(key);
+
+    if (pipeline.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return placeholder;
+
+    vk::Pipeline ready = pipeline.get();
+    return ready ? ready : placeholder;
+}
+
+std::shared_future<vk::Pipeline> VKPipelineLibrary::getAsync(const PipelineKey& key)
+{
+    return request(key);
+}
+
+vk::Pipeline VKPipelineLibrary::getBlocking(const PipelineKey& key)
+{
+    return request(key).get();
+}
+
+std::shared_future<vk::Pipeline> VKPipelineLibrary::request(const PipelineKey& key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_pipelines.find(key);
+    if (it != m_pipelines.end())
+    {
+        if (it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            ++m_hits;
+        else
+            ++m_pendingHits;
+        return it->second;
+    }
+
+    ++m_misses;
+
+    std::shared_future<vk::Pipeline> pipeline = m_compileThreads.submit([this, key]() { return compile(key); }).share();
+    m_pipelines.insert(std::make_pair(key, pipeline));
+
+    return pipeline;
+}
+
+vk::Pipeline VKPipelineLibrary::compile(const PipelineKey& key)
+{
+    if (key.compute)
+        return compileCompute(key);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    VertexLayout vertexLayout;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (key.vertexLayout < m_vertexLayouts.size())
+            vertexLayout = m_vertexLayouts[key.vertexLayout];
+    }
+
+    vk::PipelineShaderStageCreateInfo shaderStages[2];
+
+    vk::PipelineShaderStageCreateInfo& vertShaderStageInfo = shaderStages[0];
+    vertShaderStageInfo.stage = vk::ShaderStageFlagBits::eVertex;
+    vertShaderStageInfo.module = key.vertShader;
+    vertShaderStageInfo.pName = "main";
+
+    vk::PipelineShaderStageCreateInfo& fragShaderStageInfo = shaderStages[1];
+    fragShaderStageInfo.stage = vk::ShaderStageFlagBits::eFragment;
+    fragShaderStageInfo.module = key.fragShader;
+    fragShaderStageInfo.pName = "main";
+
+    vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
+    vertexInputInfo.vertexBindingDescriptionCount = (uint32_t)vertexLayout.bindings.size();
+    vertexInputInfo.pVertexBindingDescriptions = vertexLayout.bindings.data();
+    vertexInputInfo.vertexAttributeDescriptionCount = (uint32_t)vertexLayout.attributes.size();
+    vertexInputInfo.pVertexAttributeDescriptions = vertexLayout.attributes.data();
+
+    vk::PipelineInputAssemblyStateCreateInfo inputAssembly;
+    inputAssembly.topology = (vk::PrimitiveTopology)key.topology;
+    inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    // viewport and scissor are set while recording, so pipelines survive swapchain resizes
+    vk::PipelineViewportStateCreateInfo viewportState;
+    viewportState.viewportCount = 1;
+    viewportState.pViewports = nullptr;
+    viewportState.scissorCount = 1;
+    viewportState.pScissors = nullptr;
+
+    vk::PipelineRasterizationStateCreateInfo rasterizer;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = (vk::PolygonMode)key.polygonMode;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = (vk::CullModeFlags)(vk::CullModeFlagBits)key.cullMode;
+    rasterizer.frontFace = (vk::FrontFace)key.frontFace;
+    rasterizer.depthBiasEnable = VK_FALSE;
+
+    vk::PipelineMultisampleStateCreateInfo multisampling;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = (vk::SampleCountFlagBits)key.samples;
+    multisampling.minSampleShading = 1.0f;
+
+    vk::PipelineDepthStencilStateCreateInfo depthStencil;
+    depthStencil.depthTestEnable = key.depthTest ? VK_TRUE : VK_FALSE;
+    depthStencil.depthWriteEnable = key.depthWrite ? VK_TRUE : VK_FALSE;
+    depthStencil.depthCompareOp = (vk::CompareOp)key.depthCompare;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+
+    vk::PipelineColorBlendAttachmentState colorBlendAttachment;
+    colorBlendAttachment.colorWriteMask =
+        vk::ColorComponentFlagBits::eR |
+        vk::ColorComponentFlagBits::eG |
+        vk::ColorComponentFlagBits::eB |
+        vk::ColorComponentFlagBits::eA;
+    colorBlendAttachment.blendEnable = VK_FALSE;
+    colorBlendAttachment.srcColorBlendFactor = vk::BlendFactor::eOne;
+    colorBlendAttachment.dstColorBlendFactor = vk::BlendFactor::eZero;
+    colorBlendAttachment.colorBlendOp = vk::BlendOp::eAdd;
+    colorBlendAttachment.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+    colorBlendAttachment.dstAlphaBlendFactor = vk::BlendFactor::eZero;
+    colorBlendAttachment.alphaBlendOp = vk::BlendOp::eAdd;
+
+    switch ((BlendMode)key.blendMode)
+    {
+    case BlendMode::eAlpha:
+        colorBlendAttachment.blendEnable = VK_TRUE;
+        colorBlendAttachment.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+        colorBlendAttachment.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+        colorBlendAttachment.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+        break;
+    case BlendMode::eAdditive:
+        colorBlendAttachment.blendEnable = VK_TRUE;
+        colorBlendAttachment.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+        colorBlendAttachment.dstColorBlendFactor = vk::BlendFactor::eOne;
+        colorBlendAttachment.dstAlphaBlendFactor = vk::BlendFactor::eOne;
+        break;
+    default:
+        break;
+    }
+
+    vk::PipelineColorBlendStateCreateInfo colorBlending;
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.logicOp = vk::LogicOp::eCopy;
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    vk::DynamicState dynamicsStates[] = {
+        vk::DynamicState::eViewport,
+        vk::DynamicState::eScissor
+    };
+    vk::PipelineDynamicStateCreateInfo dynamicState;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicsStates;
+
+    vk::GraphicsPipelineCreateInfo pipelineInfo;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = key.layout;
+    pipelineInfo.renderPass = key.renderPass;
+    pipelineInfo.subpass = key.subpass;
+
+    vk::Pipeline pipeline;
+    bool failed = false;
+    try
+    {
+        pipeline = m_dev.createGraphicsPipeline(m_pipelineCache->getThreadCache(), pipelineInfo);
+        m_pipelineCache->markDirty();
+    }
+    catch (const std::exception& e)
+    {
+        LOG_ERROR(LogCategory::ePipeline, "Pipeline compile failed: %s", e.what());
+        failed = true;
+    }
+
+    recordCompile(failed, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+    return pipeline;
+}
+
+vk::Pipeline VKPipelineLibrary::compileCompute(const PipelineKey& key)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    vk::ComputePipelineCreateInfo pipelineInfo;
+    pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipelineInfo.stage.module = key.vertShader;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = key.layout;
+
+    vk::Pipeline pipeline;
+    bool failed = false;
+    try
+    {
+        pipeline = m_dev.createComputePipeline(m_pipelineCache->getThreadCache(), pipelineInfo);
+        m_pipelineCache->markDirty();
+    }
+    catch (const std::exception& e)
+    {
+        LOG_ERROR(LogCategory::ePipeline, "Compute pipeline compile failed: %s", e.what());
+        failed = true;
+    }
+
+    recordCompile(failed, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+    return pipeline;
+}
+
+void VKPipelineLibrary::recordCompile(bool failed, double ms)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (failed)
+    {
+        ++m_compileStats.failed;
+    }
+    else
+    {
+        ++m_compileStats.compiled;
+        m_compileStats.totalCompileMs += ms;
+        m_compileStats.maxCompileMs = std::max(m_compileStats.maxCompileMs, ms);
+    }
+}
+
+std::vector<vk::Pipeline> VKPipelineLibrary::removeRenderPass(vk::RenderPass renderPass)
+{
+    std::vector<std::shared_future<vk::Pipeline>> removed;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_pipelines.begin();
+        while (it != m_pipelines.end())
+        {
+            if (it->first.renderPass == renderPass)
+            {
+                removed.push_back(it->second);
+                it = m_pipelines.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    // compiles still running against the render pass have to land before it can be destroyed
+    std::vector<vk::Pipeline> pipelines;
+    for (auto& it : removed)
+    {
+        vk::Pipeline pipeline = it.get();
+        if (pipeline)
+            pipelines.push_back(pipeline);
+    }
+
+    return pipelines;
+}
+
+PipelineLibraryStats VKPipelineLibrary::getStats() const
+{
+    PipelineLibraryStats stats;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        stats = m_compileStats;
+    }
+
+    stats.hits = m_hits;
+    stats.pendingHits = m_pendingHits;
+    stats.misses = m_misses;
+
+    return stats;
+}
+
+void VKPipelineLibrary::printStats() const
+{
+    PipelineLibraryStats stats = getStats();
+
+    TRACE("%s", "Pipeline library:");
+    TRACE("> %llu hits, %llu while compiling, %llu misses",
+        (unsigned long long)stats.hits, (unsigned long long)stats.pendingHits, (unsigned long long)stats.misses);
+    TRACE("> %u compiled, %u failed, %.2f ms total, %.2f ms average, %.2f ms worst",
+        stats.compiled, stats.failed, stats.totalCompileMs,
+        stats.compiled ? stats.totalCompileMs / stats.compiled : 0.0, stats.maxCompileMs);
+}
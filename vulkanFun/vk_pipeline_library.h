@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <unordered_map>
+#include <future>
+#include <mutex>
+#include <atomic>
+
+#include "thread_pool.h"
+#include "vk_pipeline_cache.h"
+
+enum class BlendMode : uint8_t {
+    eOpaque,
+    eAlpha,
+    eAdditive
+};
+
+// Everything that distinguishes one pipeline from another, packed without padding so keys hash and
+// compare as raw bytes. Viewport and scissor are dynamic and so aren't part of it. Compute pipelines
+// only use vertShader, as their one stage, and layout.
+struct PipelineKey {
+    vk::ShaderModule              vertShader;
+    vk::ShaderModule              fragShader;
+    vk::RenderPass                renderPass;
+    vk::PipelineLayout            layout;
+
+    uint32_t                      vertexLayout;     // id from VKPipelineLibrary::registerVertexLayout
+    uint32_t                      subpass;
+
+    uint8_t                       topology;         // vk::PrimitiveTopology
+    uint8_t                       polygonMode;      // vk::PolygonMode
+    uint8_t                       cullMode;         // vk::CullModeFlags
+    uint8_t                       frontFace;        // vk::FrontFace
+    uint8_t                       blendMode;        // BlendMode
+    uint8_t                       depthTest;
+    uint8_t                       depthWrite;
+    uint8_t                       depthCompare;     // vk::CompareOp
+    uint8_t                       samples;          // vk::SampleCountFlagBits
+    uint8_t                       compute;
+    uint8_t                       reserved[6];
+
+    PipelineKey();
+
+    static PipelineKey            computeKey(vk::ShaderModule shader, vk::PipelineLayout layout);
+
+    bool                          operator==(const PipelineKey& o) const;
+    size_t                        hash() const;
+};
+
+struct PipelineKeyHasher {
+    size_t operator()(const PipelineKey& k) const { return k.hash(); }
+};
+
+struct PipelineLibraryStats {
+    uint64_t                      hits = 0;         // ready pipeline returned
+    uint64_t                      pendingHits = 0;  // requested while still compiling
+    uint64_t                      misses = 0;       // first request, compile started
+    uint32_t                      compiled = 0;
+    uint32_t                      failed = 0;
+    double                        totalCompileMs = 0.0;
+    double                        maxCompileMs = 0.0;
+};
+
+// Deduplicates pipelines by PipelineKey. Misses are compiled on background threads, each against
+// its own VKPipelineCache thread cache, callers get a placeholder until the real pipeline is ready.
+class VKPipelineLibrary
+{
+public:
+    void                          init(vk::Device dev, VKPipelineCache& pipelineCache, uint32_t compileThreads = 2);
+    void                          shutdown();
+
+    uint32_t                      registerVertexLayout(const std::vector<vk::VertexInputBindingDescription>& bindings,
+                                                       const std::vector<vk::VertexInputAttributeDescription>& attributes);
+
+    // the pipeline if it's ready, otherwise starts compiling it (once) and returns the placeholder
+    vk::Pipeline                  get(const PipelineKey& key, vk::Pipeline placeholder = vk::Pipeline());
+    std::shared_future<vk::Pipeline> getAsync(const PipelineKey& key);
+    vk::Pipeline                  getBlocking(const PipelineKey& key);
+
+    // forgets every pipeline built against a render pass, handing them back for deferred destruction
+    std::vector<vk::Pipeline>     removeRenderPass(vk::RenderPass renderPass);
+
+    PipelineLibraryStats          getStats() const;
+    void                          printStats() const;
+
+private:
+    struct VertexLayout {
+        std::vector<vk::VertexInputBindingDescription>   bindings;
+        std::vector<vk::VertexInputAttributeDescription> attributes;
+    };
+
+    std::shared_future<vk::Pipeline> request(const PipelineKey& key);
+    vk::Pipeline                  compile(const PipelineKey& key);
+    vk::Pipeline                  compileCompute(const PipelineKey& key);
+    void                          recordCompile(bool failed, double ms);
+
+    vk::Device                    m_dev;
+    VKPipelineCache*              m_pipelineCache;
+    ThreadPool                    m_compileThreads;
+
+    std::vector<VertexLayout>     m_vertexLayouts;
+    std::unordered_map<PipelineKey, std::shared_future<vk::Pipeline>, PipelineKeyHasher> m_pipelines;
+    mutable std::mutex            m_mutex;
+
+    std::atomic<uint64_t>         m_hits;
+    std::atomic<uint64_t>         m_pendingHits;
+    std::atomic<uint64_t>         m_misses;
+    PipelineLibraryStats          m_compileStats;   // compile half of the stats, guarded by m_mutex
+};
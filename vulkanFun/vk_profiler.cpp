@@ -0,0 +1,366 @@
+#include "vk_profiler.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+void VKProfiler::init(vk::PhysicalDevice physDevice, vk::Device dev, uint32_t timestampValidBits,
+                      uint32_t framesInFlight, bool pipelineStatistics, uint32_t maxGpuScopes)
+{
+    m_dev = dev;
+
+    auto props = physDevice.getProperties();
+    m_timestampPeriod = props.limits.timestampPeriod;
+    m_timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+    m_gpuTiming = timestampValidBits != 0;
+
+    // queries active around the render pass carry into its secondaries, which needs inheritedQueries
+    auto features = physDevice.getFeatures();
+    m_statsActive = pipelineStatistics && features.pipelineStatisticsQuery && features.inheritedQueries;
+    m_statsFlags =
+        vk::QueryPipelineStatisticFlagBits::eInputAssemblyVertices |
+        vk::QueryPipelineStatisticFlagBits::eInputAssemblyPrimitives |
+        vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations |
+        vk::QueryPipelineStatisticFlagBits::eClippingPrimitives |
+        vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+
+    m_maxGpuScopes = maxGpuScopes;
+    m_currentFrame = 0;
+    m_gpuDepth = 0;
+    m_frameNumber = 0;
+    m_capture = false;
+    m_origin = std::chrono::high_resolution_clock::now();
+    m_lastFrameStart = m_origin;
+
+    m_frames.resize(framesInFlight);
+    for (auto& frame : m_frames)
+    {
+        if (m_gpuTiming)
+        {
+            vk::QueryPoolCreateInfo poolInfo;
+            poolInfo.queryType = vk::QueryType::eTimestamp;
+            poolInfo.queryCount = m_maxGpuScopes * 2;
+            frame.timestamps = m_dev.createQueryPool(poolInfo);
+        }
+
+        if (m_statsActive)
+        {
+            vk::QueryPoolCreateInfo poolInfo;
+            poolInfo.queryType = vk::QueryType::ePipelineStatistics;
+            poolInfo.queryCount = 1;
+            poolInfo.pipelineStatistics = m_statsFlags;
+            frame.pipelineStats = m_dev.createQueryPool(poolInfo);
+        }
+    }
+
+    TRACE("Profiler: GPU timing %s (%.2f ns per tick), pipeline statistics %s",
+        m_gpuTiming ? "on" : "unsupported", m_timestampPeriod, m_statsActive ? "on" : "off");
+}
+
+void VKProfiler::shutdown()
+{
+    for (auto& frame : m_frames)
+    {
+        if (frame.timestamps)
+            m_dev.destroyQueryPool(frame.timestamps);
+        if (frame.pipelineStats)
+            m_dev.destroyQueryPool(frame.pipelineStats);
+    }
+    m_frames.clear();
+}
+
+void VKProfiler::beginFrame(uint32_t frameIx)
+{
+    auto now = std::chrono::high_resolution_clock::now();
+    if (m_frameNumber > 0)
+        addCpuSample("frame", m_lastFrameStart, now);
+    m_lastFrameStart = now;
+
+    m_currentFrame = frameIx;
+    FrameQueries& frame = m_frames[frameIx];
+
+    collect(frame);
+
+    frame.scopes.clear();
+    frame.statsWritten = false;
+    frame.submitUs = -1.0;
+    frame.frameNumber = m_frameNumber++;
+    m_gpuDepth = 0;
+}
+
+void VKProfiler::resetQueries(vk::CommandBuffer cmd)
+{
+    FrameQueries& frame = m_frames[m_currentFrame];
+
+    // timestamps are reset by the scope using them, which may be on another queue
+    if (frame.pipelineStats)
+        cmd.resetQueryPool(frame.pipelineStats, 0, 1);
+}
+
+uint32_t VKProfiler::beginGpuScope(vk::CommandBuffer cmd, const char* name)
+{
+    FrameQueries& frame = m_frames[m_currentFrame];
+    if (!m_gpuTiming || frame.scopes.size() >= m_maxGpuScopes)
+        return INVALID_SCOPE;
+
+    uint32_t scope = (uint32_t)frame.scopes.size();
+
+    GpuScope gpuScope;
+    gpuScope.name = name;
+    gpuScope.depth = m_gpuDepth++;
+    gpuScope.ended = false;
+    frame.scopes.push_back(gpuScope);
+
+    cmd.resetQueryPool(frame.timestamps, scope * 2, 2);
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, frame.timestamps, scope * 2);
+    return scope;
+}
+
+void VKProfiler::endGpuScope(vk::CommandBuffer cmd, uint32_t scope)
+{
+    if (scope == INVALID_SCOPE)
+        return;
+
+    FrameQueries& frame = m_frames[m_currentFrame];
+
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, frame.timestamps, scope * 2 + 1);
+    frame.scopes[scope].ended = true;
+    --m_gpuDepth;
+}
+
+void VKProfiler::beginPipelineStatistics(vk::CommandBuffer cmd)
+{
+    FrameQueries& frame = m_frames[m_currentFrame];
+    if (!frame.pipelineStats)
+        return;
+
+    cmd.beginQuery(frame.pipelineStats, 0, vk::QueryControlFlags());
+}
+
+void VKProfiler::endPipelineStatistics(vk::CommandBuffer cmd)
+{
+    FrameQueries& frame = m_frames[m_currentFrame];
+    if (!frame.pipelineStats)
+        return;
+
+    cmd.endQuery(frame.pipelineStats, 0);
+    frame.statsWritten = true;
+}
+
+void VKProfiler::markSubmit()
+{
+    m_frames[m_currentFrame].submitUs = toUs(std::chrono::high_resolution_clock::now());
+}
+
+void VKProfiler::collect(FrameQueries& frame)
+{
+    // recorded but never submitted, e.g. by the recording benchmark, the queries were never written
+    if (frame.submitUs < 0.0)
+        return;
+
+    // the slot's fence has signalled, but a query whose commands never ran, a scope left open say, is
+    // still unavailable. Availability comes back per query, so only those are skipped, never the frame
+    if (frame.statsWritten)
+    {
+        uint64_t counters[6] = {};  // the five statistics, then availability
+        VkResult res = vkGetQueryPoolResults(VkDevice(m_dev), VkQueryPool(frame.pipelineStats), 0, 1,
+            sizeof(counters), counters, sizeof(counters), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+        if ((res == VK_SUCCESS || res == VK_NOT_READY) && counters[5])
+        {
+            m_lastPipelineStats.inputAssemblyVertices = counters[0];
+            m_lastPipelineStats.inputAssemblyPrimitives = counters[1];
+            m_lastPipelineStats.vertexShaderInvocations = counters[2];
+            m_lastPipelineStats.clippingPrimitives = counters[3];
+            m_lastPipelineStats.fragmentShaderInvocations = counters[4];
+        }
+    }
+
+    if (frame.scopes.empty())
+        return;
+
+    // a value and its availability per query
+    const uint32_t queryCount = (uint32_t)frame.scopes.size() * 2;
+    std::vector<uint64_t> results(queryCount * 2);
+    VkResult res = vkGetQueryPoolResults(VkDevice(m_dev), VkQueryPool(frame.timestamps), 0, queryCount,
+        results.size() * sizeof(uint64_t), results.data(), 2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+    if (res != VK_SUCCESS && res != VK_NOT_READY)
+        return;
+
+    auto available = [&results](size_t query) { return results[query * 2 + 1] != 0; };
+    auto tick = [&results](size_t query) { return results[query * 2]; };
+
+    // trace events are placed relative to the first scope that started
+    uint64_t firstTick = 0;
+    for (size_t query = 0; query < queryCount; query += 2)
+    {
+        if (available(query))
+        {
+            firstTick = tick(query);
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < frame.scopes.size(); ++i)
+    {
+        const GpuScope& scope = frame.scopes[i];
+        if (!scope.ended || !available(i * 2) || !available(i * 2 + 1))
+            continue;
+
+        // the mask keeps the subtraction right when the counter wraps
+        double durationNs = (double)((tick(i * 2 + 1) - tick(i * 2)) & m_timestampMask) * m_timestampPeriod;
+        m_gpuWindows[scope.name].add(durationNs / 1.0e6);
+
+        if (m_capture && frame.submitUs >= 0.0 && m_trace.size() < MAX_TRACE_EVENTS)
+        {
+            TraceEvent event;
+            event.name = scope.name;
+            event.startUs = frame.submitUs + (double)((tick(i * 2) - firstTick) & m_timestampMask) * m_timestampPeriod / 1000.0;
+            event.durationUs = durationNs / 1000.0;
+            event.tid = 0;
+            m_trace.push_back(event);
+        }
+    }
+}
+
+void VKProfiler::addCpuSample(const char* name, std::chrono::high_resolution_clock::time_point start,
+                              std::chrono::high_resolution_clock::time_point end)
+{
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cpuWindows[name].add(ms);
+
+    if (m_capture && m_trace.size() < MAX_TRACE_EVENTS)
+    {
+        TraceEvent event;
+        event.name = name;
+        event.startUs = toUs(start);
+        event.durationUs = ms * 1000.0;
+        event.tid = threadIndex(std::this_thread::get_id()) + 1;
+        m_trace.push_back(event);
+    }
+}
+
+uint32_t VKProfiler::threadIndex(std::thread::id id)
+{
+    auto it = std::find(m_threadIds.begin(), m_threadIds.end(), id);
+    if (it != m_threadIds.end())
+        return (uint32_t)(it - m_threadIds.begin());
+
+    m_threadIds.push_back(id);
+    return (uint32_t)m_threadIds.size() - 1;
+}
+
+double VKProfiler::toUs(std::chrono::high_resolution_clock::time_point t) const
+{
+    return std::chrono::duration<double, std::micro>(t - m_origin).count();
+}
+
+void VKProfiler::Window::add(double ms)
+{
+    if (samples.size() < WINDOW_SIZE)
+    {
+        samples.push_back(ms);
+    }
+    else
+    {
+        samples[next] = ms;
+        next = (next + 1) % WINDOW_SIZE;
+    }
+}
+
+ProfilerPercentiles VKProfiler::Window::percentiles() const
+{
+    ProfilerPercentiles result;
+    if (samples.empty())
+        return result;
+
+    std::vector<double> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+
+    // nearest rank
+    auto rank = [&sorted](double p) {
+        size_t ix = (size_t)(p * sorted.size() + 0.999999);
+        return sorted[std::min(sorted.size(), std::max((size_t)1, ix)) - 1];
+    };
+
+    result.samples = (uint32_t)sorted.size();
+    result.p50 = rank(0.50);
+    result.p95 = rank(0.95);
+    result.p99 = rank(0.99);
+    result.max = sorted.back();
+    return result;
+}
+
+ProfilerPercentiles VKProfiler::getCpuPercentiles(const std::string& name) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_cpuWindows.find(name);
+    return it != m_cpuWindows.end() ? it->second.percentiles() : ProfilerPercentiles();
+}
+
+ProfilerPercentiles VKProfiler::getGpuPercentiles(const std::string& name) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_gpuWindows.find(name);
+    return it != m_gpuWindows.end() ? it->second.percentiles() : ProfilerPercentiles();
+}
+
+bool VKProfiler::writeChromeTrace(const char* fileName) const
+{
+    FILE* file = fopen(fileName, "w");
+    if (!file)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"GPU\"}}");
+    for (uint32_t i = 0; i < m_threadIds.size(); ++i)
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"CPU %u\"}}", i + 1, i);
+
+    // scope names are string literals from the code, nothing in them needs escaping
+    for (const auto& it : m_trace)
+    {
+        fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%u}",
+            it.name.c_str(), it.tid == 0 ? "gpu" : "cpu", it.startUs, it.durationUs, it.tid);
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    TRACE("Wrote %u trace events to %s", (uint32_t)m_trace.size(), fileName);
+    return true;
+}
+
+void VKProfiler::printStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    TRACE("%s", "Profiler CPU (ms):");
+    for (const auto& it : m_cpuWindows)
+    {
+        auto p = it.second.percentiles();
+        TRACE("> %-16s p50 %7.3f  p95 %7.3f  p99 %7.3f  max %7.3f  (%u samples)", it.first.c_str(), p.p50, p.p95, p.p99, p.max, p.samples);
+    }
+
+    TRACE("%s", "Profiler GPU (ms):");
+    for (const auto& it : m_gpuWindows)
+    {
+        auto p = it.second.percentiles();
+        TRACE("> %-16s p50 %7.3f  p95 %7.3f  p99 %7.3f  max %7.3f  (%u samples)", it.first.c_str(), p.p50, p.p95, p.p99, p.max, p.samples);
+    }
+
+    if (m_statsActive)
+    {
+        TRACE("> last frame: %llu vertices, %llu primitives, %llu VS invocations, %llu clipped primitives, %llu FS invocations",
+            (unsigned long long)m_lastPipelineStats.inputAssemblyVertices,
+            (unsigned long long)m_lastPipelineStats.inputAssemblyPrimitives,
+            (unsigned long long)m_lastPipelineStats.vertexShaderInvocations,
+            (unsigned long long)m_lastPipelineStats.clippingPrimitives,
+            (unsigned long long)m_lastPipelineStats.fragmentShaderInvocations);
+    }
+}
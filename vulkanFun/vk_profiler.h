@@ -0,0 +1,148 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <string>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <thread>
+
+struct ProfilerPercentiles {
+    uint32_t                      samples = 0;
+    double                        p50 = 0.0;
+    double                        p95 = 0.0;
+    double                        p99 = 0.0;
+    double                        max = 0.0;
+};
+
+// counters from the frame's pipeline statistics query, all zero when unsupported
+struct ProfilerPipelineStats {
+    uint64_t                      inputAssemblyVertices = 0;
+    uint64_t                      inputAssemblyPrimitives = 0;
+    uint64_t                      vertexShaderInvocations = 0;
+    uint64_t                      clippingPrimitives = 0;
+    uint64_t                      fragmentShaderInvocations = 0;
+};
+
+// CPU and GPU frame profiler. GPU scopes are pairs of vkCmdWriteTimestamp in a query pool per frame in
+// flight, read back once that frame's fence has been waited on, so reading never stalls. Durations feed
+// rolling windows per scope name for percentiles; with capture on every event is also kept for a
+// Chrome trace (chrome://tracing, Perfetto), GPU events placed relative to their frame's submit
+class VKProfiler
+{
+public:
+    static constexpr uint32_t     DEFAULT_MAX_GPU_SCOPES = 64;
+    static constexpr uint32_t     WINDOW_SIZE = 512;            // samples kept per scope for percentiles
+    static constexpr uint32_t     INVALID_SCOPE = ~0u;
+    static constexpr size_t       MAX_TRACE_EVENTS = 1 << 20;   // capture stops growing past this
+
+    // lowest timestampValidBits of the queue families the scopes are recorded on, 0 disables GPU timing
+    void                          init(vk::PhysicalDevice physDevice, vk::Device dev, uint32_t timestampValidBits,
+                                       uint32_t framesInFlight, bool pipelineStatistics = true,
+                                       uint32_t maxGpuScopes = DEFAULT_MAX_GPU_SCOPES);
+    void                          shutdown();
+
+    // once the frame slot's fence has signalled, collects what it measured last time round
+    void                          beginFrame(uint32_t frameIx);
+
+    // first thing recorded into the frame's primary command buffer
+    void                          resetQueries(vk::CommandBuffer cmd);
+
+    // outside a render pass, on any queue whose family has timestampValidBits. Each scope resets its own
+    // queries, so a command buffer on another queue can be timed in the same frame
+    uint32_t                      beginGpuScope(vk::CommandBuffer cmd, const char* name);
+    void                          endGpuScope(vk::CommandBuffer cmd, uint32_t scope);
+
+    // around the render pass; secondaries executed inside need getInheritedStatistics() in their inheritance info
+    void                          beginPipelineStatistics(vk::CommandBuffer cmd);
+    void                          endPipelineStatistics(vk::CommandBuffer cmd);
+    vk::QueryPipelineStatisticFlags getInheritedStatistics() const { return m_statsActive ? m_statsFlags : vk::QueryPipelineStatisticFlags(); }
+
+    // CPU time of the frame's queue submit, the GPU can't start before it
+    void                          markSubmit();
+
+    void                          addCpuSample(const char* name, std::chrono::high_resolution_clock::time_point start,
+                                               std::chrono::high_resolution_clock::time_point end);
+
+    ProfilerPercentiles           getCpuPercentiles(const std::string& name) const;
+    ProfilerPercentiles           getGpuPercentiles(const std::string& name) const;
+    const ProfilerPipelineStats&  getPipelineStats() const { return m_lastPipelineStats; }
+
+    void                          setCapture(bool enabled) { m_capture = enabled; }
+    bool                          writeChromeTrace(const char* fileName) const;
+    void                          printStats() const;
+
+    // times the enclosing block on the CPU
+    class CpuScope
+    {
+    public:
+        CpuScope(VKProfiler& profiler, const char* name) : m_profiler(profiler), m_name(name), m_start(std::chrono::high_resolution_clock::now()) {}
+        ~CpuScope() { m_profiler.addCpuSample(m_name, m_start, std::chrono::high_resolution_clock::now()); }
+
+    private:
+        VKProfiler&               m_profiler;
+        const char*               m_name;
+        std::chrono::high_resolution_clock::time_point m_start;
+    };
+
+private:
+    struct GpuScope {
+        const char*               name;
+        uint32_t                  depth;
+        bool                      ended;
+    };
+
+    struct FrameQueries {
+        vk::QueryPool             timestamps;
+        vk::QueryPool             pipelineStats;
+        std::vector<GpuScope>     scopes;
+        bool                      statsWritten = false;
+        uint64_t                  frameNumber = 0;
+        double                    submitUs = -1.0;  // CPU time of the submit, from m_origin
+    };
+
+    // fixed size ring of durations in ms
+    struct Window {
+        std::vector<double>       samples;
+        uint32_t                  next = 0;
+
+        void                      add(double ms);
+        ProfilerPercentiles       percentiles() const;
+    };
+
+    struct TraceEvent {
+        std::string               name;
+        double                    startUs;
+        double                    durationUs;
+        uint32_t                  tid;              // 0 is the GPU
+    };
+
+    void                          collect(FrameQueries& frame);
+    uint32_t                      threadIndex(std::thread::id id);
+    double                        toUs(std::chrono::high_resolution_clock::time_point t) const;
+
+    vk::Device                    m_dev;
+    double                        m_timestampPeriod;    // ns per tick
+    uint64_t                      m_timestampMask;
+    bool                          m_gpuTiming;
+    bool                          m_statsActive;
+    vk::QueryPipelineStatisticFlags m_statsFlags;
+    uint32_t                      m_maxGpuScopes;
+
+    std::vector<FrameQueries>     m_frames;
+    uint32_t                      m_currentFrame;
+    uint32_t                      m_gpuDepth;
+    uint64_t                      m_frameNumber;
+    std::chrono::high_resolution_clock::time_point m_origin;
+    std::chrono::high_resolution_clock::time_point m_lastFrameStart;
+
+    ProfilerPipelineStats         m_lastPipelineStats;
+
+    mutable std::mutex            m_mutex;      // guards everything below, CPU scopes may close on any thread
+    std::map<std::string, Window> m_cpuWindows;
+    std::map<std::string, Window> m_gpuWindows;
+    std::vector<TraceEvent>       m_trace;
+    std::vector<std::thread::id>  m_threadIds;
+    bool                          m_capture;
+};
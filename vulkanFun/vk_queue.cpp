@@ -0,0 +1,281 @@
+#include "vk_queue.h"
+#include "logging.h"
+
+#include <string.h>
+#include <algorithm>
+#include <limits>
+
+bool VKQueue::supportsTimelines(vk::Instance inst, bool hasProperties2, vk::PhysicalDevice physDevice)
+{
+#ifdef VK_KHR_timeline_semaphore
+    auto allPhysDeviceExtensions = physDevice.enumerateDeviceExtensionProperties();
+    auto found = std::find_if(allPhysDeviceExtensions.begin(), allPhysDeviceExtensions.end(), [](const vk::ExtensionProperties& e) {
+        return strcmp(e.extensionName, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0;
+    });
+
+    auto getFeatures2 = hasProperties2 ? (PFN_vkGetPhysicalDeviceFeatures2KHR)inst.getProcAddr("vkGetPhysicalDeviceFeatures2KHR") : nullptr;
+    if (found == allPhysDeviceExtensions.end() || !getFeatures2)
+        return false;
+
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR supported = {};
+    supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+
+    VkPhysicalDeviceFeatures2KHR features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+    features2.pNext = &supported;
+    getFeatures2(VkPhysicalDevice(physDevice), &features2);
+
+    return supported.timelineSemaphore == VK_TRUE;
+#else
+    (void)inst; (void)hasProperties2; (void)physDevice;
+    return false;
+#endif
+}
+
+void VKQueue::init(vk::Device dev, uint32_t family, bool timeline)
+{
+    m_dev = dev;
+    m_queue = m_dev.getQueue(family, 0);
+    m_family = family;
+
+    m_timeline = vk::Semaphore();
+    m_getCounterValue = nullptr;
+    m_waitSemaphores = nullptr;
+
+#ifdef VK_KHR_timeline_semaphore
+    if (timeline)
+    {
+        m_getCounterValue = m_dev.getProcAddr("vkGetSemaphoreCounterValueKHR");
+        m_waitSemaphores = m_dev.getProcAddr("vkWaitSemaphoresKHR");
+    }
+
+    if (m_getCounterValue && m_waitSemaphores)
+    {
+        VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+        typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+        typeInfo.initialValue = 0;
+
+        vk::SemaphoreCreateInfo semaphoreInfo;
+        semaphoreInfo.pNext = &typeInfo;
+        m_timeline = m_dev.createSemaphore(semaphoreInfo);
+    }
+#else
+    (void)timeline;
+#endif
+
+    m_pendingCount = 0;
+    m_nextSerial = 1;
+    m_flushedSerial = 0;
+    m_completedSerial = 0;
+    m_flushCount = 0;
+    m_submitCount = 0;
+}
+
+void VKQueue::shutdown()
+{
+    if (!m_queue)
+        return;
+
+    waitIdle();
+
+    for (auto it : m_freeFences)
+        m_dev.destroyFence(it);
+    m_freeFences.clear();
+
+    m_dev.destroySemaphore(m_timeline);
+    m_pending.clear();
+    m_queue = vk::Queue();
+}
+
+uint64_t VKQueue::submit(vk::CommandBuffer cmd)
+{
+    if (m_pendingCount == m_pending.size())
+        m_pending.push_back(Submission());
+
+    Submission& submission = m_pending[m_pendingCount++];
+    submission.cmd = cmd;
+    submission.waits.clear();
+    submission.waitStages.clear();
+    submission.waitValues.clear();
+    submission.signals.clear();
+    submission.signalValues.clear();
+
+    // each submission signals the timeline with its own serial
+    const uint64_t serial = m_nextSerial++;
+    if (m_timeline)
+    {
+        submission.signals.push_back(m_timeline);
+        submission.signalValues.push_back(serial);
+    }
+    return serial;
+}
+
+VKQueue& VKQueue::waitSemaphore(vk::Semaphore semaphore, vk::PipelineStageFlags stages)
+{
+    Submission& submission = m_pending[m_pendingCount - 1];
+    submission.waits.push_back(semaphore);
+    submission.waitStages.push_back(stages);
+    submission.waitValues.push_back(0);
+    return *this;
+}
+
+VKQueue& VKQueue::waitQueue(const VKQueue& queue, uint64_t serial, vk::PipelineStageFlags stages)
+{
+    // only timelines can be waited on by value, and waiting on oneself is just submission order
+    if (!queue.m_timeline || !m_timeline || &queue == this || serial == 0)
+        return *this;
+
+    Submission& submission = m_pending[m_pendingCount - 1];
+    submission.waits.push_back(queue.m_timeline);
+    submission.waitStages.push_back(stages);
+    submission.waitValues.push_back(serial);
+    return *this;
+}
+
+VKQueue& VKQueue::signalSemaphore(vk::Semaphore semaphore)
+{
+    Submission& submission = m_pending[m_pendingCount - 1];
+    submission.signals.push_back(semaphore);
+    submission.signalValues.push_back(0);
+    return *this;
+}
+
+void VKQueue::flush()
+{
+    if (m_pendingCount == 0)
+        return;
+
+    std::vector<vk::SubmitInfo> submitInfos(m_pendingCount);
+#ifdef VK_KHR_timeline_semaphore
+    std::vector<VkTimelineSemaphoreSubmitInfoKHR> timelineInfos(m_pendingCount);
+#endif
+
+    for (uint32_t i = 0; i < m_pendingCount; ++i)
+    {
+        const Submission& submission = m_pending[i];
+
+        vk::SubmitInfo& info = submitInfos[i];
+        info.waitSemaphoreCount = (uint32_t)submission.waits.size();
+        info.pWaitSemaphores = submission.waits.data();
+        info.pWaitDstStageMask = submission.waitStages.data();
+        info.commandBufferCount = 1;
+        info.pCommandBuffers = &submission.cmd;
+        info.signalSemaphoreCount = (uint32_t)submission.signals.size();
+        info.pSignalSemaphores = submission.signals.data();
+
+#ifdef VK_KHR_timeline_semaphore
+        if (m_timeline)
+        {
+            VkTimelineSemaphoreSubmitInfoKHR& timelineInfo = timelineInfos[i];
+            timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+            timelineInfo.waitSemaphoreValueCount = (uint32_t)submission.waitValues.size();
+            timelineInfo.pWaitSemaphoreValues = submission.waitValues.data();
+            timelineInfo.signalSemaphoreValueCount = (uint32_t)submission.signalValues.size();
+            timelineInfo.pSignalSemaphoreValues = submission.signalValues.data();
+            info.pNext = &timelineInfo;
+        }
+#endif
+    }
+
+    // the timeline says when each submission is done, otherwise a fence covers the whole flush
+    vk::Fence fence;
+    if (!m_timeline)
+    {
+        retireFlushes(false, 0);
+        if (m_freeFences.empty())
+            m_freeFences.push_back(m_dev.createFence(vk::FenceCreateInfo()));
+        fence = m_freeFences.back();
+        m_freeFences.pop_back();
+    }
+
+    m_queue.submit(submitInfos, fence);
+
+    m_flushedSerial = m_nextSerial - 1;
+    if (fence)
+        m_flushes.push_back(Flush{ fence, m_flushedSerial });
+
+    ++m_flushCount;
+    m_submitCount += m_pendingCount;
+    m_pendingCount = 0;
+}
+
+void VKQueue::retireFlushes(bool block, uint64_t serial)
+{
+    while (!m_flushes.empty())
+    {
+        Flush& oldest = m_flushes.front();
+        if (block && m_completedSerial < serial)
+            m_dev.waitForFences(oldest.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+        else if (m_dev.getFenceStatus(oldest.fence) != vk::Result::eSuccess)
+            break;
+
+        m_completedSerial = oldest.serial;
+        m_dev.resetFences(oldest.fence);
+        m_freeFences.push_back(oldest.fence);
+        m_flushes.pop_front();
+    }
+}
+
+bool VKQueue::isComplete(uint64_t serial)
+{
+    if (serial <= m_completedSerial)
+        return true;
+
+#ifdef VK_KHR_timeline_semaphore
+    if (m_timeline)
+    {
+        uint64_t value = 0;
+        ((PFN_vkGetSemaphoreCounterValueKHR)m_getCounterValue)(VkDevice(m_dev), VkSemaphore(m_timeline), &value);
+        m_completedSerial = std::max(m_completedSerial, value);
+        return serial <= m_completedSerial;
+    }
+#endif
+
+    retireFlushes(false, serial);
+    return serial <= m_completedSerial;
+}
+
+void VKQueue::wait(uint64_t serial)
+{
+    if (serial > m_flushedSerial)
+        flush();
+
+    if (isComplete(serial))
+        return;
+
+#ifdef VK_KHR_timeline_semaphore
+    if (m_timeline)
+    {
+        VkSemaphore semaphore = VkSemaphore(m_timeline);
+
+        VkSemaphoreWaitInfoKHR waitInfo = {};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &semaphore;
+        waitInfo.pValues = &serial;
+        ((PFN_vkWaitSemaphoresKHR)m_waitSemaphores)(VkDevice(m_dev), &waitInfo, std::numeric_limits<uint64_t>::max());
+
+        m_completedSerial = serial;
+        return;
+    }
+#endif
+
+    retireFlushes(true, serial);
+}
+
+void VKQueue::waitIdle()
+{
+    flush();
+    m_queue.waitIdle();
+
+    // everything flushed has now completed, fences included
+    m_completedSerial = m_flushedSerial;
+    retireFlushes(false, m_flushedSerial);
+}
+
+void VKQueue::printStats(const char* name) const
+{
+    LOG_INFO(LogCategory::eFrame, "%s queue (family %u, %s): %u submissions in %u vkQueueSubmit calls", name, m_family,
+        m_timeline ? "timeline" : "fences", m_submitCount, m_flushCount);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <deque>
+
+// A device queue that collects submissions and hands them to the driver in one vkQueueSubmit per
+// flush(). Every submission gets a serial, increasing in submission order, that says when it has
+// completed. With VK_KHR_timeline_semaphore the serial is the value it signals on the queue's
+// timeline semaphore, which other queues can wait on too; without it each flush gets a fence and
+// only binary semaphores order work across queues.
+//
+// Binary semaphores must be signalled by a flushed submission before one waiting on them is
+// flushed, so queues feeding others are flushed first. Timeline waits carry no such rule
+class VKQueue
+{
+public:
+    // extension present and timelineSemaphore supported, the queries need properties2 on the instance
+    static bool                   supportsTimelines(vk::Instance inst, bool hasProperties2, vk::PhysicalDevice physDevice);
+
+    // timeline only when the device was created with the extension and feature enabled
+    void                          init(vk::Device dev, uint32_t family, bool timeline);
+    void                          shutdown();
+
+    bool                          isInitialised() const { return (bool)m_queue; }
+    vk::Queue                     getQueue() const { return m_queue; }
+    uint32_t                      getFamily() const { return m_family; }
+    bool                          hasTimeline() const { return (bool)m_timeline; }
+
+    // queued until the next flush, returns the serial marking its completion. The wait and signal
+    // calls that follow apply to this submission
+    uint64_t                      submit(vk::CommandBuffer cmd);
+    VKQueue&                      waitSemaphore(vk::Semaphore semaphore, vk::PipelineStageFlags stages);
+    VKQueue&                      waitQueue(const VKQueue& queue, uint64_t serial, vk::PipelineStageFlags stages);
+    VKQueue&                      signalSemaphore(vk::Semaphore semaphore);
+
+    void                          flush();
+
+    uint64_t                      getLastSubmitted() const { return m_nextSerial - 1; }
+    bool                          isComplete(uint64_t serial);
+    // flushes first if the serial is still queued
+    void                          wait(uint64_t serial);
+    void                          waitIdle();
+
+    uint32_t                      getFlushCount() const { return m_flushCount; }
+    uint32_t                      getSubmitCount() const { return m_submitCount; }
+    void                          printStats(const char* name) const;
+
+private:
+    struct Submission {
+        vk::CommandBuffer         cmd;
+        std::vector<vk::Semaphore> waits;
+        std::vector<vk::PipelineStageFlags> waitStages;
+        std::vector<uint64_t>     waitValues;       // zero for binary semaphores
+        std::vector<vk::Semaphore> signals;
+        std::vector<uint64_t>     signalValues;
+    };
+
+    // without timelines, the fence of each flush and the last serial it covers
+    struct Flush {
+        vk::Fence                 fence;
+        uint64_t                  serial;
+    };
+
+    void                          retireFlushes(bool block, uint64_t serial);
+
+    vk::Device                    m_dev;
+    vk::Queue                     m_queue;
+    uint32_t                      m_family;
+
+    // loaded from the device, kept untyped as older headers lack the extension
+    vk::Semaphore                 m_timeline;
+    PFN_vkVoidFunction            m_getCounterValue;
+    PFN_vkVoidFunction            m_waitSemaphores;
+
+    // m_pending[0, m_pendingCount) wait for the next flush, the rest keep their capacity for reuse
+    std::vector<Submission>       m_pending;
+    uint32_t                      m_pendingCount;
+
+    std::deque<Flush>             m_flushes;
+    std::vector<vk::Fence>        m_freeFences;
+
+    uint64_t                      m_nextSerial;
+    uint64_t                      m_flushedSerial;
+    uint64_t                      m_completedSerial;
+
+    uint32_t                      m_flushCount;     // vkQueueSubmit calls and submissions they carried
+    uint32_t                      m_submitCount;
+};
@@ -0,0 +1,244 @@
+#include "vk_render_graph.h"
+#include "file_helpers.h"
+
+void VKRenderGraph::init(vk::Device dev, VKAllocator& allocator, uint32_t framesInFlight)
+{
+    m_dev = dev;
+    m_allocator = &allocator;
+    m_frames.resize(framesInFlight);
+    m_currentFrame = 0;
+}
+
+void VKRenderGraph::shutdown()
+{
+    for (auto& it : m_frames)
+        destroyResources(it);
+    m_frames.clear();
+    m_graph.reset();
+}
+
+RenderGraph& VKRenderGraph::begin(uint32_t frameIx)
+{
+    m_currentFrame = frameIx;
+    m_graph.reset();
+    return m_graph;
+}
+
+uint64_t VKRenderGraph::hashTransients() const
+{
+    // anything that changes what gets created or where it's placed
+    uint64_t h = file_helpers::hash64(nullptr, 0);
+    for (uint32_t r = 0; r < m_graph.getResourceCount(); ++r)
+    {
+        if (!m_graph.isTransient(r) || !m_graph.isLive(r))
+            continue;
+
+        const uint32_t lifetime[3] = { r, m_graph.getFirstPass(r), m_graph.getLastPass(r) };
+        h = file_helpers::hash64(lifetime, sizeof(lifetime), h);
+
+        if (m_graph.getResourceType(r) == GraphResourceType::eBuffer)
+        {
+            const GraphBufferDesc& desc = m_graph.getBufferDesc(r);
+            const uint64_t fields[2] = { desc.size, (uint64_t)(VkBufferUsageFlags)desc.usage };
+            h = file_helpers::hash64(fields, sizeof(fields), h);
+        }
+        else
+        {
+            const GraphImageDesc& desc = m_graph.getImageDesc(r);
+            const uint32_t fields[7] = { (uint32_t)desc.format, desc.extent.width, desc.extent.height, desc.mipLevels,
+                (uint32_t)desc.samples, (VkImageUsageFlags)desc.usage, (VkImageAspectFlags)desc.aspect };
+            h = file_helpers::hash64(fields, sizeof(fields), h);
+        }
+    }
+    return h;
+}
+
+void VKRenderGraph::execute(vk::CommandBuffer cmd)
+{
+    m_graph.compile();
+
+    // the slot's last frame has finished with its resources, so they can go straight away
+    FrameResources& frame = m_frames[m_currentFrame];
+    const uint64_t key = hashTransients();
+    const bool changed = key != frame.key;
+    if (changed)
+    {
+        destroyResources(frame);
+        createResources(frame);
+        frame.key = key;
+    }
+
+    // placement only depends on what was hashed, so an unchanged graph lands where it did last time
+    for (uint32_t r = 0; r < m_graph.getResourceCount(); ++r)
+    {
+        if (m_graph.isTransient(r) && m_graph.isLive(r))
+            m_graph.setMemoryRequirements(r, frame.requirements[r]);
+    }
+    m_graph.assignMemory();
+
+    if (changed)
+        bindResources(frame);
+
+    for (uint32_t p = 0; p < m_graph.getPassCount(); ++p)
+    {
+        if (m_graph.isCulled(p))
+            continue;
+
+        recordBarriers(cmd, m_graph.getBarriers(p));
+        if (m_graph.getRecord(p))
+            m_graph.getRecord(p)(cmd);
+    }
+
+    recordBarriers(cmd, m_graph.getFinalBarriers());
+}
+
+void VKRenderGraph::createResources(FrameResources& frame)
+{
+    const uint32_t count = m_graph.getResourceCount();
+    frame.buffers.assign(count, vk::Buffer());
+    frame.images.assign(count, vk::Image());
+    frame.views.assign(count, vk::ImageView());
+    frame.requirements.assign(count, vk::MemoryRequirements());
+
+    for (uint32_t r = 0; r < count; ++r)
+    {
+        if (!m_graph.isTransient(r) || !m_graph.isLive(r))
+            continue;
+
+        if (m_graph.getResourceType(r) == GraphResourceType::eBuffer)
+        {
+            const GraphBufferDesc& desc = m_graph.getBufferDesc(r);
+
+            vk::BufferCreateInfo bufferInfo;
+            bufferInfo.size = desc.size;
+            bufferInfo.usage = desc.usage;
+            bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+
+            frame.buffers[r] = m_dev.createBuffer(bufferInfo);
+            frame.requirements[r] = m_dev.getBufferMemoryRequirements(frame.buffers[r]);
+        }
+        else
+        {
+            const GraphImageDesc& desc = m_graph.getImageDesc(r);
+
+            vk::ImageCreateInfo imageInfo;
+            imageInfo.imageType = vk::ImageType::e2D;
+            imageInfo.format = desc.format;
+            imageInfo.extent = vk::Extent3D(desc.extent.width, desc.extent.height, 1);
+            imageInfo.mipLevels = desc.mipLevels;
+            imageInfo.arrayLayers = 1;
+            imageInfo.samples = desc.samples;
+            imageInfo.tiling = vk::ImageTiling::eOptimal;
+            imageInfo.usage = desc.usage;
+            imageInfo.sharingMode = vk::SharingMode::eExclusive;
+            imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+            frame.images[r] = m_dev.createImage(imageInfo);
+            frame.requirements[r] = m_dev.getImageMemoryRequirements(frame.images[r]);
+        }
+    }
+}
+
+void VKRenderGraph::bindResources(FrameResources& frame)
+{
+    // one allocation per heap, resources sharing it are bound at their offsets
+    const std::vector<GraphHeap>& heaps = m_graph.getHeaps();
+    frame.heaps.resize(heaps.size());
+    for (size_t h = 0; h < heaps.size(); ++h)
+    {
+        vk::MemoryRequirements req;
+        req.size = heaps[h].size;
+        req.alignment = heaps[h].alignment;
+        req.memoryTypeBits = heaps[h].memoryTypeBits;
+        frame.heaps[h] = m_allocator->allocate(req, vk::MemoryPropertyFlagBits::eDeviceLocal,
+            heaps[h].type == GraphResourceType::eBuffer ? VKResourceKind::eLinear : VKResourceKind::eOptimal);
+    }
+
+    for (uint32_t r = 0; r < m_graph.getResourceCount(); ++r)
+    {
+        if (!m_graph.isTransient(r) || !m_graph.isLive(r))
+            continue;
+
+        const VKAllocation& heap = frame.heaps[m_graph.getHeap(r)];
+        const vk::DeviceSize offset = heap.offset + m_graph.getHeapOffset(r);
+
+        if (m_graph.getResourceType(r) == GraphResourceType::eBuffer)
+        {
+            m_dev.bindBufferMemory(frame.buffers[r], heap.memory, offset);
+            continue;
+        }
+
+        m_dev.bindImageMemory(frame.images[r], heap.memory, offset);
+
+        vk::ImageViewCreateInfo viewInfo;
+        viewInfo.image = frame.images[r];
+        viewInfo.viewType = vk::ImageViewType::e2D;
+        viewInfo.format = m_graph.getImageDesc(r).format;
+        viewInfo.subresourceRange = m_graph.getRange(r);
+        frame.views[r] = m_dev.createImageView(viewInfo);
+    }
+}
+
+void VKRenderGraph::destroyResources(FrameResources& frame)
+{
+    for (auto it : frame.views)
+        m_dev.destroyImageView(it);
+    for (auto it : frame.images)
+        m_dev.destroyImage(it);
+    for (auto it : frame.buffers)
+        m_dev.destroyBuffer(it);
+    for (auto& it : frame.heaps)
+        m_allocator->free(it);
+
+    frame = FrameResources();
+}
+
+vk::Buffer VKRenderGraph::getBuffer(uint32_t resource) const
+{
+    if (!m_graph.isTransient(resource))
+        return m_graph.getImportedBuffer(resource);
+    return m_frames[m_currentFrame].buffers[resource];
+}
+
+vk::Image VKRenderGraph::getImage(uint32_t resource) const
+{
+    if (!m_graph.isTransient(resource))
+        return m_graph.getImportedImage(resource);
+    return m_frames[m_currentFrame].images[resource];
+}
+
+vk::ImageView VKRenderGraph::getImageView(uint32_t resource) const
+{
+    return m_graph.isTransient(resource) ? m_frames[m_currentFrame].views[resource] : vk::ImageView();
+}
+
+void VKRenderGraph::recordBarriers(vk::CommandBuffer cmd, const GraphBarrierBatch& batch) const
+{
+    if (batch.empty())
+        return;
+
+    // a pure execution dependency, write after read say, needs no memory barrier at all
+    vk::MemoryBarrier memory;
+    memory.srcAccessMask = batch.srcAccess;
+    memory.dstAccessMask = batch.dstAccess;
+    const uint32_t memoryCount = (batch.srcAccess || batch.dstAccess) ? 1 : 0;
+
+    std::vector<vk::ImageMemoryBarrier> images(batch.images.size());
+    for (size_t i = 0; i < batch.images.size(); ++i)
+    {
+        const GraphImageBarrier& it = batch.images[i];
+        images[i].srcAccessMask = it.srcAccess;
+        images[i].dstAccessMask = it.dstAccess;
+        images[i].oldLayout = it.oldLayout;
+        images[i].newLayout = it.newLayout;
+        images[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        images[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        images[i].image = getImage(it.resource);
+        images[i].subresourceRange = m_graph.getRange(it.resource);
+    }
+
+    // nothing to wait for when it's only a first use's transition
+    const vk::PipelineStageFlags srcStages = batch.srcStages ? batch.srcStages : vk::PipelineStageFlags(vk::PipelineStageFlagBits::eTopOfPipe);
+    cmd.pipelineBarrier(srcStages, batch.dstStages, vk::DependencyFlags(),
+        vk::ArrayProxy<const vk::MemoryBarrier>(memoryCount, &memory), nullptr, images);
+}
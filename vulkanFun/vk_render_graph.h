@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+
+#include "render_graph.h"
+#include "vk_allocator.h"
+
+// Runs a RenderGraph: creates its transient resources, binds them where assignMemory() placed them
+// and records the passes that survived culling, each behind its barrier batch. Every frame slot has
+// its own transient resources, only recreated when the graph's transient resources or their
+// lifetimes change, and only touched once the slot's fence has signalled
+class VKRenderGraph
+{
+public:
+    void                          init(vk::Device dev, VKAllocator& allocator, uint32_t framesInFlight);
+    void                          shutdown();
+
+    // an empty graph to build this frame's passes into
+    RenderGraph&                  begin(uint32_t frameIx);
+
+    // compiles the graph and records it, pass callbacks run from here
+    void                          execute(vk::CommandBuffer cmd);
+
+    // imported or transient, transient ones only exist from execute() on
+    vk::Buffer                    getBuffer(uint32_t resource) const;
+    vk::Image                     getImage(uint32_t resource) const;
+    vk::ImageView                 getImageView(uint32_t resource) const;   // transient only, every mip
+
+    const RenderGraphStats&       getStats() const { return m_graph.getStats(); }
+
+private:
+    // indexed by graph resource, null unless transient and live
+    struct FrameResources {
+        uint64_t                  key = 0;
+        std::vector<vk::Buffer>   buffers;
+        std::vector<vk::Image>    images;
+        std::vector<vk::ImageView> views;
+        std::vector<vk::MemoryRequirements> requirements;
+        std::vector<VKAllocation> heaps;
+    };
+
+    uint64_t                      hashTransients() const;
+    void                          createResources(FrameResources& frame);
+    void                          bindResources(FrameResources& frame);
+    void                          destroyResources(FrameResources& frame);
+    void                          recordBarriers(vk::CommandBuffer cmd, const GraphBarrierBatch& batch) const;
+
+    vk::Device                    m_dev;
+    VKAllocator*                  m_allocator;
+
+    RenderGraph                   m_graph;
+    std::vector<FrameResources>   m_frames;
+    uint32_t                      m_currentFrame;
+};
@@ -0,0 +1,278 @@
+#include "vk_render_pass.h"
+
+#include <algorithm>
+
+uint32_t VKRenderPassBuilder::addAttachment(const AttachmentInfo& info)
+{
+    m_attachments.push_back(info);
+    return (uint32_t)m_attachments.size() - 1;
+}
+
+VKRenderPassBuilder& VKRenderPassBuilder::addSubpass()
+{
+    m_subpasses.push_back(Subpass());
+    return *this;
+}
+
+VKRenderPassBuilder& VKRenderPassBuilder::color(uint32_t attachment, uint32_t resolveAttachment)
+{
+    // resolves are either all unused or one per color reference
+    Subpass& subpass = m_subpasses.back();
+    subpass.colors.push_back(vk::AttachmentReference(attachment, vk::ImageLayout::eColorAttachmentOptimal));
+    subpass.resolves.push_back(vk::AttachmentReference(resolveAttachment,
+        resolveAttachment == UNUSED ? vk::ImageLayout::eUndefined : vk::ImageLayout::eColorAttachmentOptimal));
+    return *this;
+}
+
+VKRenderPassBuilder& VKRenderPassBuilder::depth(uint32_t attachment)
+{
+    m_subpasses.back().depth = vk::AttachmentReference(attachment, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+    return *this;
+}
+
+VKRenderPassBuilder& VKRenderPassBuilder::input(uint32_t attachment)
+{
+    m_subpasses.back().inputs.push_back(vk::AttachmentReference(attachment, vk::ImageLayout::eShaderReadOnlyOptimal));
+    return *this;
+}
+
+bool VKRenderPassBuilder::isDepthFormat(vk::Format format)
+{
+    switch (format)
+    {
+    case vk::Format::eD16Unorm:
+    case vk::Format::eX8D24UnormPack32:
+    case vk::Format::eD32Sfloat:
+    case vk::Format::eS8Uint:
+    case vk::Format::eD16UnormS8Uint:
+    case vk::Format::eD24UnormS8Uint:
+    case vk::Format::eD32SfloatS8Uint:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool VKRenderPassBuilder::hasStencil(vk::Format format)
+{
+    return format == vk::Format::eS8Uint || format == vk::Format::eD16UnormS8Uint ||
+           format == vk::Format::eD24UnormS8Uint || format == vk::Format::eD32SfloatS8Uint;
+}
+
+bool VKRenderPassBuilder::uses(const Subpass& subpass, uint32_t attachment) const
+{
+    auto refers = [attachment](const std::vector<vk::AttachmentReference>& refs) {
+        return std::any_of(refs.begin(), refs.end(), [attachment](const vk::AttachmentReference& r) { return r.attachment == attachment; });
+    };
+    return subpass.depth.attachment == attachment || refers(subpass.colors) || refers(subpass.resolves) || refers(subpass.inputs);
+}
+
+bool VKRenderPassBuilder::onlyResolved(uint32_t attachment) const
+{
+    for (const auto& subpass : m_subpasses)
+    {
+        if (subpass.depth.attachment == attachment)
+            return false;
+        for (const auto& it : subpass.colors)
+        {
+            if (it.attachment == attachment)
+                return false;
+        }
+        for (const auto& it : subpass.inputs)
+        {
+            if (it.attachment == attachment)
+                return false;
+        }
+    }
+    return true;
+}
+
+bool VKRenderPassBuilder::isTransient(uint32_t attachment) const
+{
+    return !m_attachments[attachment].loadContents && !m_attachments[attachment].readAfter;
+}
+
+vk::ImageUsageFlags VKRenderPassBuilder::getImageUsage(uint32_t attachment) const
+{
+    const AttachmentInfo& info = m_attachments[attachment];
+
+    vk::ImageUsageFlags usage = isDepthFormat(info.format) ? vk::ImageUsageFlagBits::eDepthStencilAttachment : vk::ImageUsageFlagBits::eColorAttachment;
+    for (const auto& subpass : m_subpasses)
+    {
+        for (const auto& it : subpass.inputs)
+        {
+            if (it.attachment == attachment)
+                usage |= vk::ImageUsageFlagBits::eInputAttachment;
+        }
+    }
+
+    // transient images may only add input attachment usage
+    if (isTransient(attachment))
+        return usage | vk::ImageUsageFlagBits::eTransientAttachment;
+
+    if (info.readAccess & vk::AccessFlagBits::eShaderRead)
+        usage |= vk::ImageUsageFlagBits::eSampled;
+    if (info.readAccess & vk::AccessFlagBits::eTransferRead)
+        usage |= vk::ImageUsageFlagBits::eTransferSrc;
+    return usage;
+}
+
+std::vector<vk::ClearValue> VKRenderPassBuilder::getClearValues(const vk::ClearColorValue& colour, const vk::ClearDepthStencilValue& depthStencil) const
+{
+    std::vector<vk::ClearValue> values(m_attachments.size());
+    for (size_t i = 0; i < m_attachments.size(); ++i)
+    {
+        if (isDepthFormat(m_attachments[i].format))
+            values[i].depthStencil = depthStencil;
+        else
+            values[i].color = colour;
+    }
+    return values;
+}
+
+vk::RenderPass VKRenderPassBuilder::build(vk::Device dev) const
+{
+    std::vector<vk::AttachmentDescription> attachments(m_attachments.size());
+    vk::PipelineStageFlags readStages;
+    vk::AccessFlags readAccess;
+
+    for (uint32_t a = 0; a < (uint32_t)m_attachments.size(); ++a)
+    {
+        const AttachmentInfo& info = m_attachments[a];
+
+        // the layout of its last use in the pass, what it stays in when nothing reads it afterwards
+        vk::ImageLayout lastLayout = vk::ImageLayout::eUndefined;
+        for (const auto& subpass : m_subpasses)
+        {
+            for (size_t i = 0; i < subpass.colors.size(); ++i)
+            {
+                if (subpass.colors[i].attachment == a || subpass.resolves[i].attachment == a)
+                    lastLayout = vk::ImageLayout::eColorAttachmentOptimal;
+            }
+            if (subpass.depth.attachment == a)
+                lastLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+            for (const auto& it : subpass.inputs)
+            {
+                if (it.attachment == a)
+                    lastLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+            }
+        }
+
+        // a resolve target is overwritten whole, so there's nothing worth clearing
+        vk::AttachmentLoadOp loadOp = info.loadContents ? vk::AttachmentLoadOp::eLoad :
+            onlyResolved(a) ? vk::AttachmentLoadOp::eDontCare : vk::AttachmentLoadOp::eClear;
+        vk::AttachmentStoreOp storeOp = info.readAfter ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
+
+        vk::AttachmentDescription& desc = attachments[a];
+        desc.format = info.format;
+        desc.samples = info.samples;
+        desc.loadOp = loadOp;
+        desc.storeOp = storeOp;
+        desc.stencilLoadOp = hasStencil(info.format) ? loadOp : vk::AttachmentLoadOp::eDontCare;
+        desc.stencilStoreOp = hasStencil(info.format) ? storeOp : vk::AttachmentStoreOp::eDontCare;
+        desc.finalLayout = info.readAfter ? info.finalLayout : lastLayout;
+        desc.initialLayout = info.loadContents ? desc.finalLayout : vk::ImageLayout::eUndefined;
+
+        if (info.readAfter)
+        {
+            readStages |= info.readStages;
+            readAccess |= info.readAccess;
+        }
+    }
+
+    std::vector<vk::SubpassDescription> subpasses(m_subpasses.size());
+    std::vector<std::vector<uint32_t>> preserved(m_subpasses.size());
+
+    for (size_t s = 0; s < m_subpasses.size(); ++s)
+    {
+        const Subpass& subpass = m_subpasses[s];
+        const bool anyResolve = std::any_of(subpass.resolves.begin(), subpass.resolves.end(),
+            [](const vk::AttachmentReference& r) { return r.attachment != UNUSED; });
+
+        // anything written before this subpass and read after it has to survive it
+        for (uint32_t a = 0; a < (uint32_t)m_attachments.size(); ++a)
+        {
+            if (uses(subpass, a))
+                continue;
+
+            bool before = false, after = false;
+            for (size_t o = 0; o < m_subpasses.size(); ++o)
+            {
+                if (o < s)
+                    before |= uses(m_subpasses[o], a);
+                else if (o > s)
+                    after |= uses(m_subpasses[o], a);
+            }
+
+            if (before && after)
+                preserved[s].push_back(a);
+        }
+
+        vk::SubpassDescription& desc = subpasses[s];
+        desc.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+        desc.colorAttachmentCount = (uint32_t)subpass.colors.size();
+        desc.pColorAttachments = subpass.colors.data();
+        desc.pResolveAttachments = anyResolve ? subpass.resolves.data() : nullptr;
+        desc.inputAttachmentCount = (uint32_t)subpass.inputs.size();
+        desc.pInputAttachments = subpass.inputs.data();
+        desc.pDepthStencilAttachment = subpass.depth.attachment != UNUSED ? &subpass.depth : nullptr;
+        desc.preserveAttachmentCount = (uint32_t)preserved[s].size();
+        desc.pPreserveAttachments = preserved[s].data();
+    }
+
+    const vk::PipelineStageFlags attachmentStages = vk::PipelineStageFlagBits::eColorAttachmentOutput |
+        vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+    const vk::AccessFlags attachmentWrites = vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+    const vk::AccessFlags attachmentAccess = attachmentWrites | vk::AccessFlagBits::eColorAttachmentRead |
+        vk::AccessFlagBits::eDepthStencilAttachmentRead;
+
+    std::vector<vk::SubpassDependency> dependencies;
+
+    // attachments are reused frame after frame: the previous frame's writes and reads after the pass
+    // have to finish first. Color output also covers waiting on the swapchain image
+    vk::SubpassDependency first;
+    first.srcSubpass = VK_SUBPASS_EXTERNAL;
+    first.dstSubpass = 0;
+    first.srcStageMask = attachmentStages | readStages;
+    first.srcAccessMask = attachmentWrites;
+    first.dstStageMask = attachmentStages;
+    first.dstAccessMask = attachmentAccess;
+    dependencies.push_back(first);
+
+    // subpasses read what the previous ones wrote, only ever at the same pixel
+    for (uint32_t s = 1; s < (uint32_t)m_subpasses.size(); ++s)
+    {
+        vk::SubpassDependency dependency;
+        dependency.srcSubpass = s - 1;
+        dependency.dstSubpass = s;
+        dependency.srcStageMask = attachmentStages;
+        dependency.srcAccessMask = attachmentWrites;
+        dependency.dstStageMask = attachmentStages | vk::PipelineStageFlagBits::eFragmentShader;
+        dependency.dstAccessMask = attachmentAccess | vk::AccessFlagBits::eInputAttachmentRead;
+        dependency.dependencyFlags = vk::DependencyFlagBits::eByRegion;
+        dependencies.push_back(dependency);
+    }
+
+    // and whatever reads stored attachments afterwards waits for them
+    if (readStages)
+    {
+        vk::SubpassDependency last;
+        last.srcSubpass = (uint32_t)m_subpasses.size() - 1;
+        last.dstSubpass = VK_SUBPASS_EXTERNAL;
+        last.srcStageMask = attachmentStages;
+        last.srcAccessMask = attachmentWrites;
+        last.dstStageMask = readStages;
+        last.dstAccessMask = readAccess;
+        dependencies.push_back(last);
+    }
+
+    vk::RenderPassCreateInfo renderPassInfo;
+    renderPassInfo.attachmentCount = (uint32_t)attachments.size();
+    renderPassInfo.pAttachments = attachments.data();
+    renderPassInfo.subpassCount = (uint32_t)subpasses.size();
+    renderPassInfo.pSubpasses = subpasses.data();
+    renderPassInfo.dependencyCount = (uint32_t)dependencies.size();
+    renderPassInfo.pDependencies = dependencies.data();
+
+    return dev.createRenderPass(renderPassInfo);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+
+// one attachment of a render pass. Load and store ops follow from how it's used, so nothing goes
+// back to memory unless something reads it once the pass is over
+struct AttachmentInfo {
+    vk::Format                    format = vk::Format::eUndefined;
+    vk::SampleCountFlagBits       samples = vk::SampleCountFlagBits::e1;
+    bool                          loadContents = false;     // keep what it held before the pass, otherwise cleared
+    bool                          readAfter = false;        // stored at the end of the pass, otherwise it never leaves tile memory
+    vk::ImageLayout               finalLayout = vk::ImageLayout::eUndefined;   // readAfter only, the layout its reader wants
+    vk::PipelineStageFlags        readStages;               // readAfter only, where it's read
+    vk::AccessFlags               readAccess;
+};
+
+// Declarative render pass description: attachments, then subpasses referencing them. build() derives
+// load/store ops, layouts, preserved attachments and the dependencies between subpasses and with
+// whatever comes before and after the pass. Attachments neither loaded nor stored are transient and
+// can be backed by lazily allocated memory, on tilers they then never get any
+class VKRenderPassBuilder
+{
+public:
+    static constexpr uint32_t     UNUSED = VK_ATTACHMENT_UNUSED;
+
+    uint32_t                      addAttachment(const AttachmentInfo& info);
+
+    // the subpass the calls after it describe, in execution order
+    VKRenderPassBuilder&          addSubpass();
+    VKRenderPassBuilder&          color(uint32_t attachment, uint32_t resolveAttachment = UNUSED);
+    VKRenderPassBuilder&          depth(uint32_t attachment);
+    VKRenderPassBuilder&          input(uint32_t attachment);
+
+    vk::RenderPass                build(vk::Device dev) const;
+
+    uint32_t                      getAttachmentCount() const { return (uint32_t)m_attachments.size(); }
+    const AttachmentInfo&         getAttachment(uint32_t attachment) const { return m_attachments[attachment]; }
+    bool                          isTransient(uint32_t attachment) const;
+
+    // what an image backing the attachment is created with, eTransientAttachment when it's transient
+    vk::ImageUsageFlags           getImageUsage(uint32_t attachment) const;
+
+    // one per attachment, in order, for vk::RenderPassBeginInfo
+    std::vector<vk::ClearValue>   getClearValues(const vk::ClearColorValue& colour, const vk::ClearDepthStencilValue& depthStencil) const;
+
+    static bool                   isDepthFormat(vk::Format format);
+    static bool                   hasStencil(vk::Format format);
+
+private:
+    struct Subpass {
+        std::vector<vk::AttachmentReference> colors;
+        std::vector<vk::AttachmentReference> resolves;
+        std::vector<vk::AttachmentReference> inputs;
+        vk::AttachmentReference   depth = vk::AttachmentReference(UNUSED, vk::ImageLayout::eUndefined);
+    };
+
+    bool                          uses(const Subpass& subpass, uint32_t attachment) const;
+    bool                          onlyResolved(uint32_t attachment) const;
+
+    std::vector<AttachmentInfo>   m_attachments;
+    std::vector<Subpass>          m_subpasses;
+};
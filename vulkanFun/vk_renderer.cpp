@@ -1,17 +1,25 @@
 #include "vk_renderer.h"
 #include "trace.h"
 #include "file_helpers.h"
+#include "image_helpers.h"
 #include <set>
+#include <string.h>
+#include <math.h>
 #include <chrono>
+#include <filesystem>
 #include <GLFW/glfw3.h>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "vertex.h"
+#include "mesh.h"
 
 static bool ADD_VALIDATION_LAYERS = true;
 static bool ADD_RENDERDOC_LAYER = false;
 static const char* STANDARD_VALIDATION_LAYER_NAME = "VK_LAYER_LUNARG_standard_validation";
 
+// below this many draws a frame is recorded inline. The value is a guess, not measured, use --bench-record to tune it
+static const size_t PARALLEL_RECORD_MIN_DRAWS = 512;
+
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
     VkDebugReportFlagsEXT flags,
     VkDebugReportObjectTypeEXT objType,
@@ -22,34 +30,86 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
     const char* msg,
     void* userData) {
 
-    TRACE("validation layer %s: %s", layerPrefix, msg);
+    // layers can be chatty, the message is copied and formatted off this thread
+    if (flags & VK_DEBUG_REPORT_ERROR_BIT_EXT)
+        LOG_ERROR(LogCategory::eValidation, "%s: %s", layerPrefix, msg);
+    else if (flags & (VK_DEBUG_REPORT_WARNING_BIT_EXT | VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT))
+        LOG_WARNING(LogCategory::eValidation, "%s: %s", layerPrefix, msg);
+    else
+        LOG_DEBUG(LogCategory::eValidation, "%s: %s", layerPrefix, msg);
     return VK_FALSE;
 };
 
-void VKRenderer::init(GLFWwindow* window, uint32_t windowWidth, uint32_t windowHeight)
+void VKRenderer::init(GLFWwindow* window, uint32_t windowWidth, uint32_t windowHeight, uint32_t framesInFlight, uint32_t msaaSamples)
 {
     m_windowExtents = vk::Extent2D(windowWidth, windowHeight);
+    m_headless = window == nullptr;
+    m_lastImageIx = 0;
+
+    m_framesInFlight = std::max(1u, framesInFlight);
+    m_currentFrame = 0;
+    m_frameWaited = false;
+    m_frameNumber = 0;
+    m_asyncCompute = false;
+    m_timeAsyncCull = false;
+    m_timelineSemaphores = false;
+    m_sortDrawList = false;
+    m_vertexLayout = ~0u;
+    m_instancedVertexLayout = ~0u;
+    m_sceneUniformOffset = VKUniformRing::INVALID_OFFSET;
+    m_frames.resize(m_framesInFlight);
+
+    // workers plus the render thread itself each record a slice of the draw list
+    m_jobs.init();
+    m_recordSlices = m_jobs.getThreadCount() + 1;
 
     createInstance();
     setupDebugCallback();
-    createSurface(window);
+    if (!m_headless)
+        createSurface(window);
     selectPhysicalDevice();
     selectLogicalDevice();
-    createSwapChain();
-    createRenderPass();
+    m_allocator.init(m_physDevice, m_dev);
+    if (m_asyncCompute)
+        m_allocator.setSharedQueueFamilies({ (uint32_t)m_gfxQueueIx, (uint32_t)m_computeQueueIx });
+    m_uploads.init(m_dev, m_allocator, m_gfxQueue, m_transferQueue.isInitialised() ? m_transferQueue : m_gfxQueue);
+    // the cull on the async compute queue is timed too, when its family has timestamps
+    auto queueFamilies = m_physDevice.getQueueFamilyProperties();
+    uint32_t timestampBits = queueFamilies[m_gfxQueueIx].timestampValidBits;
+    m_timeAsyncCull = m_asyncCompute && queueFamilies[m_computeQueueIx].timestampValidBits != 0;
+    if (m_timeAsyncCull)
+        timestampBits = std::min(timestampBits, queueFamilies[m_computeQueueIx].timestampValidBits);
+    m_profiler.init(m_physDevice, m_dev, timestampBits, m_framesInFlight);
+    m_descriptors.init(m_dev, m_framesInFlight);
+    m_bindless.init(m_dev, m_framesInFlight, m_descriptors);
+    m_scene.init(m_physDevice, m_dev, m_allocator, m_framesInFlight);
+    m_graph.init(m_dev, m_allocator, m_framesInFlight);
+    if (m_headless)
+        createOffscreenTargets();
+    else
+        createSwapChain();
+    selectAttachmentFormats(msaaSamples);
+    m_reflector.init("pipeline_cache/reflection.bin");
+    m_layouts.init(m_dev);
+    m_shaders.init(m_dev, m_jobs, m_reflector);
     loadShaders();
+    // after the shaders, whether depth is kept for the occlusion pyramid depends on them
+    createRenderPass();
+    createAttachments();
     createPipelineCache();
+    m_pipelines.init(m_dev, m_pipelineCache);
     createDescriptorSetLayout();
     createGraphicsPipeline();
     createFrameBuffers();
     createCommandPool();
-    createVertexBuffer();
-    createIndexBuffer();
+    createMeshBuffers();
+    createMaterials();
     createUniformBuffer();
+    createCullingPass();
     createDescriptorPool();
     createDescriptorSet();
     createCommandBuffers();
-    createSemaphores();
+    createSyncObjects();
 }
 
 void VKRenderer::createInstance()
@@ -57,13 +117,13 @@ void VKRenderer::createInstance()
     auto allInstLayers = vk::enumerateInstanceLayerProperties();
     auto allInstExtensions = vk::enumerateInstanceExtensionProperties();
 
-    TRACE("%s", "Available Instance Extensions:");
-    for (auto it : allInstExtensions)
-        TRACE("> %s", it.extensionName);
+    LOG_DEBUG(LogCategory::eDevice, "Available Instance Extensions:");
+    for (auto& it : allInstExtensions)
+        LOG_DEBUG(LogCategory::eDevice, "> %s", it.extensionName);
 
-    TRACE("%s", "Available Instance Layers:");
-    for (auto it : allInstLayers)
-        TRACE("> %s", it.layerName);
+    LOG_DEBUG(LogCategory::eDevice, "Available Instance Layers:");
+    for (auto& it : allInstLayers)
+        LOG_DEBUG(LogCategory::eDevice, "> %s", it.layerName);
 
     m_addStandardValidationLayer = false;
 
@@ -95,9 +155,10 @@ void VKRenderer::createInstance()
         }
     }
 
-    // Populate required extensions vector then find and add debug report extension
+    // Populate required extensions vector then find and add debug report extension,
+    // headless needs no surface extensions and never touches GLFW
     uint32_t reqExtCount = 0;
-    const char** reqExt = glfwGetRequiredInstanceExtensions(&reqExtCount);
+    const char** reqExt = m_headless ? nullptr : glfwGetRequiredInstanceExtensions(&reqExtCount);
     std::vector<const char*> instExtensions;
     for (uint32_t i = 0; i < reqExtCount; ++i)
         instExtensions.push_back(reqExt[i]);
@@ -113,6 +174,15 @@ void VKRenderer::createInstance()
             instExtensions.push_back(debugReportExtension->extensionName);
     }
 
+    // 1.0 only reaches extended device features and limits through this, the bindless heap needs it
+    auto properties2Extension = std::find_if(allInstExtensions.begin(), allInstExtensions.end(), [](const vk::ExtensionProperties& e) {
+        return strcmp(e.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0;
+    });
+
+    m_hasProperties2 = properties2Extension != allInstExtensions.end();
+    if (m_hasProperties2)
+        instExtensions.push_back(properties2Extension->extensionName);
+
     // setup instance creation info
     vk::ApplicationInfo appInfo("vkTest", 1, "vkTest", 1, VK_API_VERSION_1_0);
     vk::InstanceCreateInfo instCreateInfo(vk::InstanceCreateFlags(), &appInfo);
@@ -141,6 +211,10 @@ void VKRenderer::setupDebugCallback()
 
     auto createDebugReportFunc = (PFN_vkCreateDebugReportCallbackEXT)m_inst.getProcAddr("vkCreateDebugReportCallbackEXT");
 
+    // missing when the debug report extension isn't available, e.g. on CI boxes without the SDK layers
+    if (!createDebugReportFunc)
+        return;
+
 	auto debugReportCreateInfEXT = VkDebugReportCallbackCreateInfoEXT(debugReportCallbackInfo);
     auto debugReportCallbackRes = createDebugReportFunc(VkInstance(m_inst), &debugReportCreateInfEXT, nullptr, &m_debugCallback);
 }
@@ -159,34 +233,36 @@ void VKRenderer::selectPhysicalDevice()
     auto allPhysDeviceExtensions = m_physDevice.enumerateDeviceExtensionProperties();
     auto allPhysDeviceLayers = m_physDevice.enumerateDeviceLayerProperties();
 
-    TRACE("Selected Physical Device '%s'", props.deviceName);
+    LOG_INFO(LogCategory::eDevice, "Selected Physical Device '%s'", props.deviceName);
 
-    TRACE("Physical Device '%s' supported Extensions:", props.deviceName);
-    for (auto it : allPhysDeviceExtensions)
-        TRACE("> %s", it.extensionName);
+    LOG_DEBUG(LogCategory::eDevice, "Physical Device '%s' supported Extensions:", props.deviceName);
+    for (auto& it : allPhysDeviceExtensions)
+        LOG_DEBUG(LogCategory::eDevice, "> %s", it.extensionName);
 
-    TRACE("Physical Device '%s' supported Layers:", props.deviceName);
-    for (auto it : allPhysDeviceLayers)
-        TRACE("> %s", it.layerName);
+    LOG_DEBUG(LogCategory::eDevice, "Physical Device '%s' supported Layers:", props.deviceName);
+    for (auto& it : allPhysDeviceLayers)
+        LOG_DEBUG(LogCategory::eDevice, "> %s", it.layerName);
 }
 
 void VKRenderer::selectLogicalDevice()
 {
-    // find graphics + present queues
+    // find graphics + compute and present queues
     auto queueFamilies = m_physDevice.getQueueFamilyProperties();
 
     // print details
-    TRACE("%s queue families:", m_physDevice.getProperties().deviceName);
+    LOG_DEBUG(LogCategory::eDevice, "%s queue families:", m_physDevice.getProperties().deviceName);
     for (int i = 0; i < (int)queueFamilies.size(); ++i)
-        TRACE("Queue %d supports: %s, count=%d", i, vk::to_string(queueFamilies[i].queueFlags).c_str(), queueFamilies[i].queueCount);
+        LOG_DEBUG(LogCategory::eDevice, "Queue %d supports: %s, count=%d", i, vk::to_string(queueFamilies[i].queueFlags).c_str(), queueFamilies[i].queueCount);
 
     m_gfxQueueIx = -1;
     m_presentQueueIx = -1;
 
     for (int i = 0; i < (int)queueFamilies.size(); ++i)
     {
-        auto presentSupport = m_physDevice.getSurfaceSupportKHR(i, m_surface);
-        if (queueFamilies[i].queueFlags & vk::QueueFlagBits::eGraphics)
+        // nothing is presented headless, the graphics family stands in for the present family
+        auto presentSupport = m_headless ? true : m_physDevice.getSurfaceSupportKHR(i, m_surface);
+        // the depth pyramid dispatches on the graphics queue, and so does the cull without async compute
+        if ((queueFamilies[i].queueFlags & vk::QueueFlagBits::eGraphics) && (queueFamilies[i].queueFlags & vk::QueueFlagBits::eCompute))
         {
             if (m_gfxQueueIx == -1)
                 m_gfxQueueIx = i;
@@ -207,18 +283,46 @@ void VKRenderer::selectLogicalDevice()
     if (m_gfxQueueIx == -1 || m_presentQueueIx == -1)
         return;
 
+    // a transfer-only family is usually a DMA engine, uploads there run alongside rendering
+    m_transferQueueIx = m_gfxQueueIx;
+    for (int i = 0; i < (int)queueFamilies.size(); ++i)
+    {
+        auto flags = queueFamilies[i].queueFlags;
+        if ((flags & vk::QueueFlagBits::eTransfer) &&
+            !(flags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)))
+        {
+            m_transferQueueIx = i;
+            break;
+        }
+    }
+
+    // a compute-only family is an async compute engine, its work overlaps the graphics queue's. The
+    // two are synchronised with timeline semaphores, without them everything stays on graphics
+    m_timelineSemaphores = VKQueue::supportsTimelines(m_inst, m_hasProperties2, m_physDevice);
+    m_computeQueueIx = m_gfxQueueIx;
+    for (int i = 0; i < (int)queueFamilies.size() && m_timelineSemaphores && m_allowAsyncCompute; ++i)
+    {
+        auto flags = queueFamilies[i].queueFlags;
+        if ((flags & vk::QueueFlagBits::eCompute) && !(flags & vk::QueueFlagBits::eGraphics))
+        {
+            m_computeQueueIx = i;
+            break;
+        }
+    }
+    m_asyncCompute = m_computeQueueIx != m_gfxQueueIx;
+
     // make sure VK_KHR_SWAPCHAIN_EXTENSION_NAME is supported
     auto allPhysDeviceExtensions = m_physDevice.enumerateDeviceExtensionProperties();
     auto swapchainExt = std::find_if(allPhysDeviceExtensions.begin(), allPhysDeviceExtensions.end(), [](vk::ExtensionProperties& e) {
         return strcmp(e.extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0;
     });
 
-    if (swapchainExt == allPhysDeviceExtensions.end())
+    if (!m_headless && swapchainExt == allPhysDeviceExtensions.end())
         return;
 
     // setup queue info for graphics + presentation queues, which might be different
     std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
-    std::set<int> uniqueQueueFamilies = { m_gfxQueueIx, m_presentQueueIx };
+    std::set<int> uniqueQueueFamilies = { m_gfxQueueIx, m_presentQueueIx, m_transferQueueIx, m_computeQueueIx };
 
     float qPriority = 1.0f;
     for (auto it : uniqueQueueFamilies)
@@ -238,10 +342,29 @@ void VKRenderer::selectLogicalDevice()
     vk::PhysicalDeviceFeatures physDeviceFeatures = m_physDevice.getFeatures();
     deviceCreateInfo.pEnabledFeatures = &physDeviceFeatures;
 
-    // enable the swapchain extension (searched for above)
-    const char* swapchainExtId[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
-    deviceCreateInfo.enabledExtensionCount = 1;
-    deviceCreateInfo.ppEnabledExtensionNames = swapchainExtId;
+    // enable the swapchain extension (searched for above), descriptor indexing when the bindless heap can use
+    // it, draw indirect count for the scene and timeline semaphores for the queues
+    std::vector<const char*> deviceExtensions;
+    if (!m_headless)
+        deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+    deviceCreateInfo.pNext = m_bindless.prepareDevice(m_inst, m_hasProperties2, m_physDevice, deviceExtensions);
+    m_scene.prepareDevice(m_physDevice, deviceExtensions);
+
+#ifdef VK_KHR_timeline_semaphore
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+    timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    timelineFeatures.timelineSemaphore = VK_TRUE;
+    if (m_timelineSemaphores)
+    {
+        timelineFeatures.pNext = const_cast<void*>(deviceCreateInfo.pNext);
+        deviceCreateInfo.pNext = &timelineFeatures;
+        deviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    }
+#endif
+
+    deviceCreateInfo.enabledExtensionCount = (uint32_t)deviceExtensions.size();
+    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
     const char* standardValidationLayers[] = { STANDARD_VALIDATION_LAYER_NAME };
 
@@ -256,38 +379,97 @@ void VKRenderer::selectLogicalDevice()
     m_dev = m_physDevice.createDevice(deviceCreateInfo);
 
     // cache queues for later
-    m_gfxQueue = m_dev.getQueue(m_gfxQueueIx, 0);
+    m_gfxQueue.init(m_dev, m_gfxQueueIx, m_timelineSemaphores);
     m_presentQueue = m_dev.getQueue(m_presentQueueIx, 0);
+    if (m_transferQueueIx != m_gfxQueueIx)
+        m_transferQueue.init(m_dev, m_transferQueueIx, m_timelineSemaphores);
+    if (m_asyncCompute)
+        m_computeQueue.init(m_dev, m_computeQueueIx, true);
+
+    LOG_INFO(LogCategory::eDevice, "Queues: graphics %d, present %d, transfer %d, compute %d%s", m_gfxQueueIx, m_presentQueueIx,
+        m_transferQueueIx, m_computeQueueIx, m_asyncCompute ? " (async)" : "");
 }
 
 void VKRenderer::recreateSwapChain(uint32_t windowWidth, uint32_t windowHeight)
 {
-    m_dev.waitIdle();
-    
-    m_windowExtents = vk::Extent2D(windowWidth, windowHeight);
+    // offscreen targets are sized once for the whole run
+    if (m_headless)
+        return;
 
-    m_dev.freeCommandBuffers(m_commandPool, m_commandBuffers);
+    // a minimised window has a 0x0 surface, which no swapchain can be created for; keep the current one
+    // until the window comes back and the resize callback asks again
+    const vk::Extent2D surfaceExtent = m_physDevice.getSurfaceCapabilitiesKHR(m_surface).currentExtent;
+    if (windowWidth == 0 || windowHeight == 0 || surfaceExtent.width == 0 || surfaceExtent.height == 0)
+        return;
 
-    m_dev.destroyPipeline(m_gfxPipeline);
-    m_dev.destroyPipelineLayout(m_gfxPipelineLayout);
+    m_windowExtents = vk::Extent2D(windowWidth, windowHeight);
 
-    m_dev.destroyRenderPass(m_renderPass);
+    // frames in flight may still be using the old views and framebuffers, so they are parked until
+    // those frames retire rather than draining the device
+    RetiredSwapChain retired;
+    retired.swapChain = m_swapChain;
+    retired.imageViews.swap(m_swapChainImageViews);
+    retired.frameBuffers.swap(m_swapChainFrameBuffers);
+    retired.attachmentImages.swap(m_attachmentImages);
+    retired.attachmentAllocs.swap(m_attachmentAllocs);
+    retired.retiredAtFrame = m_frameNumber;
 
-    for (auto it : m_swapChainFrameBuffers)
-        m_dev.destroyFramebuffer(it);
-    m_swapChainFrameBuffers.clear();
+    const vk::Format oldFormat = m_swapChainImageFormat;
 
-    for (auto it : m_swapChainImageViews)
-        m_dev.destroyImageView(it);
-    m_swapChainImageViews.clear();
+    // the old swapchain is handed over as oldSwapchain, letting the driver recycle it
+    createSwapChain();
 
-    m_dev.destroySwapchainKHR(m_swapChain);
+    // viewport and scissor are dynamic, so only a format change invalidates the render pass and pipeline
+    if (m_swapChainImageFormat != oldFormat)
+    {
+        retired.renderPass = m_renderPass;
+        retired.pipelines = m_pipelines.removeRenderPass(m_renderPass);
 
-    createSwapChain();
-    createRenderPass();
-    createGraphicsPipeline();
+        createRenderPass();
+        createGraphicsPipeline();
+    }
+
+    // depth and multisampled color are sized with the swapchain
+    for (auto it : m_attachmentViews)
+    {
+        if (it)
+            retired.imageViews.push_back(it);
+    }
+    createAttachments();
     createFrameBuffers();
-    createCommandBuffers();
+
+    m_retiredSwapChains.push_back(std::move(retired));
+}
+
+void VKRenderer::destroyRetiredSwapChains(bool all)
+{
+    auto it = m_retiredSwapChains.begin();
+    while (it != m_retiredSwapChains.end())
+    {
+        // the fence just waited on belongs to frame m_frameNumber - m_framesInFlight, and frames on one
+        // queue retire in order, so everything submitted before retiredAtFrame has finished once that's reached
+        if (!all && m_frameNumber + 1 < it->retiredAtFrame + m_framesInFlight)
+        {
+            ++it;
+            continue;
+        }
+
+        for (auto fb : it->frameBuffers)
+            m_dev.destroyFramebuffer(fb);
+        for (auto view : it->imageViews)
+            m_dev.destroyImageView(view);
+        for (size_t i = 0; i < it->attachmentImages.size(); ++i)
+            m_allocator.destroyImage(it->attachmentImages[i], it->attachmentAllocs[i]);
+
+        for (auto pipeline : it->pipelines)
+            m_dev.destroyPipeline(pipeline);
+        if (it->renderPass)
+            m_dev.destroyRenderPass(it->renderPass);
+
+        m_dev.destroySwapchainKHR(it->swapChain);
+
+        it = m_retiredSwapChains.erase(it);
+    }
 }
 
 void VKRenderer::createSwapChain()
@@ -378,6 +560,7 @@ void VKRenderer::createSwapChain()
     swapchainCreateInfo.compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque;
     swapchainCreateInfo.presentMode = selectedPresentMode;
     swapchainCreateInfo.clipped = VK_TRUE;
+    swapchainCreateInfo.oldSwapchain = m_swapChain;
 
     // now create the swapchain!
     m_swapChain = m_dev.createSwapchainKHR(swapchainCreateInfo);
@@ -406,235 +589,400 @@ void VKRenderer::createSwapChain()
     }
 }
 
+void VKRenderer::createOffscreenTargets()
+{
+    // stands in for the swapchain, one image per frame in flight so slots never share a target
+    m_swapChainImageFormat = vk::Format::eR8G8B8A8Unorm;
+    m_swapExtent = m_windowExtents;
+
+    for (uint32_t i = 0; i < m_framesInFlight; ++i)
+    {
+        vk::ImageCreateInfo imageInfo;
+        imageInfo.imageType = vk::ImageType::e2D;
+        imageInfo.format = m_swapChainImageFormat;
+        imageInfo.extent = vk::Extent3D(m_swapExtent.width, m_swapExtent.height, 1);
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = vk::SampleCountFlagBits::e1;
+        imageInfo.tiling = vk::ImageTiling::eOptimal;
+        imageInfo.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc;
+        imageInfo.sharingMode = vk::SharingMode::eExclusive;
+        imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+        vk::Image image;
+        m_offscreenImageAllocs.push_back(m_allocator.createImage(imageInfo, vk::MemoryPropertyFlagBits::eDeviceLocal, image));
+        m_swapChainImages.push_back(image);
+
+        vk::ImageViewCreateInfo imageViewCreateInfo;
+        imageViewCreateInfo.image = image;
+        imageViewCreateInfo.viewType = vk::ImageViewType::e2D;
+        imageViewCreateInfo.format = m_swapChainImageFormat;
+        imageViewCreateInfo.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+        imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+        imageViewCreateInfo.subresourceRange.levelCount = 1;
+        imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+        imageViewCreateInfo.subresourceRange.layerCount = 1;
+
+        m_swapChainImageViews.push_back(m_dev.createImageView(imageViewCreateInfo));
+    }
+}
+
+void VKRenderer::selectAttachmentFormats(uint32_t msaaSamples)
+{
+    // the first format depth can be rendered to, preferring one the occlusion pyramid can also sample
+    const vk::Format depthFormats[] = { vk::Format::eD32Sfloat, vk::Format::eD32SfloatS8Uint, vk::Format::eD24UnormS8Uint };
+
+    m_depthFormat = vk::Format::eUndefined;
+    m_depthSampleable = false;
+    for (auto it : depthFormats)
+    {
+        vk::FormatFeatureFlags features = m_physDevice.getFormatProperties(it).optimalTilingFeatures;
+        if (!(features & vk::FormatFeatureFlagBits::eDepthStencilAttachment))
+            continue;
+
+        const bool sampleable = (bool)(features & vk::FormatFeatureFlagBits::eSampledImage);
+        if (m_depthFormat == vk::Format::eUndefined || (sampleable && !m_depthSampleable))
+        {
+            m_depthFormat = it;
+            m_depthSampleable = sampleable;
+        }
+    }
+
+    if (m_depthFormat == vk::Format::eUndefined)
+        throw std::runtime_error("no usable depth format");
+
+    // color and depth share the subpass, so the count has to suit both
+    const vk::PhysicalDeviceLimits limits = m_physDevice.getProperties().limits;
+    const vk::SampleCountFlags supported = limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts;
+
+    m_msaaSamples = vk::SampleCountFlagBits::e1;
+    for (uint32_t count = 2; count <= msaaSamples && count <= 64; count *= 2)
+    {
+        if (supported & (vk::SampleCountFlagBits)count)
+            m_msaaSamples = (vk::SampleCountFlagBits)count;
+    }
+
+    LOG_INFO(LogCategory::eDevice, "Depth %s, %ux MSAA", vk::to_string(m_depthFormat).c_str(), (uint32_t)m_msaaSamples);
+}
+
 void VKRenderer::createRenderPass()
 {
-    vk::AttachmentDescription colorAttachment;
-    colorAttachment.format = m_swapChainImageFormat;
-    colorAttachment.samples = vk::SampleCountFlagBits::e1;
-    colorAttachment.loadOp = vk::AttachmentLoadOp::eClear;
-    colorAttachment.storeOp = vk::AttachmentStoreOp::eStore;
-    colorAttachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-    colorAttachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-    colorAttachment.initialLayout = vk::ImageLayout::eUndefined;
-    colorAttachment.finalLayout = vk::ImageLayout::ePresentSrcKHR;
-
-    vk::AttachmentReference colorAttachmentRef;
-    colorAttachmentRef.attachment = 0;
-    colorAttachmentRef.layout = vk::ImageLayout::eColorAttachmentOptimal;
-
-    vk::SubpassDescription subpass;
-    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colorAttachmentRef;
-
-    vk::SubpassDependency dependency;
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    dependency.srcAccessMask = vk::AccessFlags();
-    dependency.dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    dependency.dstAccessMask = vk::AccessFlagBits::eColorAttachmentRead |
-        vk::AccessFlagBits::eColorAttachmentWrite;
-
-    vk::RenderPassCreateInfo renderPassInfo;
-    renderPassInfo.attachmentCount = 1;
-    renderPassInfo.pAttachments = &colorAttachment;
-    renderPassInfo.subpassCount = 1;
-    renderPassInfo.pSubpasses = &subpass;
-
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
-
-    m_renderPass = m_dev.createRenderPass(renderPassInfo);
+    const bool multisampled = m_msaaSamples != vk::SampleCountFlagBits::e1;
+
+    // headless frames are only ever read back, never presented
+    AttachmentInfo present;
+    present.format = m_swapChainImageFormat;
+    present.readAfter = true;
+    present.finalLayout = m_headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR;
+    present.readStages = m_headless ? vk::PipelineStageFlagBits::eTransfer : vk::PipelineStageFlagBits::eBottomOfPipe;
+    present.readAccess = m_headless ? vk::AccessFlagBits::eTransferRead : vk::AccessFlags();
+
+    // depth only leaves the pass for the occlusion pyramid, which reads it single sampled
+    AttachmentInfo depth;
+    depth.format = m_depthFormat;
+    depth.samples = m_msaaSamples;
+    if (!multisampled && m_depthSampleable && m_shaders.getModule(m_cullShaderId) && m_shaders.getModule(m_pyramidShaderId))
+    {
+        depth.readAfter = true;
+        depth.finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        depth.readStages = vk::PipelineStageFlagBits::eComputeShader;
+        depth.readAccess = vk::AccessFlagBits::eShaderRead;
+    }
+
+    m_passDesc = VKRenderPassBuilder();
+    if (multisampled)
+    {
+        // samples never leave tile memory, the subpass resolves them straight into the swapchain image
+        AttachmentInfo color;
+        color.format = m_swapChainImageFormat;
+        color.samples = m_msaaSamples;
+
+        const uint32_t colorAttachment = m_passDesc.addAttachment(color);
+        m_depthAttachment = m_passDesc.addAttachment(depth);
+        m_presentAttachment = m_passDesc.addAttachment(present);
+        m_passDesc.addSubpass().color(colorAttachment, m_presentAttachment).depth(m_depthAttachment);
+    }
+    else
+    {
+        m_presentAttachment = m_passDesc.addAttachment(present);
+        m_depthAttachment = m_passDesc.addAttachment(depth);
+        m_passDesc.addSubpass().color(m_presentAttachment).depth(m_depthAttachment);
+    }
+
+    m_renderPass = m_passDesc.build(m_dev);
+
+    vk::ClearColorValue clearColour;
+    clearColour.float32[3] = 1.0f;
+    m_clearValues = m_passDesc.getClearValues(clearColour, vk::ClearDepthStencilValue(1.0f, 0));
+}
+
+void VKRenderer::createAttachments()
+{
+    const uint32_t count = m_passDesc.getAttachmentCount();
+    m_attachmentImages.assign(count, vk::Image());
+    m_attachmentAllocs.assign(count, VKAllocation());
+    m_attachmentViews.assign(count, vk::ImageView());
+
+    for (uint32_t a = 0; a < count; ++a)
+    {
+        if (a == m_presentAttachment)
+            continue;
+
+        const AttachmentInfo& info = m_passDesc.getAttachment(a);
+
+        vk::ImageCreateInfo imageInfo;
+        imageInfo.imageType = vk::ImageType::e2D;
+        imageInfo.format = info.format;
+        imageInfo.extent = vk::Extent3D(m_swapExtent.width, m_swapExtent.height, 1);
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = info.samples;
+        imageInfo.tiling = vk::ImageTiling::eOptimal;
+        imageInfo.usage = m_passDesc.getImageUsage(a);
+        imageInfo.sharingMode = vk::SharingMode::eExclusive;
+        imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+        // on tilers a transient attachment in lazily allocated memory never gets any physical pages
+        const vk::MemoryPropertyFlags preferred = m_passDesc.isTransient(a) ?
+            vk::MemoryPropertyFlagBits::eLazilyAllocated : vk::MemoryPropertyFlags();
+        m_attachmentAllocs[a] = m_allocator.createImage(imageInfo, vk::MemoryPropertyFlagBits::eDeviceLocal, m_attachmentImages[a], preferred);
+
+        // stencil is never used, and a sampled view may only have one aspect
+        vk::ImageViewCreateInfo viewInfo;
+        viewInfo.image = m_attachmentImages[a];
+        viewInfo.viewType = vk::ImageViewType::e2D;
+        viewInfo.format = info.format;
+        viewInfo.subresourceRange = vk::ImageSubresourceRange(VKRenderPassBuilder::isDepthFormat(info.format) ?
+            vk::ImageAspectFlagBits::eDepth : vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+        m_attachmentViews[a] = m_dev.createImageView(viewInfo);
+    }
+
+    updateDepthSource();
+}
+
+void VKRenderer::updateDepthSource()
+{
+    if (!m_culling.isAvailable())
+        return;
+
+    // a null view when depth isn't stored leaves the cull to the frustum test
+    const bool stored = m_passDesc.getAttachment(m_depthAttachment).readAfter;
+    m_culling.setDepthSource(stored ? m_attachmentViews[m_depthAttachment] : vk::ImageView(), m_swapExtent);
 }
 
 void VKRenderer::loadShaders()
 {
-    // load shaders
-    auto vertShaderSrc = file_helpers::readFile("shaders/vert.spv");
-    auto fragShaderSrc = file_helpers::readFile("shaders/frag.spv");
-
-    vk::ShaderModuleCreateInfo vertShaderCreateInfo;
-    vertShaderCreateInfo.codeSize = vertShaderSrc.size();
-    vertShaderCreateInfo.pCode = (uint32_t*)vertShaderSrc.data();
-    m_vertShader = m_dev.createShaderModule(vertShaderCreateInfo);
-
-    vk::ShaderModuleCreateInfo fragShaderCreateInfo;
-    fragShaderCreateInfo.codeSize = fragShaderSrc.size();
-    fragShaderCreateInfo.pCode = (uint32_t*)fragShaderSrc.data();
-    m_fragShader = m_dev.createShaderModule(fragShaderCreateInfo);
+    // materials come through the bindless heap, the fallback variant indexes the per-draw sets instead
+    const char* bindlessFrag = m_bindless.isBindless() ? "shaders/bindless_frag.spv" : "shaders/bindless_fallback_frag.spv";
+
+    // read, validated, reflected and created across the workers; every variant goes in the one batch
+    std::vector<std::string> paths = { "shaders/vert.spv", bindlessFrag, "shaders/frag.spv", "shaders/instanced_vert.spv",
+                                       "shaders/cull_comp.spv", "shaders/depth_pyramid_comp.spv" };
+    std::vector<uint32_t> ids = m_shaders.load(paths);
+
+    m_vertShaderId = ids[0];
+    m_fragShaderId = ids[1];
+    m_instancedVertShaderId = ids[3];
+    m_cullShaderId = ids[4];
+    m_pyramidShaderId = ids[5];
+
+    // without it draws come out untinted and untextured, the layout is the same either way
+    if (!m_shaders.getModule(m_fragShaderId))
+    {
+        TRACE("%s missing, materials disabled", bindlessFrag);
+        m_fragShaderId = ids[2];
+    }
+
+    m_vertShader = m_shaders.getModule(m_vertShaderId);
+    m_fragShader = m_shaders.getModule(m_fragShaderId);
+    if (!m_vertShader || !m_fragShader)
+        throw std::runtime_error("failed to load shaders");
+
+    // layouts and vertex input come from what the modules declare
+    m_vertReflection = m_shaders.getReflection(m_vertShaderId);
+    m_fragReflection = m_shaders.getReflection(m_fragShaderId);
+
+    // optional, without it the scene is simply not drawn
+    m_instancedVertShader = m_shaders.getModule(m_instancedVertShaderId);
+    if (m_instancedVertShader)
+        m_instancedVertReflection = m_shaders.getReflection(m_instancedVertShaderId);
+    else
+        TRACE("%s", "shaders/instanced_vert.spv missing, instanced scene disabled");
 }
 
-void VKRenderer::createPipelineCache()
+// the parts of a shader's reflection its pipeline layout and vertex input were generated from
+static bool sameInterface(const ShaderReflection& a, const ShaderReflection& b)
 {
-    vk::PipelineCacheCreateInfo cacheCreateInfo;
+    return a.pushConstantOffset == b.pushConstantOffset && a.pushConstantSize == b.pushConstantSize &&
+           a.bindings.size() == b.bindings.size() && a.vertexInputs.size() == b.vertexInputs.size() &&
+           memcmp(a.bindings.data(), b.bindings.data(), a.bindings.size() * sizeof(ReflectedBinding)) == 0 &&
+           memcmp(a.vertexInputs.data(), b.vertexInputs.data(), a.vertexInputs.size() * sizeof(ReflectedVertexInput)) == 0;
+}
 
-    auto pipelineCacheStoredData = file_helpers::readFile("pipeline_cache/cache.bin");
-    //file_helpers::decrypt(pipelineCacheStoredData);
+void VKRenderer::reloadShaders()
+{
+    std::vector<uint32_t> changed = m_shaders.update();
 
-    if (pipelineCacheStoredData.empty() == false)
+    bool rebuild = false;
+    bool rebuildInstanced = false;
+    for (uint32_t id : changed)
     {
-        cacheCreateInfo.initialDataSize = pipelineCacheStoredData.size();
-        cacheCreateInfo.pInitialData = (const void*)pipelineCacheStoredData.data();
+        rebuild |= id == m_vertShaderId || id == m_fragShaderId;
+        rebuildInstanced |= id == m_instancedVertShaderId || id == m_fragShaderId;
     }
 
-    m_pipelineCache = m_dev.createPipelineCache(cacheCreateInfo);
+    // the layouts were made for the interfaces the shaders had when they were created. A reload that
+    // changes one keeps the old modules, the registry holds on to them, until a restart regenerates them
+    if (rebuild || rebuildInstanced)
+    {
+        const bool instancedLoaded = m_instancedVertexLayout != ~0u;
+        if (!sameInterface(m_shaders.getReflection(m_vertShaderId), m_vertReflection) ||
+            !sameInterface(m_shaders.getReflection(m_fragShaderId), m_fragReflection) ||
+            (instancedLoaded && !sameInterface(m_shaders.getReflection(m_instancedVertShaderId), m_instancedVertReflection)))
+        {
+            LOG_WARNING(LogCategory::ePipeline, "%s", "Reloaded shaders changed their interface, restart to use them");
+            rebuild = false;
+            rebuildInstanced = false;
+        }
+    }
+
+    if (rebuild)
+    {
+        m_vertShader = m_shaders.getModule(m_vertShaderId);
+        m_fragShader = m_shaders.getModule(m_fragShaderId);
+        m_vertReflection = m_shaders.getReflection(m_vertShaderId);
+        m_fragReflection = m_shaders.getReflection(m_fragShaderId);
+
+        // the old pipeline keeps drawing until the new one has compiled
+        m_pendingGfxPipeline = m_pipelines.getAsync(getDefaultPipelineKey());
+    }
+
+    if (m_pendingGfxPipeline.valid() && m_pendingGfxPipeline.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        vk::Pipeline pipeline = m_pendingGfxPipeline.get();
+        if (pipeline)
+            m_gfxPipeline = pipeline;
+        m_pendingGfxPipeline = std::shared_future<vk::Pipeline>();
+    }
+
+    // a vertex layout is only registered for it once the shader has loaded, a late first appearance waits for a restart
+    if (rebuildInstanced && m_instancedVertexLayout != ~0u)
+    {
+        m_instancedVertShader = m_shaders.getModule(m_instancedVertShaderId);
+        m_instancedVertReflection = m_shaders.getReflection(m_instancedVertShaderId);
+        m_pendingInstancedPipeline = m_pipelines.getAsync(getInstancedPipelineKey());
+    }
+
+    if (m_pendingInstancedPipeline.valid() && m_pendingInstancedPipeline.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        vk::Pipeline pipeline = m_pendingInstancedPipeline.get();
+        if (pipeline)
+            m_instancedPipeline = pipeline;
+        m_pendingInstancedPipeline = std::shared_future<vk::Pipeline>();
+    }
+}
+
+void VKRenderer::createPipelineCache()
+{
+    // stale or corrupt files are discarded here, the driver only ever sees a blob made for it
+    m_pipelineCache.init(m_physDevice, m_dev, "pipeline_cache/cache.bin");
 }
 
 void VKRenderer::flushPipelineCache()
 {
-    auto pipelineCacheData = m_dev.getPipelineCacheData(m_pipelineCache);
-    //file_helpers::encrypt(pipelineCacheData);
-    file_helpers::writeFile("pipeline_cache/cache.bin", pipelineCacheData);
+    m_pipelineCache.flush();
 }
 
 void VKRenderer::createDescriptorSetLayout()
 {
-    vk::DescriptorSetLayoutBinding uboLayoutBinding;
-    uboLayoutBinding.binding = 0;
-    uboLayoutBinding.descriptorType = vk::DescriptorType::eUniformBuffer;
-    uboLayoutBinding.descriptorCount = 1;
-    uboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex;
-    uboLayoutBinding.pImmutableSamplers = nullptr;
-
-    vk::DescriptorSetLayoutCreateInfo layoutInfo;
-    layoutInfo.bindingCount = 1;
-    layoutInfo.pBindings = &uboLayoutBinding;
-
-    m_descriptorLayout = m_dev.createDescriptorSetLayout(layoutInfo);
+    // set 0 is the per-draw uniforms, bound at the ring offset, set 1 the bindless heap indexed through
+    // the push constants. Neither the dynamic offset nor the heap is visible in the SPIR-V
+    PipelineLayoutOverrides overrides;
+    overrides.dynamicBuffers.push_back({ 0, 0 });
+    overrides.externalSets.push_back({ 1, m_bindless.getLayout() });
+    overrides.pushConstants.push_back(vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+        0, sizeof(BindlessIndices)));
+
+    std::vector<vk::DescriptorSetLayout> setLayouts;
+    m_gfxPipelineLayout = m_layouts.getPipelineLayout({ &m_vertReflection, &m_fragReflection }, overrides, &setLayouts);
+    m_descriptorLayout = setLayouts[0];
 }
 
 void VKRenderer::createGraphicsPipeline()
 {
-    vk::PipelineShaderStageCreateInfo shaderStages[2];
+    // the layout comes from createDescriptorSetLayout and doesn't depend on the render pass, so it
+    // outlives format changes, as does the vertex layout
+    if (m_vertexLayout == ~0u)
+    {
+        // formats come from the packed layout, reflection only says which locations the shader reads
+        std::vector<vk::VertexInputBindingDescription> bindings(QuadVertexFormat::bindings.begin(), QuadVertexFormat::bindings.end());
+        std::vector<vk::VertexInputAttributeDescription> attributes(QuadVertexFormat::attributes.begin(), QuadVertexFormat::attributes.end());
 
-    vk::PipelineShaderStageCreateInfo& vertShaderStageInfo = shaderStages[0];
-    vertShaderStageInfo.stage = vk::ShaderStageFlagBits::eVertex;
-    vertShaderStageInfo.module = m_vertShader;
-    vertShaderStageInfo.pName = "main";
+        if (!VKLayoutCache::coversVertexInput(m_vertReflection, attributes))
+            TRACE("%s", "QuadVertexFormat doesn't provide every input shader.vert declares");
 
-    vk::PipelineShaderStageCreateInfo& fragShaderStageInfo = shaderStages[1];
-    fragShaderStageInfo.stage = vk::ShaderStageFlagBits::eFragment;
-    fragShaderStageInfo.module = m_fragShader;
-    fragShaderStageInfo.pName = "main";
+        m_vertexLayout = m_pipelines.registerVertexLayout(bindings, attributes);
+    }
 
+    // everything else is drawn with it until its own pipeline is ready, so it can't be deferred
+    m_gfxPipeline = m_pipelines.getBlocking(getDefaultPipelineKey());
+    m_pendingGfxPipeline = std::shared_future<vk::Pipeline>();
 
-    auto bindingDesc = Vertex::getBindingDesc();
-    auto attributeDesc = Vertex::getAttributeDesc();
+    // the instanced variant adds the per instance transform rows after the quad's own inputs
+    if (!m_instancedVertShader)
+        return;
 
-    vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDesc;
-    vertexInputInfo.vertexAttributeDescriptionCount = attributeDesc.size();
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDesc.data();
+    if (m_instancedVertexLayout == ~0u)
+    {
+        std::vector<vk::VertexInputBindingDescription> bindings(QuadVertexFormat::bindings.begin(), QuadVertexFormat::bindings.end());
+        std::vector<vk::VertexInputAttributeDescription> attributes(QuadVertexFormat::attributes.begin(), QuadVertexFormat::attributes.end());
+        VKIndirectScene::getInstanceInput((uint32_t)attributes.size(), bindings, attributes);
 
-    vk::PipelineInputAssemblyStateCreateInfo inputAssembly;
-    inputAssembly.topology = vk::PrimitiveTopology::eTriangleList;
-    inputAssembly.primitiveRestartEnable = VK_FALSE;
+        if (!VKLayoutCache::coversVertexInput(m_instancedVertReflection, attributes))
+            TRACE("%s", "QuadVertexFormat and the instance rows don't provide every input instanced.vert declares");
 
-    vk::Viewport viewport;
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)m_swapExtent.width;
-    viewport.height = (float)m_swapExtent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
+        m_instancedVertexLayout = m_pipelines.registerVertexLayout(bindings, attributes);
+    }
 
-    vk::Rect2D scissor;
-    scissor.offset = vk::Offset2D(0, 0);
-    scissor.extent = m_swapExtent;
+    m_instancedPipeline = m_pipelines.getBlocking(getInstancedPipelineKey());
+    m_pendingInstancedPipeline = std::shared_future<vk::Pipeline>();
+}
 
-    vk::PipelineViewportStateCreateInfo viewportState;
-    viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
-    viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
-
-    vk::PipelineRasterizationStateCreateInfo rasterizer;
-    rasterizer.depthClampEnable = VK_FALSE;
-    rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = vk::PolygonMode::eFill;
-    rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = vk::CullModeFlagBits::eBack;
-    rasterizer.frontFace = vk::FrontFace::eCounterClockwise;
-    rasterizer.depthBiasEnable = VK_FALSE;
-    rasterizer.depthBiasConstantFactor = 0.0f; // Optional
-    rasterizer.depthBiasClamp = 0.0f; // Optional
-    rasterizer.depthBiasSlopeFactor = 0.0f; // Optional
-
-    vk::PipelineMultisampleStateCreateInfo multisampling;
-    multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = vk::SampleCountFlagBits::e1;
-    multisampling.minSampleShading = 1.0f; // Optional
-    multisampling.pSampleMask = nullptr; /// Optional
-    multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
-    multisampling.alphaToOneEnable = VK_FALSE; // Optional
-
-    vk::PipelineColorBlendAttachmentState colorBlendAttachment;
-    colorBlendAttachment.colorWriteMask =
-        vk::ColorComponentFlagBits::eR |
-        vk::ColorComponentFlagBits::eG |
-        vk::ColorComponentFlagBits::eB |
-        vk::ColorComponentFlagBits::eA;
-    colorBlendAttachment.blendEnable = VK_FALSE;
-    colorBlendAttachment.srcColorBlendFactor = vk::BlendFactor::eOne;
-    colorBlendAttachment.dstColorBlendFactor = vk::BlendFactor::eZero;
-    colorBlendAttachment.colorBlendOp = vk::BlendOp::eAdd;
-    colorBlendAttachment.srcAlphaBlendFactor = vk::BlendFactor::eOne;
-    colorBlendAttachment.dstAlphaBlendFactor = vk::BlendFactor::eZero;
-    colorBlendAttachment.alphaBlendOp = vk::BlendOp::eAdd;
-
-    vk::PipelineColorBlendStateCreateInfo colorBlending;
-    colorBlending.logicOpEnable = VK_FALSE;
-    colorBlending.logicOp = vk::LogicOp::eCopy;
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments = &colorBlendAttachment;
-    colorBlending.blendConstants[0] = 0.0f; // Optional
-    colorBlending.blendConstants[1] = 0.0f; // Optional
-    colorBlending.blendConstants[2] = 0.0f; // Optional
-    colorBlending.blendConstants[3] = 0.0f; // Optional
-
-    vk::DynamicState dynamicsStates[] = {
-        vk::DynamicState::eViewport,
-        vk::DynamicState::eLineWidth
-    };
-    vk::PipelineDynamicStateCreateInfo dynamicState;
-    dynamicState.dynamicStateCount = 2;
-    dynamicState.pDynamicStates = dynamicsStates;
-
-    vk::DescriptorSetLayout setLayouts[] = { m_descriptorLayout };
-    vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = setLayouts;
-
-    m_gfxPipelineLayout = m_dev.createPipelineLayout(pipelineLayoutInfo);
-
-    vk::GraphicsPipelineCreateInfo pipelineInfo;
-    pipelineInfo.stageCount = 2;
-    pipelineInfo.pStages = shaderStages;
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
-    pipelineInfo.pInputAssemblyState = &inputAssembly;
-    pipelineInfo.pViewportState = &viewportState;
-    pipelineInfo.pRasterizationState = &rasterizer;
-    pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = nullptr; // Optional
-    pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.pDynamicState = nullptr; // Optional
-    pipelineInfo.layout = m_gfxPipelineLayout;
-    pipelineInfo.renderPass = m_renderPass;
-    pipelineInfo.subpass = 0;
-
-    m_gfxPipeline = m_dev.createGraphicsPipeline(m_pipelineCache, pipelineInfo);
+PipelineKey VKRenderer::getDefaultPipelineKey() const
+{
+    PipelineKey key;
+    key.vertShader = m_vertShader;
+    key.fragShader = m_fragShader;
+    key.renderPass = m_renderPass;
+    key.layout = m_gfxPipelineLayout;
+    key.vertexLayout = m_vertexLayout;
+    key.subpass = 0;
+    key.depthTest = 1;
+    key.depthWrite = 1;
+    key.samples = m_msaaSamples;
+    return key;
+}
+
+PipelineKey VKRenderer::getInstancedPipelineKey() const
+{
+    PipelineKey key = getDefaultPipelineKey();
+    key.vertShader = m_instancedVertShader;
+    key.vertexLayout = m_instancedVertexLayout;
+    return key;
 }
 
 void VKRenderer::createFrameBuffers()
 {
+    // the sized attachments are shared, only the swapchain image differs between framebuffers
+    std::vector<vk::ImageView> attachments = m_attachmentViews;
     for (auto it : m_swapChainImageViews)
     {
+        attachments[m_presentAttachment] = it;
+
         vk::FramebufferCreateInfo framebufferInfo;
         framebufferInfo.renderPass = m_renderPass;
-        framebufferInfo.attachmentCount = 1;
-        framebufferInfo.pAttachments = &it;
+        framebufferInfo.attachmentCount = (uint32_t)attachments.size();
+        framebufferInfo.pAttachments = attachments.data();
         framebufferInfo.width = m_swapExtent.width;
         framebufferInfo.height = m_swapExtent.height;
         framebufferInfo.layers = 1;
@@ -644,173 +992,191 @@ void VKRenderer::createFrameBuffers()
     }
 }
 
-uint32_t VKRenderer::findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties)
-{
-    const vk::PhysicalDeviceMemoryProperties memoryProps =
-        m_physDevice.getMemoryProperties();
-
-    for (uint32_t i = 0; i < memoryProps.memoryTypeCount;++i)
-    {
-        const auto& p = memoryProps.memoryTypes[i];
-
-        if (typeFilter & (1 << i) &&
-            (p.propertyFlags & properties) == properties)
-        {
-            return i;
-        }
-    }
-
-    return 0;
-}
-
-void VKRenderer::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Buffer& buff, vk::DeviceMemory& buffMemory)
+void VKRenderer::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Buffer& buff, VKAllocation& buffAlloc)
 {
     vk::BufferCreateInfo bufferInfo;
     bufferInfo.size = size;
     bufferInfo.usage = usage;
     bufferInfo.sharingMode = vk::SharingMode::eExclusive;
 
-    buff = m_dev.createBuffer(bufferInfo);
-
-    vk::MemoryRequirements memReq = m_dev.getBufferMemoryRequirements(buff);
-
-    vk::MemoryAllocateInfo allocInfo;
-    allocInfo.allocationSize = memReq.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memReq.memoryTypeBits, properties);
-
-    buffMemory = m_dev.allocateMemory(allocInfo);
-
-    m_dev.bindBufferMemory(buff, buffMemory, 0);
+    // memory comes out of the allocator's pooled blocks, host visible ones are already mapped
+    buffAlloc = m_allocator.createBuffer(bufferInfo, properties, buff);
 }
 
-void VKRenderer::copyBuffer(vk::Buffer src, vk::Buffer dst, vk::DeviceSize size)
+void VKRenderer::createMeshBuffers()
 {
-    vk::CommandBufferAllocateInfo allocInfo;
-    allocInfo.level = vk::CommandBufferLevel::ePrimary;
-    allocInfo.commandPool = m_commandPool;
-    allocInfo.commandBufferCount = 1;
+    const std::string path = "meshes/quad.mesh";
 
-    auto commandBuffers = m_dev.allocateCommandBuffers(allocInfo);
-    vk::CommandBuffer commandBuffer = commandBuffers[0];
-
-    vk::CommandBufferBeginInfo beginInfo;
-    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    const std::vector<uint32_t> quadIndices(indices.begin(), indices.end());
+    const VertexAttributeSource sources[] = {
+        { &vertices[0].pos.x, sizeof(Vertex) / sizeof(float) },
+        { &vertices[0].color.x, sizeof(Vertex) / sizeof(float) },
+    };
+    const uint64_t layoutHash = mesh::layoutHash<QuadVertexFormat>();
+    const uint64_t sourceHash = mesh::hashSource<QuadVertexFormat>(sources, vertices.size(), quadIndices.data(), quadIndices.size());
 
-    commandBuffer.begin(beginInfo);
+    // vertex.h is the source, the file is only rebuilt when that or QuadVertexFormat changes
+    mesh::MeshFile file;
+    const char* reason = nullptr;
+    if (!file.open(path, layoutHash, sourceHash, &reason))
+    {
+        TRACE("Building %s: %s", path.c_str(), reason);
 
-    vk::BufferCopy copyRegion;
-    copyRegion.srcOffset = 0;
-    copyRegion.dstOffset = 0;
-    copyRegion.size = size;
-    commandBuffer.copyBuffer(src, dst, copyRegion);
+        mesh::Mesh built;
+        mesh::build<QuadVertexFormat>(sources, vertices.size(), quadIndices.data(), quadIndices.size(), built);
+        std::vector<unsigned char> contents = mesh::serialize(built);
 
-    commandBuffer.end();
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+        if (!file_helpers::writeFileAtomic(path, contents.data(), contents.size()))
+            TRACE("Failed to write mesh %s", path.c_str());
 
-    vk::SubmitInfo submitInfo;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
+        file.load(std::move(contents), layoutHash, sourceHash);
+    }
 
-    m_gfxQueue.submit(submitInfo, vk::Fence());
-    m_gfxQueue.waitIdle();
+    const mesh::FileHeader& header = file.getHeader();
 
-    m_dev.freeCommandBuffers(m_commandPool, commandBuffers);
-}
+    // every stream of the format in one buffer, the draw binds each at its offset
+    vk::DeviceSize vertexSize = 0;
+    for (uint32_t s = 0; s < header.streamCount; ++s)
+    {
+        m_meshStreamOffsets[s] = vertexSize;
+        vertexSize += (file.getStreamSize(s) + 15) & ~(vk::DeviceSize)15;
+    }
 
-void VKRenderer::createVertexBuffer()
-{
-    vk::DeviceSize buffSize = sizeof(vertices[0]) * vertices.size();
-    
-    // create staging buffer
-    vk::Buffer stagingBuff;
-    vk::DeviceMemory stagingBuffMem;
+    m_meshStreamCount = header.streamCount;
+    m_meshIndexCount = header.indexCount;
+    m_meshIndexType = header.indexSize == 2 ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
 
+    // create device only vertex and index buffers
     createBuffer(
-        buffSize,
-        vk::BufferUsageFlagBits::eTransferSrc,
-        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-        stagingBuff,
-        stagingBuffMem);
-
-    // copy vertex data into it
-    void* data = m_dev.mapMemory(stagingBuffMem, 0, buffSize);
-    memcpy(data, vertices.data(), (size_t)buffSize);
-    m_dev.unmapMemory(stagingBuffMem);
-
-    // create device only vertex buffer
-    createBuffer(
-        buffSize,
+        vertexSize,
         vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer,
         vk::MemoryPropertyFlagBits::eDeviceLocal,
         m_vertexBuffer,
-        m_vertexBufferMemory);
-
-    // copy from staging to vertex buffer
-    copyBuffer(stagingBuff, m_vertexBuffer, buffSize);
-
-    // and finally destroy the staging buffer, free buffer memory
-    m_dev.destroyBuffer(stagingBuff);
-    m_dev.freeMemory(stagingBuffMem);
-}
-
-void VKRenderer::createIndexBuffer()
-{
-    vk::DeviceSize buffSize = sizeof(indices[0]) * indices.size();
-
-    // create staging buffer
-    vk::Buffer stagingBuff;
-    vk::DeviceMemory stagingBuffMem;
+        m_vertexBufferAlloc);
 
     createBuffer(
-        buffSize,
-        vk::BufferUsageFlagBits::eTransferSrc,
-        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-        stagingBuff,
-        stagingBuffMem);
-
-    // copy index data into it
-    void* data = m_dev.mapMemory(stagingBuffMem, 0, buffSize);
-    memcpy(data, indices.data(), (size_t)buffSize);
-    m_dev.unmapMemory(stagingBuffMem);
-
-    // create device only vertex buffer
-    createBuffer(
-        buffSize,
+        file.getIndicesSize(),
         vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer,
         vk::MemoryPropertyFlagBits::eDeviceLocal,
         m_indexBuffer,
-        m_indexBufferMemory);
+        m_indexBufferAlloc);
 
-    // copy from staging to index buffer
-    copyBuffer(stagingBuff, m_indexBuffer, buffSize);
+    // staged straight from the mapping, copied with everything else queued before the next flush
+    for (uint32_t s = 0; s < header.streamCount; ++s)
+    {
+        m_uploads.uploadBuffer(m_vertexBuffer, m_meshStreamOffsets[s], file.getStream(s), file.getStreamSize(s),
+            vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eVertexAttributeRead);
+    }
 
-    // and finally destroy the staging buffer, free buffer memory
-    m_dev.destroyBuffer(stagingBuff);
-    m_dev.freeMemory(stagingBuffMem);
+    m_uploads.uploadBuffer(m_indexBuffer, 0, file.getIndices(), file.getIndicesSize(),
+        vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eIndexRead);
+
+    SceneMesh sceneMesh;
+    sceneMesh.vertexBuffer = m_vertexBuffer;
+    sceneMesh.vertexStreamCount = m_meshStreamCount;
+    memcpy(sceneMesh.vertexStreamOffsets, m_meshStreamOffsets, sizeof(m_meshStreamOffsets));
+    sceneMesh.indexBuffer = m_indexBuffer;
+    sceneMesh.indexType = m_meshIndexType;
+    sceneMesh.indexCount = m_meshIndexCount;
+
+    glm::vec3 boundsMin(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+    glm::vec3 boundsMax(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+    sceneMesh.boundingSphere = glm::vec4((boundsMin + boundsMax) * 0.5f, glm::length(boundsMax - boundsMin) * 0.5f);
+    m_quadMeshId = m_scene.registerMesh(sceneMesh);
 }
 
-void VKRenderer::createUniformBuffer()
+void VKRenderer::createMaterials()
 {
-    vk::DeviceSize bufferSize = sizeof(UniformBufferObject);
+    // two tints a storage offset alignment apart: white for the defaults, a warm one for the demo quad
+    const vk::DeviceSize stride = std::max<vk::DeviceSize>(sizeof(glm::vec4), m_physDevice.getProperties().limits.minStorageBufferOffsetAlignment);
+    const glm::vec4 tints[] = { glm::vec4(1.0f), glm::vec4(1.0f, 0.8f, 0.55f, 1.0f) };
 
-    createBuffer(
-        bufferSize,
-        vk::BufferUsageFlagBits::eTransferSrc,
-        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCached,
-        m_uniformStagingBuffer,
-        m_uniformStagingBufferMemory);
+    std::vector<unsigned char> contents((size_t)stride * 2);
+    memcpy(&contents[0], &tints[0], sizeof(glm::vec4));
+    memcpy(&contents[(size_t)stride], &tints[1], sizeof(glm::vec4));
 
     createBuffer(
-        bufferSize,
-        vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eUniformBuffer,
+        contents.size(),
+        vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer,
         vk::MemoryPropertyFlagBits::eDeviceLocal,
-        m_uniformBuffer,
-        m_uniformBufferMemory);
+        m_materialBuffer,
+        m_materialBufferAlloc);
+
+    m_uploads.uploadBuffer(m_materialBuffer, 0, contents.data(), contents.size(),
+        vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eShaderRead);
+
+    // a single white texel, so a material without a texture of its own comes out as its tint
+    vk::ImageCreateInfo imageInfo;
+    imageInfo.imageType = vk::ImageType::e2D;
+    imageInfo.format = vk::Format::eR8G8B8A8Unorm;
+    imageInfo.extent = vk::Extent3D(1, 1, 1);
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = vk::SampleCountFlagBits::e1;
+    imageInfo.tiling = vk::ImageTiling::eOptimal;
+    imageInfo.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    imageInfo.sharingMode = vk::SharingMode::eExclusive;
+    imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+    m_whiteImageAlloc = m_allocator.createImage(imageInfo, vk::MemoryPropertyFlagBits::eDeviceLocal, m_whiteImage);
+
+    const uint32_t white = 0xffffffffu;
+    m_uploads.uploadImage(m_whiteImage, imageInfo.extent, &white, sizeof(white), vk::ImageLayout::eShaderReadOnlyOptimal,
+        vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eShaderRead);
+
+    vk::ImageViewCreateInfo viewInfo;
+    viewInfo.image = m_whiteImage;
+    viewInfo.viewType = vk::ImageViewType::e2D;
+    viewInfo.format = imageInfo.format;
+    viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    m_whiteImageView = m_dev.createImageView(viewInfo);
+
+    vk::SamplerCreateInfo samplerInfo;
+    samplerInfo.magFilter = vk::Filter::eLinear;
+    samplerInfo.minFilter = vk::Filter::eLinear;
+    samplerInfo.mipmapMode = vk::SamplerMipmapMode::eLinear;
+    samplerInfo.addressModeU = vk::SamplerAddressMode::eRepeat;
+    samplerInfo.addressModeV = vk::SamplerAddressMode::eRepeat;
+    samplerInfo.addressModeW = vk::SamplerAddressMode::eRepeat;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    m_materialSampler = m_dev.createSampler(samplerInfo);
+
+    // the fallback sets fill whatever a material leaves unset from these
+    m_defaultMaterial.buffer = m_bindless.registerBuffer(m_materialBuffer, 0, sizeof(glm::vec4));
+    m_defaultMaterial.image = m_bindless.registerImage(m_whiteImageView, vk::ImageLayout::eShaderReadOnlyOptimal);
+    m_defaultMaterial.sampler = m_bindless.registerSampler(m_materialSampler);
+    m_bindless.setFallbackDefaults(m_defaultMaterial);
+
+    m_demoMaterial = m_defaultMaterial;
+    m_demoMaterial.buffer = m_bindless.registerBuffer(m_materialBuffer, stride, sizeof(glm::vec4));
+}
+
+void VKRenderer::createUniformBuffer()
+{
+    m_uniformRing.init(m_physDevice, m_allocator, m_framesInFlight);
+}
+
+void VKRenderer::createCullingPass()
+{
+    // both optional, without cull.comp the scene draws every instance. On async compute the cull reads
+    // the pyramid from the frame before last, so it needn't wait for the previous frame's graphics work
+    m_culling.init(m_dev, m_allocator, m_layouts, m_pipelines, m_descriptors, m_uniformRing, m_framesInFlight,
+        m_asyncCompute ? 2 : 1);
+    m_culling.createPipelines(m_shaders.getModule(m_cullShaderId), m_shaders.getReflection(m_cullShaderId),
+        m_shaders.getModule(m_pyramidShaderId), m_shaders.getReflection(m_pyramidShaderId));
+
+    if (!m_culling.isAvailable())
+        TRACE("%s", "shaders/cull_comp.spv missing, GPU culling disabled");
+
+    updateDepthSource();
+    setGpuCulling(true);
 }
 
 void VKRenderer::createDescriptorPool()
 {
     vk::DescriptorPoolSize poolSize;
-    poolSize.type = vk::DescriptorType::eUniformBuffer;
+    poolSize.type = vk::DescriptorType::eUniformBufferDynamic;
     poolSize.descriptorCount = 1;
     
     vk::DescriptorPoolCreateInfo poolCreateInfo;
@@ -832,8 +1198,9 @@ void VKRenderer::createDescriptorSet()
 
     m_descriptorSet = m_dev.allocateDescriptorSets(allocInfo)[0];
 
+    // covers one UniformBufferObject, where in the ring it is comes from the dynamic offset
     vk::DescriptorBufferInfo bufferInfo;
-    bufferInfo.buffer = m_uniformBuffer;
+    bufferInfo.buffer = m_uniformRing.getBuffer();
     bufferInfo.offset = 0;
     bufferInfo.range = sizeof(UniformBufferObject);
 
@@ -841,7 +1208,7 @@ void VKRenderer::createDescriptorSet()
     descriptorWrite.dstSet = m_descriptorSet;
     descriptorWrite.dstBinding = 0;
     descriptorWrite.dstArrayElement = 0;
-    descriptorWrite.descriptorType = vk::DescriptorType::eUniformBuffer;
+    descriptorWrite.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
     descriptorWrite.descriptorCount = 1;
     descriptorWrite.pBufferInfo = &bufferInfo;
     descriptorWrite.pImageInfo = nullptr;
@@ -854,8 +1221,15 @@ void VKRenderer::createCommandPool()
 {
     vk::CommandPoolCreateInfo poolInfo;
     poolInfo.queueFamilyIndex = m_gfxQueueIx;
+    poolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
 
     m_commandPool = m_dev.createCommandPool(poolInfo);
+
+    if (m_asyncCompute)
+    {
+        poolInfo.queueFamilyIndex = m_computeQueueIx;
+        m_computePool = m_dev.createCommandPool(poolInfo);
+    }
 }
 
 void VKRenderer::createCommandBuffers()
@@ -863,177 +1237,817 @@ void VKRenderer::createCommandBuffers()
     vk::CommandBufferAllocateInfo allocInfo;
     allocInfo.commandPool = m_commandPool;
     allocInfo.level = vk::CommandBufferLevel::ePrimary;
-    allocInfo.commandBufferCount = (uint32_t)m_swapChainFrameBuffers.size();
+    allocInfo.commandBufferCount = m_framesInFlight;
 
-    m_commandBuffers = m_dev.allocateCommandBuffers(allocInfo);
+    auto commandBuffers = m_dev.allocateCommandBuffers(allocInfo);
 
-    for (size_t i = 0; i < m_commandBuffers.size(); ++i)
+    for (uint32_t i = 0; i < m_framesInFlight; ++i)
+        m_frames[i].commandBuffer = commandBuffers[i];
+
+    if (m_asyncCompute)
     {
-        vk::CommandBuffer& cmd = m_commandBuffers[i];
+        allocInfo.commandPool = m_computePool;
+        auto computeBuffers = m_dev.allocateCommandBuffers(allocInfo);
 
-        vk::CommandBufferBeginInfo beginInfo;
-        beginInfo.flags = vk::CommandBufferUsageFlagBits::eSimultaneousUse;
-        
-        vk::ClearValue clearColour;
-        clearColour.color.float32[0] = 0.0f;
-        clearColour.color.float32[1] = 0.0f;
-        clearColour.color.float32[2] = 0.0f;
-        clearColour.color.float32[3] = 1.0f;
-
-        vk::RenderPassBeginInfo renderPassInfo;
-        renderPassInfo.renderPass = m_renderPass;
-        renderPassInfo.framebuffer = m_swapChainFrameBuffers[i];;
-        renderPassInfo.renderArea.offset = vk::Offset2D(0, 0);
-        renderPassInfo.renderArea.extent = m_swapExtent;
-        renderPassInfo.clearValueCount = 1;
-        renderPassInfo.pClearValues = &clearColour;
-        
-        cmd.begin(beginInfo);
-        cmd.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+        for (uint32_t i = 0; i < m_framesInFlight; ++i)
+            m_frames[i].computeCommandBuffer = computeBuffers[i];
+    }
+
+    // secondaries live in their own transient pools, reset wholesale each time the frame is recorded
+    vk::CommandPoolCreateInfo poolInfo;
+    poolInfo.queueFamilyIndex = m_gfxQueueIx;
+    poolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
 
-        cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, m_gfxPipeline);
+    for (auto& frame : m_frames)
+    {
+        for (uint32_t i = 0; i < m_recordSlices; ++i)
+        {
+            vk::CommandPool pool = m_dev.createCommandPool(poolInfo);
 
-        vk::ArrayProxy<const vk::Buffer> vertexBuffers = { m_vertexBuffer };
-        vk::ArrayProxy<const vk::DeviceSize> offsets = { 0 };
-        
-        vk::ArrayProxy<const vk::DescriptorSet> descriptorSets({ m_descriptorSet });
-        vk::ArrayProxy<const uint32_t> temp({ 0 });
+            vk::CommandBufferAllocateInfo secondaryInfo;
+            secondaryInfo.commandPool = pool;
+            secondaryInfo.level = vk::CommandBufferLevel::eSecondary;
+            secondaryInfo.commandBufferCount = 1;
+
+            frame.workerPools.push_back(pool);
+            frame.secondaryBuffers.push_back(m_dev.allocateCommandBuffers(secondaryInfo)[0]);
+        }
+    }
+}
+
+void VKRenderer::recordDraws(vk::CommandBuffer cmd, const DrawItem* items, size_t count, RecordStats& stats)
+{
+    // dynamic state isn't inherited by secondaries, so every command buffer sets its own
+    vk::Viewport viewport;
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float)m_swapExtent.width;
+    viewport.height = (float)m_swapExtent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+
+    vk::Rect2D scissor;
+    scissor.offset = vk::Offset2D(0, 0);
+    scissor.extent = m_swapExtent;
+
+    cmd.setViewport(0, viewport);
+    cmd.setScissor(0, scissor);
+
+    // last state bound into this command buffer, anything unchanged isn't bound again
+    vk::Pipeline boundPipeline;
+    vk::DescriptorSet boundDescriptorSet;
+    uint32_t boundUniformOffset = 0;
+    vk::Buffer boundVertexBuffer;
+    uint32_t boundStreamCount = 0;
+    vk::DeviceSize boundStreamOffsets[MAX_VERTEX_STREAMS] = {};
+    vk::Buffer boundIndexBuffer;
+    vk::IndexType boundIndexType = vk::IndexType::eUint16;
+    vk::DescriptorSet boundMaterialSet;
+    BindlessIndices boundMaterial;
+    bool materialPushed = false;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const DrawItem& item = items[i];
+
+        vk::Pipeline pipeline = item.pipeline ? item.pipeline : m_gfxPipeline;
+        vk::DescriptorSet descriptorSet = item.descriptorSet ? item.descriptorSet : m_descriptorSet;
+
+        if (pipeline != boundPipeline)
+        {
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+            boundPipeline = pipeline;
+            ++stats.pipelineBinds;
+        }
+
+        // the dynamic offset is part of the binding, so a new offset means a rebind
+        if (descriptorSet != boundDescriptorSet || item.uniformOffset != boundUniformOffset)
+        {
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_gfxPipelineLayout, 0, descriptorSet, item.uniformOffset);
+            boundDescriptorSet = descriptorSet;
+            boundUniformOffset = item.uniformOffset;
+            ++stats.descriptorBinds;
+        }
+
+        // bindless binds the heap once per command buffer and a material change is just new push
+        // constants, the fallback rebinds set 1 whenever the material does. The default fragment shader
+        // reads both, so draws without a material still bind a set and push invalid indices
+        vk::DescriptorSet materialSet = m_bindless.getSet(item.material);
+        if (materialSet && materialSet != boundMaterialSet)
+        {
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_gfxPipelineLayout, 1, materialSet, nullptr);
+            boundMaterialSet = materialSet;
+            ++stats.descriptorBinds;
+        }
+
+        BindlessIndices push = m_bindless.getPushIndices(item.material);
+        if (!materialPushed || push != boundMaterial)
+        {
+            cmd.pushConstants(m_gfxPipelineLayout, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+                0, sizeof(push), &push);
+            boundMaterial = push;
+            materialPushed = true;
+        }
+
+        // a split vertex format reads each of its streams from a range of the same buffer
+        if (item.vertexBuffer != boundVertexBuffer || item.vertexStreamCount != boundStreamCount ||
+            memcmp(item.vertexStreamOffsets, boundStreamOffsets, item.vertexStreamCount * sizeof(vk::DeviceSize)) != 0)
+        {
+            vk::Buffer buffers[MAX_VERTEX_STREAMS];
+            for (uint32_t s = 0; s < item.vertexStreamCount; ++s)
+                buffers[s] = item.vertexBuffer;
+
+            cmd.bindVertexBuffers(0, vk::ArrayProxy<const vk::Buffer>(item.vertexStreamCount, buffers),
+                vk::ArrayProxy<const vk::DeviceSize>(item.vertexStreamCount, item.vertexStreamOffsets));
+            boundVertexBuffer = item.vertexBuffer;
+            boundStreamCount = item.vertexStreamCount;
+            memcpy(boundStreamOffsets, item.vertexStreamOffsets, sizeof(boundStreamOffsets));
+            ++stats.vertexBufferBinds;
+        }
+
+        if (item.indexBuffer != boundIndexBuffer || item.indexType != boundIndexType)
+        {
+            cmd.bindIndexBuffer(item.indexBuffer, 0, item.indexType);
+            boundIndexBuffer = item.indexBuffer;
+            boundIndexType = item.indexType;
+            ++stats.indexBufferBinds;
+        }
+
+        cmd.drawIndexed(item.indexCount, 1, item.firstIndex, item.vertexOffset, 0);
+        ++stats.draws;
+    }
+}
+
+void VKRenderer::recordScene(vk::CommandBuffer cmd, RecordStats& stats)
+{
+    if (!m_instancedPipeline || m_sceneUniformOffset == VKUniformRing::INVALID_OFFSET)
+        return;
+
+    // relies on the viewport and scissor recordDraws set in the same command buffer
+    m_scene.record(cmd, m_instancedPipeline, m_gfxPipelineLayout, m_descriptorSet, m_sceneUniformOffset, m_bindless);
+
+    const SceneStats& scene = m_scene.getStats();
+    stats.indirectDraws += scene.drawCalls;
+    stats.instances += scene.instances;
+}
+
+void VKRenderer::recordCommandBuffer(vk::CommandBuffer cmd, uint32_t imageIx, uint32_t sliceCount)
+{
+    vk::CommandBufferBeginInfo beginInfo;
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+
+    VKProfiler::CpuScope cpuScope(m_profiler, "record");
+
+    cmd.begin(beginInfo);
+
+    m_profiler.resetQueries(cmd);
+    uint32_t frameScope = m_profiler.beginGpuScope(cmd, "frame");
+
+    // instances and commands go into this frame's buffers before anything references them
+    m_scene.build();
+
+    const SceneBuffers scene = m_scene.getBuffers();
+    const bool drawScene = m_instancedPipeline && m_sceneUniformOffset != VKUniformRing::INVALID_OFFSET;
+    const bool cull = drawScene && m_scene.isGpuCulling();
+    const vk::ImageSubresourceRange colorRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+
+    // on async compute the cull gets a command buffer of its own. Waiting on its queue makes its
+    // writes visible to this frame's graphics work, so the graph has nothing to synchronise them with
+    FrameData& frame = m_frames[m_currentFrame];
+    frame.computeRecorded = cull && m_asyncCompute;
+    if (frame.computeRecorded)
+        recordAsyncCull(frame.computeCommandBuffer, scene);
 
-        cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_gfxPipelineLayout, 0, descriptorSets, temp);
+    // the passes in submission order, the graph puts the barriers between them. Buffers the host
+    // wrote are visible once submitted, so they start with nothing to wait on
+    RenderGraph& graph = m_graph.begin(m_currentFrame);
 
-        cmd.bindVertexBuffers(0, vertexBuffers, offsets);
-        cmd.bindIndexBuffer(m_indexBuffer, 0, vk::IndexType::eUint16);
+    // the render pass transitions its attachments itself, presenting and readback wait on the frame's semaphore and serial
+    const vk::ImageLayout targetLayout = m_passDesc.getAttachment(m_presentAttachment).finalLayout;
+    const uint32_t target = graph.importImage("target", m_swapChainImages[imageIx], colorRange);
+    graph.exportResource(target, GraphAccess(vk::PipelineStageFlagBits::eBottomOfPipe, vk::AccessFlags(), targetLayout));
 
-        cmd.drawIndexed(indices.size(), 1, 0, 0, 0);
+    // the pyramid pass that last wrote it, getPyramidLatency() frames ago, made its writes visible to
+    // this frame's cull. A fresh pyramid is still eUndefined, the culling pass clears it into eGeneral
+    // itself on first use
+    const uint32_t pyramid = graph.importImage("pyramid", m_culling.getPyramid(),
+        vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, m_culling.getPyramidMipCount(), 0, 1),
+        GraphAccess(vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eGeneral));
+    graph.exportResource(pyramid, GraphAccess(vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eGeneral));
+
+    const uint32_t commands = graph.importBuffer("commands", scene.commands);
+    const uint32_t culledInstances = cull ? graph.importBuffer("culledInstances", scene.culledInstances) : RenderGraph::INVALID;
+    const uint32_t depth = m_culling.hasDepthSource() ? graph.importImage("depth", m_attachmentImages[m_depthAttachment],
+        vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1)) : RenderGraph::INVALID;
+
+    if (cull && !frame.computeRecorded)
+    {
+        graph.addPass("cull", [&](vk::CommandBuffer c) {
+            uint32_t cullScope = m_profiler.beginGpuScope(c, "cull");
+            m_culling.recordCull(c, scene, m_sceneUniforms.view, m_sceneUniforms.proj);
+            m_profiler.endGpuScope(c, cullScope);
+        })
+            .write(commands, GraphAccess(vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite))
+            .write(culledInstances, GraphAccess(vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite))
+            .read(pyramid, GraphAccess(vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eGeneral));
+    }
+
+    graph.addPass("mainPass", [&](vk::CommandBuffer c) { recordMainPass(c, imageIx, sliceCount); })
+        .write(target, GraphAccess(vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::AccessFlagBits::eColorAttachmentWrite,
+            vk::ImageLayout::eUndefined, targetLayout));
+    if (drawScene)
+        graph.read(commands, GraphAccess(vk::PipelineStageFlagBits::eDrawIndirect, vk::AccessFlagBits::eIndirectCommandRead));
+    if (cull)
+        graph.read(culledInstances, GraphAccess(vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eVertexAttributeRead));
+
+    // next frame's occlusion test reads this frame's depth
+    if (depth != RenderGraph::INVALID)
+    {
+        graph.write(depth, GraphAccess(vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests,
+            vk::AccessFlagBits::eDepthStencilAttachmentWrite, vk::ImageLayout::eUndefined, vk::ImageLayout::eShaderReadOnlyOptimal));
 
-        cmd.endRenderPass();
-        cmd.end();
+        graph.addPass("depthPyramid", [&](vk::CommandBuffer c) { m_culling.recordPyramid(c); })
+            .read(depth, GraphAccess(vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eShaderReadOnlyOptimal))
+            .write(pyramid, GraphAccess(vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+                vk::ImageLayout::eGeneral));
     }
+
+    m_graph.execute(cmd);
+    m_profiler.endGpuScope(cmd, frameScope);
+
+    cmd.end();
 }
 
-void VKRenderer::createSemaphores()
+void VKRenderer::recordAsyncCull(vk::CommandBuffer cmd, const SceneBuffers& scene)
 {
-    m_imageAvailableSemaphore = m_dev.createSemaphore(vk::SemaphoreCreateInfo());
-    m_renderFinishedSemaphore = m_dev.createSemaphore(vk::SemaphoreCreateInfo());
+    vk::CommandBufferBeginInfo beginInfo;
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+
+    cmd.reset(vk::CommandBufferResetFlags());
+    cmd.begin(beginInfo);
+    uint32_t cullScope = m_timeAsyncCull ? m_profiler.beginGpuScope(cmd, "cull") : VKProfiler::INVALID_SCOPE;
+    m_culling.recordCull(cmd, scene, m_sceneUniforms.view, m_sceneUniforms.proj);
+    m_profiler.endGpuScope(cmd, cullScope);
+    cmd.end();
+}
+
+void VKRenderer::recordMainPass(vk::CommandBuffer cmd, uint32_t imageIx, uint32_t sliceCount)
+{
+    FrameData& frame = m_frames[m_currentFrame];
+
+    vk::RenderPassBeginInfo renderPassInfo;
+    renderPassInfo.renderPass = m_renderPass;
+    renderPassInfo.framebuffer = m_swapChainFrameBuffers[imageIx];
+    renderPassInfo.renderArea.offset = vk::Offset2D(0, 0);
+    renderPassInfo.renderArea.extent = m_swapExtent;
+    renderPassInfo.clearValueCount = (uint32_t)m_clearValues.size();
+    renderPassInfo.pClearValues = m_clearValues.data();
+
+    uint32_t passScope = m_profiler.beginGpuScope(cmd, "mainPass");
+    m_profiler.beginPipelineStatistics(cmd);
+
+    sliceCount = std::min(sliceCount, (uint32_t)frame.secondaryBuffers.size());
+
+    if (m_sortDrawList)
+    {
+        std::stable_sort(m_drawList.begin(), m_drawList.end(), [](const DrawItem& a, const DrawItem& b) {
+            if (a.pipeline != b.pipeline) return a.pipeline < b.pipeline;
+            if (a.descriptorSet != b.descriptorSet) return a.descriptorSet < b.descriptorSet;
+            if (a.vertexBuffer != b.vertexBuffer) return a.vertexBuffer < b.vertexBuffer;
+            return a.indexBuffer < b.indexBuffer;
+        });
+    }
+
+    m_recordStats = RecordStats();
+
+    if (sliceCount <= 1 || m_drawList.size() < PARALLEL_RECORD_MIN_DRAWS)
+    {
+        cmd.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+        recordDraws(cmd, m_drawList.data(), m_drawList.size(), m_recordStats);
+        recordScene(cmd, m_recordStats);
+    }
+    else
+    {
+        vk::CommandBufferInheritanceInfo inheritanceInfo;
+        inheritanceInfo.renderPass = m_renderPass;
+        inheritanceInfo.subpass = 0;
+        inheritanceInfo.framebuffer = m_swapChainFrameBuffers[imageIx];
+        inheritanceInfo.pipelineStatistics = m_profiler.getInheritedStatistics();
+
+        const size_t drawsPerSlice = (m_drawList.size() + sliceCount - 1) / sliceCount;
+        std::vector<RecordStats> sliceStats(sliceCount);
+
+        // each slice records into its own pool, the primary only stitches them together
+        m_jobs.parallelFor(sliceCount, [&](uint32_t slice) {
+            m_dev.resetCommandPool(frame.workerPools[slice], vk::CommandPoolResetFlags());
+
+            vk::CommandBufferBeginInfo secondaryBeginInfo;
+            secondaryBeginInfo.flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue | vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+            secondaryBeginInfo.pInheritanceInfo = &inheritanceInfo;
+
+            vk::CommandBuffer secondary = frame.secondaryBuffers[slice];
+            secondary.begin(secondaryBeginInfo);
+
+            size_t first = std::min(slice * drawsPerSlice, m_drawList.size());
+            size_t last = std::min(first + drawsPerSlice, m_drawList.size());
+            // the scene goes at the end of the last slice, so it's still drawn after the whole list
+            const bool lastSlice = slice == sliceCount - 1;
+            if (first < last || lastSlice)
+                recordDraws(secondary, &m_drawList[first], last - first, sliceStats[slice]);
+            if (lastSlice)
+                recordScene(secondary, sliceStats[slice]);
+
+            secondary.end();
+        });
+
+        for (auto& it : sliceStats)
+            m_recordStats += it;
+
+        cmd.beginRenderPass(renderPassInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+        cmd.executeCommands(vk::ArrayProxy<const vk::CommandBuffer>(sliceCount, frame.secondaryBuffers.data()));
+    }
+
+    cmd.endRenderPass();
+
+    m_profiler.endPipelineStatistics(cmd);
+    m_profiler.endGpuScope(cmd, passScope);
+}
+
+void VKRenderer::createSyncObjects()
+{
+    // frame slots start with serial 0, which counts as complete, so the first wait returns immediately
+    for (auto& frame : m_frames)
+    {
+        frame.imageAvailableSemaphore = m_dev.createSemaphore(vk::SemaphoreCreateInfo());
+        frame.renderFinishedSemaphore = m_dev.createSemaphore(vk::SemaphoreCreateInfo());
+        frame.submitSerial = 0;
+    }
+}
+
+void VKRenderer::beginFrame()
+{
+    if (m_frameWaited)
+        return;
+
+    // block until the GPU has retired the last submission that used this frame slot
+    m_gfxQueue.wait(m_frames[m_currentFrame].submitSerial);
+    m_frameWaited = true;
+
+    // anything this slot pushed or measured last time round has now been consumed
+    m_profiler.beginFrame(m_currentFrame);
+    m_uniformRing.beginFrame(m_currentFrame);
+    m_descriptors.beginFrame(m_currentFrame);
+    m_bindless.beginFrame(m_frameNumber);
+    m_uploads.collect();
+    reloadShaders();
+    m_drawList.clear();
+    m_scene.beginFrame(m_currentFrame);
+    m_culling.beginFrame(m_currentFrame);
+    m_sceneUniformOffset = VKUniformRing::INVALID_OFFSET;
+
+    destroyRetiredSwapChains(false);
+
+    // pipelines compiled since the last flush get written out in the background every so often
+    m_pipelineCache.update();
 }
 
 void VKRenderer::drawFrame()
 {
-    auto imageAquireRes =
-        m_dev.acquireNextImageKHR(
-            m_swapChain,
-            std::numeric_limits<uint64_t>::max(),
-            m_imageAvailableSemaphore,
-            vk::Fence());
-
-    if (imageAquireRes.result == vk::Result::eErrorOutOfDateKHR ||
-        imageAquireRes.result == vk::Result::eSuboptimalKHR)
+    beginFrame();
+
+    VKProfiler::CpuScope cpuScope(m_profiler, "drawFrame");
+
+    FrameData& frame = m_frames[m_currentFrame];
+
+    if (m_headless)
     {
-        recreateSwapChain(m_windowExtents.width, m_windowExtents.height);
+        drawFrameHeadless();
         return;
     }
 
-    uint32_t imageIx = imageAquireRes.value;
-
-    vk::PipelineStageFlags waitStages[] = {
-        vk::PipelineStageFlagBits::eColorAttachmentOutput
-    };
+    vk::ResultValue<uint32_t> imageAquireRes(vk::Result::eSuccess, 0);
+    try
+    {
+        imageAquireRes =
+            m_dev.acquireNextImageKHR(
+                m_swapChain,
+                std::numeric_limits<uint64_t>::max(),
+                frame.imageAvailableSemaphore,
+                vk::Fence());
+    }
+    catch (const vk::OutOfDateKHRError&)
+    {
+        // nothing was submitted, so this frame slot stays usable for the next attempt
+        m_drawList.clear();
+        m_scene.beginFrame(m_currentFrame);
+        recreateSwapChain(m_windowExtents.width, m_windowExtents.height);
+        return;
+    }
 
-    vk::SubmitInfo submitInfo;
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &m_imageAvailableSemaphore;
-    submitInfo.pWaitDstStageMask = waitStages;
+    // suboptimal still signals the semaphore, so finish the frame and recreate afterwards
+    bool swapChainStale = imageAquireRes.result == vk::Result::eSuboptimalKHR;
 
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &m_commandBuffers[imageIx];
+    uint32_t imageIx = imageAquireRes.value;
+    m_lastImageIx = imageIx;
 
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &m_renderFinishedSemaphore;
+    frame.commandBuffer.reset(vk::CommandBufferResetFlags());
+    recordCommandBuffer(frame.commandBuffer, imageIx, m_recordSlices);
+    submitFrame(frame, frame.imageAvailableSemaphore, frame.renderFinishedSemaphore);
 
-    m_gfxQueue.submit(submitInfo, vk::Fence());
+    VKProfiler::CpuScope presentScope(m_profiler, "present");
 
     vk::PresentInfoKHR presentInfo;
     presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = &m_renderFinishedSemaphore;
+    presentInfo.pWaitSemaphores = &frame.renderFinishedSemaphore;
 
     presentInfo.swapchainCount = 1;
     presentInfo.pSwapchains = &m_swapChain;
     presentInfo.pImageIndices = &imageIx;
 
-    m_presentQueue.presentKHR(presentInfo);
+    // out of date is thrown rather than returned, the frame was still submitted so it only needs a new swapchain
+    try
+    {
+        if (m_presentQueue.presentKHR(presentInfo) == vk::Result::eSuboptimalKHR)
+            swapChainStale = true;
+    }
+    catch (const vk::OutOfDateKHRError&)
+    {
+        swapChainStale = true;
+    }
+
+    // move on to the next frame slot, the CPU can now record while the GPU works on this one
+    m_currentFrame = (m_currentFrame + 1) % m_framesInFlight;
+    m_frameWaited = false;
+
+    if (swapChainStale)
+        recreateSwapChain(m_windowExtents.width, m_windowExtents.height);
+}
+
+void VKRenderer::submitFrame(FrameData& frame, vk::Semaphore waitSemaphore, vk::Semaphore signalSemaphore)
+{
+    VKProfiler::CpuScope submitScope(m_profiler, "submit");
+
+    // uploads queued since last frame go first, their barriers order them before this frame's reads
+    m_uploads.flush();
+
+    // an occlusion cull reads the pyramid built by the graphics work of the frame before last, so it
+    // overlaps the previous frame's. Without one the cull only depends on this frame slot
+    uint64_t cullSerial = 0;
+    if (frame.computeRecorded)
+    {
+        cullSerial = m_computeQueue.submit(frame.computeCommandBuffer);
+        if (m_culling.hasDepthSource())
+            m_computeQueue.waitQueue(m_gfxQueue, m_pyramidSerials[m_culling.getPyramidIndex()],
+                vk::PipelineStageFlagBits::eComputeShader);
+    }
+
+    m_profiler.markSubmit();
+    frame.submitSerial = m_gfxQueue.submit(frame.commandBuffer);
+    m_pyramidSerials[m_culling.getPyramidIndex()] = frame.submitSerial;
+    if (waitSemaphore)
+        m_gfxQueue.waitSemaphore(waitSemaphore, vk::PipelineStageFlagBits::eColorAttachmentOutput);
+    if (signalSemaphore)
+        m_gfxQueue.signalSemaphore(signalSemaphore);
+
+    // the draws read what the cull wrote, and the pyramid pass overwrites what it read
+    if (cullSerial)
+        m_gfxQueue.waitQueue(m_computeQueue, cullSerial, vk::PipelineStageFlagBits::eDrawIndirect |
+            vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eComputeShader);
+
+    // one vkQueueSubmit each, the uploads already flushed the transfer queue
+    if (m_asyncCompute)
+        m_computeQueue.flush();
+    m_gfxQueue.flush();
+    ++m_frameNumber;
+}
+
+void VKRenderer::drawFrameHeadless()
+{
+    FrameData& frame = m_frames[m_currentFrame];
+
+    // each frame slot owns its target, so there is nothing to acquire or wait for
+    uint32_t imageIx = m_currentFrame;
+    m_lastImageIx = imageIx;
+
+    frame.commandBuffer.reset(vk::CommandBufferResetFlags());
+    recordCommandBuffer(frame.commandBuffer, imageIx, m_recordSlices);
+    submitFrame(frame, vk::Semaphore(), vk::Semaphore());
+
+    m_currentFrame = (m_currentFrame + 1) % m_framesInFlight;
+    m_frameWaited = false;
+}
+
+bool VKRenderer::readbackImage(const char* fileName)
+{
+    if (m_frameNumber == 0 || !m_headless)
+        return false;
+
+    // the last frame has to land before it can be copied out
+    m_gfxQueue.waitIdle();
+
+    const uint32_t width = m_swapExtent.width;
+    const uint32_t height = m_swapExtent.height;
+
+    vk::BufferCreateInfo bufferInfo;
+    bufferInfo.size = (vk::DeviceSize)width * height * 4;
+    bufferInfo.usage = vk::BufferUsageFlagBits::eTransferDst;
+    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+
+    vk::Buffer readbackBuffer;
+    VKAllocation readbackAlloc = m_allocator.createBuffer(bufferInfo,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, readbackBuffer,
+        vk::MemoryPropertyFlagBits::eHostCached);
+
+    vk::CommandBufferAllocateInfo allocInfo;
+    allocInfo.commandPool = m_commandPool;
+    allocInfo.level = vk::CommandBufferLevel::ePrimary;
+    allocInfo.commandBufferCount = 1;
+    vk::CommandBuffer cmd = m_dev.allocateCommandBuffers(allocInfo)[0];
+
+    vk::CommandBufferBeginInfo beginInfo;
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    cmd.begin(beginInfo);
+
+    // the render pass already left the image in transfer src layout
+    vk::ImageMemoryBarrier toTransfer;
+    toTransfer.srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+    toTransfer.dstAccessMask = vk::AccessFlagBits::eTransferRead;
+    toTransfer.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
+    toTransfer.newLayout = vk::ImageLayout::eTransferSrcOptimal;
+    toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.image = m_swapChainImages[m_lastImageIx];
+    toTransfer.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+    toTransfer.subresourceRange.levelCount = 1;
+    toTransfer.subresourceRange.layerCount = 1;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(), nullptr, nullptr, toTransfer);
+
+    vk::BufferImageCopy region;
+    region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = vk::Extent3D(width, height, 1);
+    cmd.copyImageToBuffer(m_swapChainImages[m_lastImageIx], vk::ImageLayout::eTransferSrcOptimal, readbackBuffer, region);
+
+    vk::BufferMemoryBarrier toHost;
+    toHost.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toHost.dstAccessMask = vk::AccessFlagBits::eHostRead;
+    toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.buffer = readbackBuffer;
+    toHost.size = VK_WHOLE_SIZE;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost,
+        vk::DependencyFlags(), nullptr, toHost, nullptr);
+
+    cmd.end();
+
+    m_gfxQueue.wait(m_gfxQueue.submit(cmd));
+
+    m_dev.freeCommandBuffers(m_commandPool, cmd);
+
+    // RGBA8 in, RGB8 out
+    const unsigned char* src = (const unsigned char*)readbackAlloc.mapped;
+    std::vector<unsigned char> rgb((size_t)width * height * 3);
+    for (size_t i = 0; i < (size_t)width * height; ++i)
+    {
+        rgb[i * 3 + 0] = src[i * 4 + 0];
+        rgb[i * 3 + 1] = src[i * 4 + 1];
+        rgb[i * 3 + 2] = src[i * 4 + 2];
+    }
+
+    m_allocator.destroyBuffer(readbackBuffer, readbackAlloc);
+
+    size_t nameLen = strlen(fileName);
+    bool png = nameLen > 4 && strcmp(fileName + nameLen - 4, ".png") == 0;
+
+    bool written = png ?
+        image_helpers::writePNG(fileName, width, height, rgb) :
+        image_helpers::writePPM(fileName, width, height, rgb);
+
+    TRACE("%s frame %llu to %s", written ? "Wrote" : "Failed to write", (unsigned long long)m_frameNumber, fileName);
+    return written;
 }
 
 void VKRenderer::updateFrame()
 {
+    beginFrame();
+
+    VKProfiler::CpuScope cpuScope(m_profiler, "updateFrame");
+
     static auto startTime = std::chrono::high_resolution_clock::now();
 
     auto currentTime = std::chrono::high_resolution_clock::now();
     float time = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - startTime).count() / 1000.0f;
 
+    // headless runs step a fixed 60Hz clock so the same frame count always renders the same image
+    if (m_headless)
+        time = m_frameNumber / 60.0f;
+
     UniformBufferObject ubo;
     ubo.model = glm::rotate(glm::mat4(), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
     ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
     ubo.proj = glm::perspective(glm::radians(45.0f), (float)m_swapExtent.width / (float)m_swapExtent.height, 0.1f, 10.0f);
     ubo.proj[1][1] *= -1;
 
-    void* data = m_dev.mapMemory(m_uniformStagingBufferMemory, 0, sizeof(ubo), vk::MemoryMapFlags());
-    memcpy(data, &ubo, sizeof(ubo));
-    m_dev.unmapMemory(m_uniformStagingBufferMemory);
+    DrawItem quad;
+    quad.vertexBuffer = m_vertexBuffer;
+    quad.vertexStreamCount = m_meshStreamCount;
+    memcpy(quad.vertexStreamOffsets, m_meshStreamOffsets, sizeof(m_meshStreamOffsets));
+    quad.indexBuffer = m_indexBuffer;
+    quad.indexType = m_meshIndexType;
+    quad.indexCount = m_meshIndexCount;
+    quad.firstIndex = 0;
+    quad.vertexOffset = 0;
+    quad.uniformOffset = pushUniforms(ubo);
+    quad.material = m_demoMaterial;
+
+    if (quad.uniformOffset != VKUniformRing::INVALID_OFFSET)
+        submitDraw(quad);
+}
+
+void VKRenderer::benchmarkRecording(uint32_t drawCount, uint32_t maxThreads)
+{
+    const uint32_t iterations = 10;
+
+    // nothing may be in flight while we re-record the current frame's buffers over and over
+    m_dev.waitIdle();
+    updateFrame();
+
+    if (m_drawList.empty())
+        return;
+
+    DrawItem item = m_drawList[0];
+    m_drawList.assign(drawCount, item);
+
+    FrameData& frame = m_frames[m_currentFrame];
+    if (maxThreads == 0 || maxThreads > (uint32_t)frame.secondaryBuffers.size())
+        maxThreads = (uint32_t)frame.secondaryBuffers.size();
+
+    TRACE("recording benchmark: %u draws, %u iterations, up to %u threads", drawCount, iterations, maxThreads);
+
+    // one untimed pass first, so the single thread baseline doesn't pay for growing pools and rings
+    frame.commandBuffer.reset(vk::CommandBufferResetFlags());
+    recordCommandBuffer(frame.commandBuffer, 0, maxThreads);
+
+    double singleThreadMs = 0.0;
+    for (uint32_t threads = 1; threads <= maxThreads; ++threads)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (uint32_t i = 0; i < iterations; ++i)
+        {
+            frame.commandBuffer.reset(vk::CommandBufferResetFlags());
+            recordCommandBuffer(frame.commandBuffer, 0, threads);
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+        if (threads == 1)
+            singleThreadMs = ms;
+
+        TRACE("> %u thread(s): %.3f ms per frame, %.2fx, %u descriptor binds", threads, ms, singleThreadMs / ms, m_recordStats.descriptorBinds);
+    }
+
+    m_drawList.clear();
+
+    if (!m_instancedPipeline)
+        return;
+
+    // the same objects as instances of one mesh, laid out on a grid so each has its own transform
+    UniformBufferObject ubo;
+    ubo.model = glm::mat4();
+    ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    ubo.proj = glm::perspective(glm::radians(45.0f), (float)m_swapExtent.width / (float)m_swapExtent.height, 0.1f, 10.0f);
+    ubo.proj[1][1] *= -1;
+    setSceneUniforms(ubo);
+
+    const uint32_t side = (uint32_t)ceilf(sqrtf((float)drawCount));
+    std::vector<SceneInstance> instances(drawCount);
+    for (uint32_t i = 0; i < drawCount; ++i)
+    {
+        glm::vec3 position((float)(i % side) / side - 0.5f, (float)(i / side) / side - 0.5f, 0.0f);
+        glm::mat4 model = glm::scale(glm::translate(glm::mat4(), position), glm::vec3(1.0f / side));
+        instances[i] = SceneInstance::fromMatrix(model);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        m_scene.beginFrame(m_currentFrame);
+        m_scene.addInstances(m_quadMeshId, instances.data(), instances.size());
+
+        frame.commandBuffer.reset(vk::CommandBufferResetFlags());
+        recordCommandBuffer(frame.commandBuffer, 0, 1);
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start).count() / iterations;
 
-    copyBuffer(m_uniformStagingBuffer, m_uniformBuffer, sizeof(ubo));
+    TRACE("> instanced: %.3f ms per frame, %.2fx, %u instances in %u indirect draws (%s)", ms, singleThreadMs / ms,
+        m_recordStats.instances, m_recordStats.indirectDraws, m_scene.hasDrawIndirectCount() ? "draw indirect count" : "fallback");
+
+    m_scene.beginFrame(m_currentFrame);
 }
 
 void VKRenderer::shutdown()
 {
     m_dev.waitIdle();
+    m_jobs.shutdown();
 
-    flushPipelineCache();
+    destroyRetiredSwapChains(true);
 
-    m_dev.destroySemaphore(m_imageAvailableSemaphore);
-    m_dev.destroySemaphore(m_renderFinishedSemaphore);
+    // drains outstanding compiles, so they make it into the cache file too
+    m_pipelines.printStats();
+    m_pipelines.shutdown();
 
-    m_dev.freeCommandBuffers(m_commandPool, m_commandBuffers);
+    flushPipelineCache();
+    m_allocator.printStats();
+    m_profiler.printStats();
+    m_profiler.shutdown();
+
+    for (auto& frame : m_frames)
+    {
+        m_dev.destroySemaphore(frame.imageAvailableSemaphore);
+        m_dev.destroySemaphore(frame.renderFinishedSemaphore);
+        m_dev.freeCommandBuffers(m_commandPool, frame.commandBuffer);
+        if (frame.computeCommandBuffer)
+            m_dev.freeCommandBuffers(m_computePool, frame.computeCommandBuffer);
+
+        for (auto it : frame.workerPools)
+            m_dev.destroyCommandPool(it);
+    }
+    m_frames.clear();
 
     m_dev.destroyCommandPool(m_commandPool);
+    m_dev.destroyCommandPool(m_computePool);
 
     for (auto it : m_swapChainFrameBuffers)
         m_dev.destroyFramebuffer(it);
     m_swapChainFrameBuffers.clear();
 
-    m_dev.destroyPipeline(m_gfxPipeline);
-    m_dev.destroyPipelineLayout(m_gfxPipelineLayout);
-    m_dev.destroyPipelineCache(m_pipelineCache);
-
-    m_dev.destroyDescriptorSetLayout(m_descriptorLayout);
-    m_dev.destroyDescriptorPool(m_descriptorPool);
-
-    m_dev.destroyBuffer(m_vertexBuffer);
-    m_dev.freeMemory(m_vertexBufferMemory);
+    m_pipelineCache.shutdown();
 
-    m_dev.destroyBuffer(m_indexBuffer);
-    m_dev.freeMemory(m_indexBufferMemory);
+    // also destroys m_gfxPipelineLayout and m_descriptorLayout
+    m_layouts.shutdown();
+    m_shaders.shutdown();
+    m_reflector.shutdown();
 
-    m_dev.destroyBuffer(m_uniformBuffer);
-    m_dev.freeMemory(m_uniformBufferMemory);
-
-    m_dev.destroyBuffer(m_uniformStagingBuffer);
-    m_dev.freeMemory(m_uniformStagingBufferMemory);
-
-    m_dev.destroyShaderModule(m_vertShader);
-    m_dev.destroyShaderModule(m_fragShader);
+    m_dev.destroyDescriptorPool(m_descriptorPool);
+    m_bindless.shutdown();
+    m_scene.shutdown();
+    m_culling.shutdown();
+    m_graph.shutdown();
+    m_descriptors.printStats();
+    m_descriptors.shutdown();
+
+    m_allocator.destroyBuffer(m_vertexBuffer, m_vertexBufferAlloc);
+    m_allocator.destroyBuffer(m_indexBuffer, m_indexBufferAlloc);
+    m_dev.destroySampler(m_materialSampler);
+    m_dev.destroyImageView(m_whiteImageView);
+    m_allocator.destroyImage(m_whiteImage, m_whiteImageAlloc);
+    m_allocator.destroyBuffer(m_materialBuffer, m_materialBufferAlloc);
+    m_uniformRing.shutdown(m_allocator);
+    m_uploads.shutdown();
+
+    // after the uploads, which still wait on them
+    m_gfxQueue.printStats("Graphics");
+    m_gfxQueue.shutdown();
+    if (m_transferQueue.isInitialised())
+        m_transferQueue.printStats("Transfer");
+    m_transferQueue.shutdown();
+    if (m_asyncCompute)
+        m_computeQueue.printStats("Compute");
+    m_computeQueue.shutdown();
 
     m_dev.destroyRenderPass(m_renderPass);
 
+    for (auto it : m_attachmentViews)
+        m_dev.destroyImageView(it);
+    m_attachmentViews.clear();
+    for (size_t i = 0; i < m_attachmentImages.size(); ++i)
+        m_allocator.destroyImage(m_attachmentImages[i], m_attachmentAllocs[i]);
+    m_attachmentImages.clear();
+    m_attachmentAllocs.clear();
+
     for (auto it : m_swapChainImageViews)
         m_dev.destroyImageView(it);
     m_swapChainImageViews.clear();
 
+    // headless targets came from the allocator, swapchain images belong to the swapchain
+    for (size_t i = 0; i < m_offscreenImageAllocs.size(); ++i)
+        m_allocator.destroyImage(m_swapChainImages[i], m_offscreenImageAllocs[i]);
+    m_offscreenImageAllocs.clear();
+
     m_dev.destroySwapchainKHR(m_swapChain);
 
     m_inst.destroySurfaceKHR(m_surface);
 
     auto destroyDebugReportFunc = (PFN_vkDestroyDebugReportCallbackEXT)m_inst.getProcAddr("vkDestroyDebugReportCallbackEXT");
-    destroyDebugReportFunc(VkInstance(m_inst), m_debugCallback, nullptr);
+    if (destroyDebugReportFunc)
+        destroyDebugReportFunc(VkInstance(m_inst), m_debugCallback, nullptr);
+
+    m_allocator.shutdown();
 
     m_dev.destroy();
     m_inst.destroy();
@@ -1048,15 +2062,12 @@ void VKRenderer::printDecorations()
 
 void VKRenderer::printDecorations(const char* fileName)
 {
-    auto spirvData = file_helpers::readFile(fileName);
-
-    uint32_t* w = (uint32_t*)&spirvData[0];
-    uint32_t len = spirvData.size() / 4;
-
-    std::vector<uint32_t> spirvBytes(len);
-    spirvBytes.assign(w, w + len);
+    // SPIRV-Cross parses straight out of the mapping
+    file_helpers::MappedFile spirvData = file_helpers::mapFile(fileName);
+    if (spirvData.size() < sizeof(uint32_t))
+        return;
 
-    spirv_cross::CompilerGLSL glsl(std::move(spirvBytes));
+    spirv_cross::CompilerGLSL glsl((const uint32_t*)spirvData.data(), spirvData.size() / sizeof(uint32_t));
 
     auto decorationTypeToString = [](spv::Decoration d) {
         switch (d)
@@ -5,6 +5,25 @@
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 
+#include "vk_allocator.h"
+#include "vk_uniform_ring.h"
+#include "vk_upload.h"
+#include "vk_queue.h"
+#include "vk_pipeline_cache.h"
+#include "vk_pipeline_library.h"
+#include "thread_pool.h"
+#include "vk_profiler.h"
+#include "vk_descriptor_allocator.h"
+#include "vk_bindless.h"
+#include "vk_shader_reflection.h"
+#include "vk_layout_cache.h"
+#include "vk_shader_registry.h"
+#include "vertex_format.h"
+#include "vk_indirect_scene.h"
+#include "vk_culling.h"
+#include "vk_render_pass.h"
+#include "vk_render_graph.h"
+
 struct GLFWwindow;
 
 struct UniformBufferObject {
@@ -13,10 +32,83 @@ struct UniformBufferObject {
     glm::mat4 proj;
 };
 
+// number of frames the CPU may record ahead of the GPU, unless overridden in init()
+static const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+
+// resources owned by a single frame in flight, reused once its last submission has completed
+struct FrameData {
+    vk::Semaphore                 imageAvailableSemaphore;
+    vk::Semaphore                 renderFinishedSemaphore;
+    uint64_t                      submitSerial = 0; // on the graphics queue, which waits for everything else the frame ran
+    vk::CommandBuffer             commandBuffer;
+
+    // the cull, when it runs on the async compute queue
+    vk::CommandBuffer             computeCommandBuffer;
+    bool                          computeRecorded = false;
+
+    // one pool + secondary buffer per recording slice, so no two threads ever touch the same pool
+    std::vector<vk::CommandPool>  workerPools;
+    std::vector<vk::CommandBuffer> secondaryBuffers;
+};
+
+// one indexed draw in the frame's draw list, null pipeline/descriptorSet use the renderer's defaults
+struct DrawItem {
+    vk::Pipeline                  pipeline;
+    vk::DescriptorSet             descriptorSet;
+    vk::Buffer                    vertexBuffer;
+    uint32_t                      vertexStreamCount = 1;    // bindings of the vertex format, all read from vertexBuffer
+    vk::DeviceSize                vertexStreamOffsets[MAX_VERTEX_STREAMS] = {};
+    vk::Buffer                    indexBuffer;
+    vk::IndexType                 indexType;
+    uint32_t                      indexCount;
+    uint32_t                      firstIndex;
+    int32_t                       vertexOffset;
+    uint32_t                      uniformOffset;    // dynamic offset of the draw's UniformBufferObject
+    BindlessIndices               material;         // heap handles pushed as constants, unset pushes invalid ones
+};
+
+// swapchain objects replaced by a resize, destroyed once no frame in flight can reference them
+struct RetiredSwapChain {
+    vk::SwapchainKHR              swapChain;
+    std::vector<vk::ImageView>    imageViews;       // the swapchain's and the sized attachments'
+    std::vector<vk::Framebuffer>  frameBuffers;
+    std::vector<vk::Image>        attachmentImages;
+    std::vector<VKAllocation>     attachmentAllocs;
+    vk::RenderPass                renderPass;       // only set when the surface format changed
+    std::vector<vk::Pipeline>     pipelines;        // ditto, every library pipeline built against renderPass
+    uint64_t                      retiredAtFrame;
+};
+
+// what recording the last frame actually emitted, binds skipped by state filtering aren't counted
+struct RecordStats {
+    uint32_t                      draws = 0;
+    uint32_t                      pipelineBinds = 0;
+    uint32_t                      descriptorBinds = 0;
+    uint32_t                      vertexBufferBinds = 0;
+    uint32_t                      indexBufferBinds = 0;
+    uint32_t                      indirectDraws = 0;    // issued for the instanced scene, each may be many meshes
+    uint32_t                      instances = 0;
+
+    RecordStats&                  operator+=(const RecordStats& o)
+    {
+        draws += o.draws;
+        pipelineBinds += o.pipelineBinds;
+        descriptorBinds += o.descriptorBinds;
+        vertexBufferBinds += o.vertexBufferBinds;
+        indexBufferBinds += o.indexBufferBinds;
+        indirectDraws += o.indirectDraws;
+        instances += o.instances;
+        return *this;
+    }
+};
+
 class VKRenderer
 {
 public:
-    void                          init(GLFWwindow* window, uint32_t windowWidth, uint32_t windowHeight);
+    // a null window renders headless into offscreen images, with no surface or swapchain. msaaSamples
+    // is clamped to what the device supports for color and depth together
+    void                          init(GLFWwindow* window, uint32_t windowWidth, uint32_t windowHeight, uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT,
+                                       uint32_t msaaSamples = 1);
 
     void                          createInstance();
     void                          setupDebugCallback();
@@ -25,34 +117,95 @@ public:
     void                          selectLogicalDevice();
     void                          recreateSwapChain(uint32_t windowWidth, uint32_t windowHeight);
     void                          createSwapChain();
+    void                          createOffscreenTargets();
+    void                          selectAttachmentFormats(uint32_t msaaSamples);
     void                          createRenderPass();
+    void                          createAttachments();
     void                          loadShaders();
     void                          createPipelineCache();
     void                          flushPipelineCache();
     void                          createDescriptorSetLayout();
     void                          createGraphicsPipeline();
     void                          createFrameBuffers();
-    void                          createVertexBuffer();
-    void                          createIndexBuffer();
+    void                          createMeshBuffers();
+    void                          createMaterials();
     void                          createUniformBuffer();
+    void                          createCullingPass();
     void                          createDescriptorPool();
     void                          createDescriptorSet();
     void                          createCommandPool();
     void                          createCommandBuffers();
-    void                          createSemaphores();
+    void                          createSyncObjects();
 
     void                          drawFrame();
     void                          updateFrame();
 
+    // headless only, waits for the last frame and writes it out, .png by extension otherwise PPM
+    bool                          readbackImage(const char* fileName);
+    bool                          isHeadless() const { return m_headless; }
+
+    // Per-frame render list. beginFrame() waits for the frame slot to come free (updateFrame and
+    // drawFrame call it too), then uniforms and draws are submitted and drawFrame records them all
+    void                          beginFrame();
+    uint32_t                      pushUniforms(const UniformBufferObject& ubo) { return m_uniformRing.push(ubo); }
+    void                          submitDraw(const DrawItem& item) { m_drawList.push_back(item); }
+
+    // sorting by state removes more binds but loses submission order, only for order independent draws
+    void                          setDrawListSorting(bool enabled) { m_sortDrawList = enabled; }
+    const RecordStats&            getRecordStats() const { return m_recordStats; }
+
+    // Instanced objects, drawn indirectly after the draw list with the instanced vertex shader. Instances
+    // are added per frame like draws, setSceneUniforms() gives them this frame's view and projection
+    VKIndirectScene&              getScene() { return m_scene; }
+    void                          setSceneUniforms(const UniformBufferObject& ubo) { m_sceneUniforms = ubo; m_sceneUniformOffset = pushUniforms(ubo); }
+    uint32_t                      getQuadMeshId() const { return m_quadMeshId; }
+
+    // on by default when the culling shaders loaded, frustum and occlusion culling of the scene's
+    // instances in a compute pass ahead of the draws
+    void                          setGpuCulling(bool enabled) { m_scene.setGpuCulling(enabled && m_culling.isAvailable()); }
+    const CullingStats&           getCullingStats() const { return m_culling.getStats(); }
+    const RenderGraphStats&       getRenderGraphStats() const { return m_graph.getStats(); }
+
+    // allowing it before init() runs the cull on a compute-only queue family, overlapping the previous
+    // frame's graphics work. Off by default, so everything stays on graphics
+    void                          setAsyncCompute(bool allowed) { m_allowAsyncCompute = allowed; }
+    bool                          usesAsyncCompute() const { return m_asyncCompute; }
+
+    // pipelines for DrawItems, use get() with getDefaultPipelineKey() variations and the default
+    // pipeline as placeholder so a new permutation never stalls the frame it first appears in
+    VKPipelineLibrary&            getPipelineLibrary() { return m_pipelines; }
+
+    // textures, samplers and storage buffers for DrawItem::material, see VKBindlessHeap
+    VKBindlessHeap&               getBindlessHeap() { return m_bindless; }
+
+    // sets that only live for the frame being built, for DrawItem::descriptorSet
+    VKDescriptorAllocator&        getDescriptorAllocator() { return m_descriptors; }
+    PipelineKey                   getDefaultPipelineKey() const;
+    PipelineKey                   getInstancedPipelineKey() const;
+
+    VKProfiler&                   getProfiler() { return m_profiler; }
+
+    // times recording drawCount copies of the scene for 1..maxThreads slices, 0 uses every worker, then
+    // drawCount instances of it through the indirect path
+    void                          benchmarkRecording(uint32_t drawCount, uint32_t maxThreads = 0);
+
     void                          shutdown();
     
     static void                   printDecorations();
     static void                   printDecorations(const char* fileName);
 
 private:
-    uint32_t                      findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties);
-    void                          createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Buffer& buff, vk::DeviceMemory& buffMemory);
-    void                          copyBuffer(vk::Buffer src, vk::Buffer dst, vk::DeviceSize size);
+    void                          createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Buffer& buff, VKAllocation& buffAlloc);
+    void                          drawFrameHeadless();
+    void                          submitFrame(FrameData& frame, vk::Semaphore waitSemaphore, vk::Semaphore signalSemaphore);
+    void                          recordAsyncCull(vk::CommandBuffer cmd, const SceneBuffers& scene);
+    void                          recordCommandBuffer(vk::CommandBuffer cmd, uint32_t imageIx, uint32_t sliceCount);
+    void                          recordMainPass(vk::CommandBuffer cmd, uint32_t imageIx, uint32_t sliceCount);
+    void                          recordDraws(vk::CommandBuffer cmd, const DrawItem* items, size_t count, RecordStats& stats);
+    void                          recordScene(vk::CommandBuffer cmd, RecordStats& stats);
+    void                          destroyRetiredSwapChains(bool all);
+    void                          updateDepthSource();
+    void                          reloadShaders();
 
     vk::Instance                  m_inst;
 
@@ -60,12 +213,39 @@ private:
     vk::PhysicalDevice            m_physDevice;
     vk::Device                    m_dev;
 
+    VKAllocator                   m_allocator;
+    VKUploadManager               m_uploads;
+    VKProfiler                    m_profiler;
+    VKDescriptorAllocator         m_descriptors;    // transient sets, reset with their frame slot
+    VKBindlessHeap                m_bindless;
+    VKIndirectScene               m_scene;
+    VKCullingPass                 m_culling;
+    VKRenderGraph                 m_graph;          // this frame's passes and the barriers between them
+
+    // every submission goes through these, batched into one vkQueueSubmit per queue and frame
     int                           m_gfxQueueIx;
-    vk::Queue                     m_gfxQueue;
+    VKQueue                       m_gfxQueue;
 
     int                           m_presentQueueIx;
     vk::Queue                     m_presentQueue;
 
+    // transfer-only family when the device has one, otherwise the graphics family and m_gfxQueue
+    int                           m_transferQueueIx;
+    VKQueue                       m_transferQueue;
+
+    // compute-only family when the device has one and timeline semaphores to sync it with, otherwise
+    // the graphics family and m_computeQueue stays uninitialised
+    int                           m_computeQueueIx;
+    VKQueue                       m_computeQueue;
+    vk::CommandPool               m_computePool;
+    bool                          m_asyncCompute;
+    bool                          m_allowAsyncCompute = false;
+    bool                          m_timeAsyncCull;  // the compute family has timestamps too
+
+    // graphics serial of the frame that last rebuilt each of the culling pass's pyramids
+    uint64_t                      m_pyramidSerials[2] = {};
+    bool                          m_timelineSemaphores;
+
     vk::SwapchainKHR              m_swapChain;
     vk::Format                    m_swapChainImageFormat;
     vk::Extent2D                  m_swapExtent;
@@ -75,37 +255,101 @@ private:
 
     vk::Extent2D                  m_windowExtents;
 
+    // headless the swapchain members describe offscreen images owned by m_offscreenImageAllocs
+    bool                          m_headless;
+    std::vector<VKAllocation>     m_offscreenImageAllocs;
+    uint32_t                      m_lastImageIx;    // image the most recent frame rendered into
+
+    std::vector<RetiredSwapChain> m_retiredSwapChains;
+
     vk::RenderPass                m_renderPass;
 
-    vk::DescriptorSetLayout       m_descriptorLayout;
+    // how m_renderPass was built. The swapchain image is m_presentAttachment, every other attachment
+    // gets an image sized with the swapchain, transient ones in lazily allocated memory where there is any
+    VKRenderPassBuilder           m_passDesc;
+    uint32_t                      m_presentAttachment;
+    uint32_t                      m_depthAttachment;
+    std::vector<vk::Image>        m_attachmentImages;   // indexed by attachment, null for the swapchain's
+    std::vector<VKAllocation>     m_attachmentAllocs;
+    std::vector<vk::ImageView>    m_attachmentViews;
+    std::vector<vk::ClearValue>   m_clearValues;
+    vk::Format                    m_depthFormat;
+    bool                          m_depthSampleable;
+    vk::SampleCountFlagBits       m_msaaSamples;
+
+    VKShaderReflector             m_reflector;
+    VKLayoutCache                 m_layouts;
+    VKShaderRegistry              m_shaders;
+
+    vk::DescriptorSetLayout       m_descriptorLayout;   // owned by m_layouts
     vk::DescriptorPool            m_descriptorPool;
-    vk::DescriptorSet             m_descriptorSet;
+    vk::DescriptorSet             m_descriptorSet;  // dynamic uniform buffer, offset chosen at bind time
 
-    vk::Pipeline                  m_gfxPipeline;
-    vk::PipelineLayout            m_gfxPipelineLayout;
-    vk::PipelineCache             m_pipelineCache;
+    VKPipelineLibrary             m_pipelines;
+    uint32_t                      m_vertexLayout;
+    vk::Pipeline                  m_gfxPipeline;    // owned by m_pipelines
+    std::shared_future<vk::Pipeline> m_pendingGfxPipeline;  // rebuilt after a shader reload
+    uint32_t                      m_instancedVertexLayout;
+    vk::Pipeline                  m_instancedPipeline;  // null when instanced.vert isn't there, the scene isn't drawn
+    std::shared_future<vk::Pipeline> m_pendingInstancedPipeline;
+    vk::PipelineLayout            m_gfxPipelineLayout;  // owned by m_layouts
+    VKPipelineCache               m_pipelineCache;
 
-    // test shaders
+    // test shaders, modules owned by m_shaders. The fragment shader is the bindless variant when present
+    uint32_t                      m_vertShaderId;
+    uint32_t                      m_fragShaderId;
     vk::ShaderModule              m_vertShader;
     vk::ShaderModule              m_fragShader;
+    ShaderReflection              m_vertReflection;
+    ShaderReflection              m_fragReflection;
+    uint32_t                      m_instancedVertShaderId;
+    vk::ShaderModule              m_instancedVertShader;
+    ShaderReflection              m_instancedVertReflection;
+    uint32_t                      m_cullShaderId;
+    uint32_t                      m_pyramidShaderId;
 
     vk::Buffer                    m_vertexBuffer;
-    vk::DeviceMemory              m_vertexBufferMemory;
+    VKAllocation                  m_vertexBufferAlloc;
 
     vk::Buffer                    m_indexBuffer;
-    vk::DeviceMemory              m_indexBufferMemory;
+    VKAllocation                  m_indexBufferAlloc;
+
+    // the quad as loaded from its mesh file, streams back to back in m_vertexBuffer
+    uint32_t                      m_meshIndexCount;
+    vk::IndexType                 m_meshIndexType;
+    uint32_t                      m_meshStreamCount;
+    vk::DeviceSize                m_meshStreamOffsets[MAX_VERTEX_STREAMS];
+    uint32_t                      m_quadMeshId;     // the same, registered with m_scene
 
-    vk::Buffer                    m_uniformStagingBuffer;
-    vk::DeviceMemory              m_uniformStagingBufferMemory;
-    vk::Buffer                    m_uniformBuffer;
-    vk::DeviceMemory              m_uniformBufferMemory;
+    // tints, a white texel and a sampler in the bindless heap
+    vk::Buffer                    m_materialBuffer;
+    VKAllocation                  m_materialBufferAlloc;
+    vk::Image                     m_whiteImage;
+    VKAllocation                  m_whiteImageAlloc;
+    vk::ImageView                 m_whiteImageView;
+    vk::Sampler                   m_materialSampler;
+    BindlessIndices               m_defaultMaterial;    // white, what the fallback fills unset bindings with
+    BindlessIndices               m_demoMaterial;       // tinted, drawn by the quad in updateFrame
+
+    VKUniformRing                 m_uniformRing;
 
     vk::CommandPool               m_commandPool;
-    std::vector<vk::CommandBuffer> m_commandBuffers;
 
-    vk::Semaphore                 m_imageAvailableSemaphore;
-    vk::Semaphore                 m_renderFinishedSemaphore;
+    ThreadPool                    m_jobs;
+    uint32_t                      m_recordSlices;
+    std::vector<DrawItem>         m_drawList;
+    bool                          m_sortDrawList;
+    RecordStats                   m_recordStats;
+    uint32_t                      m_sceneUniformOffset;
+    UniformBufferObject           m_sceneUniforms;  // the culling pass's view and projection
+
+    uint32_t                      m_framesInFlight;
+    uint32_t                      m_currentFrame;
+    bool                          m_frameWaited;
+    uint64_t                      m_frameNumber;    // frames submitted so far
+    std::vector<FrameData>        m_frames;
 
     VkDebugReportCallbackEXT      m_debugCallback;
     bool                          m_addStandardValidationLayer;
+    bool                          m_hasProperties2;  // VK_KHR_get_physical_device_properties2 enabled
 };
\ No newline at end of file
@@ -0,0 +1,343 @@
+#include "vk_shader_reflection.h"
+#include "trace.h"
+#include "file_helpers.h"
+#include "blob.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include <spirv_cross/spirv_cross.hpp>
+
+// file layout: header, then per entry a ReflectionFileEntry followed by its bindings and vertex inputs
+struct ReflectionFileHeader {
+    uint32_t                      magic;
+    uint32_t                      version;
+    uint32_t                      entryCount;
+    uint32_t                      reserved;
+    uint64_t                      dataSize;
+};
+
+struct ReflectionFileEntry {
+    uint64_t                      spirvHash;
+    uint32_t                      stage;
+    uint32_t                      pushConstantOffset;
+    uint32_t                      pushConstantSize;
+    uint32_t                      bindingCount;
+    uint32_t                      vertexInputCount;
+    uint32_t                      reserved;
+};
+
+static_assert(sizeof(ReflectionFileHeader) == 24, "ReflectionFileHeader layout is part of the file format");
+static_assert(sizeof(ReflectionFileEntry) == 32, "ReflectionFileEntry layout is part of the file format");
+static_assert(sizeof(ReflectedBinding) == 20 && sizeof(ReflectedVertexInput) == 12, "reflected records are written as is");
+
+static uint32_t stageFromExecutionModel(spv::ExecutionModel model)
+{
+    switch (model)
+    {
+    case spv::ExecutionModelVertex: return VK_SHADER_STAGE_VERTEX_BIT;
+    case spv::ExecutionModelTessellationControl: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+    case spv::ExecutionModelTessellationEvaluation: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+    case spv::ExecutionModelGeometry: return VK_SHADER_STAGE_GEOMETRY_BIT;
+    case spv::ExecutionModelFragment: return VK_SHADER_STAGE_FRAGMENT_BIT;
+    case spv::ExecutionModelGLCompute: return VK_SHADER_STAGE_COMPUTE_BIT;
+    default: return 0;
+    }
+}
+
+static VkFormat vertexFormat(const spirv_cross::SPIRType& type)
+{
+    static const VkFormat floats[] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+    static const VkFormat ints[] = { VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+    static const VkFormat uints[] = { VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+    static const VkFormat halves[] = { VK_FORMAT_R16_SFLOAT, VK_FORMAT_R16G16_SFLOAT, VK_FORMAT_R16G16B16_SFLOAT, VK_FORMAT_R16G16B16A16_SFLOAT };
+
+    if (type.vecsize < 1 || type.vecsize > 4 || type.columns != 1)
+        return VK_FORMAT_UNDEFINED;
+
+    switch (type.basetype)
+    {
+    case spirv_cross::SPIRType::Float: return floats[type.vecsize - 1];
+    case spirv_cross::SPIRType::Int: return ints[type.vecsize - 1];
+    case spirv_cross::SPIRType::UInt: return uints[type.vecsize - 1];
+    case spirv_cross::SPIRType::Half: return halves[type.vecsize - 1];
+    default: return VK_FORMAT_UNDEFINED;
+    }
+}
+
+bool VKShaderReflector::parse(const uint32_t* words, size_t wordCount, ShaderReflection& out)
+{
+    out = ShaderReflection();
+
+    try
+    {
+        spirv_cross::Compiler compiler(words, wordCount);
+        auto resources = compiler.get_shader_resources();
+
+        out.stage = stageFromExecutionModel(compiler.get_execution_model());
+        if (!out.stage)
+            return false;
+
+        auto addBindings = [&](const std::vector<spirv_cross::Resource>& list, VkDescriptorType type, VkDescriptorType texelType) {
+            for (auto& it : list)
+            {
+                const spirv_cross::SPIRType& varType = compiler.get_type(it.type_id);
+
+                ReflectedBinding binding;
+                binding.set = compiler.get_decoration(it.id, spv::DecorationDescriptorSet);
+                binding.binding = compiler.get_decoration(it.id, spv::DecorationBinding);
+                binding.descriptorType = varType.image.dim == spv::DimBuffer ? texelType : type;
+                binding.stages = out.stage;
+
+                // arrays of arrays flatten, an unsized dimension makes the whole thing runtime sized
+                binding.count = 1;
+                for (auto size : varType.array)
+                    binding.count *= size;
+
+                out.bindings.push_back(binding);
+            }
+        };
+
+        addBindings(resources.uniform_buffers, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+        addBindings(resources.storage_buffers, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        addBindings(resources.storage_images, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER);
+        addBindings(resources.sampled_images, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER);
+        addBindings(resources.separate_images, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER);
+        addBindings(resources.separate_samplers, VK_DESCRIPTOR_TYPE_SAMPLER, VK_DESCRIPTOR_TYPE_SAMPLER);
+        addBindings(resources.subpass_inputs, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT);
+
+        std::sort(out.bindings.begin(), out.bindings.end(), [](const ReflectedBinding& a, const ReflectedBinding& b) {
+            return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+        });
+
+        // only the range the shader actually reads, so stages sharing a block can each declare part of it
+        for (auto& it : resources.push_constant_buffers)
+        {
+            auto ranges = compiler.get_active_buffer_ranges(it.id);
+            if (ranges.empty())
+                continue;
+
+            size_t first = ranges[0].offset;
+            size_t last = ranges[0].offset + ranges[0].range;
+            for (auto& range : ranges)
+            {
+                first = std::min(first, range.offset);
+                last = std::max(last, range.offset + range.range);
+            }
+
+            out.pushConstantOffset = (uint32_t)first;
+            out.pushConstantSize = (uint32_t)(last - first);
+        }
+
+        if (out.stage == VK_SHADER_STAGE_VERTEX_BIT)
+        {
+            for (auto& it : resources.stage_inputs)
+            {
+                const spirv_cross::SPIRType& type = compiler.get_type(it.type_id);
+
+                ReflectedVertexInput input;
+                input.location = compiler.get_decoration(it.id, spv::DecorationLocation);
+                input.format = vertexFormat(type);
+                input.size = type.vecsize * type.width / 8;
+
+                if (input.format == VK_FORMAT_UNDEFINED)
+                {
+                    TRACE("Vertex input %s at location %u has no attribute format", it.name.c_str(), input.location);
+                    continue;
+                }
+
+                out.vertexInputs.push_back(input);
+            }
+
+            std::sort(out.vertexInputs.begin(), out.vertexInputs.end(), [](const ReflectedVertexInput& a, const ReflectedVertexInput& b) {
+                return a.location < b.location;
+            });
+        }
+    }
+    catch (const std::exception& e)
+    {
+        LOG_ERROR(LogCategory::ePipeline, "SPIR-V reflection failed: %s", e.what());
+        out = ShaderReflection();
+        return false;
+    }
+
+    return true;
+}
+
+void VKShaderReflector::init(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_path = path;
+    m_cache.clear();
+    m_dirty = false;
+    m_stats = ShaderReflectionStats();
+
+    load();
+}
+
+void VKShaderReflector::shutdown()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    TRACE("Reflection cache: %u hits, %u parsed, %u failed", m_stats.cacheHits, m_stats.parsed, m_stats.failed);
+
+    if (m_dirty && !save())
+        LOG_WARNING(LogCategory::ePipeline, "Failed to write reflection cache %s", m_path.c_str());
+
+    m_cache.clear();
+    m_dirty = false;
+}
+
+bool VKShaderReflector::reflect(const uint32_t* words, size_t wordCount, ShaderReflection& out)
+{
+    uint64_t hash = file_helpers::hash64(words, wordCount * sizeof(uint32_t));
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_cache.find(hash);
+        if (it != m_cache.end())
+        {
+            ++m_stats.cacheHits;
+            out = it->second;
+            return true;
+        }
+    }
+
+    // parsed outside the lock, two threads racing on one module just both parse it
+    bool parsed = wordCount != 0 && parse(words, wordCount, out);
+    out.spirvHash = hash;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!parsed)
+    {
+        ++m_stats.failed;
+        return false;
+    }
+
+    ++m_stats.parsed;
+    m_cache[hash] = out;
+    m_dirty = true;
+    return true;
+}
+
+ShaderReflectionStats VKShaderReflector::getStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+bool VKShaderReflector::load()
+{
+    // only mapped while it's decoded
+    file_helpers::MappedFile file;
+    if (!file.open(m_path, file_helpers::MappedFile::Hint::eSequential))
+        return false;
+
+    ReflectionFileHeader header;
+    const char* reason = nullptr;
+    std::vector<unsigned char> fileData;
+    if (blob::decode(file.data(), file.size(), fileData, nullptr, &reason))
+    {
+        if (fileData.size() < sizeof(header))
+        {
+            reason = "truncated header";
+        }
+        else
+        {
+            memcpy(&header, fileData.data(), sizeof(header));
+            if (header.magic != FILE_MAGIC || header.version != FILE_VERSION)
+                reason = "unknown format";
+            else if (header.dataSize != fileData.size() - sizeof(header))
+                reason = "truncated data";
+        }
+    }
+
+    std::unordered_map<uint64_t, ShaderReflection> entries;
+    size_t pos = sizeof(header);
+    for (uint32_t i = 0; !reason && i < header.entryCount; ++i)
+    {
+        ReflectionFileEntry entry;
+        if (fileData.size() - pos < sizeof(entry))
+        {
+            reason = "truncated entry";
+            break;
+        }
+        memcpy(&entry, fileData.data() + pos, sizeof(entry));
+        pos += sizeof(entry);
+
+        size_t bindingBytes = (size_t)entry.bindingCount * sizeof(ReflectedBinding);
+        size_t inputBytes = (size_t)entry.vertexInputCount * sizeof(ReflectedVertexInput);
+        if (fileData.size() - pos < bindingBytes + inputBytes)
+        {
+            reason = "truncated entry";
+            break;
+        }
+
+        ShaderReflection& reflection = entries[entry.spirvHash];
+        reflection.spirvHash = entry.spirvHash;
+        reflection.stage = entry.stage;
+        reflection.pushConstantOffset = entry.pushConstantOffset;
+        reflection.pushConstantSize = entry.pushConstantSize;
+
+        reflection.bindings.resize(entry.bindingCount);
+        if (bindingBytes)
+            memcpy(reflection.bindings.data(), fileData.data() + pos, bindingBytes);
+        pos += bindingBytes;
+
+        reflection.vertexInputs.resize(entry.vertexInputCount);
+        if (inputBytes)
+            memcpy(reflection.vertexInputs.data(), fileData.data() + pos, inputBytes);
+        pos += inputBytes;
+    }
+
+    if (reason)
+    {
+        LOG_WARNING(LogCategory::ePipeline, "Discarding reflection cache %s: %s", m_path.c_str(), reason);
+        return false;
+    }
+
+    m_cache = std::move(entries);
+    TRACE("Loaded reflection cache %s, %u modules", m_path.c_str(), (uint32_t)m_cache.size());
+    return true;
+}
+
+bool VKShaderReflector::save()
+{
+    std::vector<unsigned char> fileData(sizeof(ReflectionFileHeader));
+
+    auto append = [&fileData](const void* data, size_t size) {
+        if (size)
+            fileData.insert(fileData.end(), (const unsigned char*)data, (const unsigned char*)data + size);
+    };
+
+    for (auto& it : m_cache)
+    {
+        const ShaderReflection& reflection = it.second;
+
+        ReflectionFileEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.spirvHash = reflection.spirvHash;
+        entry.stage = reflection.stage;
+        entry.pushConstantOffset = reflection.pushConstantOffset;
+        entry.pushConstantSize = reflection.pushConstantSize;
+        entry.bindingCount = (uint32_t)reflection.bindings.size();
+        entry.vertexInputCount = (uint32_t)reflection.vertexInputs.size();
+
+        append(&entry, sizeof(entry));
+        append(reflection.bindings.data(), reflection.bindings.size() * sizeof(ReflectedBinding));
+        append(reflection.vertexInputs.data(), reflection.vertexInputs.size() * sizeof(ReflectedVertexInput));
+    }
+
+    ReflectionFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = FILE_MAGIC;
+    header.version = FILE_VERSION;
+    header.entryCount = (uint32_t)m_cache.size();
+    header.dataSize = fileData.size() - sizeof(header);
+    memcpy(fileData.data(), &header, sizeof(header));
+
+    auto encoded = blob::encode(fileData.data(), fileData.size());
+    return file_helpers::writeFileAtomic(m_path, encoded.data(), encoded.size());
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+// what a module declares, plain integers (Vk enums and flags) so it can be cached on disk as is
+struct ReflectedBinding {
+    uint32_t                      set;
+    uint32_t                      binding;
+    uint32_t                      descriptorType;   // VkDescriptorType
+    uint32_t                      count;            // 0 for a runtime sized array
+    uint32_t                      stages;           // VkShaderStageFlags
+};
+
+struct ReflectedVertexInput {
+    uint32_t                      location;
+    uint32_t                      format;           // VkFormat
+    uint32_t                      size;             // bytes
+};
+
+struct ShaderReflection {
+    uint64_t                      spirvHash = 0;
+    uint32_t                      stage = 0;        // VkShaderStageFlagBits
+    uint32_t                      pushConstantOffset = 0;
+    uint32_t                      pushConstantSize = 0;     // 0 when there's no push constant block
+    std::vector<ReflectedBinding> bindings;         // sorted by set then binding
+    std::vector<ReflectedVertexInput> vertexInputs; // vertex stage only, sorted by location
+};
+
+struct ShaderReflectionStats {
+    uint32_t                      cacheHits = 0;
+    uint32_t                      parsed = 0;
+    uint32_t                      failed = 0;
+};
+
+// SPIR-V reflection through SPIRV-Cross, cached on disk by a hash of the module so startup only parses
+// modules that changed. Safe to call from any thread
+class VKShaderReflector
+{
+public:
+    static constexpr uint32_t     FILE_MAGIC = 0x46524B56; // "VKRF"
+    static constexpr uint32_t     FILE_VERSION = 2;
+
+    // loads what the file at path holds, anything malformed is discarded whole
+    void                          init(const std::string& path);
+
+    // writes the file back if anything was added
+    void                          shutdown();
+
+    // false if the module couldn't be parsed, out is then empty. Parsed straight from words, which
+    // SPIRV-Cross copies into its own IR
+    bool                          reflect(const uint32_t* words, size_t wordCount, ShaderReflection& out);
+
+    ShaderReflectionStats         getStats() const;
+
+    // the SPIRV-Cross pass itself, uncached
+    static bool                   parse(const uint32_t* words, size_t wordCount, ShaderReflection& out);
+
+private:
+    bool                          load();
+    bool                          save();
+
+    std::string                   m_path;
+    std::unordered_map<uint64_t, ShaderReflection> m_cache;
+    bool                          m_dirty = false;
+
+    mutable std::mutex            m_mutex;
+    ShaderReflectionStats         m_stats;
+};
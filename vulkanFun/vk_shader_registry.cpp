@@ -0,0 +1,374 @@
+#include "vk_shader_registry.h"
+#include "trace.h"
+#include "file_helpers.h"
+
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <unordered_set>
+
+static const uint32_t SPIRV_MAGIC = 0x07230203;
+static const size_t SPIRV_HEADER_WORDS = 5;
+
+void VKShaderRegistry::init(vk::Device dev, ThreadPool& jobs, VKShaderReflector& reflector)
+{
+    m_dev = dev;
+    m_jobs = &jobs;
+    m_reflector = &reflector;
+    m_lastWatch = std::chrono::steady_clock::now();
+    m_stats = ShaderRegistryStats();
+}
+
+void VKShaderRegistry::shutdown()
+{
+    if (m_watch.valid())
+        m_watch.wait();
+    m_watch = std::future<std::vector<Change>>();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto& it : m_modules)
+        m_dev.destroyShaderModule(it.second.module);
+    for (auto it : m_retiredModules)
+        m_dev.destroyShaderModule(it);
+
+    m_modules.clear();
+    m_retiredModules.clear();
+    m_files.clear();
+    m_ids.clear();
+}
+
+bool VKShaderRegistry::validate(const void* data, size_t size, const char** reason)
+{
+    uint32_t magic = 0;
+    if (size >= sizeof(magic))
+        memcpy(&magic, data, sizeof(magic));
+
+    if (size == 0)
+        *reason = "missing or empty";
+    else if (size % sizeof(uint32_t) != 0)
+        *reason = "not a whole number of words";
+    else if (size < SPIRV_HEADER_WORDS * sizeof(uint32_t))
+        *reason = "truncated header";
+    else if (magic != SPIRV_MAGIC)
+        *reason = "bad magic number";
+    else
+        return true;
+
+    return false;
+}
+
+int64_t VKShaderRegistry::getWriteTime(const std::string& path)
+{
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(path, ec);
+    return ec ? 0 : (int64_t)time.time_since_epoch().count();
+}
+
+VKShaderRegistry::Loaded VKShaderRegistry::readAndValidate(const std::string& path, bool copy) const
+{
+    Loaded loaded;
+    loaded.writeTime = getWriteTime(path);
+
+    auto file = std::make_shared<file_helpers::MappedFile>();
+#ifdef _WIN32
+    // a mapped file can't be written to there, which would lock the shader compiler out
+    copy = true;
+#endif
+    if (copy)
+        file->read(path);
+    else
+        file->open(path, file_helpers::MappedFile::Hint::eSequential);
+
+    const char* reason = nullptr;
+    if (!validate(file->data(), file->size(), &reason))
+    {
+        LOG_WARNING(LogCategory::ePipeline, "Rejected shader %s: %s", path.c_str(), reason);
+        return loaded;
+    }
+
+    loaded.hash = file_helpers::hash64(file->data(), file->size());
+    loaded.code = file;
+
+    // the module can still be used, only layouts generated from it will be missing what it declares
+    if (!m_reflector->reflect(file->words(), file->size() / sizeof(uint32_t), loaded.reflection))
+        LOG_WARNING(LogCategory::ePipeline, "Shader %s couldn't be reflected", path.c_str());
+
+    loaded.valid = true;
+    return loaded;
+}
+
+vk::ShaderModule VKShaderRegistry::createModule(const SpirvCode& code) const
+{
+    vk::ShaderModuleCreateInfo createInfo;
+    createInfo.codeSize = code->size();
+    createInfo.pCode = code->words();
+
+    try
+    {
+        return m_dev.createShaderModule(createInfo);
+    }
+    catch (const std::exception& e)
+    {
+        LOG_ERROR(LogCategory::ePipeline, "Shader module creation failed: %s", e.what());
+        return vk::ShaderModule();
+    }
+}
+
+std::vector<uint32_t> VKShaderRegistry::load(const std::vector<std::string>& paths)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<uint32_t> ids(paths.size(), INVALID_SHADER);
+    std::vector<uint32_t> pendingIds;
+    std::vector<std::string> pendingPaths;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            auto found = m_ids.find(paths[i]);
+            if (found != m_ids.end())
+            {
+                ids[i] = found->second;
+                continue;
+            }
+
+            File file;
+            file.path = paths[i];
+
+            ids[i] = (uint32_t)m_files.size();
+            m_ids[paths[i]] = ids[i];
+            m_files.push_back(file);
+
+            pendingIds.push_back(ids[i]);
+            pendingPaths.push_back(paths[i]);
+        }
+    }
+
+    if (pendingIds.empty())
+        return ids;
+
+    // a slice per worker plus the caller, each striding through the list so slow files spread out
+    const uint32_t pendingCount = (uint32_t)pendingIds.size();
+    const uint32_t sliceCount = std::min(pendingCount, m_jobs->getThreadCount() + 1);
+
+    std::vector<Loaded> loaded(pendingCount);
+    m_jobs->parallelFor(sliceCount, [&](uint32_t slice) {
+        for (uint32_t i = slice; i < pendingCount; i += sliceCount)
+            loaded[i] = readAndValidate(pendingPaths[i], false);
+    });
+
+    // variants with identical code get one module between them
+    std::vector<const Loaded*> toCreate;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        std::unordered_set<uint64_t> seen;
+        for (auto& it : loaded)
+        {
+            if (it.valid && m_modules.find(it.hash) == m_modules.end() && seen.insert(it.hash).second)
+                toCreate.push_back(&it);
+        }
+    }
+
+    const uint32_t createCount = (uint32_t)toCreate.size();
+    const uint32_t createSlices = std::min(createCount, m_jobs->getThreadCount() + 1);
+
+    std::vector<vk::ShaderModule> created(createCount);
+    m_jobs->parallelFor(createSlices, [&](uint32_t slice) {
+        for (uint32_t i = slice; i < createCount; i += createSlices)
+            created[i] = createModule(toCreate[i]->code);
+    });
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (uint32_t i = 0; i < createCount; ++i)
+    {
+        if (!created[i])
+            continue;
+
+        Module module;
+        module.module = created[i];
+        module.code = toCreate[i]->code;
+        module.reflection = toCreate[i]->reflection;
+        m_modules[toCreate[i]->hash] = module;
+    }
+
+    for (uint32_t i = 0; i < pendingCount; ++i)
+    {
+        File& file = m_files[pendingIds[i]];
+        file.writeTime = loaded[i].writeTime;
+
+        if (loaded[i].valid && m_modules.find(loaded[i].hash) != m_modules.end())
+            file.hash = loaded[i].hash;
+        else
+            ++m_stats.failed;
+    }
+
+    m_stats.files = (uint32_t)m_files.size();
+    m_stats.modules = (uint32_t)m_modules.size();
+    m_stats.lastLoadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    TRACE("Loaded %u shaders, %u distinct modules, in %.2f ms", pendingCount, createCount, m_stats.lastLoadMs);
+    return ids;
+}
+
+uint32_t VKShaderRegistry::load(const std::string& path)
+{
+    std::vector<std::string> paths(1, path);
+    return load(paths)[0];
+}
+
+uint32_t VKShaderRegistry::find(const std::string& path) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto found = m_ids.find(path);
+    return found != m_ids.end() ? found->second : INVALID_SHADER;
+}
+
+vk::ShaderModule VKShaderRegistry::getModule(uint32_t id) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (id >= m_files.size())
+        return vk::ShaderModule();
+
+    auto found = m_modules.find(m_files[id].hash);
+    return found != m_modules.end() ? found->second.module : vk::ShaderModule();
+}
+
+ShaderReflection VKShaderRegistry::getReflection(uint32_t id) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (id >= m_files.size())
+        return ShaderReflection();
+
+    auto found = m_modules.find(m_files[id].hash);
+    return found != m_modules.end() ? found->second.reflection : ShaderReflection();
+}
+
+SpirvCode VKShaderRegistry::getCode(uint32_t id) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (id >= m_files.size())
+        return SpirvCode();
+
+    auto found = m_modules.find(m_files[id].hash);
+    return found != m_modules.end() ? found->second.code : SpirvCode();
+}
+
+std::string VKShaderRegistry::getPath(uint32_t id) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return id < m_files.size() ? m_files[id].path : std::string();
+}
+
+std::vector<VKShaderRegistry::Change> VKShaderRegistry::findChanges(std::vector<File> files) const
+{
+    std::vector<Change> changes;
+    for (uint32_t id = 0; id < (uint32_t)files.size(); ++id)
+    {
+        int64_t writeTime = getWriteTime(files[id].path);
+        if (writeTime == 0 || writeTime == files[id].writeTime)
+            continue;
+
+        Change change;
+        change.id = id;
+        change.loaded = readAndValidate(files[id].path, true);
+        changes.push_back(change);
+    }
+    return changes;
+}
+
+void VKShaderRegistry::retireIfUnused(uint64_t hash)
+{
+    for (auto& it : m_files)
+    {
+        if (it.hash == hash)
+            return;
+    }
+
+    auto found = m_modules.find(hash);
+    if (found == m_modules.end())
+        return;
+
+    m_retiredModules.push_back(found->second.module);
+    m_modules.erase(found);
+}
+
+std::vector<uint32_t> VKShaderRegistry::update(double watchInterval)
+{
+    std::vector<uint32_t> changed;
+    auto now = std::chrono::steady_clock::now();
+
+    if (m_watch.valid())
+    {
+        // deferred when there are no workers, get() then does the scan right here
+        if (m_watch.wait_for(std::chrono::seconds(0)) == std::future_status::timeout)
+            return changed;
+
+        std::vector<Change> changes = m_watch.get();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& it : changes)
+        {
+            File& file = m_files[it.id];
+            file.writeTime = it.loaded.writeTime;
+
+            // a half written file fails validation, the next save changes the time and it's tried again
+            if (!it.loaded.valid || it.loaded.hash == file.hash)
+                continue;
+
+            if (m_modules.find(it.loaded.hash) == m_modules.end())
+            {
+                vk::ShaderModule module = createModule(it.loaded.code);
+                if (!module)
+                    continue;
+
+                Module& entry = m_modules[it.loaded.hash];
+                entry.module = module;
+                entry.code = it.loaded.code;
+                entry.reflection = it.loaded.reflection;
+            }
+
+            uint64_t previous = file.hash;
+            file.hash = it.loaded.hash;
+            retireIfUnused(previous);
+
+            ++m_stats.reloads;
+            changed.push_back(it.id);
+            TRACE("Reloaded shader %s", file.path.c_str());
+        }
+
+        m_stats.modules = (uint32_t)m_modules.size();
+        m_lastWatch = now;
+    }
+
+    // stat'ing every file is left to a worker, the frame only picks up the result
+    if (std::chrono::duration<double>(now - m_lastWatch).count() >= watchInterval)
+    {
+        std::vector<File> files;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            files = m_files;
+        }
+
+        if (m_jobs->getThreadCount() > 0)
+            m_watch = m_jobs->submit([this, files]() { return findChanges(files); });
+        else
+            m_watch = std::async(std::launch::deferred, [this, files]() { return findChanges(files); });
+        m_lastWatch = now;
+    }
+
+    return changed;
+}
+
+ShaderRegistryStats VKShaderRegistry::getStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
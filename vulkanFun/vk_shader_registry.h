@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <chrono>
+
+#include "vk_shader_reflection.h"
+#include "thread_pool.h"
+#include "file_helpers.h"
+
+// the mapped file itself, data() is the SPIR-V words
+typedef std::shared_ptr<const file_helpers::MappedFile> SpirvCode;
+
+struct ShaderRegistryStats {
+    uint32_t                      files = 0;
+    uint32_t                      modules = 0;      // distinct contents, files with identical code share one
+    uint32_t                      failed = 0;
+    uint32_t                      reloads = 0;
+    double                        lastLoadMs = 0.0;
+};
+
+// Every SPIR-V file the renderer uses, by path. Files are read, validated, reflected and turned into
+// modules across the thread pool; modules are keyed by a hash of their code, so variants that compile
+// to the same SPIR-V share a module. Hashing, reflection and module creation all read the words in
+// place from the one mapping of the file, only SPIRV-Cross keeps a parsed copy while it reflects.
+// update() watches the files' modification times in the background and swaps in new modules when
+// they change. Modules replaced by a reload live until shutdown, pipelines still in flight may have
+// been built from them
+class VKShaderRegistry
+{
+public:
+    static constexpr uint32_t     INVALID_SHADER = ~0u;
+    static constexpr double       DEFAULT_WATCH_INTERVAL = 0.5; // seconds
+
+    void                          init(vk::Device dev, ThreadPool& jobs, VKShaderReflector& reflector);
+    void                          shutdown();
+
+    // ids in the same order as paths, files already loaded return their existing id. A file that is
+    // missing or not valid SPIR-V still gets an id, with a null module until a reload fixes it.
+    // Not to be called from a pool job
+    std::vector<uint32_t>         load(const std::vector<std::string>& paths);
+    uint32_t                      load(const std::string& path);
+
+    uint32_t                      find(const std::string& path) const;
+    vk::ShaderModule              getModule(uint32_t id) const;
+    ShaderReflection              getReflection(uint32_t id) const;
+    SpirvCode                     getCode(uint32_t id) const;
+    std::string                   getPath(uint32_t id) const;
+
+    // once a frame; returns the ids whose module changed since the last call
+    std::vector<uint32_t>         update(double watchInterval = DEFAULT_WATCH_INTERVAL);
+
+    ShaderRegistryStats           getStats() const;
+
+    // checks the SPIR-V header and word alignment, reason says what's wrong when it isn't valid
+    static bool                   validate(const void* data, size_t size, const char** reason);
+
+private:
+    struct Module {
+        vk::ShaderModule          module;
+        SpirvCode                 code;
+        ShaderReflection          reflection;
+    };
+
+    struct File {
+        std::string               path;
+        uint64_t                  hash = 0;         // of the module the file currently maps to, 0 if none
+        int64_t                   writeTime = 0;
+    };
+
+    // a file read and checked on a worker, not yet in the registry
+    struct Loaded {
+        uint64_t                  hash = 0;
+        int64_t                   writeTime = 0;
+        SpirvCode                 code;
+        ShaderReflection          reflection;
+        bool                      valid = false;
+    };
+
+    struct Change {
+        uint32_t                  id;
+        Loaded                    loaded;
+    };
+
+    // a copy rather than a mapping when the file may still be being written, as on a reload
+    Loaded                        readAndValidate(const std::string& path, bool copy) const;
+    vk::ShaderModule              createModule(const SpirvCode& code) const;
+    void                          retireIfUnused(uint64_t hash);   // under m_mutex
+    std::vector<Change>           findChanges(std::vector<File> files) const;
+    static int64_t                getWriteTime(const std::string& path);
+
+    vk::Device                    m_dev;
+    ThreadPool*                   m_jobs = nullptr;
+    VKShaderReflector*            m_reflector = nullptr;
+
+    std::vector<File>             m_files;
+    std::unordered_map<std::string, uint32_t> m_ids;
+    std::unordered_map<uint64_t, Module> m_modules;
+    std::vector<vk::ShaderModule> m_retiredModules;
+
+    std::future<std::vector<Change>> m_watch;
+    std::chrono::steady_clock::time_point m_lastWatch;
+
+    mutable std::mutex            m_mutex;
+    ShaderRegistryStats           m_stats;
+};
@@ -0,0 +1,55 @@
+#include "vk_uniform_ring.h"
+#include "trace.h"
+
+void VKUniformRing::init(vk::PhysicalDevice physDevice, VKAllocator& allocator, uint32_t framesInFlight, vk::DeviceSize bytesPerFrame)
+{
+    m_alignment = std::max<vk::DeviceSize>(physDevice.getProperties().limits.minUniformBufferOffsetAlignment, 1);
+    m_bytesPerFrame = (bytesPerFrame + m_alignment - 1) & ~(m_alignment - 1);
+    m_currentFrame = 0;
+    m_overflowReported = false;
+
+    vk::BufferCreateInfo bufferInfo;
+    bufferInfo.size = m_bytesPerFrame * framesInFlight;
+    bufferInfo.usage = vk::BufferUsageFlagBits::eUniformBuffer;
+    allocator.share(bufferInfo);
+
+    // coherent so writes need no flush, and device local too where the heap allows it
+    m_bufferAlloc = allocator.createBuffer(
+        bufferInfo,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        m_buffer,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    m_frameRegions.resize(framesInFlight);
+    for (auto& it : m_frameRegions)
+        it.init(m_bytesPerFrame);
+}
+
+void VKUniformRing::shutdown(VKAllocator& allocator)
+{
+    allocator.destroyBuffer(m_buffer, m_bufferAlloc);
+    m_frameRegions.clear();
+}
+
+void VKUniformRing::beginFrame(uint32_t frameIx)
+{
+    m_currentFrame = frameIx;
+    m_frameRegions[frameIx].reset();
+}
+
+uint32_t VKUniformRing::push(const void* data, vk::DeviceSize size)
+{
+    vk::DeviceSize offset = m_frameRegions[m_currentFrame].allocate(size, m_alignment);
+    if (offset == VKLinearAllocator::INVALID_OFFSET)
+    {
+        if (!m_overflowReported)
+            TRACE("uniform ring: frame region of %llu bytes exhausted", (unsigned long long)m_bytesPerFrame);
+        m_overflowReported = true;
+        return INVALID_OFFSET;
+    }
+
+    offset += m_bytesPerFrame * m_currentFrame;
+    memcpy((char*)m_bufferAlloc.mapped + offset, data, (size_t)size);
+
+    return (uint32_t)offset;
+}
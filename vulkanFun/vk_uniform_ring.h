@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+
+#include "vk_allocator.h"
+
+// Persistently mapped ring of uniform data, bound through a dynamic uniform buffer descriptor.
+// Each frame in flight owns one region of the ring which is rewound once that frame's fence has
+// signalled, so pushing per-object data is a memcpy with no map, submit or queue drain.
+class VKUniformRing
+{
+public:
+    static constexpr uint32_t     INVALID_OFFSET = ~0u;
+    static constexpr vk::DeviceSize DEFAULT_BYTES_PER_FRAME = 1024 * 1024;
+
+    void                          init(vk::PhysicalDevice physDevice, VKAllocator& allocator, uint32_t framesInFlight, vk::DeviceSize bytesPerFrame = DEFAULT_BYTES_PER_FRAME);
+    void                          shutdown(VKAllocator& allocator);
+
+    // rewinds the region of a frame slot, only call once its fence has signalled
+    void                          beginFrame(uint32_t frameIx);
+
+    // copies data into the current frame's region, returns the dynamic offset to bind it with
+    uint32_t                      push(const void* data, vk::DeviceSize size);
+
+    template<typename T>
+    uint32_t                      push(const T& data) { return push(&data, sizeof(T)); }
+
+    vk::Buffer                    getBuffer() const { return m_buffer; }
+    vk::DeviceSize                getBytesPerFrame() const { return m_bytesPerFrame; }
+
+private:
+    vk::Buffer                    m_buffer;
+    VKAllocation                  m_bufferAlloc;
+
+    vk::DeviceSize                m_alignment;
+    vk::DeviceSize                m_bytesPerFrame;
+
+    uint32_t                      m_currentFrame;
+    std::vector<VKLinearAllocator> m_frameRegions;
+    bool                          m_overflowReported;
+};
@@ -0,0 +1,387 @@
+#include "vk_upload.h"
+#include "trace.h"
+
+// staging offsets keep 16 byte alignment, enough for any texel block and copy offset rules
+static const vk::DeviceSize STAGING_ALIGNMENT = 16;
+
+void VKUploadManager::init(vk::Device dev, VKAllocator& allocator, VKQueue& gfxQueue, VKQueue& transferQueue,
+                           vk::DeviceSize stagingSize)
+{
+    m_dev = dev;
+    m_allocator = &allocator;
+
+    m_gfxQueue = &gfxQueue;
+    m_transferQueue = &transferQueue;
+
+    vk::CommandPoolCreateInfo poolInfo;
+    poolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+    poolInfo.queueFamilyIndex = m_transferQueue->getFamily();
+    m_transferPool = m_dev.createCommandPool(poolInfo);
+
+    if (usesDedicatedTransferQueue())
+    {
+        poolInfo.queueFamilyIndex = m_gfxQueue->getFamily();
+        m_acquirePool = m_dev.createCommandPool(poolInfo);
+    }
+
+    vk::BufferCreateInfo bufferInfo;
+    bufferInfo.size = stagingSize;
+    bufferInfo.usage = vk::BufferUsageFlagBits::eTransferSrc;
+    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+
+    m_stagingAlloc = m_allocator->createBuffer(
+        bufferInfo,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        m_stagingBuffer);
+
+    m_stagingHead = 0;
+    m_stagingTail = 0;
+
+    m_pendingAcquireStages = vk::PipelineStageFlags();
+    m_recording = false;
+    m_nextToken = 1;
+    m_completedToken = 0;
+
+    TRACE("upload manager: %llu KB staging ring, %s", (unsigned long long)stagingSize / 1024,
+        usesDedicatedTransferQueue() ? "dedicated transfer queue" : "graphics queue");
+}
+
+void VKUploadManager::shutdown()
+{
+    wait(flush());
+
+    auto destroyBatch = [this](Batch& batch) {
+        m_dev.freeCommandBuffers(m_transferPool, batch.transferCmd);
+        if (usesDedicatedTransferQueue())
+        {
+            m_dev.destroySemaphore(batch.transferDone);
+            m_dev.freeCommandBuffers(m_acquirePool, batch.acquireCmd);
+        }
+    };
+
+    for (auto& it : m_freeBatches)
+        destroyBatch(it);
+    m_freeBatches.clear();
+
+    m_dev.destroyCommandPool(m_transferPool);
+    if (usesDedicatedTransferQueue())
+        m_dev.destroyCommandPool(m_acquirePool);
+
+    m_allocator->destroyBuffer(m_stagingBuffer, m_stagingAlloc);
+}
+
+VKUploadManager::Batch& VKUploadManager::currentBatch()
+{
+    if (m_recording)
+        return m_current;
+
+    if (m_freeBatches.empty())
+    {
+        Batch batch;
+
+        vk::CommandBufferAllocateInfo allocInfo;
+        allocInfo.level = vk::CommandBufferLevel::ePrimary;
+        allocInfo.commandBufferCount = 1;
+
+        allocInfo.commandPool = m_transferPool;
+        batch.transferCmd = m_dev.allocateCommandBuffers(allocInfo)[0];
+
+        if (usesDedicatedTransferQueue())
+        {
+            allocInfo.commandPool = m_acquirePool;
+            batch.acquireCmd = m_dev.allocateCommandBuffers(allocInfo)[0];
+            batch.transferDone = m_dev.createSemaphore(vk::SemaphoreCreateInfo());
+        }
+
+        m_freeBatches.push_back(std::move(batch));
+    }
+
+    m_current = std::move(m_freeBatches.back());
+    m_freeBatches.pop_back();
+
+    m_current.token = m_nextToken;
+
+    vk::CommandBufferBeginInfo beginInfo;
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    m_current.transferCmd.begin(beginInfo);
+
+    m_recording = true;
+    return m_current;
+}
+
+vk::DeviceSize VKUploadManager::allocateStaging(vk::DeviceSize size, vk::DeviceSize alignment)
+{
+    const vk::DeviceSize capacity = m_stagingAlloc.size;
+
+    // anything bigger than half the ring gets a staging buffer of its own
+    if (size > capacity / 2)
+        return VKLinearAllocator::INVALID_OFFSET;
+
+    for (;;)
+    {
+        // head == tail only ever means empty, allocations stop short of the tail to keep it that way
+        if (m_stagingHead == m_stagingTail)
+            m_stagingHead = m_stagingTail = 0;
+
+        vk::DeviceSize offset = (m_stagingHead + alignment - 1) & ~(alignment - 1);
+
+        if (m_stagingHead >= m_stagingTail)
+        {
+            if (offset + size <= capacity)
+            {
+                m_stagingHead = offset + size;
+                return offset;
+            }
+
+            // wrap, the skipped end of the ring is reclaimed when the tail passes it
+            if (size < m_stagingTail)
+            {
+                m_stagingHead = size;
+                return 0;
+            }
+        }
+        else if (offset + size < m_stagingTail)
+        {
+            m_stagingHead = offset + size;
+            return offset;
+        }
+
+        // out of room, submit what's pending and wait for the oldest batch to give its space back
+        if (m_inFlight.empty())
+            flush();
+        if (m_inFlight.empty())
+            return VKLinearAllocator::INVALID_OFFSET;
+
+        waitOldest();
+    }
+}
+
+VKUploadManager::Batch& VKUploadManager::stage(const void* data, vk::DeviceSize size, vk::Buffer& src, vk::DeviceSize& srcOffset)
+{
+    // claim staging space first, making room may flush the batch that's currently recording
+    srcOffset = allocateStaging(size, STAGING_ALIGNMENT);
+
+    Batch& batch = currentBatch();
+
+    if (srcOffset != VKLinearAllocator::INVALID_OFFSET)
+    {
+        src = m_stagingBuffer;
+        memcpy((char*)m_stagingAlloc.mapped + srcOffset, data, (size_t)size);
+        return batch;
+    }
+
+    vk::BufferCreateInfo bufferInfo;
+    bufferInfo.size = size;
+    bufferInfo.usage = vk::BufferUsageFlagBits::eTransferSrc;
+    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+
+    VKAllocation alloc = m_allocator->createBuffer(
+        bufferInfo,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        src);
+
+    memcpy(alloc.mapped, data, (size_t)size);
+
+    batch.oversizedStaging.push_back(std::make_pair(src, alloc));
+    srcOffset = 0;
+    return batch;
+}
+
+VKUploadToken VKUploadManager::uploadBuffer(vk::Buffer dst, vk::DeviceSize dstOffset, const void* data, vk::DeviceSize size,
+                                            vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess)
+{
+    vk::Buffer src;
+    vk::DeviceSize srcOffset;
+    Batch& batch = stage(data, size, src, srcOffset);
+
+    vk::BufferCopy copyRegion;
+    copyRegion.srcOffset = srcOffset;
+    copyRegion.dstOffset = dstOffset;
+    copyRegion.size = size;
+    batch.transferCmd.copyBuffer(src, dst, copyRegion);
+
+    vk::BufferMemoryBarrier barrier;
+    barrier.buffer = dst;
+    barrier.offset = dstOffset;
+    barrier.size = size;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+
+    if (usesDedicatedTransferQueue())
+    {
+        // release here, the matching acquire is recorded on the graphics queue at flush
+        barrier.srcQueueFamilyIndex = m_transferQueue->getFamily();
+        barrier.dstQueueFamilyIndex = m_gfxQueue->getFamily();
+        batch.transferCmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+            vk::DependencyFlags(), nullptr, barrier, nullptr);
+
+        barrier.srcAccessMask = vk::AccessFlags();
+        barrier.dstAccessMask = dstAccess;
+        m_pendingBufferAcquires.push_back(barrier);
+        m_pendingAcquireStages |= dstStage;
+    }
+    else
+    {
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstAccessMask = dstAccess;
+        batch.transferCmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, dstStage,
+            vk::DependencyFlags(), nullptr, barrier, nullptr);
+    }
+
+    return batch.token;
+}
+
+VKUploadToken VKUploadManager::uploadImage(vk::Image dst, vk::Extent3D extent, const void* data, vk::DeviceSize size,
+                                           vk::ImageLayout finalLayout, vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess)
+{
+    vk::Buffer src;
+    vk::DeviceSize srcOffset;
+    Batch& batch = stage(data, size, src, srcOffset);
+
+    vk::ImageMemoryBarrier barrier;
+    barrier.image = dst;
+    barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.oldLayout = vk::ImageLayout::eUndefined;
+    barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+
+    batch.transferCmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(), nullptr, nullptr, barrier);
+
+    vk::BufferImageCopy copyRegion;
+    copyRegion.bufferOffset = srcOffset;
+    copyRegion.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+    copyRegion.imageSubresource.mipLevel = 0;
+    copyRegion.imageSubresource.baseArrayLayer = 0;
+    copyRegion.imageSubresource.layerCount = 1;
+    copyRegion.imageExtent = extent;
+    batch.transferCmd.copyBufferToImage(src, dst, vk::ImageLayout::eTransferDstOptimal, copyRegion);
+
+    barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.newLayout = finalLayout;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+
+    if (usesDedicatedTransferQueue())
+    {
+        // the layout transition is part of the ownership transfer, both halves must describe it
+        barrier.srcQueueFamilyIndex = m_transferQueue->getFamily();
+        barrier.dstQueueFamilyIndex = m_gfxQueue->getFamily();
+        barrier.dstAccessMask = vk::AccessFlags();
+        batch.transferCmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+            vk::DependencyFlags(), nullptr, nullptr, barrier);
+
+        barrier.srcAccessMask = vk::AccessFlags();
+        barrier.dstAccessMask = dstAccess;
+        m_pendingImageAcquires.push_back(barrier);
+        m_pendingAcquireStages |= dstStage;
+    }
+    else
+    {
+        barrier.dstAccessMask = dstAccess;
+        batch.transferCmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, dstStage,
+            vk::DependencyFlags(), nullptr, nullptr, barrier);
+    }
+
+    return batch.token;
+}
+
+VKUploadToken VKUploadManager::flush()
+{
+    if (!m_recording)
+        return m_nextToken - 1;
+
+    Batch batch = std::move(m_current);
+    m_recording = false;
+    ++m_nextToken;
+
+    batch.stagingEnd = m_stagingHead;
+    batch.transferCmd.end();
+
+    if (usesDedicatedTransferQueue())
+    {
+        // flushed now, the acquire below may reach the driver with any later graphics flush and its
+        // binary semaphore has to be signalled by then
+        m_transferQueue->submit(batch.transferCmd);
+        m_transferQueue->signalSemaphore(batch.transferDone);
+        m_transferQueue->flush();
+
+        vk::CommandBufferBeginInfo beginInfo;
+        beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+
+        // acquire everything released above, one barrier call for the whole batch
+        batch.acquireCmd.begin(beginInfo);
+        batch.acquireCmd.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, m_pendingAcquireStages,
+            vk::DependencyFlags(), nullptr, m_pendingBufferAcquires, m_pendingImageAcquires);
+        batch.acquireCmd.end();
+
+        batch.serial = m_gfxQueue->submit(batch.acquireCmd);
+        m_gfxQueue->waitSemaphore(batch.transferDone, vk::PipelineStageFlagBits::eAllCommands);
+
+        m_pendingBufferAcquires.clear();
+        m_pendingImageAcquires.clear();
+        m_pendingAcquireStages = vk::PipelineStageFlags();
+    }
+    else
+    {
+        batch.serial = m_gfxQueue->submit(batch.transferCmd);
+    }
+
+    VKUploadToken token = batch.token;
+    m_inFlight.push_back(std::move(batch));
+    return token;
+}
+
+void VKUploadManager::retire(Batch& batch)
+{
+    m_stagingTail = batch.stagingEnd;
+    m_completedToken = batch.token;
+
+    for (auto& it : batch.oversizedStaging)
+        m_allocator->destroyBuffer(it.first, it.second);
+    batch.oversizedStaging.clear();
+
+    batch.transferCmd.reset(vk::CommandBufferResetFlags());
+    if (usesDedicatedTransferQueue())
+        batch.acquireCmd.reset(vk::CommandBufferResetFlags());
+
+    m_freeBatches.push_back(std::move(batch));
+}
+
+void VKUploadManager::waitOldest()
+{
+    Batch& batch = m_inFlight.front();
+    m_gfxQueue->wait(batch.serial);
+
+    retire(batch);
+    m_inFlight.pop_front();
+}
+
+void VKUploadManager::collect()
+{
+    while (!m_inFlight.empty() && m_gfxQueue->isComplete(m_inFlight.front().serial))
+    {
+        retire(m_inFlight.front());
+        m_inFlight.pop_front();
+    }
+}
+
+bool VKUploadManager::isComplete(VKUploadToken token)
+{
+    collect();
+    return token <= m_completedToken;
+}
+
+void VKUploadManager::wait(VKUploadToken token)
+{
+    if (m_recording && token >= m_current.token)
+        flush();
+
+    while (m_completedToken < token && !m_inFlight.empty())
+        waitOldest();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <deque>
+
+#include "vk_allocator.h"
+#include "vk_queue.h"
+
+// identifies the batch an upload was recorded into, batches complete in increasing order
+typedef uint64_t VKUploadToken;
+
+// Batches buffer and image uploads into one command buffer per flush, staged through a persistently
+// mapped ring. When the device has a transfer-only queue family the copies run there and ownership is
+// released to the graphics family, which acquires it in a small command buffer of its own.
+//
+// The transfer submission goes out straight away, the graphics one is only queued and reaches the
+// driver with the renderer's next flush of that queue. Barriers in a flushed batch are ordered against
+// everything submitted to the graphics queue after it, so the renderer never has to wait on an upload;
+// tokens only say when staging memory has been recycled and the data is resident.
+class VKUploadManager
+{
+public:
+    static constexpr vk::DeviceSize DEFAULT_STAGING_SIZE = 32ull * 1024 * 1024;
+
+    // pass the graphics queue twice when there is no transfer-only family
+    void                          init(vk::Device dev, VKAllocator& allocator, VKQueue& gfxQueue, VKQueue& transferQueue,
+                                       vk::DeviceSize stagingSize = DEFAULT_STAGING_SIZE);
+    void                          shutdown();
+
+    // data is copied into staging memory immediately, the GPU copy happens on the next flush()
+    VKUploadToken                 uploadBuffer(vk::Buffer dst, vk::DeviceSize dstOffset, const void* data, vk::DeviceSize size,
+                                               vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess);
+
+    // uploads mip 0 / layer 0 of a colour image and leaves it in finalLayout
+    VKUploadToken                 uploadImage(vk::Image dst, vk::Extent3D extent, const void* data, vk::DeviceSize size,
+                                              vk::ImageLayout finalLayout, vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess);
+
+    // submits everything queued since the last flush as a single batch, returns its token
+    VKUploadToken                 flush();
+
+    // recycles finished batches and their staging memory, never blocks
+    void                          collect();
+
+    bool                          isComplete(VKUploadToken token);
+    void                          wait(VKUploadToken token);
+
+    bool                          usesDedicatedTransferQueue() const { return m_transferQueue != m_gfxQueue; }
+
+private:
+    struct Batch {
+        VKUploadToken             token = 0;
+        vk::CommandBuffer         transferCmd;
+        vk::CommandBuffer         acquireCmd;     // only used with a dedicated transfer queue
+        vk::Semaphore             transferDone;   // ditto
+        uint64_t                  serial = 0;     // of its graphics queue submission
+        vk::DeviceSize            stagingEnd = 0; // ring head once this batch was closed
+        std::vector<std::pair<vk::Buffer, VKAllocation>> oversizedStaging;
+    };
+
+    Batch&                        currentBatch();
+    Batch&                        stage(const void* data, vk::DeviceSize size, vk::Buffer& src, vk::DeviceSize& srcOffset);
+    vk::DeviceSize                allocateStaging(vk::DeviceSize size, vk::DeviceSize alignment);
+    void                          waitOldest();
+    void                          retire(Batch& batch);
+
+    vk::Device                    m_dev;
+    VKAllocator*                  m_allocator;
+
+    VKQueue*                      m_gfxQueue;
+    VKQueue*                      m_transferQueue;
+
+    vk::CommandPool               m_transferPool;
+    vk::CommandPool               m_acquirePool;
+
+    vk::Buffer                    m_stagingBuffer;
+    VKAllocation                  m_stagingAlloc;
+    vk::DeviceSize                m_stagingHead;
+    vk::DeviceSize                m_stagingTail;
+
+    // barriers handing ownership to the graphics family, recorded into the acquire command buffer on flush
+    std::vector<vk::BufferMemoryBarrier> m_pendingBufferAcquires;
+    std::vector<vk::ImageMemoryBarrier>  m_pendingImageAcquires;
+    vk::PipelineStageFlags        m_pendingAcquireStages;
+
+    bool                          m_recording;
+    Batch                         m_current;
+    std::deque<Batch>             m_inFlight;
+    std::vector<Batch>            m_freeBatches;
+
+    VKUploadToken                 m_nextToken;
+    VKUploadToken                 m_completedToken;
+};